@@ -18,176 +18,484 @@
 */
 
 /*
-	Simple benchmarking application.
-	
-	It talks with the 'custom' device application on the LPC214x through
-	libusb.
+	Bulk throughput benchmark.
 
+	It talks through libusb-1.0 with the 'srcsink' test function on the
+	LPC, or with the older 'custom' device application if no test function
+	is found. Transfers are queued with the asynchronous API, so several of
+	them can be in flight at once and the host turnaround between two
+	transfers no longer shows in the numbers.
+
+	For every direction, number of transfers in flight and transfer size,
+	a number of warm-up trials is run first, followed by the measured
+	trials. Each trial moves a fixed amount of data, timed with the
+	monotonic clock. The mean, minimum, maximum and standard deviation of
+	the throughput over the trials go to stdout as CSV or JSON, progress
+	goes to stderr.
+
+	With -c, the test function's vendor requests are used instead, to
+	measure control transfers per second: an IN request that returns the
+	requested number of bytes for reads, an OUT request with data for
+	writes. The transfer sizes then default to 0, 8 and 64 bytes.
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/timeb.h>
-
-#include "usb.h"
-
-// types
-#ifndef MIN
-#define MIN(a,b)	((a)<(b)?(a):(b))
-#endif
-typedef unsigned int U32;
-typedef unsigned char U8;
-
-#define MAX_TIME 3000
 
-static unsigned char abData[16384];
+#include <libusb.h>
 
 // USB device specific definitions
-#define VENDOR_ID	0xFFFF
-#define PRODUCT_ID	0x0004
+#define VENDOR_ID			0xFFFF
+#define PRODUCT_ID_SRCSINK	0x0006
+#define PRODUCT_ID_CUSTOM	0x0004
 
 #define	BM_REQUEST_TYPE		(2<<5)
 #define BULK_IN_EP			0x82
 #define BULK_OUT_EP			0x05
 
-// this structure should match with the expectations of the 'custom' device!
+// vendor requests of the 'srcsink' device, see srcsink.h
+#define SRCSINK_REQ_SET_MODE	0x10
+#define SRCSINK_MODE_SOURCE_SINK	0
+#define SRCSINK_PATTERN_ZEROS	0
+#define SRCSINK_REQ_ECHO		0x13
+#define SRCSINK_REQ_SINK		0x14
+#define SRCSINK_REQ_DATA_SIZE	64
+
+// vendor requests of the 'custom' device
+#define CUSTOM_REQ_READ		0x01
+#define CUSTOM_REQ_WRITE	0x02
+
+#define MAX_LIST			16			/**< entries of a -q or -s list */
+#define MAX_DEPTH			64			/**< transfers in flight */
+#define MAX_TRIALS			100
+#define TIMEOUT_MS			2000
+
+/** A trial in progress */
 typedef struct {
-	U32		dwAddress;
-	U32		dwLength;
-} TMemoryCmd;
+	uint8_t		bEP;
+	uint32_t	dwSize;				/**< bytes per transfer */
+	uint32_t	dwToSubmit;			/**< bytes (control: transfers) not submitted yet */
+	uint32_t	dwDone;				/**< bytes transferred */
+	uint32_t	dwTransfers;		/**< transfers completed */
+	int			iInFlight;
+	int			iStatus;			/**< first failed transfer status */
+} TTrial;
 
+/** Throughput statistics over the trials of one test (kB/s or transfers/s) */
+typedef struct {
+	double		dMean;
+	double		dMin;
+	double		dMax;
+	double		dStdDev;
+} TStats;
 
-static struct usb_device * find_device(int iVendor, int iProduct)
+static libusb_device_handle	*hdl;
+static bool		fCustom;			/**< talking with the 'custom' device */
+static bool		fJson;
+static bool		fControl;			/**< control transfer rate instead of bulk throughput */
+static bool		fFirstResult = true;
+
+static struct libusb_transfer	*apTransfers[MAX_DEPTH];
+static uint8_t	*pbBuffers;
+
+
+static uint64_t TimeUs(void)
 {
-	struct usb_bus	*usb_bus;
-	struct usb_device *dev;	
-	
-	for (usb_bus = usb_get_busses(); usb_bus; usb_bus = usb_bus->next) {
-		for (dev = usb_bus->devices; dev; dev = dev->next) {
-			if ((dev->descriptor.idVendor == iVendor) && 
-				(dev->descriptor.idProduct == iProduct)) {
-				return dev;
-			}
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void PutLE32(uint8_t *pb, uint32_t dw)
+{
+	pb[0] = dw;
+	pb[1] = dw >> 8;
+	pb[2] = dw >> 16;
+	pb[3] = dw >> 24;
+}
+
+
+// parses a comma separated list of numbers, returns the number of entries
+static int ParseList(const char *psz, uint32_t *pdwList)
+{
+	char	*pszEnd;
+	int		i;
+
+	for (i = 0; i < MAX_LIST; i++) {
+		pdwList[i] = strtoul(psz, &pszEnd, 0);
+		if (pszEnd == psz) {
+			return 0;
 		}
+		if (*pszEnd != ',') {
+			return (*pszEnd == '\0') ? (i + 1) : 0;
+		}
+		psz = pszEnd + 1;
 	}
-	return NULL;
+	return 0;
 }
 
 
-static struct timeb start;
+static void LIBUSB_CALL Completed(struct libusb_transfer *pTransfer);
 
-static void starttimer(void)
+
+// submits the next transfer of a trial, if there is data left
+static void Submit(TTrial *pTrial, struct libusb_transfer *pTransfer, uint8_t *pbBuf)
 {
-	ftime(&start);
+	uint32_t	dwLen;
+	int			i;
+
+	if ((pTrial->dwToSubmit == 0) || (pTrial->iStatus != LIBUSB_TRANSFER_COMPLETED)) {
+		return;
+	}
+	if (fControl) {
+		dwLen = 1;
+		libusb_fill_control_setup(pbBuf, BM_REQUEST_TYPE | (pTrial->bEP & LIBUSB_ENDPOINT_IN),
+								(pTrial->bEP & LIBUSB_ENDPOINT_IN) ? SRCSINK_REQ_ECHO : SRCSINK_REQ_SINK,
+								0, 0, pTrial->dwSize);
+		libusb_fill_control_transfer(pTransfer, hdl, pbBuf, Completed, pTrial, TIMEOUT_MS);
+	}
+	else {
+		dwLen = (pTrial->dwToSubmit < pTrial->dwSize) ? pTrial->dwToSubmit : pTrial->dwSize;
+		libusb_fill_bulk_transfer(pTransfer, hdl, pTrial->bEP, pbBuf, dwLen,
+								Completed, pTrial, TIMEOUT_MS);
+	}
+	i = libusb_submit_transfer(pTransfer);
+	if (i < 0) {
+		fprintf(stderr, "libusb_submit_transfer failed: %s\n", libusb_error_name(i));
+		pTrial->iStatus = LIBUSB_TRANSFER_ERROR;
+		return;
+	}
+	pTrial->dwToSubmit -= dwLen;
+	pTrial->iInFlight++;
 }
 
-static int stoptimer(void)
+
+// completion callback, queues the transfer again right away
+static void LIBUSB_CALL Completed(struct libusb_transfer *pTransfer)
 {
-	struct timeb now;
-	
-	ftime(&now);
-	return 1000 * (now.time - start.time) + now.millitm - start.millitm;
+	TTrial	*pTrial = pTransfer->user_data;
+
+	pTrial->iInFlight--;
+	if (pTransfer->status != LIBUSB_TRANSFER_COMPLETED) {
+		if (pTrial->iStatus == LIBUSB_TRANSFER_COMPLETED) {
+			pTrial->iStatus = pTransfer->status;
+		}
+		return;
+	}
+	pTrial->dwDone += pTransfer->actual_length;
+	pTrial->dwTransfers++;
+	Submit(pTrial, pTransfer, pTransfer->buffer);
 }
 
 
-int main(int argc, char *argv[])
+// prepares the device for a trial of dwTotal bytes
+static bool PrepareDevice(bool fRead, uint32_t dwTotal)
 {
-	struct usb_device *dev;	
-	struct usb_dev_handle *hdl;
-	int i, j;
-	U32 dwBlockSize, dwChunk, dwBytes;
-	TMemoryCmd MemCmd;
-	int iTimer;
-
-	usb_init();
-	usb_find_busses();
-	usb_find_devices();
-	
-	dev = find_device(VENDOR_ID, PRODUCT_ID);
-	if (dev == NULL) {
-		fprintf(stderr, "device not found\n");
-		return -1;
+	uint8_t	abCmd[8];
+	int		i;
+
+	if (!fCustom || fControl) {
+		// the test function streams endlessly
+		return true;
 	}
-	
-	hdl = usb_open(dev);
-	
-	i = usb_set_configuration(hdl, 1);
+	PutLE32(&abCmd[0], 0);
+	PutLE32(&abCmd[4], dwTotal);
+	i = libusb_control_transfer(hdl, BM_REQUEST_TYPE, fRead ? CUSTOM_REQ_READ : CUSTOM_REQ_WRITE,
+								0, 0, abCmd, sizeof(abCmd), TIMEOUT_MS);
 	if (i < 0) {
-		fprintf(stderr, "usb_set_configuration failed\n");
+		fprintf(stderr, "libusb_control_transfer failed: %s\n", libusb_error_name(i));
+		return false;
 	}
-	
-	i = usb_claim_interface(hdl, 0);
-	if (i < 0) {
-		fprintf(stderr, "usb_claim_interface failed %d\n", i);
+	return true;
+}
+
+
+/*
+	Runs one trial, moving dwTotal bytes in transfers of dwSize bytes with
+	up to iDepth of them in flight. Returns the throughput in kB/s, or a
+	negative number if a transfer failed. For control transfers, dwTotal
+	is the number of transfers and the result is in transfers/s.
+ */
+static double RunTrial(bool fRead, uint32_t dwSize, int iDepth, uint32_t dwTotal)
+{
+	TTrial		Trial;
+	uint64_t	qwStart, qwTime;
+	int			i;
+
+	if (!PrepareDevice(fRead, dwTotal)) {
+		return -1;
+	}
+	memset(&Trial, 0, sizeof(Trial));
+	Trial.bEP = fRead ? BULK_IN_EP : BULK_OUT_EP;
+	Trial.dwSize = dwSize;
+	Trial.dwToSubmit = dwTotal;
+	Trial.iStatus = LIBUSB_TRANSFER_COMPLETED;
+
+	qwStart = TimeUs();
+	for (i = 0; i < iDepth; i++) {
+		Submit(&Trial, apTransfers[i], pbBuffers + i * (LIBUSB_CONTROL_SETUP_SIZE + dwSize));
+	}
+	while (Trial.iInFlight > 0) {
+		i = libusb_handle_events(NULL);
+		if ((i < 0) && (i != LIBUSB_ERROR_INTERRUPTED)) {
+			fprintf(stderr, "libusb_handle_events failed: %s\n", libusb_error_name(i));
+			return -1;
+		}
+	}
+	qwTime = TimeUs() - qwStart;
+
+	if (Trial.iStatus != LIBUSB_TRANSFER_COMPLETED) {
+		fprintf(stderr, "transfer failed with status %d after %u bytes\n", Trial.iStatus, Trial.dwDone);
 		return -1;
 	}
+	if (qwTime == 0) {
+		qwTime = 1;
+	}
+	if (fControl) {
+		return (double)Trial.dwTransfers * 1000000 / qwTime;
+	}
+	return (double)Trial.dwDone * 1000000 / 1024 / qwTime;
+}
 
 
-	// read some data
-	for (j = 6; j < 15; j++) {
-		dwBlockSize = (1 << j);
-		fprintf(stderr, "Testing blocksize %5d\n", dwBlockSize);
+static void CalcStats(const double *pdRates, int iTrials, TStats *pStats)
+{
+	double	dSum;
+	int		i;
 
-		fprintf(stderr, "* read :");
-		// send a vendor request for a read
-		MemCmd.dwAddress = 0;
-		MemCmd.dwLength = 1024 * 1024;
-		i = usb_control_msg(hdl, BM_REQUEST_TYPE, 0x01, 0, 0, (char *)&MemCmd, sizeof(MemCmd), 1000);
-		if (i < 0) {
-			fprintf(stderr, "usb_control_msg failed %d\n", i);
-		}
-		dwBytes = 0;
-		starttimer();
-		while (MemCmd.dwLength > 0) {
-			dwChunk = MIN(dwBlockSize, MemCmd.dwLength);
-			i = usb_bulk_read(hdl, 0x82, (char *)abData, dwBlockSize, 2000);
-			if (i < 0) {
-				fprintf(stderr, "usb_bulk_read failed %d\n", i);
-				break;
-			}
-			MemCmd.dwLength -= dwChunk;
-			dwBytes += dwBlockSize;
-			if (stoptimer() > MAX_TIME) {
-				break;
-			}
+	dSum = 0;
+	pStats->dMin = pdRates[0];
+	pStats->dMax = pdRates[0];
+	for (i = 0; i < iTrials; i++) {
+		dSum += pdRates[i];
+		if (pdRates[i] < pStats->dMin) {
+			pStats->dMin = pdRates[i];
 		}
-		iTimer = stoptimer();
-		fprintf(stderr, " %7d bytes in %d ms = %d kB/s\n", dwBytes, iTimer, dwBytes / iTimer);
-		// stdout
-		printf("%d,%d,%d,", dwBlockSize, dwBytes, iTimer);
+		if (pdRates[i] > pStats->dMax) {
+			pStats->dMax = pdRates[i];
+		}
+	}
+	pStats->dMean = dSum / iTrials;
 
-		fprintf(stderr, "* write:");
-		// send a vendor request for a write
-		MemCmd.dwAddress = 0;
-		MemCmd.dwLength = 1024 * 1024;
-		i = usb_control_msg(hdl, BM_REQUEST_TYPE, 0x02, 0, 0, (char *)&MemCmd, sizeof(MemCmd), 1000);
-		if (i < 0) {
-			fprintf(stderr, "usb_control_msg failed %d\n", i);
-		}
-		dwBytes = 0;
-		starttimer();
-		while (MemCmd.dwLength > 0) {
-			dwChunk = MIN(dwBlockSize, MemCmd.dwLength);
-			i = usb_bulk_write(hdl, 0x05, (char *)abData, dwBlockSize, 2000);
-			if (i < 0) {
-				fprintf(stderr, "usb_bulk_read failed %d\n", i);
-				break;
-			}
-			MemCmd.dwLength -= dwChunk;
-			dwBytes += dwBlockSize;
-			if (stoptimer() > MAX_TIME) {
-				break;
-			}
+	// sample standard deviation
+	dSum = 0;
+	for (i = 0; i < iTrials; i++) {
+		dSum += (pdRates[i] - pStats->dMean) * (pdRates[i] - pStats->dMean);
+	}
+	pStats->dStdDev = (iTrials > 1) ? sqrt(dSum / (iTrials - 1)) : 0;
+}
+
+
+static void PrintResult(bool fRead, uint32_t dwSize, int iDepth, uint32_t dwTotal, int iTrials,
+						const TStats *pStats)
+{
+	const char	*pszDir = fRead ? "read" : "write";
+	const char	*pszUnit = fControl ? "transfers/s" : "kB/s";
+
+	fprintf(stderr, "%-5s %6u bytes x %2d: %8.1f %s (min %.1f, max %.1f, stddev %.1f)\n",
+			pszDir, dwSize, iDepth, pStats->dMean, pszUnit, pStats->dMin, pStats->dMax, pStats->dStdDev);
+	if (fJson) {
+		printf("%s\n  {\"transfer\": \"%s\", \"direction\": \"%s\", \"transfer_size\": %u, "
+				"\"in_flight\": %d, \"per_trial\": %u, \"trials\": %d, \"unit\": \"%s\", "
+				"\"mean\": %.1f, \"min\": %.1f, \"max\": %.1f, \"stddev\": %.1f}",
+				fFirstResult ? "[" : ",", fControl ? "control" : "bulk", pszDir, dwSize, iDepth,
+				dwTotal, iTrials, pszUnit, pStats->dMean, pStats->dMin, pStats->dMax, pStats->dStdDev);
+	}
+	else {
+		if (fFirstResult) {
+			printf("transfer,direction,transfer size,in flight,per trial,trials,unit,mean,min,max,stddev\n");
 		}
-		fprintf(stderr, " %7d bytes in %d ms = %d kB/s\n", dwBytes, iTimer, dwBytes / iTimer);
-		// stdout
-		printf("%d,%d,%d\n", dwBlockSize, dwBytes, iTimer);
+		printf("%s,%s,%u,%d,%u,%d,%s,%.1f,%.1f,%.1f,%.1f\n", fControl ? "control" : "bulk", pszDir,
+				dwSize, iDepth, dwTotal, iTrials, pszUnit,
+				pStats->dMean, pStats->dMin, pStats->dMax, pStats->dStdDev);
 	}
+	fFirstResult = false;
+}
 
 
-	usb_release_interface(hdl, 0);
-	usb_close(hdl);
+static bool RunTest(bool fRead, uint32_t dwSize, int iDepth, uint32_t dwTotal, int iWarmUp, int iTrials)
+{
+	double	adRates[MAX_TRIALS];
+	TStats	Stats;
+	int		i;
 
-	return 0;
+	for (i = 0; i < iWarmUp; i++) {
+		if (RunTrial(fRead, dwSize, iDepth, dwTotal) < 0) {
+			return false;
+		}
+	}
+	for (i = 0; i < iTrials; i++) {
+		adRates[i] = RunTrial(fRead, dwSize, iDepth, dwTotal);
+		if (adRates[i] < 0) {
+			return false;
+		}
+	}
+	CalcStats(adRates, iTrials, &Stats);
+	PrintResult(fRead, dwSize, iDepth, dwTotal, iTrials, &Stats);
+	return true;
+}
+
+
+static bool OpenDevice(void)
+{
+	int	i;
+
+	hdl = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID_SRCSINK);
+	fCustom = (hdl == NULL);
+	if (fCustom) {
+		hdl = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID_CUSTOM);
+	}
+	if (hdl == NULL) {
+		fprintf(stderr, "device not found\n");
+		return false;
+	}
+	libusb_set_auto_detach_kernel_driver(hdl, 1);
+	i = libusb_claim_interface(hdl, 0);
+	if (i < 0) {
+		fprintf(stderr, "libusb_claim_interface failed: %s\n", libusb_error_name(i));
+		return false;
+	}
+	if (!fCustom) {
+		// zeros, so the device does not count the data we send as errors
+		i = libusb_control_transfer(hdl, BM_REQUEST_TYPE, SRCSINK_REQ_SET_MODE,
+									SRCSINK_MODE_SOURCE_SINK, SRCSINK_PATTERN_ZEROS, NULL, 0, TIMEOUT_MS);
+		if (i < 0) {
+			fprintf(stderr, "SET_MODE failed: %s\n", libusb_error_name(i));
+			return false;
+		}
+	}
+	fprintf(stderr, "Using the %s device\n", fCustom ? "custom" : "srcsink");
+	return true;
+}
+
+
+static void Usage(const char *pszName)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -s <list>  transfer sizes in bytes (default 64,512,4096,16384)\n"
+		"  -q <list>  transfers in flight, up to %d (default 1,2,4,8)\n"
+		"  -n <kB>    data per trial (default 1024)\n"
+		"  -c <n>     control transfers per second, n transfers per trial\n"
+		"  -t <n>     measured trials per test, up to %d (default 5)\n"
+		"  -w <n>     warm-up trials per test (default 1)\n"
+		"  -r         read only\n"
+		"  -W         write only\n"
+		"  -j         JSON output instead of CSV\n",
+		pszName, MAX_DEPTH, MAX_TRIALS);
 }
 
+
+int main(int argc, char *argv[])
+{
+	uint32_t	adwSizes[MAX_LIST] = {64, 512, 4096, 16384};
+	uint32_t	adwCtrlSizes[3] = {0, 8, 64};
+	uint32_t	adwDepths[MAX_LIST] = {1, 2, 4, 8};
+	int			iSizes = 4, iDepths = 4;
+	bool		fSizes = false;
+	uint32_t	dwTotal = 1024 * 1024;
+	uint32_t	dwMaxSize, dwMaxDepth;
+	int			iTrials = 5, iWarmUp = 1;
+	bool		fRead = true, fWrite = true, fOk;
+	int			c, i, j, k;
+
+	while ((c = getopt(argc, argv, "s:q:n:c:t:w:rWjh")) != -1) {
+		switch (c) {
+		case 's':	iSizes = ParseList(optarg, adwSizes); fSizes = true;	break;
+		case 'q':	iDepths = ParseList(optarg, adwDepths);			break;
+		case 'n':	dwTotal = strtoul(optarg, NULL, 0) * 1024;		break;
+		case 'c':	dwTotal = strtoul(optarg, NULL, 0); fControl = true;	break;
+		case 't':	iTrials = strtoul(optarg, NULL, 0);				break;
+		case 'w':	iWarmUp = strtoul(optarg, NULL, 0);				break;
+		case 'r':	fWrite = false;									break;
+		case 'W':	fRead = false;									break;
+		case 'j':	fJson = true;									break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if (fControl && !fSizes) {
+		memcpy(adwSizes, adwCtrlSizes, sizeof(adwCtrlSizes));
+		iSizes = 3;
+	}
+	dwMaxSize = 0;
+	for (i = 0; i < iSizes; i++) {
+		// the custom device only sends what it was asked for, in 64 byte packets
+		if (fControl ? (adwSizes[i] > SRCSINK_REQ_DATA_SIZE) : ((adwSizes[i] == 0) || ((adwSizes[i] % 64) != 0))) {
+			iSizes = 0;
+		}
+		else if (adwSizes[i] > dwMaxSize) {
+			dwMaxSize = adwSizes[i];
+		}
+	}
+	dwMaxDepth = 0;
+	for (i = 0; i < iDepths; i++) {
+		if ((adwDepths[i] == 0) || (adwDepths[i] > MAX_DEPTH)) {
+			iDepths = 0;
+		}
+		else if (adwDepths[i] > dwMaxDepth) {
+			dwMaxDepth = adwDepths[i];
+		}
+	}
+	if ((iSizes == 0) || (iDepths == 0) || (dwTotal == 0) || (iTrials < 1) || (iTrials > MAX_TRIALS) ||
+		(iWarmUp < 0) || !(fRead || fWrite)) {
+		Usage(argv[0]);
+		return 1;
+	}
+
+	i = libusb_init(NULL);
+	if (i < 0) {
+		fprintf(stderr, "libusb_init failed: %s\n", libusb_error_name(i));
+		return 1;
+	}
+	if (!OpenDevice()) {
+		libusb_exit(NULL);
+		return 1;
+	}
+
+	if (fControl && fCustom) {
+		fprintf(stderr, "control transfer tests need the srcsink device\n");
+		libusb_exit(NULL);
+		return 1;
+	}
+
+	// room for a setup packet in front of every buffer, for control transfers
+	pbBuffers = calloc(dwMaxDepth, LIBUSB_CONTROL_SETUP_SIZE + dwMaxSize);
+	for (i = 0; i < (int)dwMaxDepth; i++) {
+		apTransfers[i] = libusb_alloc_transfer(0);
+	}
+
+	fOk = (pbBuffers != NULL);
+	for (i = 0; fOk && (i < 2); i++) {
+		if ((i == 0) ? !fRead : !fWrite) {
+			continue;
+		}
+		for (j = 0; fOk && (j < iDepths); j++) {
+			for (k = 0; fOk && (k < iSizes); k++) {
+				fOk = RunTest(i == 0, adwSizes[k], adwDepths[j], dwTotal, iWarmUp, iTrials);
+			}
+		}
+	}
+	if (fJson && !fFirstResult) {
+		printf("\n]\n");
+	}
+
+	for (i = 0; i < (int)dwMaxDepth; i++) {
+		libusb_free_transfer(apTransfers[i]);
+	}
+	free(pbBuffers);
+	libusb_release_interface(hdl, 0);
+	libusb_close(hdl);
+	libusb_exit(NULL);
+
+	return fOk ? 0 : 1;
+}
@@ -0,0 +1,565 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Isochronous streaming test.
+
+	It talks through libusb-1.0 with alternate setting 1 of the 'srcsink'
+	test function on the LPC, which streams isoc packets in both
+	directions, one per frame. A number of isoc transfers, each of a
+	number of packets, is kept in flight on each endpoint for as long as
+	the test runs.
+
+	Every packet starts with a sequence number, see srcsink.h. IN packets
+	also carry the frame number in which the device wrote them and are
+	checked here: sequence numbers that never arrive are dropped, old ones
+	are duplicated, and a packet is late when it arrives more frames after
+	the previous one than the frame numbers say it was written after it.
+	Packet slots without data are counted as empty. The device checks the
+	OUT packets the same way and reports its counters afterwards; there,
+	a packet is late when it arrives after a frame without a packet.
+
+	Two histograms show the timing: the frames between consecutive IN
+	packets as written by the device, and for both directions how much the
+	time between transfer completions deviates from the nominal transfer
+	duration of one frame per packet, which is the jitter the application
+	sees.
+
+	Human readable results go to stderr, a CSV line per direction to stdout:
+	direction,packet size,in flight,packets per transfer,packets,dropped,
+	duplicated,late,empty,errors,mean jitter,max jitter (us)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libusb.h>
+
+// USB device specific definitions, see srcsink.h
+#define VENDOR_ID			0xFFFF
+#define PRODUCT_ID			0x0006
+
+#define	BM_REQUEST_TYPE		(2<<5)
+#define ISOC_IN_EP			0x83
+#define ISOC_OUT_EP			0x06
+
+#define SRCSINK_REQ_SET_ISOC		0x15
+#define SRCSINK_REQ_GET_ISOC_STATS	0x16
+
+#define ISOC_SEQ			0			/**< offset of the sequence number */
+#define ISOC_FRAME			4			/**< offset of the frame number (IN) */
+#define ISOC_LEN			6			/**< offset of the packet length */
+#define ISOC_HDR_SIZE		8
+
+#define FRAME_MASK			0x7FF
+#define TIMEOUT_MS			1000
+
+#define MAX_TRANSFERS		64
+#define MAX_PACKETS			128			/**< packets per transfer */
+#define MAX_FRAMES			8			/**< frame deltas of 8 and up share a bucket */
+#define JITTER_BUCKETS		41			/**< odd, the middle one is no jitter */
+
+/** One direction of the stream */
+typedef struct {
+	const char	*pszName;
+	uint8_t		bEP;
+	bool		fIn;
+	int			iActive;			/**< transfers in flight */
+	uint32_t	dwSeq;				/**< next OUT / expected IN sequence number */
+	// packet checks
+	bool		fSynced;			/**< dwSeq is known (IN) */
+	uint16_t	wLastFrame;			/**< frame number of the last IN packet */
+	int			iSlots;				/**< packet slots since the last IN packet */
+	uint64_t	qwPackets;
+	uint64_t	qwDropped;
+	uint64_t	qwDuplicated;
+	uint64_t	qwLate;
+	uint64_t	qwEmpty;
+	uint64_t	qwErrors;
+	uint64_t	aqwFrames[MAX_FRAMES + 1];
+	// completion jitter
+	uint64_t	qwLastUs;
+	uint64_t	aqwJitter[JITTER_BUCKETS];
+	uint64_t	qwJitterCount;
+	uint64_t	qwJitterSum;		/**< us, absolute */
+	uint64_t	qwJitterMax;		/**< us, absolute */
+	struct libusb_transfer	*apXfers[MAX_TRANSFERS];
+} TStream;
+
+static libusb_device_handle	*hdl;
+static bool			fRunning;
+static bool			fFailed;
+static int			iSize;
+static int			iPackets = 8;
+static int			iBucketUs = 100;
+static TStream		InStream;
+static TStream		OutStream;
+
+
+static uint64_t TimeUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static uint16_t GetLE16(const uint8_t *pb)
+{
+	return pb[0] | (pb[1] << 8);
+}
+
+
+static void PutLE32(uint8_t *pb, uint32_t dw)
+{
+	pb[0] = dw;
+	pb[1] = dw >> 8;
+	pb[2] = dw >> 16;
+	pb[3] = dw >> 24;
+}
+
+
+static uint32_t GetLE32(const uint8_t *pb)
+{
+	return pb[0] | (pb[1] << 8) | (pb[2] << 16) | ((uint32_t)pb[3] << 24);
+}
+
+
+// the payload after the header, the same in both directions
+static bool CheckPayload(const uint8_t *pbData, int iLen, uint32_t dwSeq)
+{
+	int	i;
+
+	for (i = ISOC_HDR_SIZE; i < iLen; i++) {
+		if (pbData[i] != (uint8_t)(dwSeq + i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+static void FillPacket(uint8_t *pbData, uint32_t dwSeq)
+{
+	int	i;
+
+	PutLE32(&pbData[ISOC_SEQ], dwSeq);
+	pbData[ISOC_FRAME] = 0;
+	pbData[ISOC_FRAME + 1] = 0;
+	pbData[ISOC_LEN] = iSize & 0xFF;
+	pbData[ISOC_LEN + 1] = iSize >> 8;
+	for (i = ISOC_HDR_SIZE; i < iSize; i++) {
+		pbData[i] = dwSeq + i;
+	}
+}
+
+
+// checks one IN packet slot
+static void CheckInPacket(TStream *pStream, const struct libusb_iso_packet_descriptor *pDesc, const uint8_t *pbData)
+{
+	uint32_t	dwSeq;
+	uint16_t	wFrame;
+	int32_t		iDelta;
+	int			iFrames;
+
+	pStream->iSlots++;
+	if ((pDesc->status != LIBUSB_TRANSFER_COMPLETED) || (pDesc->actual_length == 0)) {
+		pStream->qwEmpty++;
+		return;
+	}
+	pStream->qwPackets++;
+	if ((pDesc->actual_length < ISOC_HDR_SIZE) || (GetLE16(&pbData[ISOC_LEN]) != pDesc->actual_length)) {
+		pStream->qwErrors++;
+		return;
+	}
+	dwSeq = GetLE32(&pbData[ISOC_SEQ]);
+	wFrame = GetLE16(&pbData[ISOC_FRAME]);
+	if (!CheckPayload(pbData, pDesc->actual_length, dwSeq)) {
+		pStream->qwErrors++;
+	}
+	if (pStream->fSynced) {
+		iDelta = (int32_t)(dwSeq - pStream->dwSeq);
+		if (iDelta < 0) {
+			pStream->qwDuplicated++;
+			return;
+		}
+		pStream->qwDropped += iDelta;
+		iFrames = (wFrame - pStream->wLastFrame) & FRAME_MASK;
+		pStream->aqwFrames[(iFrames < MAX_FRAMES) ? iFrames : MAX_FRAMES]++;
+		if (pStream->iSlots > iFrames) {
+			pStream->qwLate++;
+		}
+	}
+	pStream->fSynced = true;
+	pStream->dwSeq = dwSeq + 1;
+	pStream->wLastFrame = wFrame;
+	pStream->iSlots = 0;
+}
+
+
+// records how far the time since the previous completion is off
+static void RecordJitter(TStream *pStream, int iPacketsDone)
+{
+	uint64_t	qwNow;
+	int64_t		iJitter;
+	int			iBucket;
+
+	qwNow = TimeUs();
+	if (pStream->qwLastUs != 0) {
+		iJitter = (int64_t)(qwNow - pStream->qwLastUs) - iPacketsDone * 1000;
+		iBucket = JITTER_BUCKETS / 2 + (iJitter + ((iJitter < 0) ? -iBucketUs / 2 : iBucketUs / 2)) / iBucketUs;
+		if (iBucket < 0) {
+			iBucket = 0;
+		}
+		if (iBucket >= JITTER_BUCKETS) {
+			iBucket = JITTER_BUCKETS - 1;
+		}
+		pStream->aqwJitter[iBucket]++;
+		if (iJitter < 0) {
+			iJitter = -iJitter;
+		}
+		pStream->qwJitterCount++;
+		pStream->qwJitterSum += iJitter;
+		if ((uint64_t)iJitter > pStream->qwJitterMax) {
+			pStream->qwJitterMax = iJitter;
+		}
+	}
+	pStream->qwLastUs = qwNow;
+}
+
+
+static bool Submit(TStream *pStream, struct libusb_transfer *pXfer)
+{
+	int	i;
+
+	if (!pStream->fIn) {
+		for (i = 0; i < iPackets; i++) {
+			FillPacket(pXfer->buffer + i * iSize, pStream->dwSeq++);
+		}
+	}
+	i = libusb_submit_transfer(pXfer);
+	if (i < 0) {
+		fprintf(stderr, "isoc %s submit failed: %s\n", pStream->pszName, libusb_error_name(i));
+		fFailed = true;
+		return false;
+	}
+	pStream->iActive++;
+	return true;
+}
+
+
+static void LIBUSB_CALL Completed(struct libusb_transfer *pXfer)
+{
+	TStream	*pStream = pXfer->user_data;
+	int		i;
+
+	pStream->iActive--;
+	if (pXfer->status == LIBUSB_TRANSFER_CANCELLED) {
+		return;
+	}
+	if (pXfer->status != LIBUSB_TRANSFER_COMPLETED) {
+		fprintf(stderr, "isoc %s transfer failed: %s\n", pStream->pszName, libusb_error_name(pXfer->status));
+		fFailed = true;
+		return;
+	}
+	RecordJitter(pStream, pXfer->num_iso_packets);
+	for (i = 0; i < pXfer->num_iso_packets; i++) {
+		if (pStream->fIn) {
+			CheckInPacket(pStream, &pXfer->iso_packet_desc[i], libusb_get_iso_packet_buffer_simple(pXfer, i));
+		}
+		else if (pXfer->iso_packet_desc[i].status != LIBUSB_TRANSFER_COMPLETED) {
+			pStream->qwErrors++;
+		}
+	}
+	if (fRunning && !fFailed) {
+		Submit(pStream, pXfer);
+	}
+}
+
+
+static bool StartStream(TStream *pStream, int iTransfers)
+{
+	struct libusb_transfer	*pXfer;
+	uint8_t	*pbBuf;
+	int		i;
+
+	for (i = 0; i < iTransfers; i++) {
+		pXfer = libusb_alloc_transfer(iPackets);
+		pbBuf = malloc(iPackets * iSize);
+		if ((pXfer == NULL) || (pbBuf == NULL)) {
+			fprintf(stderr, "out of memory\n");
+			return false;
+		}
+		libusb_fill_iso_transfer(pXfer, hdl, pStream->bEP, pbBuf, iPackets * iSize, iPackets,
+								Completed, pStream, TIMEOUT_MS);
+		libusb_set_iso_packet_lengths(pXfer, iSize);
+		pXfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+		pStream->apXfers[i] = pXfer;
+		if (!Submit(pStream, pXfer)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// cancels what is still in flight and waits for it
+static void StopStream(TStream *pStream, int iTransfers)
+{
+	int	i;
+
+	for (i = 0; i < iTransfers; i++) {
+		if (pStream->apXfers[i] != NULL) {
+			libusb_cancel_transfer(pStream->apXfers[i]);
+		}
+	}
+	while (pStream->iActive > 0) {
+		if (libusb_handle_events(NULL) < 0) {
+			break;
+		}
+	}
+	for (i = 0; i < iTransfers; i++) {
+		if (pStream->apXfers[i] != NULL) {
+			libusb_free_transfer(pStream->apXfers[i]);
+			pStream->apXfers[i] = NULL;
+		}
+	}
+}
+
+
+// takes the OUT counters from the device
+static bool GetDeviceStats(TStream *pStream)
+{
+	uint8_t	abData[24];
+	int		i;
+
+	i = libusb_control_transfer(hdl, BM_REQUEST_TYPE | LIBUSB_ENDPOINT_IN, SRCSINK_REQ_GET_ISOC_STATS,
+								0, 0, abData, sizeof(abData), TIMEOUT_MS);
+	if (i != sizeof(abData)) {
+		fprintf(stderr, "GET_ISOC_STATS failed: %s\n", libusb_error_name(i));
+		return false;
+	}
+	pStream->qwPackets = GetLE32(&abData[4]);
+	pStream->qwDropped = GetLE32(&abData[8]);
+	pStream->qwDuplicated = GetLE32(&abData[12]);
+	pStream->qwLate = GetLE32(&abData[16]);
+	pStream->qwErrors += GetLE32(&abData[20]);
+	return true;
+}
+
+
+static void Report(TStream *pStream, int iTransfers)
+{
+	int	i;
+
+	fprintf(stderr, "isoc %s, %d bytes, %d x %d packets in flight:\n", pStream->pszName, iSize,
+			iTransfers, iPackets);
+	fprintf(stderr, "  %llu packets, %llu dropped, %llu duplicated, %llu late, %llu empty, %llu errors\n",
+			(unsigned long long)pStream->qwPackets, (unsigned long long)pStream->qwDropped,
+			(unsigned long long)pStream->qwDuplicated, (unsigned long long)pStream->qwLate,
+			(unsigned long long)pStream->qwEmpty, (unsigned long long)pStream->qwErrors);
+	if (pStream->fIn) {
+		fprintf(stderr, "  frames between packets:\n");
+		for (i = 0; i <= MAX_FRAMES; i++) {
+			if (pStream->aqwFrames[i] != 0) {
+				fprintf(stderr, "  %6d%s %12llu\n", i, (i == MAX_FRAMES) ? "+" : " ",
+						(unsigned long long)pStream->aqwFrames[i]);
+			}
+		}
+	}
+	fprintf(stderr, "  completion jitter (us):\n");
+	for (i = 0; i < JITTER_BUCKETS; i++) {
+		if (pStream->aqwJitter[i] != 0) {
+			fprintf(stderr, "  %s%6d %12llu\n",
+					(i == 0) ? "<=" : (i == JITTER_BUCKETS - 1) ? ">=" : "  ",
+					(i - JITTER_BUCKETS / 2) * iBucketUs, (unsigned long long)pStream->aqwJitter[i]);
+		}
+	}
+
+	printf("%s,%d,%d,%d,%llu,%llu,%llu,%llu,%llu,%llu,%.1f,%llu\n", pStream->pszName, iSize,
+			iTransfers, iPackets, (unsigned long long)pStream->qwPackets,
+			(unsigned long long)pStream->qwDropped, (unsigned long long)pStream->qwDuplicated,
+			(unsigned long long)pStream->qwLate, (unsigned long long)pStream->qwEmpty,
+			(unsigned long long)pStream->qwErrors,
+			(pStream->qwJitterCount > 0) ? (double)pStream->qwJitterSum / pStream->qwJitterCount : 0,
+			(unsigned long long)pStream->qwJitterMax);
+}
+
+
+static bool OpenDevice(void)
+{
+	int	i;
+
+	hdl = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID);
+	if (hdl == NULL) {
+		fprintf(stderr, "device not found\n");
+		return false;
+	}
+	libusb_set_auto_detach_kernel_driver(hdl, 1);
+	i = libusb_claim_interface(hdl, 0);
+	if (i < 0) {
+		fprintf(stderr, "libusb_claim_interface failed: %s\n", libusb_error_name(i));
+		return false;
+	}
+	i = libusb_set_interface_alt_setting(hdl, 0, 1);
+	if (i < 0) {
+		fprintf(stderr, "libusb_set_interface_alt_setting failed: %s\n", libusb_error_name(i));
+		return false;
+	}
+	i = libusb_get_max_iso_packet_size(libusb_get_device(hdl), ISOC_IN_EP);
+	if (i < ISOC_HDR_SIZE) {
+		fprintf(stderr, "no isoc endpoints: %s\n", libusb_error_name(i));
+		return false;
+	}
+	if (iSize == 0) {
+		iSize = i;
+	}
+	if (iSize > i) {
+		fprintf(stderr, "packet size %d is over the endpoint maximum of %d\n", iSize, i);
+		return false;
+	}
+	return true;
+}
+
+
+static void Usage(const char *pszName)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d <dir>   in or out, may be repeated (default both)\n"
+		"  -s <bytes> packet size, %d up to the endpoint maximum (default maximum)\n"
+		"  -q <n>     transfers in flight per direction, 1 to %d (default 8)\n"
+		"  -k <n>     packets per transfer, 1 to %d (default 8)\n"
+		"  -t <s>     test duration in seconds (default 10)\n"
+		"  -b <us>    jitter histogram bucket width (default 100)\n",
+		pszName, ISOC_HDR_SIZE, MAX_TRANSFERS, MAX_PACKETS);
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct timeval	tv = {0, 100000};
+	bool		fIn = false, fOut = false, fOk;
+	int			iTransfers = 8, iSeconds = 10;
+	uint64_t	qwEnd;
+	int			c, i;
+
+	while ((c = getopt(argc, argv, "d:s:q:k:t:b:h")) != -1) {
+		switch (c) {
+		case 'd':
+			if (strcmp(optarg, "in") == 0) {
+				fIn = true;
+			}
+			else if (strcmp(optarg, "out") == 0) {
+				fOut = true;
+			}
+			else {
+				Usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 's':	iSize = strtoul(optarg, NULL, 0);		break;
+		case 'q':	iTransfers = strtoul(optarg, NULL, 0);	break;
+		case 'k':	iPackets = strtoul(optarg, NULL, 0);	break;
+		case 't':	iSeconds = strtoul(optarg, NULL, 0);	break;
+		case 'b':	iBucketUs = strtoul(optarg, NULL, 0);	break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if (((iSize != 0) && (iSize < ISOC_HDR_SIZE)) || (iTransfers < 1) || (iTransfers > MAX_TRANSFERS) ||
+		(iPackets < 1) || (iPackets > MAX_PACKETS) || (iSeconds < 1) || (iBucketUs < 1)) {
+		Usage(argv[0]);
+		return 1;
+	}
+	if (!fIn && !fOut) {
+		fIn = fOut = true;
+	}
+	InStream.pszName = "in";
+	InStream.bEP = ISOC_IN_EP;
+	InStream.fIn = true;
+	OutStream.pszName = "out";
+	OutStream.bEP = ISOC_OUT_EP;
+	OutStream.fIn = false;
+
+	i = libusb_init(NULL);
+	if (i < 0) {
+		fprintf(stderr, "libusb_init failed: %s\n", libusb_error_name(i));
+		return 1;
+	}
+	fOk = OpenDevice();
+	if (fOk) {
+		// restarts both streams on the device
+		i = libusb_control_transfer(hdl, BM_REQUEST_TYPE, SRCSINK_REQ_SET_ISOC, fIn ? iSize : 0, 0,
+									NULL, 0, TIMEOUT_MS);
+		if (i < 0) {
+			fprintf(stderr, "SET_ISOC failed: %s\n", libusb_error_name(i));
+			fOk = false;
+		}
+	}
+
+	if (fOk) {
+		fRunning = true;
+		fOk = (!fIn || StartStream(&InStream, iTransfers)) && (!fOut || StartStream(&OutStream, iTransfers));
+		qwEnd = TimeUs() + (uint64_t)iSeconds * 1000000;
+		while (fOk && !fFailed && (TimeUs() < qwEnd)) {
+			if (libusb_handle_events_timeout_completed(NULL, &tv, NULL) < 0) {
+				break;
+			}
+		}
+		fRunning = false;
+		StopStream(&InStream, iTransfers);
+		StopStream(&OutStream, iTransfers);
+		fOk = fOk && !fFailed;
+	}
+
+	if (fOk && fIn) {
+		Report(&InStream, iTransfers);
+	}
+	if (fOk && fOut) {
+		fOk = GetDeviceStats(&OutStream);
+		if (fOk) {
+			Report(&OutStream, iTransfers);
+		}
+	}
+
+	if (hdl != NULL) {
+		libusb_set_interface_alt_setting(hdl, 0, 0);
+		libusb_release_interface(hdl, 0);
+		libusb_close(hdl);
+	}
+	libusb_exit(NULL);
+
+	return fOk ? 0 : 1;
+}
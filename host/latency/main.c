@@ -0,0 +1,508 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Round trip latency benchmark.
+
+	It talks through libusb-1.0 with the 'srcsink' test function on the
+	LPC and times ping-pong round trips on the bulk endpoints (in echo
+	mode), on the interrupt endpoints and on the control pipe: a packet is
+	sent and the echo is read back before the next packet goes out.
+
+	The round trip times go into a log-linear histogram with a resolution
+	of better than 1%, like HdrHistogram, from which the percentiles are
+	taken. With -o, the full percentile distribution of every pipe is
+	written in the HdrHistogram text format, ready for its plotting tools.
+
+	The device stamps every echo with the USB frame numbers in which it
+	received and sent it. Since the round trips are back to back, the
+	frames from one echo leaving the device to the next ping arriving are
+	the host's share (host turnaround and waiting for the host controller
+	to schedule the transfer), the frames between receiving and sending
+	are the device's share. Round trips shorter than a frame show up as 0.
+
+	Human readable results go to stderr, a CSV line per pipe to stdout:
+	pipe,size,round trips,min,mean,p50,p90,p99,p99.9,p99.99,max (us),
+	host frames,device frames (average per round trip)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libusb.h>
+
+// USB device specific definitions, see srcsink.h
+#define VENDOR_ID			0xFFFF
+#define PRODUCT_ID			0x0006
+
+#define	BM_REQUEST_TYPE		(2<<5)
+#define BULK_IN_EP			0x82
+#define BULK_OUT_EP			0x05
+#define INT_IN_EP			0x81
+#define INT_OUT_EP			0x04
+
+#define SRCSINK_REQ_SET_MODE	0x10
+#define SRCSINK_REQ_ECHO		0x13
+#define SRCSINK_MODE_ECHO		2
+
+#define ECHO_RX_FRAME		0			/**< offset of the receive frame number */
+#define ECHO_TX_FRAME		2			/**< offset of the send frame number */
+#define ECHO_SEQ			4			/**< offset of our sequence number */
+
+#define MIN_SIZE			8
+#define MAX_SIZE			64
+#define FRAME_MASK			0x7FF
+#define TIMEOUT_MS			1000
+
+// histogram: 2^SUB_BITS linear buckets per power of two, up to 2^MAX_BITS ns
+#define SUB_BITS			7
+#define SUB_COUNT			(1 << SUB_BITS)
+#define HALF_COUNT			(SUB_COUNT / 2)
+#define MAX_BITS			40
+#define NUM_BUCKETS			(SUB_COUNT + (MAX_BITS - SUB_BITS) * HALF_COUNT)
+
+#define MAX_FRAMES			4			/**< frame counts of 4 and up share a bucket */
+
+typedef enum {
+	ePipeBulk,
+	ePipeInt,
+	ePipeCtrl,
+	ePipeNum
+} EPipe;
+
+/** Results of one pipe */
+typedef struct {
+	uint32_t	adwBuckets[NUM_BUCKETS];
+	uint64_t	qwCount;
+	uint64_t	qwSum;				/**< ns */
+	double		dSumSq;				/**< ns^2, for the standard deviation */
+	uint64_t	qwMin;
+	uint64_t	qwMax;
+	uint64_t	aqwHostFrames[MAX_FRAMES + 1];
+	uint64_t	aqwDevFrames[MAX_FRAMES + 1];
+	uint64_t	qwHostFrameSum;
+	uint64_t	qwDevFrameSum;
+} THistogram;
+
+static const char *apszPipes[] = {"bulk", "interrupt", "control"};
+
+static libusb_device_handle	*hdl;
+static THistogram	Hist;
+
+
+static uint64_t TimeNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static uint16_t GetLE16(const uint8_t *pb)
+{
+	return pb[0] | (pb[1] << 8);
+}
+
+
+static void PutLE32(uint8_t *pb, uint32_t dw)
+{
+	pb[0] = dw;
+	pb[1] = dw >> 8;
+	pb[2] = dw >> 16;
+	pb[3] = dw >> 24;
+}
+
+
+static uint32_t GetLE32(const uint8_t *pb)
+{
+	return pb[0] | (pb[1] << 8) | (pb[2] << 16) | ((uint32_t)pb[3] << 24);
+}
+
+
+// histogram bucket of a value
+static int BucketIndex(uint64_t qw)
+{
+	int	iBits, iShift;
+
+	if (qw < SUB_COUNT) {
+		return qw;
+	}
+	for (iBits = SUB_BITS; (iBits < 64) && ((qw >> iBits) != 0); iBits++)
+		;
+	if (iBits > MAX_BITS) {
+		return NUM_BUCKETS - 1;
+	}
+	// qw >> iShift is in [HALF_COUNT, SUB_COUNT)
+	iShift = iBits - SUB_BITS;
+	return SUB_COUNT + (iShift - 1) * HALF_COUNT + (qw >> iShift) - HALF_COUNT;
+}
+
+
+// highest value that falls in a histogram bucket
+static uint64_t BucketValue(int iIndex)
+{
+	int	iShift;
+
+	if (iIndex < SUB_COUNT) {
+		return iIndex;
+	}
+	iShift = (iIndex - SUB_COUNT) / HALF_COUNT + 1;
+	return ((uint64_t)((iIndex - SUB_COUNT) % HALF_COUNT + HALF_COUNT + 1) << iShift) - 1;
+}
+
+
+static void Record(uint64_t qwNs, int iHostFrames, int iDevFrames)
+{
+	Hist.adwBuckets[BucketIndex(qwNs)]++;
+	if ((Hist.qwCount == 0) || (qwNs < Hist.qwMin)) {
+		Hist.qwMin = qwNs;
+	}
+	if (qwNs > Hist.qwMax) {
+		Hist.qwMax = qwNs;
+	}
+	Hist.qwCount++;
+	Hist.qwSum += qwNs;
+	Hist.dSumSq += (double)qwNs * qwNs;
+	if (iHostFrames >= 0) {
+		Hist.aqwHostFrames[(iHostFrames < MAX_FRAMES) ? iHostFrames : MAX_FRAMES]++;
+		Hist.qwHostFrameSum += iHostFrames;
+	}
+	Hist.aqwDevFrames[(iDevFrames < MAX_FRAMES) ? iDevFrames : MAX_FRAMES]++;
+	Hist.qwDevFrameSum += iDevFrames;
+}
+
+
+// value at a percentile, in ns
+static uint64_t Percentile(double dPercentile)
+{
+	uint64_t	qwCount, qwLimit;
+	int			i;
+
+	qwLimit = (uint64_t)(dPercentile / 100 * Hist.qwCount + 0.5);
+	if (qwLimit == 0) {
+		qwLimit = 1;
+	}
+	qwCount = 0;
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		qwCount += Hist.adwBuckets[i];
+		if (qwCount >= qwLimit) {
+			// the bucket bound can be above the largest value seen
+			return (BucketValue(i) < Hist.qwMax) ? BucketValue(i) : Hist.qwMax;
+		}
+	}
+	return Hist.qwMax;
+}
+
+
+static double Mean(void)
+{
+	return (double)Hist.qwSum / Hist.qwCount;
+}
+
+
+static double StdDev(void)
+{
+	double	dVar;
+
+	dVar = Hist.dSumSq / Hist.qwCount - Mean() * Mean();
+	return (dVar > 0) ? sqrt(dVar) : 0;
+}
+
+
+// writes the percentile distribution in the HdrHistogram text format (us)
+static bool WriteDistribution(const char *pszPrefix, EPipe ePipe)
+{
+	char		szName[256];
+	FILE		*f;
+	uint64_t	qwCount;
+	double		dFraction;
+	int			i;
+
+	snprintf(szName, sizeof(szName), "%s_%s.hgrm", pszPrefix, apszPipes[ePipe]);
+	f = fopen(szName, "w");
+	if (f == NULL) {
+		perror(szName);
+		return false;
+	}
+	fprintf(f, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+	qwCount = 0;
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		if (Hist.adwBuckets[i] == 0) {
+			continue;
+		}
+		qwCount += Hist.adwBuckets[i];
+		dFraction = (double)qwCount / Hist.qwCount;
+		if (qwCount < Hist.qwCount) {
+			fprintf(f, "%12.3f %2.12f %10llu %14.2f\n", BucketValue(i) / 1000.0, dFraction,
+					(unsigned long long)qwCount, 1 / (1 - dFraction));
+		}
+		else {
+			fprintf(f, "%12.3f %2.12f %10llu\n", Hist.qwMax / 1000.0, dFraction,
+					(unsigned long long)qwCount);
+		}
+	}
+	fprintf(f, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", Mean() / 1000, StdDev() / 1000);
+	fprintf(f, "#[Max     = %12.3f, Total count    = %12llu]\n", Hist.qwMax / 1000.0,
+			(unsigned long long)Hist.qwCount);
+	fclose(f);
+	return true;
+}
+
+
+// a bulk or interrupt transfer, depending on the pipe
+static int Transfer(EPipe ePipe, uint8_t bEP, uint8_t *pbData, int iLen, int *piDone)
+{
+	if (ePipe == ePipeBulk) {
+		return libusb_bulk_transfer(hdl, bEP, pbData, iLen, piDone, TIMEOUT_MS);
+	}
+	return libusb_interrupt_transfer(hdl, bEP, pbData, iLen, piDone, TIMEOUT_MS);
+}
+
+
+/*
+	Does one round trip on a pipe. Returns false on error, otherwise the
+	frame numbers of the echo are in *pwRxFrame and *pwTxFrame.
+ */
+static bool RoundTrip(EPipe ePipe, uint32_t dwSeq, int iSize, uint16_t *pwRxFrame, uint16_t *pwTxFrame)
+{
+	uint8_t	abOut[MAX_SIZE], abIn[MAX_SIZE];
+	int		i, iLen;
+
+	memset(abOut, 0, iSize);
+	PutLE32(&abOut[ECHO_SEQ], dwSeq);
+	if (ePipe == ePipeCtrl) {
+		iLen = libusb_control_transfer(hdl, BM_REQUEST_TYPE | LIBUSB_ENDPOINT_IN, SRCSINK_REQ_ECHO,
+									dwSeq & 0xFFFF, dwSeq >> 16, abIn, iSize, TIMEOUT_MS);
+		if (iLen < 0) {
+			fprintf(stderr, "control echo failed: %s\n", libusb_error_name(iLen));
+			return false;
+		}
+	}
+	else {
+		i = Transfer(ePipe, (ePipe == ePipeBulk) ? BULK_OUT_EP : INT_OUT_EP, abOut, iSize, &iLen);
+		if (i == 0) {
+			i = Transfer(ePipe, (ePipe == ePipeBulk) ? BULK_IN_EP : INT_IN_EP, abIn, iSize, &iLen);
+		}
+		if (i < 0) {
+			fprintf(stderr, "%s echo failed: %s\n", apszPipes[ePipe], libusb_error_name(i));
+			return false;
+		}
+	}
+	if ((iLen != iSize) || (GetLE32(&abIn[ECHO_SEQ]) != dwSeq)) {
+		fprintf(stderr, "%s echo %u is wrong\n", apszPipes[ePipe], dwSeq);
+		return false;
+	}
+	*pwRxFrame = GetLE16(&abIn[ECHO_RX_FRAME]);
+	*pwTxFrame = GetLE16(&abIn[ECHO_TX_FRAME]);
+	return true;
+}
+
+
+static bool RunPipe(EPipe ePipe, int iSize, uint32_t dwWarmUp, uint32_t dwCount)
+{
+	uint64_t	qwStart, qwTime;
+	uint16_t	wRxFrame, wTxFrame, wLastTxFrame;
+	uint32_t	dwSeq;
+
+	memset(&Hist, 0, sizeof(Hist));
+	wLastTxFrame = 0;
+	for (dwSeq = 0; dwSeq < dwWarmUp + dwCount; dwSeq++) {
+		qwStart = TimeNs();
+		if (!RoundTrip(ePipe, dwSeq, iSize, &wRxFrame, &wTxFrame)) {
+			return false;
+		}
+		qwTime = TimeNs() - qwStart;
+		if (dwSeq >= dwWarmUp) {
+			// the host's share is only known from the second round trip on
+			Record(qwTime, (dwSeq > 0) ? ((wRxFrame - wLastTxFrame) & FRAME_MASK) : -1,
+					(wTxFrame - wRxFrame) & FRAME_MASK);
+		}
+		wLastTxFrame = wTxFrame;
+	}
+	return true;
+}
+
+
+static void Report(EPipe ePipe, int iSize)
+{
+	uint64_t	qwHostCount;
+	int			i;
+
+	qwHostCount = 0;
+	for (i = 0; i <= MAX_FRAMES; i++) {
+		qwHostCount += Hist.aqwHostFrames[i];
+	}
+	fprintf(stderr, "%s, %d bytes, %llu round trips (us):\n", apszPipes[ePipe], iSize,
+			(unsigned long long)Hist.qwCount);
+	fprintf(stderr, "  min %.1f  mean %.1f  stddev %.1f  max %.1f\n", Hist.qwMin / 1000.0,
+			Mean() / 1000, StdDev() / 1000, Hist.qwMax / 1000.0);
+	fprintf(stderr, "  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  p99.99 %.1f\n",
+			Percentile(50) / 1000.0, Percentile(90) / 1000.0, Percentile(99) / 1000.0,
+			Percentile(99.9) / 1000.0, Percentile(99.99) / 1000.0);
+	fprintf(stderr, "  frames     ");
+	for (i = 0; i <= MAX_FRAMES; i++) {
+		fprintf(stderr, "%7d%s", i, (i == MAX_FRAMES) ? "+" : " ");
+	}
+	fprintf(stderr, "\n  host       ");
+	for (i = 0; i <= MAX_FRAMES; i++) {
+		fprintf(stderr, "%7.2f%% ", (qwHostCount > 0) ? 100.0 * Hist.aqwHostFrames[i] / qwHostCount : 0);
+	}
+	fprintf(stderr, "\n  device     ");
+	for (i = 0; i <= MAX_FRAMES; i++) {
+		fprintf(stderr, "%7.2f%% ", 100.0 * Hist.aqwDevFrames[i] / Hist.qwCount);
+	}
+	fprintf(stderr, "\n");
+
+	printf("%s,%d,%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.3f,%.3f\n", apszPipes[ePipe], iSize,
+			(unsigned long long)Hist.qwCount, Hist.qwMin / 1000.0, Mean() / 1000,
+			Percentile(50) / 1000.0, Percentile(90) / 1000.0, Percentile(99) / 1000.0,
+			Percentile(99.9) / 1000.0, Percentile(99.99) / 1000.0, Hist.qwMax / 1000.0,
+			(qwHostCount > 0) ? (double)Hist.qwHostFrameSum / qwHostCount : 0,
+			(double)Hist.qwDevFrameSum / Hist.qwCount);
+}
+
+
+static bool OpenDevice(void)
+{
+	uint8_t	abBuf[MAX_SIZE];
+	int		i, iLen;
+
+	hdl = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID);
+	if (hdl == NULL) {
+		fprintf(stderr, "device not found\n");
+		return false;
+	}
+	libusb_set_auto_detach_kernel_driver(hdl, 1);
+	i = libusb_claim_interface(hdl, 0);
+	if (i < 0) {
+		fprintf(stderr, "libusb_claim_interface failed: %s\n", libusb_error_name(i));
+		return false;
+	}
+	i = libusb_control_transfer(hdl, BM_REQUEST_TYPE, SRCSINK_REQ_SET_MODE, SRCSINK_MODE_ECHO, 0,
+								NULL, 0, TIMEOUT_MS);
+	if (i < 0) {
+		fprintf(stderr, "SET_MODE failed: %s\n", libusb_error_name(i));
+		return false;
+	}
+	// throw away what the source left in the bulk IN endpoint
+	while (libusb_bulk_transfer(hdl, BULK_IN_EP, abBuf, sizeof(abBuf), &iLen, 50) == 0)
+		;
+	return true;
+}
+
+
+static void Usage(const char *pszName)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -p <pipe>  bulk, interrupt or control, may be repeated (default all)\n"
+		"  -n <n>     round trips per pipe (default 100000)\n"
+		"  -w <n>     warm-up round trips (default 1000)\n"
+		"  -s <bytes> packet size, %d to %d (default %d)\n"
+		"  -o <name>  write percentile distributions to <name>_<pipe>.hgrm\n",
+		pszName, MIN_SIZE, MAX_SIZE, MIN_SIZE);
+}
+
+
+int main(int argc, char *argv[])
+{
+	bool		afPipes[ePipeNum] = {false, false, false};
+	bool		fAny = false, fOk;
+	uint32_t	dwCount = 100000, dwWarmUp = 1000;
+	int			iSize = MIN_SIZE;
+	const char	*pszPrefix = NULL;
+	int			c, i;
+
+	while ((c = getopt(argc, argv, "p:n:w:s:o:h")) != -1) {
+		switch (c) {
+		case 'p':
+			for (i = 0; i < ePipeNum; i++) {
+				if (strncmp(optarg, apszPipes[i], strlen(optarg)) == 0) {
+					afPipes[i] = true;
+					fAny = true;
+					break;
+				}
+			}
+			if (i == ePipeNum) {
+				Usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'n':	dwCount = strtoul(optarg, NULL, 0);		break;
+		case 'w':	dwWarmUp = strtoul(optarg, NULL, 0);	break;
+		case 's':	iSize = strtoul(optarg, NULL, 0);		break;
+		case 'o':	pszPrefix = optarg;						break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((dwCount == 0) || (iSize < MIN_SIZE) || (iSize > MAX_SIZE)) {
+		Usage(argv[0]);
+		return 1;
+	}
+	if (!fAny) {
+		for (i = 0; i < ePipeNum; i++) {
+			afPipes[i] = true;
+		}
+	}
+
+	i = libusb_init(NULL);
+	if (i < 0) {
+		fprintf(stderr, "libusb_init failed: %s\n", libusb_error_name(i));
+		return 1;
+	}
+	fOk = OpenDevice();
+
+	for (i = 0; fOk && (i < ePipeNum); i++) {
+		if (!afPipes[i]) {
+			continue;
+		}
+		fOk = RunPipe(i, iSize, dwWarmUp, dwCount);
+		if (fOk) {
+			Report(i, iSize);
+			if (pszPrefix != NULL) {
+				fOk = WriteDistribution(pszPrefix, i);
+			}
+		}
+	}
+
+	if (hdl != NULL) {
+		libusb_release_interface(hdl, 0);
+		libusb_close(hdl);
+	}
+	libusb_exit(NULL);
+
+	return fOk ? 0 : 1;
+}
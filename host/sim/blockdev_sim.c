@@ -0,0 +1,293 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file
+	Simulated block devices for host builds of the mass storage example.
+
+	Two media are available: a RAM disk, and a memory-mapped image file
+	which keeps its contents between runs. Each simulated device exports a
+	blockdev.h operations table, so it can be served as a SCSI logical unit.
+
+	Each access can be slowed down to mimic a real card, using a fixed
+	latency per block plus a transfer time derived from the bandwidth.
+	The delay is a busy wait, just like the SPI driver on the target spins
+	while talking to the card. Writes can also be started asynchronously,
+	in which case the device stays busy for the write time while the
+	caller goes on; any other access waits for it first.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "blockdev.h"
+#include "blockdev_sim.h"
+
+#define BLOCKSIZE		512
+
+/** State of one simulated block device */
+typedef struct {
+	uint8_t			*pbMedium;		/**< RAM disk or mapped image */
+	uint32_t		dwMediumSize;	/**< size of medium in bytes */
+	TBlockDevTiming	Timing;
+	uint64_t		qwBusyUntil;	/**< end of a started write (ns) */
+} TSimBlockDev;
+
+static TSimBlockDev		aDev[SIM_MAX_DEVS];
+
+
+static uint64_t SimNow(void)
+{
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+/**
+	Local function to start the simulated access time of one block
+
+	@param [in]	pDev		Device
+	@param [in]	dwLatency	Fixed part of the access time (us)
+	@param [in]	dwBytes		Number of bytes transferred
+ */
+static void SimStartDelay(TSimBlockDev *pDev, uint32_t dwLatency, uint32_t dwBytes)
+{
+	uint64_t	qwDelay;
+
+	qwDelay = (uint64_t)dwLatency * 1000;
+	if (pDev->Timing.dwBandwidth != 0) {
+		qwDelay += ((uint64_t)dwBytes * 1000000000) / pDev->Timing.dwBandwidth;
+	}
+	pDev->qwBusyUntil = (qwDelay != 0) ? (SimNow() + qwDelay) : 0;
+}
+
+
+// spins until the device is no longer busy
+static void SimWait(TSimBlockDev *pDev)
+{
+	while ((pDev->qwBusyUntil != 0) && (SimNow() < pDev->qwBusyUntil));
+	pDev->qwBusyUntil = 0;
+}
+
+
+/**
+	Local function to spin for the simulated access time of one block
+ */
+static void SimDelay(TSimBlockDev *pDev, uint32_t dwLatency, uint32_t dwBytes)
+{
+	SimWait(pDev);
+	SimStartDelay(pDev, dwLatency, dwBytes);
+	SimWait(pDev);
+}
+
+
+static bool SimInit(TSimBlockDev *pDev)
+{
+	return (pDev->pbMedium != NULL);
+}
+
+
+static bool SimWrite(TSimBlockDev *pDev, uint32_t dwBlock, uint8_t *pbBuf)
+{
+	if (dwBlock >= (pDev->dwMediumSize / BLOCKSIZE)) {
+		return false;
+	}
+	SimDelay(pDev, pDev->Timing.dwWriteLatency, BLOCKSIZE);
+	memcpy(pDev->pbMedium + (size_t)dwBlock * BLOCKSIZE, pbBuf, BLOCKSIZE);
+	return true;
+}
+
+
+static bool SimRead(TSimBlockDev *pDev, uint32_t dwBlock, uint8_t *pbBuf)
+{
+	if (dwBlock >= (pDev->dwMediumSize / BLOCKSIZE)) {
+		return false;
+	}
+	SimDelay(pDev, pDev->Timing.dwReadLatency, BLOCKSIZE);
+	memcpy(pbBuf, pDev->pbMedium + (size_t)dwBlock * BLOCKSIZE, BLOCKSIZE);
+	return true;
+}
+
+
+static bool SimStartWrite(TSimBlockDev *pDev, uint32_t dwBlock, uint8_t *pbBuf)
+{
+	if (dwBlock >= (pDev->dwMediumSize / BLOCKSIZE)) {
+		return false;
+	}
+	SimWait(pDev);
+	SimStartDelay(pDev, pDev->Timing.dwWriteLatency, BLOCKSIZE);
+	memcpy(pDev->pbMedium + (size_t)dwBlock * BLOCKSIZE, pbBuf, BLOCKSIZE);
+	return true;
+}
+
+
+static bool SimPoll(TSimBlockDev *pDev)
+{
+	if ((pDev->qwBusyUntil != 0) && (SimNow() < pDev->qwBusyUntil)) {
+		return false;
+	}
+	pDev->qwBusyUntil = 0;
+	return true;
+}
+
+
+// discarded blocks read back as zeroes
+static bool SimDiscard(TSimBlockDev *pDev, uint32_t dwBlock, uint32_t dwCount)
+{
+	if ((dwBlock > (pDev->dwMediumSize / BLOCKSIZE)) || (dwCount > (pDev->dwMediumSize / BLOCKSIZE) - dwBlock)) {
+		return false;
+	}
+	SimDelay(pDev, pDev->Timing.dwWriteLatency, 0);
+	memset(pDev->pbMedium + (size_t)dwBlock * BLOCKSIZE, 0, (size_t)dwCount * BLOCKSIZE);
+	return true;
+}
+
+
+static bool SimGetSize(TSimBlockDev *pDev, uint32_t *pdwNumBlocks)
+{
+	if (pDev->pbMedium == NULL) {
+		return false;
+	}
+	*pdwNumBlocks = pDev->dwMediumSize / BLOCKSIZE;
+	return true;
+}
+
+
+/** Operations table of simulated device n, the blockdev API has no context pointer */
+#define SIM_DEV_OPS(n) \
+	static bool SimInit##n(void) { return SimInit(&aDev[n]); } \
+	static bool SimWrite##n(uint32_t dwBlock, uint8_t *pbBuf) { return SimWrite(&aDev[n], dwBlock, pbBuf); } \
+	static bool SimRead##n(uint32_t dwBlock, uint8_t *pbBuf) { return SimRead(&aDev[n], dwBlock, pbBuf); } \
+	static bool SimGetSize##n(uint32_t *pdwNumBlocks) { return SimGetSize(&aDev[n], pdwNumBlocks); } \
+	static bool SimDiscard##n(uint32_t dwBlock, uint32_t dwCount) { return SimDiscard(&aDev[n], dwBlock, dwCount); } \
+	static bool SimStartWrite##n(uint32_t dwBlock, uint8_t *pbBuf) { return SimStartWrite(&aDev[n], dwBlock, pbBuf); } \
+	static bool SimPoll##n(void) { return SimPoll(&aDev[n]); }
+
+SIM_DEV_OPS(0)
+SIM_DEV_OPS(1)
+
+static const TBlockDevOps aOps[SIM_MAX_DEVS] = {
+	{SimInit0, SimWrite0, SimRead0, SimGetSize0, SimDiscard0, SimStartWrite0, SimPoll0},
+	{SimInit1, SimWrite1, SimRead1, SimGetSize1, SimDiscard1, SimStartWrite1, SimPoll1}
+};
+
+
+/**
+	Sets up a simulated device with a RAM disk as medium
+
+	@param [in]	iDev	Device index
+	@param [in]	dwSize	Size of the disk in bytes
+
+	@return block device operations, or NULL if the disk could not be allocated
+ */
+const TBlockDevOps *BlockDevSimRam(int iDev, uint32_t dwSize)
+{
+	TSimBlockDev *pDev = &aDev[iDev];
+
+	pDev->pbMedium = calloc(1, dwSize);
+	if (pDev->pbMedium == NULL) {
+		return NULL;
+	}
+	pDev->dwMediumSize = dwSize;
+	return &aOps[iDev];
+}
+
+
+/**
+	Sets up a simulated device with a memory-mapped image file as medium
+
+	@param [in]	iDev	Device index
+	@param [in]	pszPath	Image file, created if it does not exist
+	@param [in]	dwSize	Size of the image in bytes, 0 to use the file size
+
+	@return block device operations, or NULL if the file could not be mapped
+ */
+const TBlockDevOps *BlockDevSimFile(int iDev, const char *pszPath, uint32_t dwSize)
+{
+	TSimBlockDev	*pDev = &aDev[iDev];
+	struct stat		st;
+	void			*pv;
+	int				fd;
+
+	fd = open(pszPath, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror(pszPath);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror(pszPath);
+		close(fd);
+		return NULL;
+	}
+	if (dwSize == 0) {
+		dwSize = st.st_size;
+	}
+	else if ((uint32_t)st.st_size != dwSize) {
+		if (ftruncate(fd, dwSize) < 0) {
+			perror(pszPath);
+			close(fd);
+			return NULL;
+		}
+	}
+	if (dwSize < BLOCKSIZE) {
+		fprintf(stderr, "%s: image too small\n", pszPath);
+		close(fd);
+		return NULL;
+	}
+
+	pv = mmap(NULL, dwSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (pv == MAP_FAILED) {
+		perror(pszPath);
+		return NULL;
+	}
+	pDev->pbMedium = pv;
+	pDev->dwMediumSize = dwSize;
+	return &aOps[iDev];
+}
+
+
+/**
+	Sets the timing model of a device, all zeroes means as fast as possible
+
+	@param [in]	iDev	Device index
+	@param [in]	pTiming	Timing parameters
+ */
+void BlockDevSimTiming(int iDev, const TBlockDevTiming *pTiming)
+{
+	aDev[iDev].Timing = *pTiming;
+}
@@ -0,0 +1,53 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	Configuration of the simulated block devices in blockdev_sim.c.
+
+	Up to SIM_MAX_DEVS devices can be set up, each with its own medium and
+	timing. BlockDevSimRam and BlockDevSimFile return the operations table
+	to hand to SCSIAddLUN.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "blockdev.h"
+
+#define SIM_MAX_DEVS	2	/**< number of simulated block devices */
+
+/** Timing model applied to every block access */
+typedef struct {
+	uint32_t	dwReadLatency;		/**< access time per block read (us) */
+	uint32_t	dwWriteLatency;		/**< programming time per block write (us) */
+	uint32_t	dwBandwidth;		/**< transfer rate (bytes/s), 0 = unlimited */
+} TBlockDevTiming;
+
+const TBlockDevOps *BlockDevSimRam(int iDev, uint32_t dwSize);
+const TBlockDevOps *BlockDevSimFile(int iDev, const char *pszPath, uint32_t dwSize);
+void BlockDevSimTiming(int iDev, const TBlockDevTiming *pTiming);
@@ -0,0 +1,455 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	USB to UART bridge simulation.
+
+	Runs the bridge of bridge.c with all its ports on the PC, on top of
+	the simulated USB controller and simulated UARTs.
+
+	The host first sets a line coding on every port and checks that it
+	reaches the UART, and that a line coding the UART cannot do is stalled
+	and leaves the old one in place.
+
+	Then the peer of each UART is set to another format than the port.
+	Data in both directions has to arrive with errors, until the host sets
+	the line coding of the peer, from when on it has to arrive intact.
+
+	Finally the host and the peers stream data through all ports in both
+	directions at once. Nothing may be lost or corrupted, and every
+	direction of every port has to reach at least MIN_LINE_RATE % of what
+	the line can carry.
+
+	The bus is modelled as FRAME_PACKETS bulk packets per frame, which the
+	host hands out to the ports in turn. The UARTs run in between, as does
+	the main loop of main_bridge.c.
+
+	Human readable results go to stderr, a CSV line per port and direction
+	to stdout: test,port,direction,chars,frames,%line,errors
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "usbapi.h"
+#include "usbhw_lpc.h"
+
+#include "bridge.h"
+
+#include "usbhw_sim.h"
+#include "uart_sim.h"
+
+#define FRAME_PACKETS	19			/**< full-speed bulk packets in one frame */
+#define FRAME_NS		1000000		/**< length of a frame */
+#define MIN_LINE_RATE	95			/**< % of the line rate each direction must get */
+
+#define FAST_BAUD		921600
+#define SLOW_BAUD		57600
+
+#define LE_WORD(x)		((x)&0xFF),((x)>>8)
+
+/** Host side of one port */
+typedef struct {
+	bool		fWrite;				/**< host sends data */
+	uint32_t	dwSent;				/**< chars accepted by the device */
+	uint32_t	dwReceived;			/**< chars received from the device */
+	uint32_t	dwErrors;			/**< received chars that were wrong */
+} THostPort;
+
+static const uint8_t abDescriptors[] = {
+
+// device descriptor
+	0x12,
+	DESC_DEVICE,
+	LE_WORD(0x0200),			// bcdUSB
+	0xEF, 0x02, 0x01,			// bDeviceClass, bDeviceSubClass, bDeviceProtocol
+	MAX_PACKET_SIZE0,			// bMaxPacketSize
+	LE_WORD(0xFFFF),			// idVendor
+	LE_WORD(0x0005),			// idProduct
+	LE_WORD(0x0100),			// bcdDevice
+	0x00,						// iManufacturer
+	0x00,						// iProduct
+	0x00,						// iSerialNumber
+	0x01,						// bNumConfigurations
+
+// configuration descriptor
+	0x09,
+	DESC_CONFIGURATION,
+	LE_WORD(9 + CDC_NUM_PORTS * CDC_PORT_DESC_SIZE),	// wTotalLength
+	2 * CDC_NUM_PORTS,			// bNumInterfaces
+	0x01,						// bConfigurationValue
+	0x00,						// iConfiguration
+	0xC0,						// bmAttributes
+	0x32,						// bMaxPower
+
+	CDC_PORT_DESCRIPTORS(0)
+#if CDC_NUM_PORTS > 1
+	CDC_PORT_DESCRIPTORS(1)
+#endif
+#if CDC_NUM_PORTS > 2
+	CDC_PORT_DESCRIPTORS(2)
+#endif
+#if CDC_NUM_PORTS > 3
+	CDC_PORT_DESCRIPTORS(3)
+#endif
+
+// terminating zero
+	0
+};
+
+// UART of each port, as in bridge.c
+static const int aiUarts[] = {1, 2, 3, 0};
+
+static THostPort	aHost[CDC_NUM_PORTS];
+static uint32_t		dwFrames;				/**< simulated time in frames */
+
+
+static int SetLineCoding(int iPort, uint32_t dwBaud, int iDataBits, int iParity, int iStopBits)
+{
+	uint8_t	abData[7];
+
+	abData[0] = dwBaud;
+	abData[1] = dwBaud >> 8;
+	abData[2] = dwBaud >> 16;
+	abData[3] = dwBaud >> 24;
+	abData[4] = iStopBits;
+	abData[5] = iParity;
+	abData[6] = iDataBits;
+	return SimHostRequest((REQTYPE_TYPE_CLASS << 5) | REQTYPE_RECIP_INTERFACE,
+				SET_LINE_CODING, 0, CDC_COMM_IF(iPort), abData, 7);
+}
+
+
+// whether the UART of a port runs the given format
+static bool UARTFormatIs(int iPort, uint32_t dwBaud, int iDataBits, int iParity, int iStopBits)
+{
+	uint32_t	dwUARTBaud;
+	int			iUARTDataBits, iUARTParity, iUARTStopBits;
+
+	return UARTSimGetFormat(aiUarts[iPort], &dwUARTBaud, &iUARTDataBits, &iUARTParity, &iUARTStopBits) &&
+		(dwUARTBaud == dwBaud) && (iUARTDataBits == iDataBits) &&
+		(iUARTParity == iParity) && (iUARTStopBits == iStopBits);
+}
+
+
+// one OUT transaction on a port, returns true if the bus was used
+static bool HostOut(int iPort)
+{
+	THostPort	*pHost = &aHost[iPort];
+	uint8_t		abData[CDC_MAX_PACKET];
+	int			i;
+
+	if (!pHost->fWrite) {
+		return false;
+	}
+	for (i = 0; i < CDC_MAX_PACKET; i++) {
+		abData[i] = UARTSimData(aiUarts[iPort], pHost->dwSent + i);
+	}
+	if (SimHostOut(CDC_BULK_OUT_EP(iPort), abData, CDC_MAX_PACKET) < 0) {
+		return false;
+	}
+	pHost->dwSent += CDC_MAX_PACKET;
+	return true;
+}
+
+
+// one IN transaction on a port, returns true if the bus was used
+static bool HostIn(int iPort)
+{
+	THostPort	*pHost = &aHost[iPort];
+	uint8_t		abData[CDC_MAX_PACKET];
+	int			i, iLen;
+
+	iLen = SimHostIn(CDC_BULK_IN_EP(iPort), abData, sizeof(abData));
+	if (iLen < 0) {
+		return false;
+	}
+	for (i = 0; i < iLen; i++) {
+		if (abData[i] != UARTSimData(aiUarts[iPort], pHost->dwReceived + i)) {
+			pHost->dwErrors++;
+		}
+	}
+	pHost->dwReceived += iLen;
+	return true;
+}
+
+
+/*
+	Runs the bus for one frame, split in FRAME_PACKETS slots. In every
+	slot the next port and direction that is not NAKed gets a packet,
+	then the main loop makes a pass and the UARTs run for the length of
+	the slot.
+ */
+static void RunFrame(void)
+{
+	static int	iNext;
+	int			iSlot, iTry;
+	bool		fBusy;
+
+	for (iSlot = 0; iSlot < FRAME_PACKETS; iSlot++) {
+		fBusy = false;
+		for (iTry = 0; !fBusy && (iTry < 2 * CDC_NUM_PORTS); iTry++) {
+			if ((iNext & 1) == 0) {
+				fBusy = HostOut(iNext / 2);
+			}
+			else {
+				fBusy = HostIn(iNext / 2);
+			}
+			iNext = (iNext + 1) % (2 * CDC_NUM_PORTS);
+		}
+		BridgePoll();
+		UARTSimRun((iSlot + 1) * FRAME_NS / FRAME_PACKETS - iSlot * FRAME_NS / FRAME_PACKETS);
+	}
+	SimHostFrame();
+	dwFrames++;
+}
+
+
+// runs until everything sent has arrived, returns false if a port gets stuck
+static bool Drain(void)
+{
+	TUARTSimStats	Stats;
+	int				iPort, iFrames;
+
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		aHost[iPort].fWrite = false;
+	}
+	for (iFrames = 0; iFrames < 1000; iFrames++) {
+		for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+			UARTSimGetStats(aiUarts[iPort], &Stats);
+			if ((Stats.dwReceived != aHost[iPort].dwSent) || (aHost[iPort].dwReceived != Stats.dwSent)) {
+				break;
+			}
+		}
+		if (iPort == CDC_NUM_PORTS) {
+			return true;
+		}
+		RunFrame();
+	}
+	fprintf(stderr, "port %d: data did not arrive\n", iPort);
+	return false;
+}
+
+
+static void Report(const char *pszTest, int iPort, const char *pszDir, uint32_t dwChars,
+				uint32_t dwFrameCount, uint32_t dwLineChars, uint32_t dwErrors)
+{
+	uint32_t	dwPercent;
+
+	dwPercent = (uint32_t)((uint64_t)dwChars * 100 / dwLineChars);
+	fprintf(stderr, "%-8s port %d %-9s %u chars in %u frames, %u%% of the line, %u errors\n",
+			pszTest, iPort, pszDir, dwChars, dwFrameCount, dwPercent, dwErrors);
+	printf("%s,%d,%s,%u,%u,%u,%u\n", pszTest, iPort, pszDir, dwChars, dwFrameCount, dwPercent, dwErrors);
+}
+
+
+static bool TestLineCoding(void)
+{
+	uint8_t	abData[7];
+	int		iPort;
+	bool	fOk;
+
+	fOk = true;
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		if ((SetLineCoding(iPort, FAST_BAUD, 8, 0, 0) != 7) ||
+			!UARTFormatIs(iPort, FAST_BAUD, 8, 0, 0)) {
+			fprintf(stderr, "port %d: line coding did not reach the UART\n", iPort);
+			fOk = false;
+		}
+		// 16 data bits, and a baud rate out of reach
+		if ((SetLineCoding(iPort, FAST_BAUD, 16, 0, 0) != SIM_STALL) ||
+			(SetLineCoding(iPort, 10000000, 8, 0, 0) != SIM_STALL)) {
+			fprintf(stderr, "port %d: impossible line coding not stalled\n", iPort);
+			fOk = false;
+		}
+		memset(abData, 0, sizeof(abData));
+		if ((SimHostRequest(0x80 | (REQTYPE_TYPE_CLASS << 5) | REQTYPE_RECIP_INTERFACE,
+					GET_LINE_CODING, 0, CDC_COMM_IF(iPort), abData, 7) != 7) ||
+			((abData[0] | (abData[1] << 8) | (abData[2] << 16)) != FAST_BAUD) || (abData[6] != 8) ||
+			!UARTFormatIs(iPort, FAST_BAUD, 8, 0, 0)) {
+			fprintf(stderr, "port %d: stalled line coding was applied\n", iPort);
+			fOk = false;
+		}
+	}
+	fprintf(stderr, "line coding on %d ports: %s\n", CDC_NUM_PORTS, fOk ? "ok" : "wrong");
+	return fOk;
+}
+
+
+// sends some data both ways on all ports, returns the number of errors
+static uint32_t Exchange(uint32_t dwChars)
+{
+	TUARTSimStats	Stats;
+	TBridgeStats	BridgeStats;
+	uint32_t		dwErrors;
+	int				iPort;
+
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		aHost[iPort].fWrite = true;
+		UARTSimSend(aiUarts[iPort], dwChars);
+	}
+	// the host sends in whole packets
+	while (aHost[0].dwSent < dwChars) {
+		RunFrame();
+	}
+	Drain();
+
+	dwErrors = 0;
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		UARTSimGetStats(aiUarts[iPort], &Stats);
+		BridgeGetStats(iPort, &BridgeStats);
+		dwErrors += aHost[iPort].dwErrors + Stats.dwErrors + BridgeStats.dwFramingErrors;
+	}
+	return dwErrors;
+}
+
+
+static bool TestMismatch(void)
+{
+	uint32_t	dwErrors;
+	int			iPort;
+	bool		fOk;
+
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		UARTSimSetPeer(aiUarts[iPort], SLOW_BAUD, 8, 2, 0);
+	}
+	dwErrors = Exchange(256);
+	fOk = (dwErrors > 0);
+	fprintf(stderr, "mismatch %u errors before the line coding\n", dwErrors);
+
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		if (SetLineCoding(iPort, SLOW_BAUD, 8, 2, 0) != 7) {
+			fprintf(stderr, "port %d: line coding failed\n", iPort);
+			fOk = false;
+		}
+	}
+	if (Exchange(256) != dwErrors) {
+		fprintf(stderr, "mismatch errors after the line coding\n");
+		fOk = false;
+	}
+	fprintf(stderr, "mismatch %s\n", fOk ? "ok" : "wrong");
+	return fOk;
+}
+
+
+static bool TestStream(uint32_t dwFrameCount)
+{
+	TUARTSimStats	aStart[CDC_NUM_PORTS], Stats;
+	TBridgeStats	BridgeStats;
+	uint32_t		adwHostStart[CDC_NUM_PORTS];
+	uint32_t		adwErrors[CDC_NUM_PORTS];
+	uint32_t		dwLineChars, dwStart, dwToUART, dwFromUART;
+	int				iPort;
+	bool			fOk;
+
+	// 10 bits a char at 8N1
+	dwLineChars = (uint64_t)FAST_BAUD * dwFrameCount / 10000;
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		UARTSimSetPeer(aiUarts[iPort], FAST_BAUD, 8, 0, 0);
+		SetLineCoding(iPort, FAST_BAUD, 8, 0, 0);
+		UARTSimGetStats(aiUarts[iPort], &aStart[iPort]);
+		BridgeGetStats(iPort, &BridgeStats);
+		adwErrors[iPort] = aHost[iPort].dwErrors + aStart[iPort].dwErrors + BridgeStats.dwFramingErrors;
+		adwHostStart[iPort] = aHost[iPort].dwReceived;
+		aHost[iPort].fWrite = true;
+		UARTSimSend(aiUarts[iPort], dwLineChars);
+	}
+	dwStart = dwFrames;
+	while (dwFrames - dwStart < dwFrameCount) {
+		RunFrame();
+	}
+
+	fOk = true;
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		UARTSimGetStats(aiUarts[iPort], &Stats);
+		BridgeGetStats(iPort, &BridgeStats);
+		dwToUART = Stats.dwReceived - aStart[iPort].dwReceived;
+		dwFromUART = aHost[iPort].dwReceived - adwHostStart[iPort];
+		adwErrors[iPort] = aHost[iPort].dwErrors + Stats.dwErrors + BridgeStats.dwFramingErrors +
+						BridgeStats.dwOverruns + BridgeStats.dwRxDropped + Stats.dwOverruns +
+						Stats.dwTxOverflows - adwErrors[iPort];
+		Report("stream", iPort, "to_uart", dwToUART, dwFrameCount, dwLineChars, adwErrors[iPort]);
+		Report("stream", iPort, "from_uart", dwFromUART, dwFrameCount, dwLineChars, adwErrors[iPort]);
+		if (((uint64_t)dwToUART * 100 < (uint64_t)dwLineChars * MIN_LINE_RATE) ||
+			((uint64_t)dwFromUART * 100 < (uint64_t)dwLineChars * MIN_LINE_RATE)) {
+			fprintf(stderr, "port %d: below %d%% of the line rate\n", iPort, MIN_LINE_RATE);
+			fOk = false;
+		}
+		fOk = fOk && (adwErrors[iPort] == 0);
+	}
+	return Drain() && fOk;
+}
+
+
+static void Usage(const char *pszName)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -f <frames> frames to stream (default 2000)\n",
+		pszName);
+}
+
+
+int main(int argc, char *argv[])
+{
+	uint32_t	dwFrameCount = 2000;
+	int			c;
+	bool		fOk;
+
+	while ((c = getopt(argc, argv, "f:h")) != -1) {
+		switch (c) {
+		case 'f':	dwFrameCount = strtoul(optarg, NULL, 0);	break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// set up the device side, like main_bridge.c does
+	USBInit();
+	USBRegisterDescriptors(abDescriptors);
+	CdcRegisterHandlers();
+	CdcInit();
+	CdcRegisterLineCodingHandler(BridgeSetLineCoding);
+	BridgeInit();
+	SimHostReset();
+
+	if (SimHostRequest(0x00, REQ_SET_CONFIGURATION, 1, 0, NULL, 0) != 0) {
+		fprintf(stderr, "SET_CONFIGURATION failed\n");
+		return 1;
+	}
+	fOk = TestLineCoding();
+	fOk = TestMismatch() && fOk;
+	fOk = TestStream(dwFrameCount) && fOk;
+
+	fprintf(stderr, "%s\n", fOk ? "PASS" : "FAIL");
+	return fOk ? 0 : 1;
+}
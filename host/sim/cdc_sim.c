@@ -0,0 +1,561 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Multi-port CDC ACM simulation.
+
+	Runs the CDC function of cdc_acm.c with all its ports on the PC, on
+	top of the simulated USB controller, with the echo loop of
+	main_serial.c as application.
+
+	The host first reads the configuration descriptor and checks the
+	interfaces and endpoints of every port, then sets a different line
+	coding and control line state on each port and reads them back, to
+	check that class requests reach the right port.
+
+	Then it opens all ports at once and streams data through the echo on
+	every port. The bus is modelled as a number of bulk packets per frame,
+	which the host hands out to the ports in turn, like a host controller
+	does. Throughput is given per port and in total, in simulated time.
+
+	The same is repeated with the host no longer reading port 0, so that
+	port 0 backs up all the way into its OUT endpoint. The other ports have
+	to keep their throughput, and no data may be lost on port 0 once the
+	host reads it again.
+
+	Finally, single characters are sent on the other ports while port 0
+	streams, and have to come back within a couple of frames.
+
+	Human readable results go to stderr, a CSV line per port and test to
+	stdout: test,port,bytes,frames,kB/s,errors
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "usbapi.h"
+#include "usbhw_lpc.h"
+
+#include "cdc_acm.h"
+
+#include "usbhw_sim.h"
+
+#define FRAME_PACKETS	19		/**< full-speed bulk packets in one frame */
+#define MAX_LATENCY		3		/**< frames an interactive character may take */
+#define CHAR_INTERVAL	8		/**< frames between interactive characters */
+#define MIN_SHARE		80		/**< % of the fair share each busy port must get */
+
+#define LE_WORD(x)		((x)&0xFF),((x)>>8)
+
+/** Host side of one port */
+typedef struct {
+	bool		fWrite;				/**< host sends data */
+	bool		fRead;				/**< host reads the echo */
+	uint32_t	dwSent;				/**< bytes accepted by the device */
+	uint32_t	dwReceived;			/**< bytes echoed back */
+	uint32_t	dwErrors;			/**< echoed bytes that did not match */
+	uint32_t	dwLimit;			/**< stop sending at this many bytes */
+} THostPort;
+
+static const uint8_t abDescriptors[] = {
+
+// device descriptor
+	0x12,
+	DESC_DEVICE,
+	LE_WORD(0x0200),			// bcdUSB
+	0xEF, 0x02, 0x01,			// bDeviceClass, bDeviceSubClass, bDeviceProtocol
+	MAX_PACKET_SIZE0,			// bMaxPacketSize
+	LE_WORD(0xFFFF),			// idVendor
+	LE_WORD(0x0005),			// idProduct
+	LE_WORD(0x0100),			// bcdDevice
+	0x00,						// iManufacturer
+	0x00,						// iProduct
+	0x00,						// iSerialNumber
+	0x01,						// bNumConfigurations
+
+// configuration descriptor
+	0x09,
+	DESC_CONFIGURATION,
+	LE_WORD(9 + CDC_NUM_PORTS * CDC_PORT_DESC_SIZE),	// wTotalLength
+	2 * CDC_NUM_PORTS,			// bNumInterfaces
+	0x01,						// bConfigurationValue
+	0x00,						// iConfiguration
+	0xC0,						// bmAttributes
+	0x32,						// bMaxPower
+
+	CDC_PORT_DESCRIPTORS(0)
+#if CDC_NUM_PORTS > 1
+	CDC_PORT_DESCRIPTORS(1)
+#endif
+#if CDC_NUM_PORTS > 2
+	CDC_PORT_DESCRIPTORS(2)
+#endif
+#if CDC_NUM_PORTS > 3
+	CDC_PORT_DESCRIPTORS(3)
+#endif
+
+// terminating zero
+	0
+};
+
+static THostPort	aHost[CDC_NUM_PORTS];
+static uint32_t		dwFrames;				/**< simulated time in frames */
+static uint32_t		adwCharSent[CDC_NUM_PORTS];	/**< frame of the last interactive character */
+
+
+// the data on a port, without a period that lines up with the FIFOs
+static uint8_t Data(int iPort, uint32_t dwPos)
+{
+	return (dwPos ^ (dwPos >> 8) ^ (dwPos >> 16) ^ (iPort * 0x5A)) & 0xFF;
+}
+
+
+static int ClassRequest(bool fIn, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+				uint8_t *pbData, int iLen)
+{
+	return SimHostRequest((fIn ? 0x80 : 0) | (REQTYPE_TYPE_CLASS << 5) | REQTYPE_RECIP_INTERFACE,
+				bRequest, wValue, wIndex, pbData, iLen);
+}
+
+
+// the echo loop of main_serial.c, one pass over all ports
+static void EchoPass(void)
+{
+	uint8_t	abBuf[CDC_MAX_PACKET];
+	int		iPort, iLen;
+
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		iLen = CdcTxFree(iPort);
+		if (iLen > CDC_MAX_PACKET) {
+			iLen = CDC_MAX_PACKET;
+		}
+		iLen = CdcRead(iPort, abBuf, iLen);
+		CdcWrite(iPort, abBuf, iLen);
+	}
+}
+
+
+static bool TestDescriptors(void)
+{
+	uint8_t	abConf[512];
+	uint8_t	*pb;
+	int		iLen, iPort, iIntf, iEPs, iIADs;
+	bool	fOk;
+
+	iLen = SimHostRequest(0x80, REQ_GET_DESCRIPTOR, DESC_CONFIGURATION << 8, 0, abConf, sizeof(abConf));
+	if (iLen != 9 + CDC_NUM_PORTS * CDC_PORT_DESC_SIZE) {
+		fprintf(stderr, "configuration descriptor is %d bytes instead of %d\n",
+				iLen, 9 + CDC_NUM_PORTS * CDC_PORT_DESC_SIZE);
+		return false;
+	}
+	fOk = (abConf[4] == 2 * CDC_NUM_PORTS);
+	iIntf = -1;
+	iEPs = 0;
+	iIADs = 0;
+	for (pb = abConf; pb < abConf + iLen; pb += pb[0]) {
+		switch (pb[1]) {
+		case DESC_INTERFACE_ASSOCIATION:
+			fOk = fOk && (pb[2] == CDC_COMM_IF(iIADs)) && (pb[3] == 2);
+			iIADs++;
+			break;
+		case DESC_INTERFACE:
+			iIntf = pb[2];
+			break;
+		case CS_INTERFACE:
+			// union functional descriptor
+			if (pb[2] == 0x06) {
+				fOk = fOk && (pb[3] == iIntf) && (pb[4] == iIntf + 1);
+			}
+			break;
+		case DESC_ENDPOINT:
+			iPort = iIntf / 2;
+			if ((iIntf & 1) == 0) {
+				fOk = fOk && (pb[2] == CDC_INT_IN_EP(iPort));
+			}
+			else {
+				fOk = fOk && ((pb[2] == CDC_BULK_IN_EP(iPort)) || (pb[2] == CDC_BULK_OUT_EP(iPort)));
+			}
+			iEPs++;
+			break;
+		}
+		if (pb[0] == 0) {
+			break;
+		}
+	}
+	fOk = fOk && (iIntf == 2 * CDC_NUM_PORTS - 1) && (iEPs == 3 * CDC_NUM_PORTS) &&
+		(iIADs == ((CDC_NUM_PORTS > 1) ? CDC_NUM_PORTS : 0));
+	fprintf(stderr, "descriptors %d ports, %d interfaces, %d endpoints: %s\n",
+			CDC_NUM_PORTS, iIntf + 1, iEPs, fOk ? "ok" : "wrong");
+	return fOk;
+}
+
+
+static bool TestRequests(void)
+{
+	TLineCoding			LineCoding;
+	const TLineCoding	*pLineCoding;
+	uint8_t				abData[7];
+	int					iPort;
+	bool				fOk;
+
+	fOk = true;
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		LineCoding.dwDTERate = 9600 * (iPort + 1);
+		abData[0] = LineCoding.dwDTERate;
+		abData[1] = LineCoding.dwDTERate >> 8;
+		abData[2] = LineCoding.dwDTERate >> 16;
+		abData[3] = LineCoding.dwDTERate >> 24;
+		abData[4] = iPort % 3;		// stop bits
+		abData[5] = iPort % 5;		// parity
+		abData[6] = 8 - iPort;		// data bits
+		if ((ClassRequest(false, SET_LINE_CODING, 0, CDC_COMM_IF(iPort), abData, 7) != 7) ||
+			(ClassRequest(false, SET_CONTROL_LINE_STATE, iPort & 3, CDC_COMM_IF(iPort), NULL, 0) != 0)) {
+			fprintf(stderr, "port %d: class request failed\n", iPort);
+			return false;
+		}
+	}
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		memset(abData, 0, sizeof(abData));
+		if (ClassRequest(true, GET_LINE_CODING, 0, CDC_COMM_IF(iPort), abData, 7) != 7) {
+			fprintf(stderr, "port %d: GET_LINE_CODING failed\n", iPort);
+			return false;
+		}
+		pLineCoding = CdcGetLineCoding(iPort);
+		if ((abData[0] | (abData[1] << 8) | (abData[2] << 16)) != 9600 * (iPort + 1) ||
+			(abData[4] != iPort % 3) || (abData[5] != iPort % 5) || (abData[6] != 8 - iPort) ||
+			(pLineCoding->dwDTERate != 9600 * (uint32_t)(iPort + 1)) ||
+			(pLineCoding->bDataBits != 8 - iPort) ||
+			(CdcGetLineState(iPort) != (iPort & 3))) {
+			fprintf(stderr, "port %d: line coding or state went to the wrong port\n", iPort);
+			fOk = false;
+		}
+	}
+	// no port behind this interface
+	if (ClassRequest(true, GET_LINE_CODING, 0, CDC_COMM_IF(CDC_NUM_PORTS), abData, 7) != SIM_STALL) {
+		fprintf(stderr, "request for a missing port not stalled\n");
+		fOk = false;
+	}
+	fprintf(stderr, "class requests routed to %d ports: %s\n", CDC_NUM_PORTS, fOk ? "ok" : "wrong");
+	return fOk;
+}
+
+
+// one OUT transaction on a port, returns true if the bus was used
+static bool HostOut(int iPort)
+{
+	THostPort	*pHost = &aHost[iPort];
+	uint8_t		abData[CDC_MAX_PACKET];
+	int			i, iLen;
+
+	iLen = CDC_MAX_PACKET;
+	if (pHost->dwLimit - pHost->dwSent < (uint32_t)iLen) {
+		iLen = pHost->dwLimit - pHost->dwSent;
+	}
+	if (!pHost->fWrite || (iLen == 0)) {
+		return false;
+	}
+	for (i = 0; i < iLen; i++) {
+		abData[i] = Data(iPort, pHost->dwSent + i);
+	}
+	if (SimHostOut(CDC_BULK_OUT_EP(iPort), abData, iLen) < 0) {
+		return false;
+	}
+	pHost->dwSent += iLen;
+	return true;
+}
+
+
+// one IN transaction on a port, returns true if the bus was used
+static bool HostIn(int iPort)
+{
+	THostPort	*pHost = &aHost[iPort];
+	uint8_t		abData[CDC_MAX_PACKET];
+	int			i, iLen;
+
+	if (!pHost->fRead) {
+		return false;
+	}
+	iLen = SimHostIn(CDC_BULK_IN_EP(iPort), abData, sizeof(abData));
+	if (iLen < 0) {
+		return false;
+	}
+	for (i = 0; i < iLen; i++) {
+		if (abData[i] != Data(iPort, pHost->dwReceived + i)) {
+			pHost->dwErrors++;
+		}
+	}
+	if ((iLen > 0) && (adwCharSent[iPort] != 0)) {
+		// an interactive character came back
+		if (dwFrames - adwCharSent[iPort] > MAX_LATENCY) {
+			fprintf(stderr, "port %d: character took %u frames\n", iPort, dwFrames - adwCharSent[iPort]);
+			pHost->dwErrors++;
+		}
+		adwCharSent[iPort] = 0;
+	}
+	pHost->dwReceived += iLen;
+	return true;
+}
+
+
+/*
+	Runs the bus for one frame: FRAME_PACKETS transactions go to the ports
+	in turn, both directions, skipping those that are NAKed. The device
+	runs an echo pass after every transaction.
+ */
+static void RunFrame(void)
+{
+	static int	iNext;
+	int			iPackets, iIdle;
+	bool		fBusy;
+
+	iPackets = 0;
+	iIdle = 0;
+	while ((iPackets < FRAME_PACKETS) && (iIdle < 2 * CDC_NUM_PORTS)) {
+		if ((iNext & 1) == 0) {
+			fBusy = HostOut(iNext / 2);
+		}
+		else {
+			fBusy = HostIn(iNext / 2);
+		}
+		iNext = (iNext + 1) % (2 * CDC_NUM_PORTS);
+		if (fBusy) {
+			iPackets++;
+			iIdle = 0;
+		}
+		else {
+			iIdle++;
+		}
+		EchoPass();
+	}
+	SimHostFrame();
+	dwFrames++;
+}
+
+
+static void HostInit(uint32_t dwLimit)
+{
+	int	iPort;
+
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		memset(&aHost[iPort], 0, sizeof(aHost[iPort]));
+		aHost[iPort].fWrite = true;
+		aHost[iPort].fRead = true;
+		aHost[iPort].dwLimit = dwLimit;
+		adwCharSent[iPort] = 0;
+	}
+}
+
+
+// runs until all ports are back to idle, returns false if one gets stuck
+static bool Drain(void)
+{
+	int	iPort, iFrames;
+
+	for (iFrames = 0; iFrames < 1000; iFrames++) {
+		for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+			if (aHost[iPort].dwReceived != aHost[iPort].dwSent) {
+				break;
+			}
+		}
+		if (iPort == CDC_NUM_PORTS) {
+			return true;
+		}
+		RunFrame();
+	}
+	fprintf(stderr, "port %d: %u bytes did not come back\n",
+			iPort, aHost[iPort].dwSent - aHost[iPort].dwReceived);
+	return false;
+}
+
+
+static void Report(const char *pszTest, int iPort, uint32_t dwBytes, uint32_t dwFrameCount, uint32_t dwErrors)
+{
+	uint32_t	dwRate;
+
+	dwRate = (dwFrameCount > 0) ? (uint32_t)((uint64_t)dwBytes * 1000 / 1024 / dwFrameCount) : 0;
+	if (iPort < 0) {
+		fprintf(stderr, "%-8s all     %u bytes in %u frames, %u kB/s, %u errors\n",
+				pszTest, dwBytes, dwFrameCount, dwRate, dwErrors);
+		printf("%s,all,%u,%u,%u,%u\n", pszTest, dwBytes, dwFrameCount, dwRate, dwErrors);
+	}
+	else {
+		fprintf(stderr, "%-8s port %d  %u bytes in %u frames, %u kB/s, %u errors\n",
+				pszTest, iPort, dwBytes, dwFrameCount, dwRate, dwErrors);
+		printf("%s,%d,%u,%u,%u,%u\n", pszTest, iPort, dwBytes, dwFrameCount, dwRate, dwErrors);
+	}
+}
+
+
+/*
+	Streams data through all ports for a number of frames, with the host
+	reading port 0 or not. Checks that every port that is read gets at
+	least MIN_SHARE % of a fair share of what got through.
+ */
+static bool TestStream(const char *pszTest, uint32_t dwFrameCount, bool fReadPort0)
+{
+	uint32_t	adwStart[CDC_NUM_PORTS];
+	uint32_t	dwStart, dwTotal, dwErrors, dwMin;
+	int			iPort, iBusy;
+	bool		fOk;
+
+	HostInit(0xFFFFFFFF);
+	aHost[0].fRead = fReadPort0;
+	// let the FIFOs fill up first
+	for (dwStart = 0; dwStart < 50; dwStart++) {
+		RunFrame();
+	}
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		adwStart[iPort] = aHost[iPort].dwReceived;
+	}
+	dwStart = dwFrames;
+	while (dwFrames - dwStart < dwFrameCount) {
+		RunFrame();
+	}
+
+	dwTotal = 0;
+	dwErrors = 0;
+	dwMin = 0xFFFFFFFF;
+	iBusy = 0;
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		adwStart[iPort] = aHost[iPort].dwReceived - adwStart[iPort];
+		Report(pszTest, iPort, adwStart[iPort], dwFrameCount, aHost[iPort].dwErrors);
+		dwTotal += adwStart[iPort];
+		dwErrors += aHost[iPort].dwErrors;
+		if (aHost[iPort].fRead) {
+			iBusy++;
+			if (adwStart[iPort] < dwMin) {
+				dwMin = adwStart[iPort];
+			}
+		}
+	}
+	Report(pszTest, -1, dwTotal, dwFrameCount, dwErrors);
+
+	fOk = (dwErrors == 0);
+	if ((uint64_t)dwMin * iBusy * 100 < (uint64_t)dwTotal * MIN_SHARE) {
+		fprintf(stderr, "%s: a port got only %u of %u bytes\n", pszTest, dwMin, dwTotal);
+		fOk = false;
+	}
+	if (!fReadPort0 && (aHost[0].dwReceived != 0)) {
+		fprintf(stderr, "%s: port 0 was not read but sent %u bytes\n", pszTest, aHost[0].dwReceived);
+		fOk = false;
+	}
+
+	// read everything that is left, nothing may have been lost
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		aHost[iPort].fWrite = false;
+		aHost[iPort].fRead = true;
+	}
+	return Drain() && fOk && (aHost[0].dwErrors == 0);
+}
+
+
+/*
+	Sends a character on each of the other ports every few frames while
+	port 0 streams, each has to come back within MAX_LATENCY frames.
+ */
+static bool TestLatency(uint32_t dwFrameCount)
+{
+	uint32_t	dwStart, dwChars, dwErrors;
+	int			iPort;
+
+	HostInit(0);
+	aHost[0].dwLimit = 0xFFFFFFFF;
+	dwStart = dwFrames;
+	dwChars = 0;
+	while (dwFrames - dwStart < dwFrameCount) {
+		for (iPort = 1; iPort < CDC_NUM_PORTS; iPort++) {
+			if (((dwFrames + iPort) % CHAR_INTERVAL) == 0) {
+				if (adwCharSent[iPort] != 0) {
+					fprintf(stderr, "port %d: character lost\n", iPort);
+					aHost[iPort].dwErrors++;
+				}
+				aHost[iPort].dwLimit++;
+				adwCharSent[iPort] = dwFrames;
+				dwChars++;
+			}
+		}
+		RunFrame();
+	}
+	aHost[0].fWrite = false;
+	dwErrors = 0;
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		dwErrors += aHost[iPort].dwErrors;
+	}
+	fprintf(stderr, "latency  %u characters next to %u bytes on port 0, %u errors\n",
+			dwChars, aHost[0].dwReceived, dwErrors);
+	return Drain() && (dwErrors == 0);
+}
+
+
+static void Usage(const char *pszName)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -f <frames> frames per test (default 2000)\n",
+		pszName);
+}
+
+
+int main(int argc, char *argv[])
+{
+	uint32_t	dwFrameCount = 2000;
+	int			c;
+	bool		fOk;
+
+	while ((c = getopt(argc, argv, "f:h")) != -1) {
+		switch (c) {
+		case 'f':	dwFrameCount = strtoul(optarg, NULL, 0);	break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// set up the device side, like main_serial.c does
+	USBInit();
+	USBRegisterDescriptors(abDescriptors);
+	CdcRegisterHandlers();
+	CdcInit();
+	SimHostReset();
+
+	fOk = TestDescriptors();
+	if (SimHostRequest(0x00, REQ_SET_CONFIGURATION, 1, 0, NULL, 0) != 0) {
+		fprintf(stderr, "SET_CONFIGURATION failed\n");
+		return 1;
+	}
+	fOk = TestRequests() && fOk;
+	fOk = TestStream("stream", dwFrameCount, true) && fOk;
+	fOk = TestStream("blocked", dwFrameCount, false) && fOk;
+	fOk = TestLatency(dwFrameCount) && fOk;
+
+	fprintf(stderr, "%s\n", fOk ? "PASS" : "FAIL");
+	return fOk ? 0 : 1;
+}
@@ -0,0 +1,309 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Console benchmark.
+
+	Runs console.c and printf.c on the PC, on a simulated UART, under a
+	USB stack built with DEBUG on, so control requests that fail print on
+	the console from the USB interrupt, like on the target.
+
+	First, formatted output has to arrive on the UART intact. Then output
+	is printed without giving the UART any time, which may not block, and
+	has to be dropped and counted beyond what the buffer holds, with what
+	was kept arriving intact.
+
+	Finally the requests of an enumeration are run over and over, with the
+	main loop sending console output in between. Each request is timed on
+	the PC, with its logging. For comparison, the old console waited for
+	the transmitter to be empty before every character, which costs a
+	character time on the line for every character printed.
+
+	Human readable results go to stderr, a CSV line to stdout:
+	requests,chars,polled (us/request),buffered (us/request),longest (us),dropped
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "usbapi.h"
+#include "usbhw_lpc.h"
+
+#include "console.h"
+#include "uart.h"
+
+#include "usbhw_sim.h"
+#include "uart_sim.h"
+
+#define BAUD_RATE		115200
+#define CHAR_NS			(10 * 1000000000ULL / BAUD_RATE)	/**< 8N1 */
+#define MAX_BUFFERED_US	50			/**< allowed mean time of a request */
+
+#define LE_WORD(x)		((x)&0xFF),((x)>>8)
+
+static const uint8_t abDescriptors[] = {
+
+// device descriptor
+	0x12,
+	DESC_DEVICE,
+	LE_WORD(0x0110),			// bcdUSB
+	0xFF,						// bDeviceClass
+	0x00,						// bDeviceSubClass
+	0x00,						// bDeviceProtocol
+	MAX_PACKET_SIZE0,			// bMaxPacketSize
+	LE_WORD(0xFFFF),			// idVendor
+	LE_WORD(0x0006),			// idProduct
+	LE_WORD(0x0100),			// bcdDevice
+	0x00,						// iManufacturer
+	0x00,						// iProduct
+	0x00,						// iSerialNumber
+	0x01,						// bNumConfigurations
+
+// configuration descriptor
+	0x09,
+	DESC_CONFIGURATION,
+	LE_WORD(18),				// wTotalLength
+	0x01,						// bNumInterfaces
+	0x01,						// bConfigurationValue
+	0x00,						// iConfiguration
+	0x80,						// bmAttributes
+	0x32,						// bMaxPower
+
+// interface
+	0x09,
+	DESC_INTERFACE,
+	0x00,						// bInterfaceNumber
+	0x00,						// bAlternateSetting
+	0x00,						// bNumEndPoints
+	0xFF,						// bInterfaceClass
+	0x00,						// bInterfaceSubClass
+	0x00,						// bInterfaceProtocol
+	0x00,						// iInterface
+
+// terminating zero
+	0
+};
+
+static uint8_t	abCapture[16384];
+
+
+// the main loop for a while, sending console output
+static void RunMainLoop(uint32_t dwUs)
+{
+	uint32_t	i;
+
+	for (i = 0; i < dwUs / 100; i++) {
+		ConsolePoll();
+		UARTSimRun(100000);
+	}
+}
+
+
+// runs the main loop until all console output has arrived
+static uint32_t Drain(void)
+{
+	TUARTSimStats	Stats;
+	uint32_t		dwLast;
+
+	do {
+		UARTSimGetStats(0, &Stats);
+		dwLast = Stats.dwReceived;
+		RunMainLoop(10 * UART_HW_FIFO * CHAR_NS / 1000);
+		UARTSimGetStats(0, &Stats);
+	} while (Stats.dwReceived != dwLast);
+	return Stats.dwReceived;
+}
+
+
+// what the console should send for a text, with CR LF line ends
+static int Expect(char *pcOut, const char *pszText)
+{
+	int	iLen;
+
+	for (iLen = 0; *pszText; pszText++) {
+		if (*pszText == '\n') {
+			pcOut[iLen++] = '\r';
+		}
+		pcOut[iLen++] = *pszText;
+	}
+	return iLen;
+}
+
+
+static bool TestOutput(void)
+{
+	static char	acText[1024], acExpected[1024];
+	uint32_t	dwLen;
+	int			i, iPos, iExpected;
+
+	Drain();
+	UARTSimCapture(0, abCapture, sizeof(abCapture));
+	iPos = 0;
+	for (i = 0; i < 20; i++) {
+		printf("line %d: %s %x%c", i, "text", i * 0x1234, (i & 1) ? '\n' : ' ');
+		iPos += snprintf(acText + iPos, sizeof(acText) - iPos,
+					"line %d: %s %x%c", i, "text", i * 0x1234, (i & 1) ? '\n' : ' ');
+	}
+	iExpected = Expect(acExpected, acText);
+	dwLen = Drain();
+	if ((dwLen != (uint32_t)iExpected) || (memcmp(abCapture, acExpected, iExpected) != 0)) {
+		fprintf(stderr, "output: %u chars sent, %d expected\n", dwLen, iExpected);
+		return false;
+	}
+	fprintf(stderr, "output   %u chars intact\n", dwLen);
+	return true;
+}
+
+
+static bool TestDrops(void)
+{
+	static char	acExpected[4096];
+	uint32_t	dwDropped, dwLen;
+	uint64_t	qwStart, qwTime;
+	int			i;
+
+	Drain();
+	UARTSimCapture(0, abCapture, sizeof(abCapture));
+	dwDropped = ConsoleGetDropped();
+
+	// the UART gets no time at all
+	qwStart = SimTimeNs();
+	for (i = 0; i < 400; i++) {
+		printf("%08x ", i);
+		sprintf(acExpected + 9 * i, "%08x ", i);
+	}
+	qwTime = SimTimeNs() - qwStart;
+	dwDropped = ConsoleGetDropped() - dwDropped;
+	dwLen = Drain();
+
+	fprintf(stderr, "drops    %d chars in %llu us, %u sent, %u dropped\n",
+			9 * 400, (unsigned long long)qwTime / 1000, dwLen, dwDropped);
+	// the buffer, and what went into the transmit FIFO before it filled up
+	if ((dwLen <= CONSOLE_BUF_SIZE) || (dwLen > CONSOLE_BUF_SIZE + UART_HW_FIFO) ||
+		(dwLen + dwDropped != 9 * 400) ||
+		(memcmp(abCapture, acExpected, dwLen) != 0)) {
+		fprintf(stderr, "drops: wrong output or count\n");
+		return false;
+	}
+	return true;
+}
+
+
+static bool TestControl(int iCount)
+{
+	uint8_t		abData[64];
+	uint64_t	qwStart, qwTime, qwTotal, qwMax;
+	uint32_t	dwChars, dwDropped, dwPolledUs, dwBufferedUs;
+	int			i, iReq, iRequests;
+
+	Drain();
+	UARTSimCapture(0, abCapture, sizeof(abCapture));
+	dwDropped = ConsoleGetDropped();
+	qwTotal = 0;
+	qwMax = 0;
+	iRequests = 0;
+
+	for (i = 0; i < iCount; i++) {
+		// a short enumeration, with a string descriptor that does not exist
+		for (iReq = 0; iReq < 6; iReq++) {
+			qwStart = SimTimeNs();
+			switch (iReq) {
+			case 0:	SimHostRequest(0x80, REQ_GET_DESCRIPTOR, DESC_DEVICE << 8, 0, abData, 8);	break;
+			case 1:	SimHostRequest(0x00, REQ_SET_ADDRESS, 1 + (i % 100), 0, NULL, 0);	break;
+			case 2:	SimHostRequest(0x80, REQ_GET_DESCRIPTOR, DESC_DEVICE << 8, 0, abData, 18);	break;
+			case 3:	SimHostRequest(0x80, REQ_GET_DESCRIPTOR, DESC_CONFIGURATION << 8, 0, abData, sizeof(abData));	break;
+			case 4:	SimHostRequest(0x80, REQ_GET_DESCRIPTOR, (DESC_STRING << 8) | 5, 0x0409, abData, sizeof(abData));	break;
+			case 5:	SimHostRequest(0x00, REQ_SET_CONFIGURATION, 1, 0, NULL, 0);	break;
+			}
+			qwTime = SimTimeNs() - qwStart;
+			iRequests++;
+			qwTotal += qwTime;
+			if (qwTime > qwMax) {
+				qwMax = qwTime;
+			}
+			// the host leaves 10 ms after SET_ADDRESS, and a frame after the others
+			RunMainLoop((iReq == 1) ? 10000 : 1000);
+		}
+	}
+	dwChars = Drain();
+	dwDropped = ConsoleGetDropped() - dwDropped;
+
+	dwPolledUs = (uint32_t)(dwChars * CHAR_NS / 1000 / iRequests);
+	dwBufferedUs = (uint32_t)(qwTotal / 1000 / iRequests);
+	fprintf(stderr, "control  %d requests, %u chars logged\n", iRequests, dwChars);
+	fprintf(stderr, "control  polled console   %u us per request on the line\n", dwPolledUs);
+	fprintf(stderr, "control  buffered console %u.%03u us per request, longest %llu.%03llu us, %u dropped\n",
+			dwBufferedUs, (uint32_t)((qwTotal / iRequests) % 1000),
+			(unsigned long long)qwMax / 1000, (unsigned long long)qwMax % 1000, dwDropped);
+	fprintf(stdout, "%d,%u,%u,%u,%llu,%u\n", iRequests, dwChars, dwPolledUs, dwBufferedUs,
+			(unsigned long long)qwMax / 1000, dwDropped);
+	return (dwChars > 0) && (dwDropped == 0) && (dwBufferedUs < MAX_BUFFERED_US);
+}
+
+
+static void Usage(const char *pszName)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -n <count> enumerations to run (default 2000)\n",
+		pszName);
+}
+
+
+int main(int argc, char *argv[])
+{
+	int		iCount = 2000;
+	int		c;
+	bool	fOk;
+
+	while ((c = getopt(argc, argv, "n:h")) != -1) {
+		switch (c) {
+		case 'n':	iCount = strtoul(optarg, NULL, 0);	break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	ConsoleInit(BAUD_RATE);
+	UARTSimSetPeer(0, BAUD_RATE, 8, 0, 0);
+
+	USBInit();
+	USBRegisterDescriptors(abDescriptors);
+	SimHostReset();
+
+	fOk = TestOutput();
+	fOk = TestDrops() && fOk;
+	fOk = TestControl(iCount) && fOk;
+
+	fprintf(stderr, "%s\n", fOk ? "PASS" : "FAIL");
+	return fOk ? 0 : 1;
+}
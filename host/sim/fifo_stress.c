@@ -0,0 +1,241 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	FIFO stress test.
+
+	Runs the producer and the consumer of serial_fifo.c in two threads, as
+	fast as they go, the way the USB interrupt and the main loop of the
+	serial example share their FIFOs. The producer writes a byte sequence
+	with randomly chosen calls: fifo_put, fifo_write and fifo_reserve with
+	fifo_commit, within the span or running into the slack after the
+	buffer, each of random length. The consumer reads it back with
+	fifo_get, fifo_read and fifo_peek with fifo_consume, and checks every
+	byte, and that nothing was written past the slack. With
+	missing barriers or a wrong index calculation, bytes get lost,
+	duplicated or read before they were written, which shows up as a
+	sequence error sooner or later, more likely on a multi-core machine.
+	A thread that finds the FIFO full or empty yields, so the test makes
+	progress on a single core too, and both yield at random now and then,
+	so the other one finds the FIFO at all fill levels.
+
+	Human readable results go to stderr, a CSV line to stdout:
+	bytes,time (us),MB/s,errors
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "serial_fifo.h"
+
+#define MAX_CHUNK		(VCOM_FIFO_SIZE + 16)	/**< a bit more than fits */
+#define YIELD_RATE		16						/**< yield once in so many calls */
+
+/** FIFO buffer, with a guard area to catch writes past its end */
+static struct {
+	uint8_t		abBuf[VCOM_FIFO_SIZE];
+	uint8_t		abSlack[VCOM_FIFO_SLACK];
+	uint8_t		abGuard[MAX_CHUNK];
+} FifoMem;
+
+static fifo_t		Fifo;
+static uint64_t		qwTotal = 100000000;
+static uint64_t		qwErrors;
+
+
+static uint64_t TimeUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+// a small and fast random number generator, one per thread
+static uint32_t Random(uint32_t *pdwState)
+{
+	uint32_t x = *pdwState;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*pdwState = x;
+	return x;
+}
+
+
+// the byte at a stream position, with a period much longer than the FIFO
+static uint8_t Data(uint64_t qwPos)
+{
+	return qwPos ^ (qwPos >> 8) ^ (qwPos >> 16);
+}
+
+
+static void *Producer(void *pArg)
+{
+	uint8_t		abChunk[MAX_CHUNK];
+	uint8_t		*pbSpan;
+	uint64_t	qwPos;
+	uint32_t	dwRandom = 0x12345678;
+	int			i, iLen, iSpan;
+
+	qwPos = 0;
+	while (qwPos < qwTotal) {
+		if ((fifo_free(&Fifo) == 0) || ((Random(&dwRandom) % YIELD_RATE) == 0)) {
+			sched_yield();
+		}
+		iLen = Random(&dwRandom) % MAX_CHUNK + 1;
+		if ((uint64_t)iLen > (qwTotal - qwPos)) {
+			iLen = qwTotal - qwPos;
+		}
+		switch (Random(&dwRandom) % 4) {
+		case 0:
+			if (fifo_put(&Fifo, Data(qwPos))) {
+				qwPos++;
+			}
+			break;
+		case 1:
+			for (i = 0; i < iLen; i++) {
+				abChunk[i] = Data(qwPos + i);
+			}
+			qwPos += fifo_write(&Fifo, abChunk, iLen);
+			break;
+		case 2:
+			iLen = (fifo_reserve(&Fifo, &pbSpan) < iLen) ? fifo_reserve(&Fifo, &pbSpan) : iLen;
+			for (i = 0; i < iLen; i++) {
+				pbSpan[i] = Data(qwPos + i);
+			}
+			fifo_commit(&Fifo, iLen);
+			qwPos += iLen;
+			break;
+		default:
+			// like a USB packet, running into the slack
+			iSpan = fifo_reserve(&Fifo, &pbSpan) + VCOM_FIFO_SLACK;
+			iLen = (fifo_free(&Fifo) < iLen) ? fifo_free(&Fifo) : iLen;
+			iLen = (iSpan < iLen) ? iSpan : iLen;
+			for (i = 0; i < iLen; i++) {
+				pbSpan[i] = Data(qwPos + i);
+			}
+			fifo_commit(&Fifo, iLen);
+			qwPos += iLen;
+			break;
+		}
+	}
+	return pArg;
+}
+
+
+static void *Consumer(void *pArg)
+{
+	uint8_t		abChunk[MAX_CHUNK];
+	uint8_t		*pbSpan;
+	uint8_t		c;
+	uint64_t	qwPos;
+	uint32_t	dwRandom = 0x87654321;
+	int			i, iLen;
+
+	qwPos = 0;
+	while (qwPos < qwTotal) {
+		if ((fifo_avail(&Fifo) == 0) || ((Random(&dwRandom) % YIELD_RATE) == 0)) {
+			sched_yield();
+		}
+		iLen = Random(&dwRandom) % MAX_CHUNK + 1;
+		switch (Random(&dwRandom) % 3) {
+		case 0:
+			if (fifo_get(&Fifo, &c)) {
+				qwErrors += (c != Data(qwPos));
+				qwPos++;
+			}
+			break;
+		case 1:
+			iLen = fifo_read(&Fifo, abChunk, iLen);
+			for (i = 0; i < iLen; i++) {
+				qwErrors += (abChunk[i] != Data(qwPos + i));
+			}
+			qwPos += iLen;
+			break;
+		default:
+			iLen = (fifo_peek(&Fifo, &pbSpan) < iLen) ? fifo_peek(&Fifo, &pbSpan) : iLen;
+			for (i = 0; i < iLen; i++) {
+				qwErrors += (pbSpan[i] != Data(qwPos + i));
+			}
+			fifo_consume(&Fifo, iLen);
+			qwPos += iLen;
+			break;
+		}
+		if ((fifo_avail(&Fifo) < 0) || (fifo_avail(&Fifo) > VCOM_FIFO_SIZE)) {
+			qwErrors++;
+		}
+	}
+	return pArg;
+}
+
+
+int main(int argc, char *argv[])
+{
+	pthread_t	Thread;
+	uint64_t	qwTime;
+	int			c;
+
+	while ((c = getopt(argc, argv, "n:h")) != -1) {
+		switch (c) {
+		case 'n':	qwTotal = strtoull(optarg, NULL, 0) * 1000000;	break;
+		default:
+			fprintf(stderr, "Usage: %s [-n <MB>]  (default 100)\n", argv[0]);
+			return 1;
+		}
+	}
+
+	memset(FifoMem.abGuard, 0xA5, sizeof(FifoMem.abGuard));
+	fifo_init(&Fifo, FifoMem.abBuf);
+	qwTime = TimeUs();
+	if (pthread_create(&Thread, NULL, Producer, NULL) != 0) {
+		perror("pthread_create");
+		return 1;
+	}
+	Consumer(NULL);
+	pthread_join(Thread, NULL);
+	qwTime = TimeUs() - qwTime;
+	for (c = 0; c < (int)sizeof(FifoMem.abGuard); c++) {
+		qwErrors += (FifoMem.abGuard[c] != 0xA5);
+	}
+
+	fprintf(stderr, "%llu bytes in %llu us, %.1f MB/s, %llu errors\n", (unsigned long long)qwTotal,
+			(unsigned long long)qwTime, (double)qwTotal / qwTime, (unsigned long long)qwErrors);
+	fprintf(stderr, "%s\n", (qwErrors == 0) ? "PASS" : "FAIL");
+	printf("%llu,%llu,%.1f,%llu\n", (unsigned long long)qwTotal, (unsigned long long)qwTime,
+			(double)qwTotal / qwTime, (unsigned long long)qwErrors);
+	return (qwErrors == 0) ? 0 : 1;
+}
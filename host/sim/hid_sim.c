@@ -0,0 +1,801 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	HID function simulation.
+
+	Runs the HID function of hid.c on the PC, on top of the simulated USB
+	controller, with two input reports: a state report that is coalesced
+	and a counter report whose reports all have to arrive. Each counter
+	report carries the frame it was queued in, so the host sees how long
+	it waited.
+
+	First, the counter report is queued once per frame, and the host has
+	to collect all of them at one per frame, with the same latency every
+	time. Then the host stops polling for a while, and the queue has to
+	refuse new reports, drop the oldest ones or coalesce them, as its
+	policy says, and reports that waited too long have to be dropped.
+	Both reports together have to fill every frame. Finally the idle rate
+	has to repeat the last report, and a bus reset has to empty the queue.
+
+	The other way, the host sends an output report on the interrupt OUT
+	endpoint every frame, which all have to reach their handler in order,
+	also when the application does not handle them for a while and the
+	host gets NAKs. Output reports with SET_REPORT go the same way, and
+	feature reports have to be read back as written.
+
+	Human readable results go to stderr, a CSV line per test to stdout:
+	test,frames,reports,reports/s,max latency (frames),refused,dropped,coalesced,stale
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "usbapi.h"
+
+#include "hid.h"
+
+#include "usbhw_sim.h"
+
+#define REPORT_ID_STATE		1
+#define REPORT_ID_COUNTER	2
+#define REPORT_ID_OUTPUT	3
+#define REPORT_ID_FEATURE	4
+#define REPORT_SIZE			4
+
+#define PAUSE_FRAMES		40		/**< host does not poll for this long */
+#define MAX_AGE				5		/**< frames, for the stale test */
+#define IDLE_RATE			2		/**< units of 4 ms, for the idle test */
+#define MAX_FRAMES			30000	/**< longest test, the host keeps all counter reports */
+
+#define LE_WORD(x)		((x)&0xFF),((x)>>8)
+
+static const uint8_t abReportDesc[] = {
+	0x06, 0x00, 0xFF,		// usage page (vendor defined)
+	0x09, 0x01,				// usage
+	0xA1, 0x01,				// collection (application)
+	0x15, 0x00,				// logical minimum (0)
+	0x26, 0xFF, 0x00,		// logical maximum (255)
+	0x75, 0x08,				// report size (8)
+	0x95, REPORT_SIZE,		// report count
+	0x85, REPORT_ID_STATE,
+	0x09, 0x02,				// usage
+	0x81, 0x02,				// input (data, var, abs)
+	0x85, REPORT_ID_COUNTER,
+	0x09, 0x03,				// usage
+	0x81, 0x02,				// input (data, var, abs)
+	0x85, REPORT_ID_OUTPUT,
+	0x09, 0x04,				// usage
+	0x91, 0x02,				// output (data, var, abs)
+	0x85, REPORT_ID_FEATURE,
+	0x09, 0x05,				// usage
+	0xB1, 0x02,				// feature (data, var, abs)
+	0xC0
+};
+
+static const uint8_t abDescriptors[] = {
+
+// device descriptor
+	0x12,
+	DESC_DEVICE,
+	LE_WORD(0x0110),			// bcdUSB
+	0x00,						// bDeviceClass
+	0x00,						// bDeviceSubClass
+	0x00,						// bDeviceProtocol
+	MAX_PACKET_SIZE0,			// bMaxPacketSize
+	LE_WORD(0xFFFF),			// idVendor
+	LE_WORD(0x0001),			// idProduct
+	LE_WORD(0x0100),			// bcdDevice
+	0x00,						// iManufacturer
+	0x00,						// iProduct
+	0x00,						// iSerialNumber
+	0x01,						// bNumConfigurations
+
+// configuration descriptor
+	0x09,
+	DESC_CONFIGURATION,
+	LE_WORD(9 + HID_DESC_SIZE),	// wTotalLength
+	0x01,						// bNumInterfaces
+	0x01,						// bConfigurationValue
+	0x00,						// iConfiguration
+	0x80,						// bmAttributes
+	0x32,						// bMaxPower
+
+	HID_DESCRIPTORS(sizeof(abReportDesc))
+
+// terminating zero
+	0
+};
+
+/** What the host received in a test */
+typedef struct {
+	int			iFrames;
+	int			iReports;
+	int			aiPerID[REPORT_ID_COUNTER + 1];
+	int			iMaxLatency;		/**< frames, of the counter reports */
+	int			iMinLatency;
+	int			iMaxLatencyQueued;	/**< of the counter reports after the first */
+	int			aiSeq[MAX_FRAMES];	/**< sequence numbers of the counter reports */
+	uint32_t	dwLastState;		/**< last state report */
+	bool		fStateOrder;		/**< state reports only went forward */
+	bool		fInvalid;
+} THostRx;
+
+static const char *apszPolicies[] = {"queue", "drop", "coalesce"};
+
+static uint16_t		wFrame;			/**< frames since the start */
+static uint16_t		wSeq;			/**< next counter report */
+static uint32_t		dwState;		/**< next state report */
+static THidStats	StartStats;
+
+// what the output and feature report handlers got
+static int			aiOutSeq[MAX_FRAMES];
+static int			iOutReports;
+static int			iOutMaxLatency;
+static int			iOutMinLatency;
+static bool			fOutInvalid;
+static uint8_t		abFeature[REPORT_SIZE];
+
+
+static void RxInit(THostRx *pRx)
+{
+	memset(pRx, 0, sizeof(*pRx));
+	pRx->iMinLatency = 0x7FFFFFFF;
+	pRx->fStateOrder = true;
+	HidGetStats(&StartStats);
+}
+
+
+// the host polls the IN endpoint once
+static void Poll(THostRx *pRx)
+{
+	uint8_t	abData[HID_MAX_PACKET];
+	int		iLen, iLatency;
+	uint32_t dw;
+
+	iLen = SimHostIn(HID_INT_IN_EP, abData, sizeof(abData));
+	if (iLen < 0) {
+		return;
+	}
+	if ((iLen != REPORT_SIZE + 1) || (abData[0] < REPORT_ID_STATE) || (abData[0] > REPORT_ID_COUNTER)) {
+		fprintf(stderr, "invalid report of %d bytes, ID %d\n", iLen, abData[0]);
+		pRx->fInvalid = true;
+		return;
+	}
+	pRx->iReports++;
+	pRx->aiPerID[abData[0]]++;
+	dw = SimGetLE32(&abData[1]);
+	if (abData[0] == REPORT_ID_STATE) {
+		if ((pRx->aiPerID[REPORT_ID_STATE] > 1) && (dw < pRx->dwLastState)) {
+			pRx->fStateOrder = false;
+		}
+		pRx->dwLastState = dw;
+		return;
+	}
+	// counter: sequence number and frame in which it was queued
+	iLatency = (uint16_t)(wFrame - (dw >> 16));
+	if (iLatency > pRx->iMaxLatency) {
+		pRx->iMaxLatency = iLatency;
+	}
+	if (iLatency < pRx->iMinLatency) {
+		pRx->iMinLatency = iLatency;
+	}
+	if ((pRx->aiPerID[REPORT_ID_COUNTER] > 1) && (iLatency > pRx->iMaxLatencyQueued)) {
+		pRx->iMaxLatencyQueued = iLatency;
+	}
+	if (pRx->aiPerID[REPORT_ID_COUNTER] <= (int)(sizeof(pRx->aiSeq) / sizeof(pRx->aiSeq[0]))) {
+		pRx->aiSeq[pRx->aiPerID[REPORT_ID_COUNTER] - 1] = dw & 0xFFFF;
+	}
+}
+
+
+static void Frame(THostRx *pRx)
+{
+	SimHostFrame();
+	wFrame++;
+	pRx->iFrames++;
+}
+
+
+// output report: sequence number and frame in which the host sent it
+static void OutputHandler(uint8_t bReportID, const uint8_t *pbData, int iLen)
+{
+	uint32_t	dw;
+	int			iLatency;
+
+	if ((bReportID != REPORT_ID_OUTPUT) || (iLen != REPORT_SIZE)) {
+		fOutInvalid = true;
+		return;
+	}
+	dw = SimGetLE32(pbData);
+	iLatency = (uint16_t)(wFrame - (dw >> 16));
+	if (iLatency > iOutMaxLatency) {
+		iOutMaxLatency = iLatency;
+	}
+	if (iLatency < iOutMinLatency) {
+		iOutMinLatency = iLatency;
+	}
+	if (iOutReports < MAX_FRAMES) {
+		aiOutSeq[iOutReports] = dw & 0xFFFF;
+	}
+	iOutReports++;
+}
+
+
+static void FeatureSet(uint8_t bReportID, const uint8_t *pbData, int iLen)
+{
+	if ((bReportID != REPORT_ID_FEATURE) || (iLen != REPORT_SIZE)) {
+		fOutInvalid = true;
+		return;
+	}
+	memcpy(abFeature, pbData, iLen);
+}
+
+
+static bool FeatureGet(uint8_t bReportID, uint8_t *pbData, int iLen)
+{
+	if ((bReportID != REPORT_ID_FEATURE) || (iLen != REPORT_SIZE)) {
+		fOutInvalid = true;
+		return false;
+	}
+	memcpy(pbData, abFeature, iLen);
+	return true;
+}
+
+
+static void OutInit(void)
+{
+	iOutReports = 0;
+	iOutMaxLatency = 0;
+	iOutMinLatency = 0x7FFFFFFF;
+	fOutInvalid = false;
+	HidGetStats(&StartStats);
+}
+
+
+// checks that the output reports are the sequence numbers 0 to iCount - 1
+static bool CheckOutSeq(int iCount)
+{
+	int	i;
+
+	if (iOutReports != iCount) {
+		fprintf(stderr, "%d output reports, expected %d\n", iOutReports, iCount);
+		return false;
+	}
+	for (i = 0; (i < iCount) && (i < MAX_FRAMES); i++) {
+		if (aiOutSeq[i] != i) {
+			fprintf(stderr, "output report %d is %d\n", i, aiOutSeq[i]);
+			return false;
+		}
+	}
+	return !fOutInvalid;
+}
+
+
+static bool SendCounter(void)
+{
+	uint8_t	abData[REPORT_SIZE];
+
+	abData[0] = wSeq;
+	abData[1] = wSeq >> 8;
+	abData[2] = wFrame;
+	abData[3] = wFrame >> 8;
+	wSeq++;
+	return HidSendReport(REPORT_ID_COUNTER, abData, sizeof(abData));
+}
+
+
+static bool SendState(void)
+{
+	uint8_t	abData[REPORT_SIZE];
+
+	abData[0] = dwState;
+	abData[1] = dwState >> 8;
+	abData[2] = dwState >> 16;
+	abData[3] = dwState >> 24;
+	dwState++;
+	return HidSendReport(REPORT_ID_STATE, abData, sizeof(abData));
+}
+
+
+// the host polls until nothing comes for a few frames
+static void Drain(THostRx *pRx)
+{
+	int	i, iReports;
+
+	for (i = 0; i < 3; i++) {
+		iReports = pRx->iReports;
+		Frame(pRx);
+		Poll(pRx);
+		if (pRx->iReports != iReports) {
+			i = -1;
+		}
+	}
+}
+
+
+static void Report(const char *pszTest, const THostRx *pRx)
+{
+	THidStats	Stats;
+	uint32_t	dwRate;
+
+	HidGetStats(&Stats);
+	dwRate = (pRx->iFrames > 0) ? pRx->iReports * 1000 / pRx->iFrames : 0;
+	fprintf(stderr, "%-12s %d reports in %d frames, %u/s, latency %d to %d frames, "
+			"%u refused, %u dropped, %u coalesced, %u stale\n",
+			pszTest, pRx->iReports, pRx->iFrames, dwRate,
+			(pRx->iMinLatency <= pRx->iMaxLatency) ? pRx->iMinLatency : 0, pRx->iMaxLatency,
+			Stats.dwRefused - StartStats.dwRefused, Stats.dwDropped - StartStats.dwDropped,
+			Stats.dwCoalesced - StartStats.dwCoalesced, Stats.dwStale - StartStats.dwStale);
+	printf("%s,%d,%d,%u,%d,%u,%u,%u,%u\n", pszTest, pRx->iFrames, pRx->iReports, dwRate,
+			pRx->iMaxLatency, Stats.dwRefused - StartStats.dwRefused,
+			Stats.dwDropped - StartStats.dwDropped, Stats.dwCoalesced - StartStats.dwCoalesced,
+			Stats.dwStale - StartStats.dwStale);
+}
+
+
+// checks that the counter reports are the sequence numbers iFirst to iLast, after iFirstSkip
+static bool CheckSeq(const THostRx *pRx, int iFirst, int iSkipTo, int iLast)
+{
+	int	i, iSeq, iCount;
+
+	iCount = 0;
+	for (iSeq = iFirst; iSeq <= iLast; iSeq++) {
+		if ((iSeq > iFirst) && (iSeq < iSkipTo)) {
+			continue;
+		}
+		if ((iCount >= pRx->aiPerID[REPORT_ID_COUNTER]) || (pRx->aiSeq[iCount] != (iSeq & 0xFFFF))) {
+			fprintf(stderr, "counter report %d is %d, expected %d\n", iCount,
+					(iCount < pRx->aiPerID[REPORT_ID_COUNTER]) ? pRx->aiSeq[iCount] : -1, iSeq);
+			for (i = 0; i < pRx->aiPerID[REPORT_ID_COUNTER]; i++) {
+				fprintf(stderr, " %d", pRx->aiSeq[i]);
+			}
+			fprintf(stderr, "\n");
+			return false;
+		}
+		iCount++;
+	}
+	if (iCount != pRx->aiPerID[REPORT_ID_COUNTER]) {
+		fprintf(stderr, "%d counter reports, expected %d\n", pRx->aiPerID[REPORT_ID_COUNTER], iCount);
+		return false;
+	}
+	return true;
+}
+
+
+static bool TestDescriptors(void)
+{
+	uint8_t	abData[256];
+	int		iLen;
+	bool	fOk;
+
+	fOk = true;
+	iLen = SimHostRequest(0x81, REQ_GET_DESCRIPTOR, DESC_HID_REPORT << 8, HID_IF, abData, sizeof(abData));
+	if ((iLen != sizeof(abReportDesc)) || (memcmp(abData, abReportDesc, iLen) != 0)) {
+		fprintf(stderr, "report descriptor of %d bytes\n", iLen);
+		fOk = false;
+	}
+	iLen = SimHostRequest(0x81, REQ_GET_DESCRIPTOR, DESC_HID_HID << 8, HID_IF, abData, sizeof(abData));
+	if ((iLen != 9) || (abData[1] != DESC_HID_HID) || (abData[7] != sizeof(abReportDesc))) {
+		fprintf(stderr, "HID descriptor of %d bytes\n", iLen);
+		fOk = false;
+	}
+	// nothing was sent yet, so the reports are all zeros
+	iLen = SimHostRequest(0xA1, HID_GET_REPORT, (HID_REPORT_INPUT << 8) | REPORT_ID_STATE, HID_IF, abData, sizeof(abData));
+	if ((iLen != REPORT_SIZE + 1) || (abData[0] != REPORT_ID_STATE) || (SimGetLE32(&abData[1]) != 0)) {
+		fprintf(stderr, "GET_REPORT returned %d bytes\n", iLen);
+		fOk = false;
+	}
+	if (SimHostRequest(0xA1, HID_GET_REPORT, (HID_REPORT_INPUT << 8) | 3, HID_IF, abData, sizeof(abData)) != SIM_STALL) {
+		fprintf(stderr, "GET_REPORT of an unknown report ID not stalled\n");
+		fOk = false;
+	}
+	return fOk;
+}
+
+
+// one counter report per frame, as fast as the host polls
+static bool TestRate(int iFrames)
+{
+	static THostRx	Rx;
+	int		i, iSeq;
+
+	HidRegisterInputReport(REPORT_ID_COUNTER, REPORT_SIZE, eHidQueue, 0);
+	RxInit(&Rx);
+	iSeq = wSeq;
+	for (i = 0; i < iFrames; i++) {
+		Frame(&Rx);
+		Poll(&Rx);
+		SendCounter();
+	}
+	Drain(&Rx);
+	Report("rate", &Rx);
+	return !Rx.fInvalid && CheckSeq(&Rx, iSeq, iSeq, iSeq + iFrames - 1) &&
+			(Rx.iMaxLatency == Rx.iMinLatency) && (Rx.iMaxLatency <= HID_IN_INTERVAL) &&
+			(Rx.iReports * 1000 / iFrames >= 990);
+}
+
+
+// the host does not poll while a report is queued every frame
+static bool TestPolicy(EHidPolicy ePolicy)
+{
+	THostRx		Rx;
+	THidStats	Stats;
+	char		szTest[32];
+	int			i, iSeq, iLast;
+	bool		fOk;
+
+	HidRegisterInputReport(REPORT_ID_COUNTER, REPORT_SIZE, ePolicy, 0);
+	RxInit(&Rx);
+	iSeq = wSeq;
+	for (i = 0; i < PAUSE_FRAMES; i++) {
+		Frame(&Rx);
+		SendCounter();
+	}
+	Drain(&Rx);
+	snprintf(szTest, sizeof(szTest), "%s", apszPolicies[ePolicy]);
+	Report(szTest, &Rx);
+	HidGetStats(&Stats);
+
+	// the first report went into the endpoint, the others had to wait
+	iLast = iSeq + PAUSE_FRAMES - 1;
+	switch (ePolicy) {
+	case eHidQueue:
+		fOk = CheckSeq(&Rx, iSeq, iSeq, iSeq + HID_QUEUE_SIZE) &&
+				(Stats.dwRefused - StartStats.dwRefused == PAUSE_FRAMES - HID_QUEUE_SIZE - 1);
+		break;
+	case eHidDropOldest:
+		fOk = CheckSeq(&Rx, iSeq, iLast - HID_QUEUE_SIZE + 1, iLast) &&
+				(Stats.dwDropped - StartStats.dwDropped == PAUSE_FRAMES - HID_QUEUE_SIZE - 1);
+		break;
+	default:
+		fOk = CheckSeq(&Rx, iSeq, iLast, iLast) &&
+				(Stats.dwCoalesced - StartStats.dwCoalesced == PAUSE_FRAMES - 2);
+		break;
+	}
+	return fOk && !Rx.fInvalid;
+}
+
+
+/*
+	Reports that waited too long are dropped. The first one does not
+	count, it waits in the endpoint rather than in the queue.
+ */
+static bool TestStale(void)
+{
+	THostRx		Rx;
+	THidStats	Stats;
+	int			i;
+
+	HidRegisterInputReport(REPORT_ID_COUNTER, REPORT_SIZE, eHidQueue, MAX_AGE);
+	RxInit(&Rx);
+	for (i = 0; i < 2 * MAX_AGE; i++) {
+		Frame(&Rx);
+		SendCounter();
+	}
+	Drain(&Rx);
+	Report("stale", &Rx);
+	HidGetStats(&Stats);
+	return !Rx.fInvalid && (Stats.dwStale > StartStats.dwStale) &&
+			(Rx.iReports + (int)(Stats.dwStale - StartStats.dwStale) == 2 * MAX_AGE) &&
+			(Rx.iMaxLatencyQueued <= MAX_AGE + HID_IN_INTERVAL);
+}
+
+
+/*
+	A state report that changes four times per frame, and a counter report
+	every other frame: the counter reports all have to arrive, and the
+	state reports fill the other frames with the latest state. A counter
+	report waits for the state report queued ahead of it, for the one in
+	the endpoint and for the next poll, always three frames.
+ */
+static bool TestMixed(int iFrames)
+{
+	static THostRx	Rx;
+	int		i, j, iSeq;
+
+	HidRegisterInputReport(REPORT_ID_COUNTER, REPORT_SIZE, eHidQueue, 0);
+	RxInit(&Rx);
+	iSeq = wSeq;
+	for (i = 0; i < iFrames; i++) {
+		Frame(&Rx);
+		Poll(&Rx);
+		for (j = 0; j < 4; j++) {
+			SendState();
+		}
+		if ((i % 2) == 0) {
+			SendCounter();
+		}
+	}
+	Drain(&Rx);
+	Report("mixed", &Rx);
+	return !Rx.fInvalid && CheckSeq(&Rx, iSeq, iSeq, iSeq + (iFrames + 1) / 2 - 1) &&
+			Rx.fStateOrder && (Rx.dwLastState == dwState - 1) &&
+			(Rx.iMaxLatency == Rx.iMinLatency) && (Rx.iMaxLatency <= 3 * HID_IN_INTERVAL) &&
+			(Rx.iReports * 1000 / Rx.iFrames >= 990);
+}
+
+
+// with an idle rate, the last state report is repeated
+static bool TestIdle(void)
+{
+	THostRx	Rx;
+	uint8_t	abData[8];
+	int		i, iLen;
+	bool	fOk;
+
+	fOk = true;
+	if (SimHostRequest(0x21, HID_SET_IDLE, (IDLE_RATE << 8) | REPORT_ID_STATE, HID_IF, NULL, 0) != 0) {
+		fprintf(stderr, "SET_IDLE failed\n");
+		fOk = false;
+	}
+	iLen = SimHostRequest(0xA1, HID_GET_IDLE, REPORT_ID_STATE, HID_IF, abData, 1);
+	if ((iLen != 1) || (abData[0] != IDLE_RATE)) {
+		fprintf(stderr, "GET_IDLE returned %d\n", (iLen == 1) ? abData[0] : iLen);
+		fOk = false;
+	}
+	RxInit(&Rx);
+	for (i = 0; i < 40 * IDLE_RATE * 4; i++) {
+		Frame(&Rx);
+		Poll(&Rx);
+	}
+	Report("idle", &Rx);
+	if ((Rx.aiPerID[REPORT_ID_STATE] < 39) || (Rx.aiPerID[REPORT_ID_STATE] > 40) ||
+		(Rx.aiPerID[REPORT_ID_COUNTER] != 0) || (Rx.dwLastState != dwState - 1)) {
+		fprintf(stderr, "%d state reports repeated\n", Rx.aiPerID[REPORT_ID_STATE]);
+		fOk = false;
+	}
+	iLen = SimHostRequest(0xA1, HID_GET_REPORT, (HID_REPORT_INPUT << 8) | REPORT_ID_STATE, HID_IF, abData, sizeof(abData));
+	if ((iLen != REPORT_SIZE + 1) || (SimGetLE32(&abData[1]) != dwState - 1)) {
+		fprintf(stderr, "GET_REPORT does not return the last report\n");
+		fOk = false;
+	}
+
+	// and off again, for all reports
+	SimHostRequest(0x21, HID_SET_IDLE, 0, HID_IF, NULL, 0);
+	RxInit(&Rx);
+	for (i = 0; i < 100; i++) {
+		Frame(&Rx);
+		Poll(&Rx);
+	}
+	if (Rx.iReports != 0) {
+		fprintf(stderr, "%d reports after the idle rate was turned off\n", Rx.iReports);
+		fOk = false;
+	}
+	return fOk && !Rx.fInvalid;
+}
+
+
+// a bus reset empties the queue
+static bool TestReset(void)
+{
+	THostRx	Rx;
+	int		i;
+	bool	fOk;
+
+	HidRegisterInputReport(REPORT_ID_COUNTER, REPORT_SIZE, eHidQueue, 0);
+	RxInit(&Rx);
+	for (i = 0; i < 8; i++) {
+		Frame(&Rx);
+		SendCounter();
+	}
+	SimHostReset();
+	SimHostRequest(0x00, REQ_SET_CONFIGURATION, 1, 0, NULL, 0);
+	Drain(&Rx);
+	fOk = (Rx.iReports == 0);
+
+	// and it works as before
+	SendCounter();
+	Drain(&Rx);
+	Report("reset", &Rx);
+	return fOk && (Rx.iReports == 1) && (Rx.aiSeq[0] == (uint16_t)(wSeq - 1));
+}
+
+
+/*
+	The host sends an output report on the OUT endpoint every frame, and
+	retries it in the next frame when it was NAKed. For a while in the
+	middle, the application does not call HidPoll.
+ */
+static bool TestOutput(int iFrames)
+{
+	THostRx		Rx;
+	THidStats	Stats;
+	uint8_t		abData[REPORT_SIZE + 1];
+	int			i, iSeq, iNaks;
+	bool		fOk;
+
+	OutInit();
+	RxInit(&Rx);
+	iSeq = 0;
+	iNaks = 0;
+	for (i = 0; i < iFrames; i++) {
+		Frame(&Rx);
+		abData[0] = REPORT_ID_OUTPUT;
+		SimPutLE32(&abData[1], iSeq | (wFrame << 16));
+		if (SimHostOut(HID_INT_OUT_EP, abData, sizeof(abData)) == sizeof(abData)) {
+			iSeq++;
+		}
+		else {
+			iNaks++;
+		}
+		if ((i < iFrames / 2) || (i >= iFrames / 2 + PAUSE_FRAMES)) {
+			HidPoll();
+		}
+	}
+	HidPoll();
+
+	Rx.iReports = iOutReports;
+	Rx.iMaxLatency = iOutMaxLatency;
+	Rx.iMinLatency = iOutMinLatency;
+	Report("output", &Rx);
+	fprintf(stderr, "output       %d NAKs while the application did not poll\n", iNaks);
+	fOk = CheckOutSeq(iSeq);
+
+	// the host only has to wait while the application does not poll
+	if ((iNaks == 0) || (iNaks > PAUSE_FRAMES) || (iSeq < iFrames - PAUSE_FRAMES)) {
+		fprintf(stderr, "%d of %d output reports sent, %d NAKs\n", iSeq, iFrames, iNaks);
+		fOk = false;
+	}
+
+	// reports with an unknown ID or length are dropped
+	abData[0] = REPORT_ID_COUNTER;
+	SimHostOut(HID_INT_OUT_EP, abData, sizeof(abData));
+	abData[0] = REPORT_ID_OUTPUT;
+	SimHostOut(HID_INT_OUT_EP, abData, sizeof(abData) - 1);
+	HidPoll();
+	HidGetStats(&Stats);
+	if ((Stats.dwOutInvalid - StartStats.dwOutInvalid != 2) || (iOutReports != iSeq)) {
+		fprintf(stderr, "invalid output reports not dropped\n");
+		fOk = false;
+	}
+	return fOk;
+}
+
+
+// output and feature reports on the control pipe
+static bool TestSetReport(void)
+{
+	uint8_t	abData[REPORT_SIZE + 1], abFeatureIn[REPORT_SIZE + 1];
+	int		i, iLen;
+	bool	fOk;
+
+	OutInit();
+	fOk = true;
+	abData[0] = REPORT_ID_OUTPUT;
+	SimPutLE32(&abData[1], wFrame << 16);
+	if (SimHostRequest(0x21, HID_SET_REPORT, (HID_REPORT_OUTPUT << 8) | REPORT_ID_OUTPUT, HID_IF,
+				abData, sizeof(abData)) != sizeof(abData)) {
+		fprintf(stderr, "SET_REPORT of an output report failed\n");
+		fOk = false;
+	}
+	HidPoll();
+	fOk = CheckOutSeq(1) && fOk;
+
+	// both buffers full: the request is stalled, the reports are kept
+	for (i = 0; i < 3; i++) {
+		SimPutLE32(&abData[1], (i + 1) | (wFrame << 16));
+		iLen = SimHostRequest(0x21, HID_SET_REPORT, (HID_REPORT_OUTPUT << 8) | REPORT_ID_OUTPUT, HID_IF,
+					abData, sizeof(abData));
+		if ((iLen == SIM_STALL) != (i == 2)) {
+			fprintf(stderr, "SET_REPORT %d with %d buffers full returned %d\n", i, i, iLen);
+			fOk = false;
+		}
+	}
+	HidPoll();
+	fOk = CheckOutSeq(3) && fOk;
+
+	abData[0] = REPORT_ID_FEATURE;
+	SimPutLE32(&abData[1], 0x12345678);
+	if (SimHostRequest(0x21, HID_SET_REPORT, (HID_REPORT_FEATURE << 8) | REPORT_ID_FEATURE, HID_IF,
+				abData, sizeof(abData)) != sizeof(abData)) {
+		fprintf(stderr, "SET_REPORT of a feature report failed\n");
+		fOk = false;
+	}
+	iLen = SimHostRequest(0xA1, HID_GET_REPORT, (HID_REPORT_FEATURE << 8) | REPORT_ID_FEATURE, HID_IF,
+				abFeatureIn, sizeof(abFeatureIn));
+	if ((iLen != sizeof(abFeatureIn)) || (memcmp(abData, abFeatureIn, iLen) != 0)) {
+		fprintf(stderr, "GET_REPORT of the feature report returned %d bytes\n", iLen);
+		fOk = false;
+	}
+
+	// wrong length, unknown reports
+	if ((SimHostRequest(0x21, HID_SET_REPORT, (HID_REPORT_FEATURE << 8) | REPORT_ID_FEATURE, HID_IF,
+				abData, REPORT_SIZE) != SIM_STALL) ||
+		(SimHostRequest(0x21, HID_SET_REPORT, (HID_REPORT_FEATURE << 8) | REPORT_ID_OUTPUT, HID_IF,
+				abData, sizeof(abData)) != SIM_STALL) ||
+		(SimHostRequest(0xA1, HID_GET_REPORT, (HID_REPORT_OUTPUT << 8) | REPORT_ID_OUTPUT, HID_IF,
+				abFeatureIn, sizeof(abFeatureIn)) != SIM_STALL)) {
+		fprintf(stderr, "invalid SET_REPORT / GET_REPORT not stalled\n");
+		fOk = false;
+	}
+	fprintf(stderr, "setreport    %s\n", fOk ? "ok" : "failed");
+	return fOk && !fOutInvalid;
+}
+
+
+static void Usage(const char *pszName)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -n <frames> frames of the rate test, up to %d (default 10000)\n",
+		pszName, MAX_FRAMES);
+}
+
+
+int main(int argc, char *argv[])
+{
+	int		iFrames = 10000;
+	int		c;
+	bool	fOk;
+
+	while ((c = getopt(argc, argv, "n:h")) != -1) {
+		switch (c) {
+		case 'n':	iFrames = strtoul(optarg, NULL, 0);	break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((iFrames < 1) || (iFrames > MAX_FRAMES)) {
+		fprintf(stderr, "invalid number of frames %d\n", iFrames);
+		return 1;
+	}
+
+	// set up the device side, like main_hid.c does
+	USBInit();
+	USBRegisterDescriptors(abDescriptors);
+	HidRegisterHandlers();
+	HidInit(abReportDesc, sizeof(abReportDesc));
+	HidRegisterInputReport(REPORT_ID_STATE, REPORT_SIZE, eHidCoalesce, 0);
+	HidRegisterInputReport(REPORT_ID_COUNTER, REPORT_SIZE, eHidQueue, 0);
+	HidRegisterOutputReport(REPORT_ID_OUTPUT, REPORT_SIZE, OutputHandler);
+	HidRegisterFeatureReport(REPORT_ID_FEATURE, REPORT_SIZE, FeatureSet, FeatureGet);
+
+	SimHostReset();
+	SimHostRequest(0x00, REQ_SET_CONFIGURATION, 1, 0, NULL, 0);
+
+	fOk = TestDescriptors();
+	fOk = TestRate(iFrames) && fOk;
+	fOk = TestPolicy(eHidQueue) && fOk;
+	fOk = TestPolicy(eHidDropOldest) && fOk;
+	fOk = TestPolicy(eHidCoalesce) && fOk;
+	fOk = TestStale() && fOk;
+	fOk = TestMixed(iFrames) && fOk;
+	fOk = TestIdle() && fOk;
+	fOk = TestReset() && fOk;
+	fOk = TestOutput(iFrames) && fOk;
+	fOk = TestSetReport() && fOk;
+
+	fprintf(stderr, "%s\n", fOk ? "PASS" : "FAIL");
+	return fOk ? 0 : 1;
+}
+
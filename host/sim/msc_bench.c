@@ -0,0 +1,1202 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Mass storage benchmark.
+
+	Measures throughput and latency of the mass storage function with raw
+	SCSI READ(10) and WRITE(10) commands over the bulk-only transport. The
+	device is either
+	* the BOT and SCSI layers of the mass storage example, built into this
+	  program on top of the simulated USB controller, with a RAM disk or an
+	  image file as medium, or
+	* a real device, through libusb-1.0 (build with LIBUSB=1, use -d).
+
+	The simulated device can use the UAS transport instead (-U), with up to
+	the given number of commands in flight. Commands are submitted on the
+	command pipe while earlier ones are still moving data, and completed
+	as their SENSE IUs come in, the way a UAS host driver queues them.
+
+	With -V, every block written carries its LBA, and every block read
+	that was written before is checked for it.
+
+	Every access pattern is run with every transfer size:
+	  seqread, seqwrite		sequential access
+	  randread, randwrite	random access, aligned to the transfer size
+	  meta					small file system updates: for each file, a
+							directory and a FAT block are read, the file
+							data is written, followed by both FAT copies and
+							the directory block
+	A trace of commands can be replayed too (-R), one command per line:
+	R or W, LBA, number of blocks. The replay runs once, with transfer size 0
+	in the results.
+
+	Write patterns destroy the data on the disk, on a real device they only
+	run when -W is given.
+
+	Human readable results go to stderr, a CSV line per test goes to stdout:
+	pattern,transfer size,commands,bytes,time (us),MB/s,IOPS,
+	avg latency (us),p50 latency (us),p90 latency (us),p99 latency (us),max latency (us)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBUSB
+#include <libusb.h>
+#endif
+
+#include "usbapi.h"
+#include "usbhw_lpc.h"
+
+#include "msc_bot.h"
+#include "msc_uas.h"
+#include "msc_scsi.h"
+
+#include "usbhw_sim.h"
+#include "blockdev_sim.h"
+
+#define MAX_PACKET_SIZE	64
+#define MAX_XFER		65536		/**< largest transfer size */
+#define TIMEOUT_US		1000000		/**< give up waiting for the device */
+#define USB_TIMEOUT		5000		/**< libusb timeout (ms) */
+#define MAX_DEPTH		32			/**< most UAS commands in flight */
+
+#define CBW_SIGNATURE	0x43425355
+#define CSW_SIGNATURE	0x53425355
+
+#define SCSI_CMD_READ_CAPACITY_10	0x25
+#define SCSI_CMD_READ_10			0x28
+#define SCSI_CMD_WRITE_10			0x2A
+
+// UAS information units
+#define IU_COMMAND			0x01
+#define IU_SENSE			0x03
+#define IU_RESPONSE			0x04
+#define IU_READ_READY		0x06
+#define IU_WRITE_READY		0x07
+
+// layout of the file system for the meta pattern (blocks)
+#define META_FAT			1		/**< first FAT */
+#define META_FAT_SIZE		32		/**< size of one FAT */
+#define META_DIR			(META_FAT + 2 * META_FAT_SIZE)	/**< root directory */
+#define META_DIR_SIZE		32
+#define META_DATA			(META_DIR + META_DIR_SIZE)		/**< first data block */
+
+/** A command of an access pattern */
+typedef struct {
+	bool		fRead;
+	uint32_t	dwLBA;
+	uint32_t	dwBlocks;
+} TBenchCmd;
+
+/** Access pattern, returns the next command */
+typedef void (TFnPattern)(TBenchCmd *pCmd, uint32_t dwXfer, int iStep);
+
+/** Executes the three phases of a BOT command */
+typedef bool (TFnTransfer)(const uint8_t *pbCBW, bool fIn, uint8_t *pbData, uint32_t dwLen, uint8_t *pbCSW);
+
+/** An access pattern */
+typedef struct {
+	const char	*pszName;
+	TFnPattern	*pfnNext;
+	bool		fWrites;			/**< pattern writes to the disk */
+} TBenchPattern;
+
+static TFnTransfer	*pfnTransfer;
+static uint32_t		dwNumBlocks;	/**< disk size */
+static uint32_t		dwTag;
+static uint32_t		dwRandom = 0x2545F491;
+static uint8_t		bLUN;
+
+static TBenchCmd	*pTrace;
+static int			iTraceLen;
+
+static int			iUasDepth;		/**< UAS commands in flight, 0 for BOT */
+static bool			fVerify;
+static uint8_t		*pabWritten;	/**< bitmap of blocks written with -V */
+
+
+// xorshift32, the same sequence on every run
+static uint32_t Random(void)
+{
+	dwRandom ^= dwRandom << 13;
+	dwRandom ^= dwRandom >> 17;
+	dwRandom ^= dwRandom << 5;
+	return dwRandom;
+}
+
+
+/*************************************************************************
+	Simulated device
+**************************************************************************/
+
+/**
+	Local function to move a BOT command through the simulated controller,
+	packet by packet, like a host controller does
+ */
+static bool SimTransfer(const uint8_t *pbCBW, bool fIn, uint8_t *pbData, uint32_t dwLen, uint8_t *pbCSW)
+{
+	uint8_t		abPacket[MAX_PACKET_SIZE];
+	uint32_t	dwDone;
+	uint64_t	qwWait;
+	int			iPacket, iChunk, i;
+
+	iPacket = SimHostGetMaxPacketSize(MSC_BULK_IN_EP);
+
+	// command
+	qwWait = SimTimeUs();
+	while ((i = SimHostOut(MSC_BULK_OUT_EP, pbCBW, 31)) == SIM_NAK) {
+		if (SimTimeUs() - qwWait > TIMEOUT_US) {
+			fprintf(stderr, "device does not take CBW\n");
+			return false;
+		}
+	}
+	if (i < 0) {
+		fprintf(stderr, "CBW stalled\n");
+		return false;
+	}
+
+	// data
+	dwDone = 0;
+	qwWait = SimTimeUs();
+	while (dwDone < dwLen) {
+		iChunk = (dwLen - dwDone < (uint32_t)iPacket) ? (int)(dwLen - dwDone) : iPacket;
+		if (fIn) {
+			i = SimHostIn(MSC_BULK_IN_EP, abPacket, iPacket);
+			if (i > 0) {
+				memcpy(pbData + dwDone, abPacket, (i < iChunk) ? i : iChunk);
+			}
+		}
+		else {
+			i = SimHostOut(MSC_BULK_OUT_EP, pbData + dwDone, iChunk);
+		}
+		if (i == SIM_NAK) {
+			if (SimTimeUs() - qwWait > TIMEOUT_US) {
+				fprintf(stderr, "device not responding in data phase\n");
+				return false;
+			}
+			continue;
+		}
+		if (i == SIM_STALL) {
+			SimHostClearHalt(fIn ? MSC_BULK_IN_EP : MSC_BULK_OUT_EP);
+			break;
+		}
+		qwWait = SimTimeUs();
+		dwDone += i;
+		if (i < iPacket) {
+			// short packet ends the data phase
+			break;
+		}
+	}
+
+	// status
+	qwWait = SimTimeUs();
+	while ((i = SimHostIn(MSC_BULK_IN_EP, pbCSW, 13)) < 0) {
+		if (i == SIM_STALL) {
+			SimHostClearHalt(MSC_BULK_IN_EP);
+		}
+		if (SimTimeUs() - qwWait > TIMEOUT_US) {
+			fprintf(stderr, "no CSW\n");
+			return false;
+		}
+	}
+	return (i == 13);
+}
+
+
+/**
+	Local function to move the data of a UAS command, after its READ READY
+	or WRITE READY IU
+ */
+static bool UasData(bool fIn, uint8_t *pbData, uint32_t dwLen)
+{
+	uint8_t		abPacket[MAX_PACKET_SIZE];
+	uint32_t	dwDone;
+	uint64_t	qwWait;
+	int			iPacket, iChunk, i;
+
+	iPacket = SimHostGetMaxPacketSize(fIn ? MSC_UAS_DATA_IN_EP : MSC_UAS_DATA_OUT_EP);
+	dwDone = 0;
+	qwWait = SimTimeUs();
+	while (dwDone < dwLen) {
+		iChunk = (dwLen - dwDone < (uint32_t)iPacket) ? (int)(dwLen - dwDone) : iPacket;
+		if (fIn) {
+			i = SimHostIn(MSC_UAS_DATA_IN_EP, abPacket, iPacket);
+			if (i > 0) {
+				memcpy(pbData + dwDone, abPacket, (i < iChunk) ? i : iChunk);
+			}
+		}
+		else {
+			i = SimHostOut(MSC_UAS_DATA_OUT_EP, pbData + dwDone, iChunk);
+		}
+		if (i == SIM_NAK) {
+			if (SimTimeUs() - qwWait > TIMEOUT_US) {
+				fprintf(stderr, "device not responding in data phase\n");
+				return false;
+			}
+			continue;
+		}
+		if (i < 0) {
+			fprintf(stderr, "data pipe stalled\n");
+			return false;
+		}
+		qwWait = SimTimeUs();
+		dwDone += i;
+		if (i < iPacket) {
+			// short packet ends the data phase
+			break;
+		}
+	}
+	return true;
+}
+
+
+/**
+	Local function to read the next IU from the UAS status pipe
+
+	@return length of the IU, 0 if there is none yet, -1 on a timeout
+ */
+static int UasStatus(uint8_t *pbIU, uint64_t *pqwWait)
+{
+	int i;
+
+	i = SimHostIn(MSC_UAS_STATUS_EP, pbIU, MAX_PACKET_SIZE);
+	if (i > 0) {
+		*pqwWait = SimTimeUs();
+		return i;
+	}
+	if (SimTimeUs() - *pqwWait > TIMEOUT_US) {
+		fprintf(stderr, "no status from device\n");
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+	Local function to submit a command IU
+
+	@return true if the device took it, false on a NAK
+ */
+static bool UasSubmit(uint16_t wTag, const uint8_t *pbCDB, int iCDBLen)
+{
+	uint8_t	abIU[32];
+
+	memset(abIU, 0, sizeof(abIU));
+	abIU[0] = IU_COMMAND;
+	abIU[2] = wTag >> 8;
+	abIU[3] = wTag;
+	abIU[9] = bLUN;
+	memcpy(&abIU[16], pbCDB, iCDBLen);
+	return (SimHostOut(MSC_UAS_CMD_EP, abIU, sizeof(abIU)) == sizeof(abIU));
+}
+
+
+// reports a SENSE IU with bad status, or a RESPONSE IU
+static void UasReportError(const uint8_t *pbIU)
+{
+	if (pbIU[0] == IU_RESPONSE) {
+		fprintf(stderr, "UAS response code %02X for tag %d\n", pbIU[7], (pbIU[2] << 8) | pbIU[3]);
+	}
+	else {
+		fprintf(stderr, "UAS status %02X, sense %02X/%02X/%02X for tag %d\n", pbIU[6],
+			pbIU[16 + 2] & 0x0F, pbIU[16 + 12], pbIU[16 + 13], (pbIU[2] << 8) | pbIU[3]);
+	}
+}
+
+
+/**
+	Executes one SCSI command through UAS, on its own
+
+	@return SCSI status (0 = good), or -1 on a transport error
+ */
+static int UasCommand(const uint8_t *pbCDB, int iCDBLen, bool fIn, uint8_t *pbData, uint32_t dwLen)
+{
+	uint8_t		abIU[MAX_PACKET_SIZE];
+	uint64_t	qwWait;
+	int			i;
+
+	qwWait = SimTimeUs();
+	while (!UasSubmit(++dwTag, pbCDB, iCDBLen)) {
+		if (SimTimeUs() - qwWait > TIMEOUT_US) {
+			fprintf(stderr, "device does not take command IU\n");
+			return -1;
+		}
+	}
+	qwWait = SimTimeUs();
+	while ((i = UasStatus(abIU, &qwWait)) >= 0) {
+		if ((i == 0) || ((uint16_t)((abIU[2] << 8) | abIU[3]) != (uint16_t)dwTag)) {
+			continue;
+		}
+		switch (abIU[0]) {
+		case IU_READ_READY:
+		case IU_WRITE_READY:
+			if ((fIn != (abIU[0] == IU_READ_READY)) || !UasData(fIn, pbData, dwLen)) {
+				return -1;
+			}
+			break;
+		case IU_SENSE:
+			if (abIU[6] != 0) {
+				UasReportError(abIU);
+			}
+			return abIU[6];
+		default:
+			UasReportError(abIU);
+			return -1;
+		}
+	}
+	return -1;
+}
+
+
+/**
+	Local function to set up the device side, like main_msc.c does
+ */
+static bool SimOpen(const char *pszFile, uint32_t dwSize, const TBlockDevTiming *pTiming)
+{
+	const TBlockDevOps *pOps;
+
+	pOps = (pszFile != NULL) ? BlockDevSimFile(0, pszFile, dwSize) : BlockDevSimRam(0, dwSize);
+	if (pOps == NULL) {
+		return false;
+	}
+	BlockDevSimTiming(0, pTiming);
+	if (!SCSIAddLUN(pOps)) {
+		return false;
+	}
+
+	USBHwInit();
+	USBHwNakIntEnable(INACK_BI | INACK_BO);
+	if (iUasDepth > 0) {
+		// alternate setting 1
+		USBHwEPConfig(MSC_UAS_CMD_EP, MAX_PACKET_SIZE);
+		USBHwEPConfig(MSC_UAS_STATUS_EP, MAX_PACKET_SIZE);
+		USBHwEPConfig(MSC_UAS_DATA_IN_EP, MAX_PACKET_SIZE);
+		USBHwEPConfig(MSC_UAS_DATA_OUT_EP, MAX_PACKET_SIZE);
+		USBHwRegisterEPIntHandler(MSC_UAS_CMD_EP, MSCUasCommandOut);
+		USBHwRegisterEPIntHandler(MSC_UAS_STATUS_EP, MSCUasStatusIn);
+		USBHwRegisterEPIntHandler(MSC_UAS_DATA_IN_EP, MSCUasDataIn);
+		USBHwRegisterEPIntHandler(MSC_UAS_DATA_OUT_EP, MSCUasDataOut);
+		MSCUasReset();
+	}
+	else {
+		USBHwEPConfig(MSC_BULK_IN_EP, MAX_PACKET_SIZE);
+		USBHwEPConfig(MSC_BULK_OUT_EP, MAX_PACKET_SIZE);
+		USBHwRegisterEPIntHandler(MSC_BULK_IN_EP, MSCBotBulkIn);
+		USBHwRegisterEPIntHandler(MSC_BULK_OUT_EP, MSCBotBulkOut);
+		MSCBotReset();
+	}
+
+	pfnTransfer = SimTransfer;
+	return true;
+}
+
+
+/*************************************************************************
+	Real device
+**************************************************************************/
+
+#ifdef HAVE_LIBUSB
+
+static libusb_device_handle	*hUsb;
+static uint8_t				bUsbIn, bUsbOut;
+
+
+/**
+	Local function to execute a BOT command with one libusb transfer per
+	phase, recovering from stalls as described in the BOT specification
+ */
+static bool UsbTransfer(const uint8_t *pbCBW, bool fIn, uint8_t *pbData, uint32_t dwLen, uint8_t *pbCSW)
+{
+	uint8_t	bEP;
+	int		iDone, i;
+
+	// command
+	i = libusb_bulk_transfer(hUsb, bUsbOut, (uint8_t *)pbCBW, 31, &iDone, USB_TIMEOUT);
+	if (i < 0) {
+		fprintf(stderr, "CBW failed: %s\n", libusb_error_name(i));
+		return false;
+	}
+
+	// data
+	if (dwLen > 0) {
+		bEP = fIn ? bUsbIn : bUsbOut;
+		i = libusb_bulk_transfer(hUsb, bEP, pbData, dwLen, &iDone, USB_TIMEOUT);
+		if (i == LIBUSB_ERROR_PIPE) {
+			libusb_clear_halt(hUsb, bEP);
+		}
+		else if (i < 0) {
+			fprintf(stderr, "data phase failed: %s\n", libusb_error_name(i));
+			return false;
+		}
+	}
+
+	// status, once more after a stall
+	i = libusb_bulk_transfer(hUsb, bUsbIn, pbCSW, 13, &iDone, USB_TIMEOUT);
+	if (i == LIBUSB_ERROR_PIPE) {
+		libusb_clear_halt(hUsb, bUsbIn);
+		i = libusb_bulk_transfer(hUsb, bUsbIn, pbCSW, 13, &iDone, USB_TIMEOUT);
+	}
+	if (i < 0) {
+		fprintf(stderr, "CSW failed: %s\n", libusb_error_name(i));
+		return false;
+	}
+	return (iDone == 13);
+}
+
+
+/**
+	Local function to open a device and claim its bulk-only interface,
+	taking it away from the kernel driver for the duration of the test
+ */
+static bool UsbOpen(uint16_t wVendor, uint16_t wProduct)
+{
+	struct libusb_config_descriptor		*pConfig;
+	const struct libusb_interface_descriptor	*pIf;
+	const struct libusb_endpoint_descriptor	*pEP;
+	int		i, j, iIf;
+
+	if (libusb_init(NULL) < 0) {
+		return false;
+	}
+	hUsb = libusb_open_device_with_vid_pid(NULL, wVendor, wProduct);
+	if (hUsb == NULL) {
+		fprintf(stderr, "device %04X:%04X not found\n", wVendor, wProduct);
+		return false;
+	}
+	if (libusb_get_active_config_descriptor(libusb_get_device(hUsb), &pConfig) < 0) {
+		return false;
+	}
+
+	// first mass storage bulk-only interface
+	iIf = -1;
+	bUsbIn = bUsbOut = 0;
+	for (i = 0; (i < pConfig->bNumInterfaces) && (iIf < 0); i++) {
+		pIf = &pConfig->interface[i].altsetting[0];
+		if ((pIf->bInterfaceClass != LIBUSB_CLASS_MASS_STORAGE) || (pIf->bInterfaceProtocol != 0x50)) {
+			continue;
+		}
+		iIf = pIf->bInterfaceNumber;
+		for (j = 0; j < pIf->bNumEndpoints; j++) {
+			pEP = &pIf->endpoint[j];
+			if ((pEP->bmAttributes & 3) == LIBUSB_TRANSFER_TYPE_BULK) {
+				if (pEP->bEndpointAddress & 0x80) {
+					bUsbIn = pEP->bEndpointAddress;
+				}
+				else {
+					bUsbOut = pEP->bEndpointAddress;
+				}
+			}
+		}
+	}
+	libusb_free_config_descriptor(pConfig);
+	if ((iIf < 0) || (bUsbIn == 0) || (bUsbOut == 0)) {
+		fprintf(stderr, "no bulk-only mass storage interface\n");
+		return false;
+	}
+
+	libusb_set_auto_detach_kernel_driver(hUsb, 1);
+	if (libusb_claim_interface(hUsb, iIf) < 0) {
+		fprintf(stderr, "cannot claim interface %d\n", iIf);
+		return false;
+	}
+
+	pfnTransfer = UsbTransfer;
+	return true;
+}
+
+#endif
+
+
+/*************************************************************************
+	Commands
+**************************************************************************/
+
+/**
+	Executes one SCSI command through the bulk-only transport
+
+	@return CSW status (0 = passed), or -1 on a transport error
+ */
+static int BotCommand(const uint8_t *pbCDB, int iCDBLen, bool fIn, uint8_t *pbData, uint32_t dwLen)
+{
+	uint8_t		abCBW[31], abCSW[13];
+
+	memset(abCBW, 0, sizeof(abCBW));
+	SimPutLE32(&abCBW[0], CBW_SIGNATURE);
+	SimPutLE32(&abCBW[4], ++dwTag);
+	SimPutLE32(&abCBW[8], dwLen);
+	abCBW[12] = fIn ? 0x80 : 0x00;
+	abCBW[13] = bLUN;
+	abCBW[14] = iCDBLen;
+	memcpy(&abCBW[15], pbCDB, iCDBLen);
+
+	if (!pfnTransfer(abCBW, fIn, pbData, dwLen, abCSW)) {
+		return -1;
+	}
+	if ((SimGetLE32(&abCSW[0]) != CSW_SIGNATURE) || (SimGetLE32(&abCSW[4]) != dwTag)) {
+		fprintf(stderr, "invalid CSW\n");
+		return -1;
+	}
+	return abCSW[12];
+}
+
+
+// executes a command on its own, through either transport
+static int Command(const uint8_t *pbCDB, int iCDBLen, bool fIn, uint8_t *pbData, uint32_t dwLen)
+{
+	if (iUasDepth > 0) {
+		return UasCommand(pbCDB, iCDBLen, fIn, pbData, dwLen);
+	}
+	return BotCommand(pbCDB, iCDBLen, fIn, pbData, dwLen);
+}
+
+
+static void BuildReadWrite10(const TBenchCmd *pCmd, uint8_t *pbCDB)
+{
+	memset(pbCDB, 0, 10);
+	pbCDB[0] = pCmd->fRead ? SCSI_CMD_READ_10 : SCSI_CMD_WRITE_10;
+	pbCDB[2] = pCmd->dwLBA >> 24;
+	pbCDB[3] = pCmd->dwLBA >> 16;
+	pbCDB[4] = pCmd->dwLBA >> 8;
+	pbCDB[5] = pCmd->dwLBA;
+	pbCDB[7] = pCmd->dwBlocks >> 8;
+	pbCDB[8] = pCmd->dwBlocks;
+}
+
+
+/*************************************************************************
+	Verification
+**************************************************************************/
+
+// stamps the blocks of a write with their LBA
+static void StampBlocks(const TBenchCmd *pCmd, uint8_t *pbData)
+{
+	uint32_t i;
+
+	for (i = 0; i < pCmd->dwBlocks; i++) {
+		SimPutLE32(pbData + i * 512, pCmd->dwLBA + i);
+		SimPutLE32(pbData + i * 512 + 4, ~(pCmd->dwLBA + i));
+	}
+}
+
+
+// remembers the blocks of a completed write
+static void MarkBlocks(const TBenchCmd *pCmd)
+{
+	uint32_t i, dwBlock;
+
+	for (i = 0; i < pCmd->dwBlocks; i++) {
+		dwBlock = pCmd->dwLBA + i;
+		pabWritten[dwBlock / 8] |= 1 << (dwBlock % 8);
+	}
+}
+
+
+/**
+	Local function to check the stamps of the blocks of a completed read,
+	for blocks that were written before
+
+	@return false if a block holds the wrong data
+ */
+static bool CheckBlocks(const TBenchCmd *pCmd, const uint8_t *pbData)
+{
+	uint32_t i, dwBlock;
+
+	for (i = 0; i < pCmd->dwBlocks; i++) {
+		dwBlock = pCmd->dwLBA + i;
+		if (((pabWritten[dwBlock / 8] & (1 << (dwBlock % 8))) != 0) &&
+			((SimGetLE32(pbData + i * 512) != dwBlock) || (SimGetLE32(pbData + i * 512 + 4) != ~dwBlock))) {
+			fprintf(stderr, "block %u holds data of block %u\n", dwBlock, SimGetLE32(pbData + i * 512));
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/*************************************************************************
+	Access patterns
+**************************************************************************/
+
+static void Sequential(TBenchCmd *pCmd, uint32_t dwXfer, int iStep)
+{
+	uint32_t dwSpan = dwNumBlocks / dwXfer;
+
+	pCmd->dwBlocks = dwXfer;
+	pCmd->dwLBA = (iStep % dwSpan) * dwXfer;
+}
+
+
+static void SeqRead(TBenchCmd *pCmd, uint32_t dwXfer, int iStep)
+{
+	Sequential(pCmd, dwXfer, iStep);
+	pCmd->fRead = true;
+}
+
+
+static void SeqWrite(TBenchCmd *pCmd, uint32_t dwXfer, int iStep)
+{
+	Sequential(pCmd, dwXfer, iStep);
+	pCmd->fRead = false;
+}
+
+
+static void RandRead(TBenchCmd *pCmd, uint32_t dwXfer, int iStep)
+{
+	(void)iStep;
+	pCmd->fRead = true;
+	pCmd->dwBlocks = dwXfer;
+	pCmd->dwLBA = (Random() % (dwNumBlocks / dwXfer)) * dwXfer;
+}
+
+
+static void RandWrite(TBenchCmd *pCmd, uint32_t dwXfer, int iStep)
+{
+	RandRead(pCmd, dwXfer, iStep);
+	pCmd->fRead = false;
+}
+
+
+static void Meta(TBenchCmd *pCmd, uint32_t dwXfer, int iStep)
+{
+	static uint32_t	dwDir, dwFat;
+	uint32_t		dwFiles;
+
+	// a directory entry and a FAT block for each new file
+	if ((iStep % 6) == 0) {
+		dwDir = META_DIR + Random() % META_DIR_SIZE;
+		dwFat = META_FAT + Random() % META_FAT_SIZE;
+	}
+	pCmd->dwBlocks = 1;
+	switch (iStep % 6) {
+	case 0:		pCmd->fRead = true;		pCmd->dwLBA = dwDir;	break;
+	case 1:		pCmd->fRead = true;		pCmd->dwLBA = dwFat;	break;
+	case 2:
+		// file data, files follow each other on the disk
+		dwFiles = (dwNumBlocks - META_DATA) / dwXfer;
+		pCmd->fRead = false;
+		pCmd->dwBlocks = dwXfer;
+		pCmd->dwLBA = META_DATA + ((iStep / 6) % dwFiles) * dwXfer;
+		break;
+	case 3:		pCmd->fRead = false;	pCmd->dwLBA = dwFat;	break;
+	case 4:		pCmd->fRead = false;	pCmd->dwLBA = dwFat + META_FAT_SIZE;	break;
+	default:	pCmd->fRead = false;	pCmd->dwLBA = dwDir;	break;
+	}
+}
+
+
+static void Replay(TBenchCmd *pCmd, uint32_t dwXfer, int iStep)
+{
+	(void)dwXfer;
+	*pCmd = pTrace[iStep % iTraceLen];
+}
+
+
+static const TBenchPattern aPatterns[] = {
+	{"seqread",		SeqRead,	false},
+	{"seqwrite",	SeqWrite,	true},
+	{"randread",	RandRead,	false},
+	{"randwrite",	RandWrite,	true},
+	{"meta",		Meta,		true},
+	{"replay",		Replay,		true}
+};
+
+#define NUM_PATTERNS	(sizeof(aPatterns) / sizeof(aPatterns[0]))
+
+
+/**
+	Local function to load a trace for the replay pattern
+
+	@return false if the file cannot be read or holds an invalid command
+ */
+static bool LoadTrace(const char *pszFile)
+{
+	FILE		*f;
+	char		szLine[128], cOp;
+	unsigned	uLBA, uBlocks;
+	int			iLine, iSize;
+
+	f = fopen(pszFile, "r");
+	if (f == NULL) {
+		perror(pszFile);
+		return false;
+	}
+	iSize = 0;
+	iTraceLen = 0;
+	for (iLine = 1; fgets(szLine, sizeof(szLine), f) != NULL; iLine++) {
+		if ((szLine[0] == '#') || (szLine[0] == '\n')) {
+			continue;
+		}
+		if ((sscanf(szLine, " %c , %u , %u", &cOp, &uLBA, &uBlocks) != 3) ||
+			((cOp != 'R') && (cOp != 'W')) || (uBlocks == 0) || (uBlocks > MAX_XFER / 512)) {
+			fprintf(stderr, "%s:%d: invalid command\n", pszFile, iLine);
+			fclose(f);
+			return false;
+		}
+		if (iTraceLen == iSize) {
+			iSize = (iSize == 0) ? 256 : 2 * iSize;
+			pTrace = realloc(pTrace, iSize * sizeof(TBenchCmd));
+		}
+		pTrace[iTraceLen].fRead = (cOp == 'R');
+		pTrace[iTraceLen].dwLBA = uLBA;
+		pTrace[iTraceLen].dwBlocks = uBlocks;
+		iTraceLen++;
+	}
+	fclose(f);
+	return (iTraceLen > 0);
+}
+
+
+/*************************************************************************
+	Measurement
+**************************************************************************/
+
+static int CompareU64(const void *p1, const void *p2)
+{
+	uint64_t	q1 = *(const uint64_t *)p1, q2 = *(const uint64_t *)p2;
+
+	return (q1 > q2) - (q1 < q2);
+}
+
+
+// returns a percentile of sorted latencies
+static uint64_t Percentile(const uint64_t *pqwLat, int iCount, int iPercent)
+{
+	return pqwLat[(iCount - 1) * iPercent / 100];
+}
+
+
+/** State of a benchmark run */
+typedef struct {
+	const TBenchPattern	*pPattern;
+	uint32_t	dwXfer;			/**< transfer size (blocks) */
+	uint64_t	qwAmount;		/**< bytes to move */
+	uint64_t	qwMaxTime;		/**< time limit (us) */
+	uint64_t	qwStart;
+	int			iMaxCmds;		/**< size of pqwLat */
+	int			iIssued;		/**< commands started */
+	uint64_t	qwIssued;		/**< bytes of the commands started */
+	int			iCmds;			/**< commands completed */
+	uint64_t	qwBytes;		/**< bytes of the commands completed */
+	uint64_t	*pqwLat;		/**< latency of each completed command */
+} TBenchRun;
+
+
+/**
+	Local function to get the next command of a run, if the run is not
+	over yet, and stamp the data of a write
+
+	@return false if the run is over
+ */
+static bool NextCommand(TBenchRun *pRun, TBenchCmd *pCmd, uint8_t *pbData)
+{
+	if ((pRun->iIssued == pRun->iMaxCmds) || (pRun->qwIssued >= pRun->qwAmount) ||
+		(SimTimeUs() - pRun->qwStart > pRun->qwMaxTime)) {
+		return false;
+	}
+	pRun->pPattern->pfnNext(pCmd, pRun->dwXfer, pRun->iIssued);
+	pRun->iIssued++;
+	pRun->qwIssued += pCmd->dwBlocks * 512;
+	if (fVerify && !pCmd->fRead) {
+		StampBlocks(pCmd, pbData);
+	}
+	return true;
+}
+
+
+/**
+	Local function to account for a completed command
+
+	@return false if verification failed
+ */
+static bool CommandDone(TBenchRun *pRun, const TBenchCmd *pCmd, uint64_t qwLatency, const uint8_t *pbData)
+{
+	pRun->pqwLat[pRun->iCmds++] = qwLatency;
+	pRun->qwBytes += pCmd->dwBlocks * 512;
+	if (fVerify) {
+		if (!pCmd->fRead) {
+			MarkBlocks(pCmd);
+		}
+		else if (!CheckBlocks(pCmd, pbData)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/**
+	Local function to run the commands of a test one at a time, through
+	BOT or UAS
+
+	@return false if a command failed
+ */
+static bool RunSingle(TBenchRun *pRun, uint8_t *pbBuf)
+{
+	TBenchCmd	Cmd;
+	uint8_t		abCDB[10];
+	uint64_t	qwCmd;
+
+	while (NextCommand(pRun, &Cmd, pbBuf)) {
+		BuildReadWrite10(&Cmd, abCDB);
+		qwCmd = SimTimeUs();
+		if (Command(abCDB, sizeof(abCDB), Cmd.fRead, pbBuf, Cmd.dwBlocks * 512) != 0) {
+			fprintf(stderr, "%s failed at LBA %u\n", Cmd.fRead ? "READ10" : "WRITE10", Cmd.dwLBA);
+			return false;
+		}
+		if (!CommandDone(pRun, &Cmd, SimTimeUs() - qwCmd, pbBuf)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/**
+	Local function to run the commands of a test with up to iUasDepth UAS
+	commands in flight. Each slot has a tag and a buffer of its own. A new
+	command is submitted whenever a slot is free and the device takes it,
+	data moves when the device announces a tag on the status pipe.
+
+	@return false if a command failed
+ */
+static bool RunQueued(TBenchRun *pRun, uint8_t *pbBuf)
+{
+	TBenchCmd	aCmd[MAX_DEPTH];
+	uint64_t	aqwStart[MAX_DEPTH];
+	bool		afBusy[MAX_DEPTH];
+	uint8_t		abCDB[10], abIU[MAX_PACKET_SIZE];
+	uint64_t	qwWait;
+	int			i, iBusy, iNext;
+	bool		fMore;
+
+	memset(afBusy, 0, sizeof(afBusy));
+	iBusy = 0;
+	iNext = -1;			// prepared command the device has not taken yet
+	fMore = true;
+	qwWait = SimTimeUs();
+
+	while (fMore || (iBusy > 0)) {
+		// keep the queue full
+		if ((iNext < 0) && fMore && (iBusy < iUasDepth)) {
+			for (iNext = 0; afBusy[iNext]; iNext++) {
+				// find a free slot
+			}
+			fMore = NextCommand(pRun, &aCmd[iNext], pbBuf + iNext * MAX_XFER);
+			if (fMore) {
+				afBusy[iNext] = true;
+				aqwStart[iNext] = SimTimeUs();
+				iBusy++;
+			}
+			else {
+				iNext = -1;
+			}
+		}
+		if (iNext >= 0) {
+			BuildReadWrite10(&aCmd[iNext], abCDB);
+			if (UasSubmit(iNext + 1, abCDB, sizeof(abCDB))) {
+				iNext = -1;
+				continue;
+			}
+		}
+
+		// handle the next IU on the status pipe
+		i = UasStatus(abIU, &qwWait);
+		if (i < 0) {
+			return false;
+		}
+		if (i == 0) {
+			continue;
+		}
+		i = ((abIU[2] << 8) | abIU[3]) - 1;
+		if ((i < 0) || (i >= iUasDepth) || !afBusy[i] || (i == iNext)) {
+			fprintf(stderr, "IU %02X for unknown tag %d\n", abIU[0], i + 1);
+			return false;
+		}
+		switch (abIU[0]) {
+		case IU_READ_READY:
+		case IU_WRITE_READY:
+			if (!UasData(abIU[0] == IU_READ_READY, pbBuf + i * MAX_XFER, aCmd[i].dwBlocks * 512)) {
+				return false;
+			}
+			break;
+		case IU_SENSE:
+			if (abIU[6] != 0) {
+				UasReportError(abIU);
+				return false;
+			}
+			if (!CommandDone(pRun, &aCmd[i], SimTimeUs() - aqwStart[i], pbBuf + i * MAX_XFER)) {
+				return false;
+			}
+			afBusy[i] = false;
+			iBusy--;
+			break;
+		default:
+			UasReportError(abIU);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/**
+	Runs one pattern with one transfer size, until the amount of data is
+	moved or the time is up, and reports the results
+
+	@return false if a command failed
+ */
+static bool RunTest(const TBenchPattern *pPattern, uint32_t dwXfer, uint64_t qwAmount, uint64_t qwMaxTime,
+	uint8_t *pbBuf)
+{
+	TBenchRun	Run;
+	uint64_t	*pqwLat, qwTime, qwBytes, qwSum;
+	int			i, iCmds;
+	double		dMBs, dIOPS;
+	bool		fOk;
+
+	memset(&Run, 0, sizeof(Run));
+	Run.pPattern = pPattern;
+	Run.dwXfer = dwXfer / 512;
+	Run.qwAmount = qwAmount;
+	Run.qwMaxTime = qwMaxTime;
+	// a command moves at least one block
+	Run.iMaxCmds = qwAmount / 512 + 1;
+	Run.pqwLat = malloc(Run.iMaxCmds * sizeof(uint64_t));
+	if (Run.pqwLat == NULL) {
+		return false;
+	}
+
+	Run.qwStart = SimTimeUs();
+	fOk = (iUasDepth > 0) ? RunQueued(&Run, pbBuf) : RunSingle(&Run, pbBuf);
+	qwTime = SimTimeUs() - Run.qwStart;
+	if (!fOk || (Run.iCmds == 0)) {
+		fprintf(stderr, "%s failed\n", pPattern->pszName);
+		free(Run.pqwLat);
+		return false;
+	}
+	if (qwTime == 0) {
+		qwTime = 1;
+	}
+	pqwLat = Run.pqwLat;
+	iCmds = Run.iCmds;
+	qwBytes = Run.qwBytes;
+	qwSum = 0;
+	for (i = 0; i < iCmds; i++) {
+		qwSum += pqwLat[i];
+	}
+
+	qsort(pqwLat, iCmds, sizeof(uint64_t), CompareU64);
+	dMBs = qwBytes / (double)qwTime;
+	dIOPS = iCmds * 1000000.0 / qwTime;
+	fprintf(stderr, "* %-9s %5u: %8.2f MB/s %8.0f IOPS, latency avg %llu us, p50 %llu, p90 %llu, p99 %llu, max %llu\n",
+		pPattern->pszName, dwXfer, dMBs, dIOPS, (unsigned long long)(qwSum / iCmds),
+		(unsigned long long)Percentile(pqwLat, iCmds, 50), (unsigned long long)Percentile(pqwLat, iCmds, 90),
+		(unsigned long long)Percentile(pqwLat, iCmds, 99), (unsigned long long)pqwLat[iCmds - 1]);
+	printf("%s,%u,%d,%llu,%llu,%.3f,%.1f,%llu,%llu,%llu,%llu,%llu\n", pPattern->pszName, dwXfer, iCmds,
+		(unsigned long long)qwBytes, (unsigned long long)qwTime, dMBs, dIOPS, (unsigned long long)(qwSum / iCmds),
+		(unsigned long long)Percentile(pqwLat, iCmds, 50), (unsigned long long)Percentile(pqwLat, iCmds, 90),
+		(unsigned long long)Percentile(pqwLat, iCmds, 99), (unsigned long long)pqwLat[iCmds - 1]);
+	fflush(stdout);
+
+	free(pqwLat);
+	return true;
+}
+
+
+static void Usage(const char *pszName)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+#ifdef HAVE_LIBUSB
+		"  -d <vid:pid> benchmark a real device (hex IDs) instead of the simulation\n"
+		"  -W         allow write patterns on a real device, destroys its data\n"
+		"  -L <lun>   logical unit of the real device (default 0)\n"
+#endif
+		"  -f <file>  image file for the simulated device (default RAM disk)\n"
+		"  -U <n>     use UAS on the simulated device, with up to n commands in flight\n"
+		"  -s <kB>    simulated disk size (default 16384, 0 = size of existing image)\n"
+		"  -r <us>    simulated read latency per block (default 0)\n"
+		"  -w <us>    simulated write latency per block (default 0)\n"
+		"  -b <kB/s>  simulated medium bandwidth (default 0 = unlimited)\n"
+		"  -t <list>  transfer sizes in bytes (default 512,4096,16384,65536)\n"
+		"  -p <list>  patterns (default seqread,seqwrite,randread,randwrite,meta)\n"
+		"  -R <file>  trace to replay, adds the replay pattern\n"
+		"  -n <kB>    amount of data per test (default 4096)\n"
+		"  -T <ms>    time limit per test (default 5000)\n"
+		"  -V         verify the data read\n",
+		pszName);
+}
+
+
+// checks if a name is in a comma separated list
+static bool InList(const char *pszList, const char *pszName)
+{
+	size_t	iLen = strlen(pszName);
+	const char	*psz;
+
+	for (psz = pszList; (psz = strstr(psz, pszName)) != NULL; psz += iLen) {
+		if (((psz == pszList) || (psz[-1] == ',')) && ((psz[iLen] == ',') || (psz[iLen] == '\0'))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+
+int main(int argc, char *argv[])
+{
+	TBlockDevTiming	Timing;
+	const char		*pszFile = NULL, *pszPatterns = "seqread,seqwrite,randread,randwrite,meta";
+	const char		*pszSizes = "512,4096,16384,65536";
+	const char		*pszDevice = NULL, *pszTrace = NULL;
+	char			*psz;
+	uint32_t		dwSize = 16384 * 1024, dwXfer;
+	uint64_t		qwAmount = 4096 * 1024, qwMaxTime = 5000000;
+	uint8_t			abCDB[10], abCap[8], *pbBuf;
+	unsigned		uVendor, uProduct;
+	unsigned		i;
+	int				c;
+	bool			fOk, fWrites = false;
+
+	memset(&Timing, 0, sizeof(Timing));
+	while ((c = getopt(argc, argv, "d:WL:f:U:s:r:w:b:t:p:R:n:T:Vh")) != -1) {
+		switch (c) {
+		case 'd':	pszDevice = optarg;								break;
+		case 'W':	fWrites = true;									break;
+		case 'L':	bLUN = strtoul(optarg, NULL, 0);				break;
+		case 'f':	pszFile = optarg;								break;
+		case 'U':	iUasDepth = strtoul(optarg, NULL, 0);			break;
+		case 'V':	fVerify = true;									break;
+		case 's':	dwSize = strtoul(optarg, NULL, 0) * 1024;		break;
+		case 'r':	Timing.dwReadLatency = strtoul(optarg, NULL, 0);	break;
+		case 'w':	Timing.dwWriteLatency = strtoul(optarg, NULL, 0);	break;
+		case 'b':	Timing.dwBandwidth = strtoul(optarg, NULL, 0) * 1024;	break;
+		case 't':	pszSizes = optarg;								break;
+		case 'p':	pszPatterns = optarg;							break;
+		case 'R':	pszTrace = optarg;								break;
+		case 'n':	qwAmount = strtoull(optarg, NULL, 0) * 1024;	break;
+		case 'T':	qwMaxTime = strtoull(optarg, NULL, 0) * 1000;	break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	for (psz = (char *)pszSizes; *psz != '\0'; psz += (*psz == ',')) {
+		dwXfer = strtoul(psz, &psz, 0);
+		if ((dwXfer == 0) || ((dwXfer % 512) != 0) || (dwXfer > MAX_XFER) || ((*psz != ',') && (*psz != '\0'))) {
+			fprintf(stderr, "invalid transfer size %u\n", dwXfer);
+			return 1;
+		}
+	}
+	if ((iUasDepth < 0) || (iUasDepth > MAX_DEPTH) || ((iUasDepth > 0) && (pszDevice != NULL))) {
+		fprintf(stderr, "UAS takes 1 to %d commands, on the simulated device only\n", MAX_DEPTH);
+		return 1;
+	}
+	if ((pszTrace != NULL) && !LoadTrace(pszTrace)) {
+		return 1;
+	}
+
+	if (pszDevice != NULL) {
+#ifdef HAVE_LIBUSB
+		if ((sscanf(pszDevice, "%x:%x", &uVendor, &uProduct) != 2) || !UsbOpen(uVendor, uProduct)) {
+			return 1;
+		}
+#else
+		(void)uVendor;
+		(void)uProduct;
+		fprintf(stderr, "built without libusb, only the simulated device is available\n");
+		return 1;
+#endif
+	}
+	else {
+		if (!SimOpen(pszFile, dwSize, &Timing)) {
+			return 1;
+		}
+		bLUN = 0;
+		fWrites = true;
+	}
+
+	// disk size
+	memset(abCDB, 0, sizeof(abCDB));
+	abCDB[0] = SCSI_CMD_READ_CAPACITY_10;
+	if (Command(abCDB, 10, true, abCap, sizeof(abCap)) != 0) {
+		fprintf(stderr, "READ CAPACITY failed\n");
+		return 1;
+	}
+	dwNumBlocks = ((abCap[0] << 24) | (abCap[1] << 16) | (abCap[2] << 8) | abCap[3]) + 1;
+	fprintf(stderr, "disk has %u blocks of %u bytes\n", dwNumBlocks,
+		(abCap[4] << 24) | (abCap[5] << 16) | (abCap[6] << 8) | abCap[7]);
+	if (dwNumBlocks < META_DATA + MAX_XFER / 512) {
+		fprintf(stderr, "disk too small\n");
+		return 1;
+	}
+	for (i = 0; (int)i < iTraceLen; i++) {
+		if (pTrace[i].dwLBA + pTrace[i].dwBlocks > dwNumBlocks) {
+			fprintf(stderr, "trace goes past the end of the disk\n");
+			return 1;
+		}
+	}
+
+	// a buffer for each command in flight
+	pbBuf = malloc(MAX_DEPTH * MAX_XFER);
+	for (i = 0; i < MAX_DEPTH * MAX_XFER; i++) {
+		pbBuf[i] = i ^ (i >> 8);
+	}
+	pabWritten = calloc(dwNumBlocks / 8 + 1, 1);
+
+	printf("pattern,transfer size,commands,bytes,time (us),MB/s,IOPS,"
+		"avg latency (us),p50 latency (us),p90 latency (us),p99 latency (us),max latency (us)\n");
+	fOk = true;
+	for (i = 0; (i < NUM_PATTERNS) && fOk; i++) {
+		if (aPatterns[i].pfnNext == Replay) {
+			if (iTraceLen > 0) {
+				fOk = RunTest(&aPatterns[i], 0, qwAmount, qwMaxTime, pbBuf);
+			}
+			continue;
+		}
+		if (!InList(pszPatterns, aPatterns[i].pszName)) {
+			continue;
+		}
+		if (aPatterns[i].fWrites && !fWrites) {
+			fprintf(stderr, "* %s skipped, use -W to allow writes\n", aPatterns[i].pszName);
+			continue;
+		}
+		for (psz = (char *)pszSizes; (*psz != '\0') && fOk; psz += (*psz == ',')) {
+			dwXfer = strtoul(psz, &psz, 0);
+			fOk = RunTest(&aPatterns[i], dwXfer, qwAmount, qwMaxTime, pbBuf);
+		}
+	}
+
+	free(pbBuf);
+	return fOk ? 0 : 1;
+}
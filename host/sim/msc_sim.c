@@ -0,0 +1,726 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Mass storage simulation.
+
+	Runs the BOT and SCSI layers of the mass storage example on the PC, on
+	top of the simulated USB controller and a simulated block device. This
+	program plays the role of the USB host: it issues CBWs, moves the data
+	packet by packet and collects the CSWs, just like a real host would.
+
+	It writes a test pattern over the disk, reads it back and verifies it,
+	and reports throughput and per-command latency of both passes.
+	With several logical units, the commands of a pass alternate between
+	the units, so the latency of a fast unit next to a slow one shows.
+
+	A logical unit can also be a simulated SD card, served by the target
+	SD card driver (blockdev_sd.c and sdcard.c) over a simulated SPI bus.
+	The clock the driver negotiates is reported, and any violation of the
+	SD protocol seen by the card fails the run. Limiting the stable clock
+	or disabling high speed support exercises the fallback paths.
+	With -u, every unit that reports logical block provisioning gets an
+	UNMAP of a few ranges, which must read back as zeroes afterwards. On
+	the SD card, the erase commands must cover exactly the same ranges,
+	and no USB transaction may wait for an erase to finish unless -S is
+	given.
+
+	The SD card driver checks CRCs on the bus unless -C is given. Noise on
+	the bus (-e) shows whether corrupted blocks are caught and retried, or
+	end up on the host. With -B, the bus takes as long as it would at the
+	negotiated clock, so the throughput with and without CRC checking can
+	be compared; sdcrc_bench.sh does just that.
+
+	Writes go to block devices asynchronously where possible, so the BOT
+	layer NAKs the host while the medium is busy. The number of USB
+	transactions that took over 100 us shows how often the device was kept
+	from servicing anything else; -S on a LUN makes its writes synchronous
+	for comparison.
+
+	Human readable results go to stderr, a CSV line per pass and LUN goes
+	to stdout:
+	op,lun,transfer size,bytes,time (us),kB/s,avg latency (us),max latency (us),
+	slow USB transactions,longest USB transaction (us)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "usbapi.h"
+#include "usbhw_lpc.h"
+
+#include "msc_bot.h"
+#include "msc_scsi.h"
+#include "blockdev.h"
+
+#include "usbhw_sim.h"
+#include "blockdev_sim.h"
+#include "sdcard_sim.h"
+#include "sdcard.h"
+
+#define BLOCKSIZE		512
+#define MAX_PACKET_SIZE	512			/**< largest bulk packet size */
+#define TIMEOUT_US		1000000		/**< give up waiting for the device */
+#define SLOW_CALL_US	100			/**< a USB transaction that holds up the device */
+
+#define CBW_SIGNATURE	0x43425355
+#define CSW_SIGNATURE	0x53425355
+
+#define SCSI_CMD_INQUIRY			0x12
+#define SCSI_CMD_READ_CAPACITY_10	0x25
+#define SCSI_CMD_READ_10			0x28
+#define SCSI_CMD_WRITE_10			0x2A
+#define SCSI_CMD_UNMAP				0x42
+#define SCSI_CMD_SERVICE_ACTION_IN_16	0x9E
+
+#define SAI_READ_CAPACITY_16		0x10
+#define VPD_BLOCK_LIMITS			0xB0
+
+#define UNMAP_RANGES				3
+#define UNMAP_ERASE_US				20000	/**< SD card erase time in the UNMAP test */
+
+/** Per-LUN state of a test pass */
+typedef struct {
+	uint32_t	dwNumBlocks;		/**< capacity reported by READ CAPACITY */
+	uint32_t	dwLBA;				/**< next LBA to access */
+	uint32_t	dwBytes;			/**< bytes transferred in this pass */
+	uint64_t	qwSumLat;			/**< sum of command latencies (us) */
+	uint64_t	qwMaxLat;			/**< largest command latency (us) */
+	int			iCmds;				/**< commands executed in this pass */
+	bool		fCard;				/**< simulated SD card */
+	bool		fSync;				/**< synchronous writes and discards */
+} TSimLUN;
+
+static int		iPacketSize = 64;	/**< bulk packet size */
+static int		iCardStableClock = 0;
+static bool		fCardHighSpeed = true;
+static bool		fCardCrc = true;
+static bool		fCardBusTiming = false;
+static uint32_t	dwCardNoise = 0;
+
+static TBlockDevOps		aSyncOps[SIM_MAX_DEVS];
+
+static int		iSlowCalls;			/**< USB transactions over SLOW_CALL_US in this pass */
+static uint64_t	qwMaxCall;			/**< longest USB transaction in this pass (us) */
+static uint32_t	dwTag;
+static TSimLUN	aSimLUN[SIM_MAX_DEVS];
+static int		iNumLUNs;
+
+
+static void PutBE32(uint8_t *pb, uint32_t dw)
+{
+	pb[0] = dw >> 24;
+	pb[1] = dw >> 16;
+	pb[2] = dw >> 8;
+	pb[3] = dw;
+}
+
+
+static uint32_t GetBE32(const uint8_t *pb)
+{
+	return ((uint32_t)pb[0] << 24) | (pb[1] << 16) | (pb[2] << 8) | pb[3];
+}
+
+
+// a bulk OUT transaction, timed
+static int HostOut(uint8_t bEP, const uint8_t *pbBuf, int iLen)
+{
+	uint64_t	qwStart;
+	int			i;
+
+	qwStart = SimTimeUs();
+	i = SimHostOut(bEP, pbBuf, iLen);
+	qwStart = SimTimeUs() - qwStart;
+	if (qwStart > SLOW_CALL_US) {
+		iSlowCalls++;
+	}
+	if (qwStart > qwMaxCall) {
+		qwMaxCall = qwStart;
+	}
+	return i;
+}
+
+
+// a bulk IN transaction, timed
+static int HostIn(uint8_t bEP, uint8_t *pbBuf, int iMaxLen)
+{
+	uint64_t	qwStart;
+	int			i;
+
+	qwStart = SimTimeUs();
+	i = SimHostIn(bEP, pbBuf, iMaxLen);
+	qwStart = SimTimeUs() - qwStart;
+	if (qwStart > SLOW_CALL_US) {
+		iSlowCalls++;
+	}
+	if (qwStart > qwMaxCall) {
+		qwMaxCall = qwStart;
+	}
+	return i;
+}
+
+
+/**
+	Executes one SCSI command through the bulk-only transport
+
+	@param [in]	bLUN	Logical unit number
+	@param [in]	pbCDB	Command block
+	@param [in]	iCDBLen	Command block length
+	@param [in]	fIn		true for device-to-host data
+	@param [in,out] pbData	Data buffer
+	@param [in]	dwLen	Expected data transfer length
+
+	@return CSW status (0 = passed), or -1 on a transport error
+ */
+static int BotCommand(uint8_t bLUN, const uint8_t *pbCDB, int iCDBLen, bool fIn, uint8_t *pbData, uint32_t dwLen)
+{
+	uint8_t		abCBW[31], abCSW[13], abPacket[MAX_PACKET_SIZE];
+	uint32_t	dwDone;
+	uint64_t	qwWait;
+	int			iPacket, iChunk, i;
+
+	iPacket = SimHostGetMaxPacketSize(MSC_BULK_IN_EP);
+
+	// command
+	memset(abCBW, 0, sizeof(abCBW));
+	SimPutLE32(&abCBW[0], CBW_SIGNATURE);
+	SimPutLE32(&abCBW[4], ++dwTag);
+	SimPutLE32(&abCBW[8], dwLen);
+	abCBW[12] = fIn ? 0x80 : 0x00;
+	abCBW[13] = bLUN;
+	abCBW[14] = iCDBLen;
+	memcpy(&abCBW[15], pbCDB, iCDBLen);
+	qwWait = SimTimeUs();
+	while ((i = HostOut(MSC_BULK_OUT_EP, abCBW, sizeof(abCBW))) == SIM_NAK) {
+		if (SimTimeUs() - qwWait > TIMEOUT_US) {
+			fprintf(stderr, "device does not take CBW\n");
+			return -1;
+		}
+	}
+	if (i < 0) {
+		fprintf(stderr, "CBW stalled\n");
+		return -1;
+	}
+
+	// data
+	dwDone = 0;
+	qwWait = SimTimeUs();
+	while (dwDone < dwLen) {
+		iChunk = (dwLen - dwDone < (uint32_t)iPacket) ? (int)(dwLen - dwDone) : iPacket;
+		if (fIn) {
+			i = HostIn(MSC_BULK_IN_EP, abPacket, iPacket);
+			if (i > 0) {
+				memcpy(pbData + dwDone, abPacket, (i < iChunk) ? i : iChunk);
+			}
+		}
+		else {
+			i = HostOut(MSC_BULK_OUT_EP, pbData + dwDone, iChunk);
+		}
+		if (i == SIM_NAK) {
+			if (SimTimeUs() - qwWait > TIMEOUT_US) {
+				fprintf(stderr, "device not responding in data phase\n");
+				return -1;
+			}
+			continue;
+		}
+		if (i == SIM_STALL) {
+			SimHostClearHalt(fIn ? MSC_BULK_IN_EP : MSC_BULK_OUT_EP);
+			break;
+		}
+		qwWait = SimTimeUs();
+		dwDone += i;
+		if (i < iPacket) {
+			// short packet ends the data phase
+			break;
+		}
+	}
+
+	// status
+	qwWait = SimTimeUs();
+	while ((i = HostIn(MSC_BULK_IN_EP, abCSW, sizeof(abCSW))) < 0) {
+		if (i == SIM_STALL) {
+			SimHostClearHalt(MSC_BULK_IN_EP);
+		}
+		if (SimTimeUs() - qwWait > TIMEOUT_US) {
+			fprintf(stderr, "no CSW\n");
+			return -1;
+		}
+	}
+	if ((i != 13) || (SimGetLE32(&abCSW[0]) != CSW_SIGNATURE) || (SimGetLE32(&abCSW[4]) != dwTag)) {
+		fprintf(stderr, "invalid CSW\n");
+		return -1;
+	}
+	return abCSW[12];
+}
+
+
+static int ReadWrite10(uint8_t bLUN, bool fRead, uint32_t dwLBA, uint16_t wBlocks, uint8_t *pbData)
+{
+	uint8_t abCDB[10];
+
+	memset(abCDB, 0, sizeof(abCDB));
+	abCDB[0] = fRead ? SCSI_CMD_READ_10 : SCSI_CMD_WRITE_10;
+	abCDB[2] = dwLBA >> 24;
+	abCDB[3] = dwLBA >> 16;
+	abCDB[4] = dwLBA >> 8;
+	abCDB[5] = dwLBA;
+	abCDB[7] = wBlocks >> 8;
+	abCDB[8] = wBlocks;
+	return BotCommand(bLUN, abCDB, sizeof(abCDB), fRead, pbData, (uint32_t)wBlocks * BLOCKSIZE);
+}
+
+
+static void FillPattern(uint8_t *pbBuf, uint32_t dwLBA, uint32_t dwLen)
+{
+	uint32_t i;
+
+	for (i = 0; i < dwLen; i += 4) {
+		SimPutLE32(pbBuf + i, (dwLBA + i / BLOCKSIZE) ^ (i * 0x9E3779B1));
+	}
+}
+
+
+/**
+	Runs one sequential pass over all disks, alternating between them
+
+	@return true if all commands passed (and read data matched)
+ */
+static bool RunPass(bool fRead, uint32_t dwXfer, uint32_t dwTotal)
+{
+	TSimLUN		*pLUN;
+	uint8_t		*pbBuf, *pbRef;
+	uint32_t	dwBlocks;
+	uint64_t	qwStart, qwCmd, qwLat, qwTime;
+	int			i;
+	bool		fOk, fBusy;
+
+	pbBuf = malloc(dwXfer);
+	pbRef = malloc(dwXfer);
+	dwBlocks = dwXfer / BLOCKSIZE;
+	for (i = 0; i < iNumLUNs; i++) {
+		pLUN = &aSimLUN[i];
+		pLUN->dwLBA = 0;
+		pLUN->dwBytes = 0;
+		pLUN->iCmds = 0;
+		pLUN->qwMaxLat = 0;
+		pLUN->qwSumLat = 0;
+	}
+	iSlowCalls = 0;
+	qwMaxCall = 0;
+	fOk = true;
+
+	qwStart = SimTimeUs();
+	do {
+		fBusy = false;
+		for (i = 0; (i < iNumLUNs) && fOk; i++) {
+			pLUN = &aSimLUN[i];
+			if (pLUN->dwBytes >= dwTotal) {
+				continue;
+			}
+			fBusy = true;
+			if (pLUN->dwLBA + dwBlocks > pLUN->dwNumBlocks) {
+				pLUN->dwLBA = 0;
+			}
+			FillPattern(pbRef, pLUN->dwLBA, dwXfer);
+			if (!fRead) {
+				memcpy(pbBuf, pbRef, dwXfer);
+			}
+			qwCmd = SimTimeUs();
+			if (ReadWrite10(i, fRead, pLUN->dwLBA, dwBlocks, pbBuf) != 0) {
+				fprintf(stderr, "%s failed at LUN %d, LBA %u\n", fRead ? "READ10" : "WRITE10", i, pLUN->dwLBA);
+				fOk = false;
+				break;
+			}
+			qwLat = SimTimeUs() - qwCmd;
+			pLUN->qwSumLat += qwLat;
+			if (qwLat > pLUN->qwMaxLat) {
+				pLUN->qwMaxLat = qwLat;
+			}
+			if (fRead && (memcmp(pbBuf, pbRef, dwXfer) != 0)) {
+				fprintf(stderr, "data mismatch at LUN %d, LBA %u\n", i, pLUN->dwLBA);
+				fOk = false;
+				break;
+			}
+			pLUN->dwLBA += dwBlocks;
+			pLUN->dwBytes += dwXfer;
+			pLUN->iCmds++;
+		}
+	} while (fBusy && fOk);
+	qwTime = SimTimeUs() - qwStart;
+	if (qwTime == 0) {
+		qwTime = 1;
+	}
+
+	for (i = 0; i < iNumLUNs; i++) {
+		pLUN = &aSimLUN[i];
+		fprintf(stderr, "* %s LUN %d: %7u bytes in %llu us = %llu kB/s, latency avg %llu us, max %llu us\n",
+			fRead ? "read " : "write", i, pLUN->dwBytes, (unsigned long long)qwTime,
+			(unsigned long long)(pLUN->dwBytes * 1000ULL / qwTime),
+			(unsigned long long)(pLUN->iCmds ? pLUN->qwSumLat / pLUN->iCmds : 0),
+			(unsigned long long)pLUN->qwMaxLat);
+		printf("%s,%d,%u,%u,%llu,%llu,%llu,%llu,%d,%llu\n", fRead ? "read" : "write", i, dwXfer, pLUN->dwBytes,
+			(unsigned long long)qwTime, (unsigned long long)(pLUN->dwBytes * 1000ULL / qwTime),
+			(unsigned long long)(pLUN->iCmds ? pLUN->qwSumLat / pLUN->iCmds : 0),
+			(unsigned long long)pLUN->qwMaxLat, iSlowCalls, (unsigned long long)qwMaxCall);
+	}
+	fprintf(stderr, "* %s: %d USB transactions over %d us, longest %llu us\n", fRead ? "read " : "write",
+		iSlowCalls, SLOW_CALL_US, (unsigned long long)qwMaxCall);
+
+	free(pbBuf);
+	free(pbRef);
+	return fOk;
+}
+
+
+/**
+	Unmaps a few ranges of a LUN and checks that they read back as zeroes,
+	and that a simulated SD card erased exactly those ranges.
+
+	@return true if the LUN passed, or does not support UNMAP
+ */
+static bool UnmapTest(int iLUN)
+{
+	TSimLUN		*pLUN = &aSimLUN[iLUN];
+	uint8_t		abCDB[16], abData[64];
+	uint8_t		abZero[BLOCKSIZE], abBlock[BLOCKSIZE];
+	uint32_t	adwLBA[UNMAP_RANGES], adwLen[UNMAP_RANGES], dwMaxLen, dwMaxDesc, dw;
+	const TSDSimErase	*pErases;
+	int			i, iNumErases;
+
+	// provisioning support is reported by READ CAPACITY(16)
+	memset(abCDB, 0, sizeof(abCDB));
+	abCDB[0] = SCSI_CMD_SERVICE_ACTION_IN_16;
+	abCDB[1] = SAI_READ_CAPACITY_16;
+	PutBE32(&abCDB[10], 32);
+	if (BotCommand(iLUN, abCDB, 16, true, abData, 32) != 0) {
+		fprintf(stderr, "READ CAPACITY(16) failed on LUN %d\n", iLUN);
+		return false;
+	}
+	if (GetBE32(&abData[4]) + 1 != pLUN->dwNumBlocks) {
+		fprintf(stderr, "READ CAPACITY(16) reports wrong size on LUN %d\n", iLUN);
+		return false;
+	}
+	if ((abData[14] & 0x80) == 0) {
+		fprintf(stderr, "LUN %d does not support UNMAP\n", iLUN);
+		return true;
+	}
+
+	// the limits
+	memset(abCDB, 0, sizeof(abCDB));
+	abCDB[0] = SCSI_CMD_INQUIRY;
+	abCDB[1] = 1;
+	abCDB[2] = VPD_BLOCK_LIMITS;
+	abCDB[4] = sizeof(abData);
+	if (BotCommand(iLUN, abCDB, 6, true, abData, sizeof(abData)) != 0) {
+		fprintf(stderr, "Block Limits VPD page failed on LUN %d\n", iLUN);
+		return false;
+	}
+	dwMaxLen = GetBE32(&abData[20]);
+	dwMaxDesc = GetBE32(&abData[24]);
+	fprintf(stderr, "LUN %d: UNMAP of up to %u blocks in %u ranges\n", iLUN, dwMaxLen, dwMaxDesc);
+	if (dwMaxDesc < UNMAP_RANGES) {
+		return false;
+	}
+
+	// the start, the middle and the end of the disk
+	adwLBA[0] = 0;
+	adwLen[0] = 8;
+	adwLBA[1] = pLUN->dwNumBlocks / 2 + 3;
+	adwLen[1] = 100;
+	adwLBA[2] = pLUN->dwNumBlocks - 16;
+	adwLen[2] = 16;
+
+	// a range past the end must be rejected without touching anything
+	if (pLUN->fCard) {
+		SDSimClearEraseLog();
+	}
+	memset(abCDB, 0, sizeof(abCDB));
+	abCDB[0] = SCSI_CMD_UNMAP;
+	abCDB[8] = 8 + 2 * 16;
+	memset(abData, 0, sizeof(abData));
+	abData[1] = 6 + 2 * 16;
+	abData[3] = 2 * 16;
+	PutBE32(&abData[8 + 4], adwLBA[0]);
+	PutBE32(&abData[8 + 8], adwLen[0]);
+	PutBE32(&abData[24 + 4], pLUN->dwNumBlocks - 1);
+	PutBE32(&abData[24 + 8], 2);
+	if (BotCommand(iLUN, abCDB, 10, false, abData, abCDB[8]) != 1) {
+		fprintf(stderr, "UNMAP past the end not rejected on LUN %d\n", iLUN);
+		return false;
+	}
+	if (pLUN->fCard && (SDSimGetEraseLog(&iNumErases), iNumErases != 0)) {
+		fprintf(stderr, "rejected UNMAP erased blocks\n");
+		return false;
+	}
+
+	// the real thing, with erases that take long enough to notice
+	if (pLUN->fCard) {
+		SDSimSetBusy(20, UNMAP_ERASE_US);
+	}
+	qwMaxCall = 0;
+	abCDB[8] = 8 + UNMAP_RANGES * 16;
+	memset(abData, 0, sizeof(abData));
+	abData[1] = 6 + UNMAP_RANGES * 16;
+	abData[3] = UNMAP_RANGES * 16;
+	for (i = 0; i < UNMAP_RANGES; i++) {
+		PutBE32(&abData[8 + i * 16 + 4], adwLBA[i]);
+		PutBE32(&abData[8 + i * 16 + 8], adwLen[i]);
+	}
+	if (BotCommand(iLUN, abCDB, 10, false, abData, abCDB[8]) != 0) {
+		fprintf(stderr, "UNMAP failed on LUN %d\n", iLUN);
+		return false;
+	}
+	if (pLUN->fCard && !pLUN->fSync && (qwMaxCall >= UNMAP_ERASE_US / 2)) {
+		fprintf(stderr, "UNMAP held up the device for %u us\n", (unsigned)qwMaxCall);
+		return false;
+	}
+
+	if (pLUN->fCard) {
+		pErases = SDSimGetEraseLog(&iNumErases);
+		if (iNumErases != UNMAP_RANGES) {
+			fprintf(stderr, "SD card did %d erases instead of %d\n", iNumErases, UNMAP_RANGES);
+			return false;
+		}
+		for (i = 0; i < UNMAP_RANGES; i++) {
+			if ((pErases[i].dwFirst != adwLBA[i]) || (pErases[i].dwLast != adwLBA[i] + adwLen[i] - 1)) {
+				fprintf(stderr, "SD card erased %u-%u instead of %u-%u\n", pErases[i].dwFirst,
+					pErases[i].dwLast, adwLBA[i], adwLBA[i] + adwLen[i] - 1);
+				return false;
+			}
+		}
+	}
+
+	// unmapped blocks read as zeroes, their neighbours keep the pattern
+	memset(abZero, 0, sizeof(abZero));
+	for (i = 0; i < UNMAP_RANGES; i++) {
+		for (dw = adwLBA[i]; dw < adwLBA[i] + adwLen[i]; dw++) {
+			if ((ReadWrite10(iLUN, true, dw, 1, abBlock) != 0) || (memcmp(abBlock, abZero, BLOCKSIZE) != 0)) {
+				fprintf(stderr, "LUN %d, LBA %u not unmapped\n", iLUN, dw);
+				return false;
+			}
+		}
+	}
+	if ((ReadWrite10(iLUN, true, adwLBA[0] + adwLen[0], 1, abBlock) != 0) ||
+		(memcmp(abBlock, abZero, BLOCKSIZE) == 0)) {
+		fprintf(stderr, "LUN %d, LBA %u unmapped too\n", iLUN, adwLBA[0] + adwLen[0]);
+		return false;
+	}
+	fprintf(stderr, "* unmap LUN %d: ok\n", iLUN);
+	return true;
+}
+
+
+static void Usage(const char *pszName)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [-L [LUN options]]\n"
+		"  -t <bytes> transfer size per command, multiple of 512 (default 4096)\n"
+		"  -n <kB>    amount of data to write and read per LUN (default 1024)\n"
+		"  -u         test UNMAP after the read pass\n"
+		"  -p <bytes> bulk packet size, 32, 64 or 512 (default 64)\n"
+		"LUN options, -L starts the options of the next LUN (max %d):\n"
+		"  -f <file>  use a memory-mapped image file instead of a RAM disk\n"
+		"  -c         use the SD card driver on a simulated card (one LUN only)\n"
+		"  -k <kHz>   highest stable SPI clock of the card (default unlimited)\n"
+		"  -l         card without high speed support\n"
+		"  -C         no CRC checking on the SD card bus\n"
+		"  -e <n>     flip a bit in one out of n bytes on the SD card bus\n"
+		"  -B         SD card bus transfers take real time\n"
+		"  -S         synchronous writes, the device spins while the medium is busy\n"
+		"  -s <kB>    disk size (default 4096, 0 = size of existing image)\n"
+		"  -r <us>    read latency per block (default 0)\n"
+		"  -w <us>    write latency per block (default 0, SD card 20, erase 10x)\n"
+		"  -b <kB/s>  medium bandwidth (default 0 = unlimited)\n",
+		pszName, SIM_MAX_DEVS);
+}
+
+
+// returns a copy of a block device without asynchronous writes
+static const TBlockDevOps *SyncOps(int iDev, const TBlockDevOps *pOps)
+{
+	aSyncOps[iDev] = *pOps;
+	aSyncOps[iDev].pfnStartWrite = NULL;
+	aSyncOps[iDev].pfnPoll = NULL;
+	return &aSyncOps[iDev];
+}
+
+
+/**
+	Local function to set up a simulated block device and serve it as LUN
+ */
+static bool AddLUN(int iDev, bool fCard, bool fSync, const char *pszFile, uint32_t dwSize, const TBlockDevTiming *pTiming)
+{
+	const TBlockDevOps *pOps;
+	bool	fHighSpeed;
+	int		iClock;
+
+	aSimLUN[iDev].fCard = fCard;
+	aSimLUN[iDev].fSync = fSync;
+	if (fCard) {
+		if (!SDSimInit(dwSize / BLOCKSIZE)) {
+			return false;
+		}
+		SDSimSetClock(iCardStableClock, fCardHighSpeed);
+		SDSimSetBusTiming(fCardBusTiming);
+		SDSetCRC(fCardCrc);
+		if (pTiming->dwWriteLatency != 0) {
+			SDSimSetBusy(pTiming->dwWriteLatency, 10 * pTiming->dwWriteLatency);
+		}
+		if (!SCSIAddLUN(fSync ? SyncOps(iDev, &BlockDevSD) : &BlockDevSD)) {
+			return false;
+		}
+		iClock = SDSimGetClock(&fHighSpeed);
+		fprintf(stderr, "LUN %d: SD card at %d kHz, %s mode, CRC %s\n", iDev, iClock / 1000,
+			fHighSpeed ? "high speed" : "default speed", fCardCrc ? "on" : "off");
+		// the noise starts after initialisation
+		SDSimSetNoise(dwCardNoise);
+		return true;
+	}
+	pOps = (pszFile != NULL) ? BlockDevSimFile(iDev, pszFile, dwSize) : BlockDevSimRam(iDev, dwSize);
+	if (pOps == NULL) {
+		return false;
+	}
+	BlockDevSimTiming(iDev, pTiming);
+	return SCSIAddLUN(fSync ? SyncOps(iDev, pOps) : pOps);
+}
+
+
+int main(int argc, char *argv[])
+{
+	TBlockDevTiming	Timing;
+	const char		*pszFile = NULL;
+	uint32_t		dwSize = 4096 * 1024;
+	uint32_t		dwXfer = 4096;
+	uint32_t		dwTotal = 1024 * 1024;
+	uint8_t			abCDB[10], abCap[8];
+	uint32_t		dwBitErrors, dwCrcErrors;
+	int				c, i;
+	bool			fOk, fCard = false, fHaveCard = false, fUnmap = false, fSync = false;
+
+	memset(&Timing, 0, sizeof(Timing));
+	iNumLUNs = 0;
+	while ((c = getopt(argc, argv, "f:ck:lCe:BSs:t:n:up:r:w:b:Lh")) != -1) {
+		switch (c) {
+		case 'f':	pszFile = optarg;								break;
+		case 'c':	fCard = true;									break;
+		case 'k':	iCardStableClock = strtoul(optarg, NULL, 0) * 1000;	break;
+		case 'l':	fCardHighSpeed = false;							break;
+		case 'C':	fCardCrc = false;								break;
+		case 'e':	dwCardNoise = strtoul(optarg, NULL, 0);			break;
+		case 'B':	fCardBusTiming = true;							break;
+		case 'S':	fSync = true;									break;
+		case 'u':	fUnmap = true;									break;
+		case 'p':	iPacketSize = strtoul(optarg, NULL, 0);			break;
+		case 's':	dwSize = strtoul(optarg, NULL, 0) * 1024;		break;
+		case 't':	dwXfer = strtoul(optarg, NULL, 0);				break;
+		case 'n':	dwTotal = strtoul(optarg, NULL, 0) * 1024;		break;
+		case 'r':	Timing.dwReadLatency = strtoul(optarg, NULL, 0);	break;
+		case 'w':	Timing.dwWriteLatency = strtoul(optarg, NULL, 0);	break;
+		case 'b':	Timing.dwBandwidth = strtoul(optarg, NULL, 0) * 1024;	break;
+		case 'L':
+			if ((iNumLUNs + 1 >= SIM_MAX_DEVS) || (fCard && fHaveCard) ||
+				!AddLUN(iNumLUNs, fCard, fSync, pszFile, dwSize, &Timing)) {
+				Usage(argv[0]);
+				return 1;
+			}
+			iNumLUNs++;
+			// next LUN starts from the defaults again
+			fHaveCard = fHaveCard || fCard;
+			fCard = false;
+			fSync = false;
+			pszFile = NULL;
+			dwSize = 4096 * 1024;
+			memset(&Timing, 0, sizeof(Timing));
+			break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((dwXfer == 0) || ((dwXfer % BLOCKSIZE) != 0) || (dwXfer / BLOCKSIZE > 0xFFFF)) {
+		fprintf(stderr, "invalid transfer size %u\n", dwXfer);
+		return 1;
+	}
+	// the 31-byte CBW has to fit in one packet
+	if ((iPacketSize < 32) || (iPacketSize > MAX_PACKET_SIZE) || ((iPacketSize & (iPacketSize - 1)) != 0)) {
+		fprintf(stderr, "invalid packet size %d\n", iPacketSize);
+		return 1;
+	}
+	if ((fCard && fHaveCard) || !AddLUN(iNumLUNs, fCard, fSync, pszFile, dwSize, &Timing)) {
+		Usage(argv[0]);
+		return 1;
+	}
+	iNumLUNs++;
+
+	// set up the device side, like main_msc.c and SET_CONFIGURATION do
+	USBHwInit();
+	USBHwNakIntEnable(INACK_BI | INACK_BO);
+	USBHwEPConfig(MSC_BULK_IN_EP, iPacketSize);
+	USBHwEPConfig(MSC_BULK_OUT_EP, iPacketSize);
+	USBHwRegisterEPIntHandler(MSC_BULK_IN_EP, MSCBotBulkIn);
+	USBHwRegisterEPIntHandler(MSC_BULK_OUT_EP, MSCBotBulkOut);
+	MSCBotReset();
+
+	// check the disk sizes through the SCSI layer
+	for (i = 0; i < iNumLUNs; i++) {
+		memset(abCDB, 0, sizeof(abCDB));
+		abCDB[0] = SCSI_CMD_READ_CAPACITY_10;
+		if (BotCommand(i, abCDB, 10, true, abCap, sizeof(abCap)) != 0) {
+			fprintf(stderr, "READ CAPACITY failed on LUN %d\n", i);
+			return 1;
+		}
+		aSimLUN[i].dwNumBlocks = ((abCap[0] << 24) | (abCap[1] << 16) | (abCap[2] << 8) | abCap[3]) + 1;
+		fprintf(stderr, "LUN %d has %u blocks\n", i, aSimLUN[i].dwNumBlocks);
+		if (aSimLUN[i].dwNumBlocks < dwXfer / BLOCKSIZE) {
+			fprintf(stderr, "disk too small for transfer size %u\n", dwXfer);
+			return 1;
+		}
+	}
+
+	fOk = RunPass(false, dwXfer, dwTotal);
+	fOk = fOk && RunPass(true, dwXfer, dwTotal);
+	for (i = 0; (i < iNumLUNs) && fOk && fUnmap; i++) {
+		fOk = UnmapTest(i);
+	}
+	if (fHaveCard || fCard) {
+		dwBitErrors = SDSimGetBitErrors(&dwCrcErrors);
+		fprintf(stderr, "SD bus: %u bit errors, %u rejected by the card\n", dwBitErrors, dwCrcErrors);
+	}
+	if (SDSimGetViolations() != 0) {
+		fprintf(stderr, "%u SD protocol violations\n", SDSimGetViolations());
+		fOk = false;
+	}
+	if (SimHostGetOverruns() != 0) {
+		fprintf(stderr, "%u endpoint overruns\n", SimHostGetOverruns());
+		fOk = false;
+	}
+	return fOk ? 0 : 1;
+}
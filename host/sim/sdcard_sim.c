@@ -0,0 +1,808 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file
+	Model of an SDHC card in SPI mode, behind the spi.h API.
+
+	Every byte clocked by SPITransfer is fed to the card, which answers
+	with the byte it shifts out at the same time. The card collects 6-byte
+	commands, answers them after one byte of NCR, sends read data after a
+	short access time, accepts write data blocks and signals busy (DO low)
+	for a configurable time after programming or erasing. Busy times are
+	real time, so a driver that spins on the busy signal is as slow as it
+	would be on a real card.
+
+	Commands that arrive out of sequence are answered with the error bits
+	a real card would set, so driver mistakes show up as failing calls.
+
+	The card supports the high speed function (CMD6) unless told not to.
+	Clocking it faster than its current speed mode allows counts as a
+	protocol violation. Above the highest stable clock, as set by
+	SDSimSetClock, the bytes the card sends get corrupted, just like on a
+	bus with too much capacitance.
+
+	Random bit errors in both directions can be added with SDSimSetNoise.
+	With CRC checking on (CMD59), the card rejects corrupted commands and
+	write data like a real card, and sends a correct CRC16 with all data,
+	so the driver can drop blocks that were corrupted on their way to the
+	host. SDSimSetBusTiming makes every transfer take as long as it would
+	on the bus at the configured clock, so the cost of computing CRCs can
+	be compared to the time spent moving the data.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spi.h"
+#include "sdcard_sim.h"
+
+#define BLOCKSIZE				512
+
+#define R1_IDLE_STATE			(1<<0)
+#define R1_ERASE_RESET			(1<<1)
+#define R1_ILLEGAL_COMMAND		(1<<2)
+#define R1_COM_CRC_ERROR		(1<<3)
+#define R1_ERASE_SEQ_ERROR		(1<<4)
+#define R1_ADDRESS_ERROR		(1<<5)
+#define R1_PARAMETER_ERROR		(1<<6)
+
+#define CMD_GO_IDLE_STATE			0
+#define CMD_SWITCH_FUNC				6
+#define CMD_SEND_IF_COND			8
+#define CMD_SEND_CSD				9
+#define CMD_SEND_CID				10
+#define CMD_SEND_STATUS				13
+#define CMD_SET_BLOCKLEN			16
+#define CMD_READ_SINGLE_BLOCK		17
+#define CMD_WRITE_BLOCK				24
+#define CMD_ERASE_WR_BLK_START_ADDR	32
+#define CMD_ERASE_WR_BLK_END_ADDR	33
+#define CMD_ERASE					38
+#define CMD_SD_SEND_OP_COND			41
+#define CMD_APP_CMD					55
+#define CMD_READ_OCR				58
+#define CMD_CRC_ON_OFF				59
+
+#define TOKEN_START_BLOCK			0xFE
+#define DATA_RESP_ACCEPTED			0x05
+
+#define OCR_READY					(1UL<<31)
+#define OCR_CCS						(1UL<<30)
+#define OCR_VOLTAGE					0x00FF8000UL
+
+#define NAC_BYTES					2	/**< access time before a read data token */
+#define INIT_POLLS					3	/**< ACMD41 calls before the card is ready */
+
+#define CLOCK_DEFAULT				25000000
+#define CLOCK_HIGH_SPEED			50000000
+#define TRAN_SPEED_DEFAULT			0x32	/**< 25 MHz */
+#define TRAN_SPEED_HIGH				0x5A	/**< 50 MHz */
+
+/** What the card expects from the host next */
+typedef enum {
+	eCommand,		/**< command bytes */
+	eWriteToken,	/**< start block token of a write */
+	eWriteData		/**< write data and CRC */
+} ESimState;
+
+/** State of the simulated card */
+typedef struct {
+	uint8_t		*pbMedium;
+	uint32_t	dwBlocks;
+
+	// host side of the bus
+	int			iSpeed;				/**< SPI clock frequency (Hz) */
+	int			iStableClock;		/**< highest clock without errors, 0 = any */
+	int			iCorrupt;			/**< counts bytes sent above the stable clock */
+	uint32_t	dwViolations;		/**< protocol violations seen */
+	bool		fSpeedChecked;		/**< iSpeed checked against speed mode */
+	bool		fBusTiming;			/**< transfers take real time */
+	uint64_t	qwBusFree;			/**< end of the last transfer (ns) */
+	uint32_t	dwNoise;			/**< one bit error per this many bytes, 0 = none */
+	uint32_t	dwRandom;			/**< noise generator state */
+	uint32_t	dwBitErrors;		/**< bits flipped by noise */
+	uint32_t	dwCrcErrors;		/**< commands and data blocks rejected for their CRC */
+
+	// card state
+	ESimState	eState;
+	bool		fIdle;				/**< still in idle state */
+	bool		fAppCmd;			/**< previous command was CMD55 */
+	bool		fCrcOn;				/**< CRC checking on (CMD59) */
+	bool		fHsSupport;			/**< high speed function available */
+	bool		fHighSpeed;			/**< high speed mode selected */
+	int			iInitPolls;			/**< ACMD41 calls left until ready */
+	uint8_t		abCmd[6];
+	int			iCmdPos;
+
+	// write in progress
+	uint32_t	dwWriteBlock;
+	uint8_t		abData[BLOCKSIZE + 2];
+	int			iDataPos;
+	uint16_t	wDataCrc;			/**< CRC16 of the data so far */
+
+	// erase sequence
+	bool		fEraseStart, fEraseEnd;
+	uint32_t	dwEraseStart, dwEraseEnd;
+
+	// bytes to shift out, followed by the busy signal
+	uint8_t		abOut[BLOCKSIZE + 16];
+	int			iOutHead, iOutTail;
+	uint64_t	qwBusyUntil;		/**< end of busy signal (ns) */
+	int			iWriteBusy, iEraseBusy;	/**< busy times (us) */
+
+	TSDSimErase	aErases[SDSIM_MAX_ERASES];
+	int			iNumErases;
+} TSDSim;
+
+static TSDSim	Card;
+
+
+static uint8_t Crc7(const uint8_t *pb, int iLen)
+{
+	uint8_t	bCrc = 0;
+	int		i, j;
+
+	for (i = 0; i < iLen; i++) {
+		for (j = 7; j >= 0; j--) {
+			bCrc <<= 1;
+			if ((((pb[i] >> j) ^ (bCrc >> 7)) & 1) != 0) {
+				bCrc ^= 0x09;
+			}
+		}
+	}
+	return bCrc & 0x7F;
+}
+
+
+static uint16_t Crc16Byte(uint16_t wCrc, uint8_t b)
+{
+	int		j;
+
+	wCrc ^= b << 8;
+	for (j = 0; j < 8; j++) {
+		wCrc = (wCrc & 0x8000) ? ((wCrc << 1) ^ 0x1021) : (wCrc << 1);
+	}
+	return wCrc;
+}
+
+
+static uint16_t Crc16(const uint8_t *pb, int iLen)
+{
+	uint16_t	wCrc = 0;
+	int			i;
+
+	for (i = 0; i < iLen; i++) {
+		wCrc = Crc16Byte(wCrc, pb[i]);
+	}
+	return wCrc;
+}
+
+
+static uint64_t SimNow(void)
+{
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+static void SimBusy(int iTime)
+{
+	Card.qwBusyUntil = (iTime > 0) ? (SimNow() + (uint64_t)iTime * 1000) : 0;
+}
+
+
+static void SimOut(uint8_t b)
+{
+	Card.abOut[Card.iOutTail++] = b;
+}
+
+
+static void SimOut32(uint32_t dw)
+{
+	SimOut(dw >> 24);
+	SimOut(dw >> 16);
+	SimOut(dw >> 8);
+	SimOut(dw);
+}
+
+
+// queues a data block with start token and CRC, after the access time
+static void SimOutData(const uint8_t *pbData, int iLen)
+{
+	uint16_t	wCrc;
+	int			i;
+
+	for (i = 0; i < NAC_BYTES; i++) {
+		SimOut(0xFF);
+	}
+	SimOut(TOKEN_START_BLOCK);
+	memcpy(&Card.abOut[Card.iOutTail], pbData, iLen);
+	Card.iOutTail += iLen;
+	wCrc = Crc16(pbData, iLen);
+	SimOut(wCrc >> 8);
+	SimOut(wCrc);
+}
+
+
+// builds the CSD of an SDHC card (CSD version 2.0)
+static void SimGetCSD(uint8_t *pbCSD)
+{
+	uint32_t	dwCSize;
+
+	dwCSize = Card.dwBlocks / 1024 - 1;
+	memset(pbCSD, 0, 16);
+	pbCSD[0] = 0x40;			// CSD_STRUCTURE = 1
+	pbCSD[1] = 0x0E;			// TAAC
+	pbCSD[3] = Card.fHighSpeed ? TRAN_SPEED_HIGH : TRAN_SPEED_DEFAULT;
+	pbCSD[4] = 0x5B;			// CCC
+	pbCSD[5] = 0x59;			// CCC, READ_BL_LEN = 9
+	pbCSD[7] = (dwCSize >> 16) & 0x3F;
+	pbCSD[8] = dwCSize >> 8;
+	pbCSD[9] = dwCSize;
+	pbCSD[10] = 0x7F;			// ERASE_BLK_EN, SECTOR_SIZE
+	pbCSD[11] = 0x80;
+	pbCSD[12] = 0x0A;			// R2W_FACTOR, WRITE_BL_LEN
+	pbCSD[13] = 0x40;
+	pbCSD[15] = (Crc7(pbCSD, 15) << 1) | 1;
+}
+
+
+static void SimViolation(const char *pszWhat)
+{
+	fprintf(stderr, "SD: %s\n", pszWhat);
+	Card.dwViolations++;
+}
+
+
+/**
+	Local function to handle CMD6 for function group 1 (access mode), the
+	other groups only have their default function.
+ */
+static void SimSwitchFunc(uint32_t dwArg, uint8_t *pbStatus)
+{
+	int		iFunc, iResult;
+
+	iFunc = dwArg & 0x0F;
+	if (iFunc == 0x0F) {
+		// no change
+		iResult = Card.fHighSpeed ? 1 : 0;
+	}
+	else if ((iFunc == 0) || ((iFunc == 1) && Card.fHsSupport)) {
+		iResult = iFunc;
+	}
+	else {
+		iResult = 0x0F;
+	}
+	if ((dwArg & 0x80000000) && (iResult != 0x0F)) {
+		Card.fHighSpeed = (iResult == 1);
+		Card.fSpeedChecked = false;
+	}
+	if ((dwArg & 0x80000000) && (iResult == 0x0F)) {
+		SimViolation("switch to unsupported function");
+	}
+
+	// 512-bit switch status
+	memset(pbStatus, 0, 64);
+	pbStatus[1] = 100;						// maximum current (mA)
+	pbStatus[2] = pbStatus[4] = pbStatus[6] = pbStatus[8] = pbStatus[10] = 0x80;
+	pbStatus[3] = pbStatus[5] = pbStatus[7] = pbStatus[9] = pbStatus[11] = 0x01;
+	pbStatus[12] = 0x80;					// group 1 support
+	pbStatus[13] = Card.fHsSupport ? 0x03 : 0x01;
+	pbStatus[16] = iResult;					// group 1 selection
+}
+
+
+static void SimLogErase(uint32_t dwFirst, uint32_t dwLast)
+{
+	if (Card.iNumErases < SDSIM_MAX_ERASES) {
+		Card.aErases[Card.iNumErases].dwFirst = dwFirst;
+		Card.aErases[Card.iNumErases].dwLast = dwLast;
+	}
+	Card.iNumErases++;
+}
+
+
+/**
+	Local function to execute a complete command and queue the response
+ */
+static void SimCommand(void)
+{
+	uint8_t		bCmd, bR1;
+	uint32_t	dwArg;
+	uint8_t		abReg[64];
+	bool		fApp;
+
+	bCmd = Card.abCmd[0] & 0x3F;
+	dwArg = (Card.abCmd[1] << 24) | (Card.abCmd[2] << 16) | (Card.abCmd[3] << 8) | Card.abCmd[4];
+	fApp = Card.fAppCmd;
+	Card.fAppCmd = false;
+
+	// a new command aborts whatever the host did not read
+	Card.iOutHead = Card.iOutTail = 0;
+	Card.qwBusyUntil = 0;
+	SimOut(0xFF);		// NCR
+
+	bR1 = Card.fIdle ? R1_IDLE_STATE : 0;
+
+	// CMD0 and CMD8 are always protected by a CRC
+	if ((Card.fCrcOn || (bCmd == CMD_GO_IDLE_STATE) || (bCmd == CMD_SEND_IF_COND)) &&
+		((Card.abCmd[5] >> 1) != Crc7(Card.abCmd, 5))) {
+		Card.dwCrcErrors++;
+		SimOut(bR1 | R1_COM_CRC_ERROR);
+		return;
+	}
+
+	// anything but the next step of an erase sequence cancels it
+	if ((bCmd != CMD_ERASE_WR_BLK_END_ADDR) && (bCmd != CMD_ERASE) && (bCmd != CMD_SEND_STATUS)) {
+		if (Card.fEraseStart && (bCmd != CMD_ERASE_WR_BLK_START_ADDR)) {
+			bR1 |= R1_ERASE_RESET;
+		}
+		Card.fEraseStart = Card.fEraseEnd = false;
+	}
+
+	if (Card.fIdle && (bCmd != CMD_GO_IDLE_STATE) && (bCmd != CMD_SEND_IF_COND) &&
+		(bCmd != CMD_APP_CMD) && (bCmd != CMD_READ_OCR) && (bCmd != CMD_CRC_ON_OFF) &&
+		!(fApp && (bCmd == CMD_SD_SEND_OP_COND))) {
+		SimOut(bR1 | R1_ILLEGAL_COMMAND);
+		return;
+	}
+
+	if (fApp && (bCmd == CMD_SD_SEND_OP_COND)) {
+		if ((dwArg & OCR_CCS) == 0) {
+			// a host that does not support SDHC never gets this card ready
+			SimOut(bR1);
+			return;
+		}
+		if (--Card.iInitPolls <= 0) {
+			Card.fIdle = false;
+		}
+		SimOut(Card.fIdle ? R1_IDLE_STATE : 0);
+		return;
+	}
+
+	switch (bCmd) {
+
+	case CMD_GO_IDLE_STATE:
+		Card.fIdle = true;
+		Card.fCrcOn = false;
+		Card.fHighSpeed = false;
+		Card.fSpeedChecked = false;
+		Card.iInitPolls = INIT_POLLS;
+		SimOut(R1_IDLE_STATE);
+		break;
+
+	case CMD_SEND_IF_COND:
+		// R7: echo voltage range and check pattern
+		SimOut(bR1);
+		SimOut32(dwArg & 0xFFF);
+		break;
+
+	case CMD_APP_CMD:
+		Card.fAppCmd = true;
+		SimOut(bR1);
+		break;
+
+	case CMD_READ_OCR:
+		SimOut(bR1);
+		SimOut32((Card.fIdle ? 0 : (OCR_READY | OCR_CCS)) | OCR_VOLTAGE);
+		break;
+
+	case CMD_CRC_ON_OFF:
+		Card.fCrcOn = (dwArg & 1) != 0;
+		SimOut(bR1);
+		break;
+
+	case CMD_SEND_CSD:
+		SimOut(bR1);
+		SimGetCSD(abReg);
+		SimOutData(abReg, 16);
+		break;
+
+	case CMD_SEND_CID:
+		SimOut(bR1);
+		memcpy(abReg, "\x03" "SDLPCUSB\x10\x12\x34\x56\x78\x00\xA6\x01", 16);
+		abReg[15] = (Crc7(abReg, 15) << 1) | 1;
+		SimOutData(abReg, 16);
+		break;
+
+	case CMD_SWITCH_FUNC:
+		SimOut(bR1);
+		SimSwitchFunc(dwArg, abReg);
+		SimOutData(abReg, 64);
+		break;
+
+	case CMD_SEND_STATUS:
+		// R2
+		SimOut(bR1);
+		SimOut(0);
+		break;
+
+	case CMD_SET_BLOCKLEN:
+		// SDHC cards always use 512-byte blocks
+		SimOut(bR1);
+		break;
+
+	case CMD_READ_SINGLE_BLOCK:
+		if (dwArg >= Card.dwBlocks) {
+			SimOut(bR1 | R1_ADDRESS_ERROR);
+			break;
+		}
+		SimOut(bR1);
+		SimOutData(Card.pbMedium + (size_t)dwArg * BLOCKSIZE, BLOCKSIZE);
+		break;
+
+	case CMD_WRITE_BLOCK:
+		if (dwArg >= Card.dwBlocks) {
+			SimOut(bR1 | R1_ADDRESS_ERROR);
+			break;
+		}
+		SimOut(bR1);
+		Card.dwWriteBlock = dwArg;
+		Card.eState = eWriteToken;
+		break;
+
+	case CMD_ERASE_WR_BLK_START_ADDR:
+		if (dwArg >= Card.dwBlocks) {
+			SimOut(bR1 | R1_ADDRESS_ERROR);
+			break;
+		}
+		Card.dwEraseStart = dwArg;
+		Card.fEraseStart = true;
+		Card.fEraseEnd = false;
+		SimOut(bR1);
+		break;
+
+	case CMD_ERASE_WR_BLK_END_ADDR:
+		if (!Card.fEraseStart) {
+			SimOut(bR1 | R1_ERASE_SEQ_ERROR);
+			break;
+		}
+		if ((dwArg >= Card.dwBlocks) || (dwArg < Card.dwEraseStart)) {
+			SimOut(bR1 | R1_ADDRESS_ERROR);
+			break;
+		}
+		Card.dwEraseEnd = dwArg;
+		Card.fEraseEnd = true;
+		SimOut(bR1);
+		break;
+
+	case CMD_ERASE:
+		if (!Card.fEraseStart || !Card.fEraseEnd) {
+			SimOut(bR1 | R1_ERASE_SEQ_ERROR);
+			break;
+		}
+		// erased blocks read back as zeroes (DATA_STAT_AFTER_ERASE = 0)
+		memset(Card.pbMedium + (size_t)Card.dwEraseStart * BLOCKSIZE, 0,
+			(size_t)(Card.dwEraseEnd - Card.dwEraseStart + 1) * BLOCKSIZE);
+		SimLogErase(Card.dwEraseStart, Card.dwEraseEnd);
+		Card.fEraseStart = Card.fEraseEnd = false;
+		// R1b
+		SimOut(bR1);
+		SimBusy(Card.iEraseBusy);
+		break;
+
+	default:
+		SimOut(bR1 | R1_ILLEGAL_COMMAND);
+		break;
+	}
+}
+
+
+// flips a random bit in one out of dwNoise bytes, on average
+static uint8_t SimNoise(uint8_t b)
+{
+	if (Card.dwNoise == 0) {
+		return b;
+	}
+	// xorshift32, reproducible from run to run
+	Card.dwRandom ^= Card.dwRandom << 13;
+	Card.dwRandom ^= Card.dwRandom >> 17;
+	Card.dwRandom ^= Card.dwRandom << 5;
+	if ((Card.dwRandom % Card.dwNoise) != 0) {
+		return b;
+	}
+	Card.dwBitErrors++;
+	return b ^ (1 << ((Card.dwRandom >> 24) & 7));
+}
+
+
+/**
+	Local function to clock one byte through the card
+
+	@param [in]	bIn		Byte on DI
+	@return byte on DO
+ */
+static uint8_t SimExchange(uint8_t bIn)
+{
+	uint8_t		bOut;
+	uint16_t	wCrc;
+
+	bIn = SimNoise(bIn);
+
+	// shift out queued bytes first, then the busy signal
+	if (Card.iOutHead < Card.iOutTail) {
+		bOut = Card.abOut[Card.iOutHead++];
+	}
+	else if ((Card.qwBusyUntil != 0) && (SimNow() < Card.qwBusyUntil)) {
+		bOut = 0x00;
+	}
+	else {
+		bOut = 0xFF;
+	}
+
+	// check the clock once per change
+	if (!Card.fSpeedChecked) {
+		Card.fSpeedChecked = true;
+		if (Card.iSpeed > (Card.fHighSpeed ? CLOCK_HIGH_SPEED : CLOCK_DEFAULT)) {
+			SimViolation(Card.fHighSpeed ? "clock above 50 MHz" : "clock above 25 MHz in default speed mode");
+		}
+	}
+	if ((Card.iStableClock != 0) && (Card.iSpeed > Card.iStableClock) && ((++Card.iCorrupt % 7) == 0)) {
+		bOut ^= 0x01;
+	}
+	bOut = SimNoise(bOut);
+
+	switch (Card.eState) {
+
+	case eCommand:
+		// a command starts with bits '01'
+		if ((Card.iCmdPos == 0) && ((bIn & 0xC0) != 0x40)) {
+			break;
+		}
+		Card.abCmd[Card.iCmdPos++] = bIn;
+		if (Card.iCmdPos == 6) {
+			Card.iCmdPos = 0;
+			SimCommand();
+		}
+		break;
+
+	case eWriteToken:
+		if (bIn == TOKEN_START_BLOCK) {
+			Card.iDataPos = 0;
+			Card.wDataCrc = 0;
+			Card.eState = eWriteData;
+		}
+		else if (bIn != 0xFF) {
+			fprintf(stderr, "SD: unexpected token 0x%02X\n", bIn);
+			Card.eState = eCommand;
+		}
+		break;
+
+	case eWriteData:
+		// the CRC is calculated while the data comes in, like a card does
+		if (Card.iDataPos < BLOCKSIZE) {
+			Card.wDataCrc = Crc16Byte(Card.wDataCrc, bIn);
+		}
+		Card.abData[Card.iDataPos++] = bIn;
+		if (Card.iDataPos < BLOCKSIZE + 2) {
+			break;
+		}
+		Card.eState = eCommand;
+		Card.iOutHead = Card.iOutTail = 0;
+		wCrc = (Card.abData[BLOCKSIZE] << 8) | Card.abData[BLOCKSIZE + 1];
+		if (Card.fCrcOn && (wCrc != Card.wDataCrc)) {
+			Card.dwCrcErrors++;
+			SimOut(0x0B);		// data rejected, CRC error
+			break;
+		}
+		memcpy(Card.pbMedium + (size_t)Card.dwWriteBlock * BLOCKSIZE, Card.abData, BLOCKSIZE);
+		SimOut(DATA_RESP_ACCEPTED);
+		SimBusy(Card.iWriteBusy);
+		break;
+	}
+	return bOut;
+}
+
+
+/**
+	Inserts a blank card
+
+	@param [in]	dwBlocks	Capacity in blocks, rounded down to a multiple of 512 kB
+
+	@return false if the card memory could not be allocated
+ */
+bool SDSimInit(uint32_t dwBlocks)
+{
+	memset(&Card, 0, sizeof(Card));
+	Card.dwBlocks = dwBlocks - (dwBlocks % 1024);
+	if (Card.dwBlocks == 0) {
+		fprintf(stderr, "SD: card size must be at least 512 kB\n");
+		return false;
+	}
+	Card.pbMedium = calloc(Card.dwBlocks, BLOCKSIZE);
+	if (Card.pbMedium == NULL) {
+		return false;
+	}
+	Card.eState = eCommand;
+	Card.fIdle = true;
+	Card.iInitPolls = INIT_POLLS;
+	Card.iWriteBusy = 20;
+	Card.iEraseBusy = 200;
+	Card.fHsSupport = true;
+	return true;
+}
+
+
+/**
+	Sets the clock capabilities of the card and bus
+
+	@param [in]	iStableClock	Highest SPI clock that works (Hz), 0 = any
+	@param [in]	fHighSpeed		Card supports high speed mode
+ */
+void SDSimSetClock(int iStableClock, bool fHighSpeed)
+{
+	Card.iStableClock = iStableClock;
+	Card.fHsSupport = fHighSpeed;
+}
+
+
+/**
+	Returns the SPI clock in use
+
+	@param [out] pfHighSpeed	Card is in high speed mode
+ */
+int SDSimGetClock(bool *pfHighSpeed)
+{
+	*pfHighSpeed = Card.fHighSpeed;
+	return Card.iSpeed;
+}
+
+
+/**
+	Returns the number of protocol violations, like clocking the card too fast
+	for its speed mode or selecting a function it does not support
+ */
+uint32_t SDSimGetViolations(void)
+{
+	return Card.dwViolations;
+}
+
+
+/**
+	Sets how long the card signals busy
+
+	@param [in]	iWriteBusy	Busy time after a block write (us)
+	@param [in]	iEraseBusy	Busy time after an erase (us)
+ */
+void SDSimSetBusy(int iWriteBusy, int iEraseBusy)
+{
+	Card.iWriteBusy = iWriteBusy;
+	Card.iEraseBusy = iEraseBusy;
+}
+
+
+/**
+	Adds random bit errors on the bus, in both directions
+
+	@param [in]	dwInterval	One bit error per this many bytes on average, 0 = none
+ */
+void SDSimSetNoise(uint32_t dwInterval)
+{
+	Card.dwNoise = dwInterval;
+	Card.dwRandom = 0x12345678;
+}
+
+
+/**
+	Returns the number of bits flipped by noise
+
+	@param [out] pdwCrcErrors	Commands and data blocks the card rejected for their CRC
+ */
+uint32_t SDSimGetBitErrors(uint32_t *pdwCrcErrors)
+{
+	*pdwCrcErrors = Card.dwCrcErrors;
+	return Card.dwBitErrors;
+}
+
+
+/**
+	Makes transfers take as long as they would on the bus
+
+	@param [in]	fOn		Wait 8 clocks per byte at the configured SPI clock
+ */
+void SDSimSetBusTiming(bool fOn)
+{
+	Card.fBusTiming = fOn;
+	Card.qwBusFree = 0;
+}
+
+
+/**
+	Returns the ranges erased since the card was inserted or the log was
+	cleared, in the order of execution
+
+	@param [out] piCount	Number of erases, may exceed SDSIM_MAX_ERASES
+ */
+const TSDSimErase *SDSimGetEraseLog(int *piCount)
+{
+	*piCount = Card.iNumErases;
+	return Card.aErases;
+}
+
+
+void SDSimClearEraseLog(void)
+{
+	Card.iNumErases = 0;
+}
+
+
+/*************************************************************************
+	SPI driver interface
+**************************************************************************/
+
+void SPIInit(void)
+{
+	Card.iSpeed = 0;
+}
+
+
+void SPISetSpeed(int iFrequency)
+{
+	Card.iSpeed = iFrequency;
+	Card.fSpeedChecked = false;
+}
+
+
+void SPITransfer(int iCount, uint8_t *pbTxData, uint8_t *pbRxData)
+{
+	uint64_t	qwNow;
+	uint8_t		b;
+	int			i;
+
+	// the transfer starts now, or when the previous one is done
+	qwNow = SimNow();
+
+	for (i = 0; i < iCount; i++) {
+		b = SimExchange((pbTxData != NULL) ? pbTxData[i] : 0xFF);
+		if (pbRxData != NULL) {
+			pbRxData[i] = b;
+		}
+	}
+
+	if (Card.fBusTiming && (Card.iSpeed > 0)) {
+		if (Card.qwBusFree < qwNow) {
+			Card.qwBusFree = qwNow;
+		}
+		Card.qwBusFree += (uint64_t)iCount * 8 * 1000000000 / Card.iSpeed;
+		while (SimNow() < Card.qwBusFree) {
+			// bus busy
+		}
+	}
+}
+
+
+void SPITick(int iCount)
+{
+	// clocks without chip select, the card ignores them
+	(void)iCount;
+}
@@ -0,0 +1,62 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	Simulated SD card on the SPI bus.
+
+	This replaces the SPI driver (spi.h) in host builds, so the target SD
+	card driver in sdcard.c talks to a model of an SDHC card in SPI mode,
+	byte by byte. The model checks the command sequences it receives and
+	the SPI clock against the speed mode, and keeps a log of the block
+	ranges it has erased. Noise on the bus can be simulated, to test CRC
+	checking.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SDSIM_MAX_ERASES	64	/**< size of the erase log */
+
+/** One erase operation, as executed on CMD38 */
+typedef struct {
+	uint32_t	dwFirst;		/**< first erased block */
+	uint32_t	dwLast;			/**< last erased block */
+} TSDSimErase;
+
+bool SDSimInit(uint32_t dwBlocks);
+void SDSimSetBusy(int iWriteBusy, int iEraseBusy);
+void SDSimSetClock(int iStableClock, bool fHighSpeed);
+void SDSimSetNoise(uint32_t dwInterval);
+void SDSimSetBusTiming(bool fOn);
+
+int SDSimGetClock(bool *pfHighSpeed);
+uint32_t SDSimGetViolations(void);
+uint32_t SDSimGetBitErrors(uint32_t *pdwCrcErrors);
+
+const TSDSimErase *SDSimGetEraseLog(int *piCount);
+void SDSimClearEraseLog(void);
@@ -0,0 +1,21 @@
+#!/bin/sh
+#
+# Compares SD card throughput with and without CRC checking on the bus,
+# using msc_sim on a simulated card with real-time bus transfers.
+# Extra arguments go to msc_sim, for example -k 12000 for a slower bus
+# or -e 100000 to add noise (with CRC off the run then usually fails).
+#
+# Output: transfer size, then write and read kB/s with CRC off and on,
+# and the throughput lost to CRC checking.
+
+SIM=${SIM:-./msc_sim}
+SIZES="512 4096 32768"
+
+echo "transfer,write off,write on,write loss %,read off,read on,read loss %"
+for t in $SIZES; do
+	off=$($SIM -c -B -C -t $t -n 2048 "$@" 2>/dev/null) && off=$(echo "$off" | cut -d, -f6) || off="- -"
+	on=$($SIM -c -B -t $t -n 2048 "$@" 2>/dev/null) && on=$(echo "$on" | cut -d, -f6) || on="- -"
+	# a failed run shows as -
+	echo $t $off $on | awk 'function loss(a, b) { return (a == "-" || b == "-") ? "-" : sprintf("%.1f", 100 * (a - b) / a) }
+		{ printf "%s,%s,%s,%s,%s,%s,%s\n", $1, $2, $4, loss($2, $4), $3, $5, loss($3, $5) }'
+done
@@ -0,0 +1,591 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Source/sink test function simulation.
+
+	Runs the test function of main_srcsink.c on the PC, on top of the
+	simulated USB controller, and checks it the way a host would: the IN
+	stream in source/sink mode, the OUT data in sink mode and the data
+	sent back in loopback mode, with each of the patterns. The vendor
+	requests go through the control transfer handling of the stack.
+
+	With -e, one byte of every n-th OUT packet is corrupted, and the device
+	has to report exactly those errors.
+
+	The echoes for latency measurements are checked too: every echo has to
+	come back unchanged apart from the frame numbers, which have to match
+	the simulated frame at the time.
+
+	The isoc streams of alternate setting 1 run for a while with packets
+	of several sizes. The host leaves out, drops and repeats OUT packets
+	and skips IN frames now and then, and both sides have to count
+	exactly those.
+
+	Finally, the control transfer rate is measured with 0, 8 and 64 byte
+	vendor requests in both directions. The device may not queue any
+	packet on the control pipe that the host does not ask for.
+
+	Human readable results go to stderr, a CSV line per test to stdout:
+	test,pattern,bytes,time (us),kB/s,host errors,device errors
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "usbapi.h"
+#include "usbhw_lpc.h"
+
+#include "pattern.h"
+#include "srcsink.h"
+
+#include "usbhw_sim.h"
+
+#define MAX_PACKET_SIZE	64			/**< largest packet of the test function */
+#define STALE_PACKETS	2			/**< IN packets left from before SET_MODE */
+#define MAX_IDLE		1000		/**< give up after this many NAKs in a row */
+
+/** Host side of an IN stream */
+typedef struct {
+	TPattern	Pattern;			/**< expected data */
+	uint8_t		abFirst[4];			/**< first word of the pattern */
+	int			iPackets;			/**< packets received since SET_MODE */
+	bool		fSynced;			/**< a packet started the new stream */
+	uint32_t	dwBytes;			/**< bytes checked */
+	uint32_t	dwErrors;			/**< bytes that did not match */
+} THostStream;
+
+static const char *apszPatterns[] = {"zeros", "counter", "prbs"};
+
+static int		iPacketSize = 64;
+static int		iErrorRate = 0;		/**< corrupt every n-th OUT packet, 0 = never */
+
+static uint8_t	abVendorReqData[SRCSINK_REQ_DATA_SIZE];
+
+
+// a vendor request over the control pipe, returns the data length or a SIM_ error
+static int VendorRequest(bool fIn, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint8_t *pbData, int iLen)
+{
+	return SimHostRequest((REQTYPE_TYPE_VENDOR << 5) | (fIn ? 0x80 : 0), bRequest, wValue, wIndex, pbData, iLen);
+}
+
+
+static bool SetMode(int iMode, EPattern ePattern)
+{
+	return VendorRequest(false, SRCSINK_REQ_SET_MODE, iMode, ePattern, NULL, 0) == 0;
+}
+
+
+static bool GetStats(TSrcSinkStats *pStats)
+{
+	uint8_t	abData[sizeof(TSrcSinkStats)];
+
+	if (VendorRequest(true, SRCSINK_REQ_GET_STATS, 0, 0, abData, sizeof(abData)) != sizeof(abData)) {
+		return false;
+	}
+	pStats->dwOutBytes = SimGetLE32(&abData[0]);
+	pStats->dwOutErrors = SimGetLE32(&abData[4]);
+	pStats->dwInBytes = SimGetLE32(&abData[8]);
+	pStats->dwInErrors = SimGetLE32(&abData[12]);
+	return true;
+}
+
+
+static void StreamInit(THostStream *pStream, EPattern ePattern)
+{
+	memset(pStream, 0, sizeof(*pStream));
+	PatternInit(&pStream->Pattern, ePattern);
+	PatternFill(&pStream->Pattern, pStream->abFirst, sizeof(pStream->abFirst));
+	PatternInit(&pStream->Pattern, ePattern);
+}
+
+
+/*
+	Checks a packet of an IN stream. Packets that were queued before
+	SET_MODE are skipped: the new stream starts with the first packet that
+	starts with the first word of the pattern, or a later one within the
+	first few packets if that one does too.
+ */
+static void StreamCheck(THostStream *pStream, const uint8_t *pbData, int iLen)
+{
+	EPattern	ePattern;
+
+	if ((pStream->iPackets++ <= STALE_PACKETS) && (iLen >= 4) &&
+		(memcmp(pbData, pStream->abFirst, 4) == 0)) {
+		ePattern = pStream->Pattern.ePattern;
+		PatternInit(&pStream->Pattern, ePattern);
+		pStream->fSynced = true;
+		pStream->dwBytes = 0;
+		pStream->dwErrors = 0;
+	}
+	if (pStream->fSynced) {
+		pStream->dwBytes += iLen;
+		pStream->dwErrors += PatternCheck(&pStream->Pattern, pbData, iLen);
+	}
+}
+
+
+static void Report(const char *pszTest, EPattern ePattern, uint32_t dwBytes, uint64_t qwTime,
+				uint32_t dwHostErrors, uint32_t dwDevErrors)
+{
+	uint32_t	dwRate;
+
+	dwRate = (qwTime > 0) ? (uint32_t)((uint64_t)dwBytes * 1000000 / 1024 / qwTime) : 0;
+	fprintf(stderr, "%-8s %-8s %u bytes in %llu us, %u kB/s, %u host errors, %u device errors\n",
+			pszTest, apszPatterns[ePattern], dwBytes, (unsigned long long)qwTime, dwRate,
+			dwHostErrors, dwDevErrors);
+	printf("%s,%s,%u,%llu,%u,%u,%u\n", pszTest, apszPatterns[ePattern], dwBytes,
+			(unsigned long long)qwTime, dwRate, dwHostErrors, dwDevErrors);
+}
+
+
+// fills the next OUT packet, corrupting it if its turn has come
+static int NextOutPacket(TPattern *pPattern, uint8_t *pbData, int iLen, int iPacket, uint32_t *pdwInjected)
+{
+	PatternFill(pPattern, pbData, iLen);
+	if ((iErrorRate != 0) && ((iPacket % iErrorRate) == iErrorRate - 1)) {
+		pbData[iPacket % iLen] ^= 0x5A;
+		(*pdwInjected)++;
+	}
+	return iLen;
+}
+
+
+static bool TestSource(EPattern ePattern, uint32_t dwTotal)
+{
+	THostStream		Stream;
+	TSrcSinkStats	Stats;
+	uint8_t			abData[MAX_PACKET_SIZE];
+	uint64_t		qwStart;
+	int				iLen, iIdle;
+
+	if (!SetMode(SRCSINK_MODE_SOURCE_SINK, ePattern)) {
+		fprintf(stderr, "SET_MODE failed\n");
+		return false;
+	}
+	StreamInit(&Stream, ePattern);
+	qwStart = SimTimeUs();
+	iIdle = 0;
+	while (Stream.dwBytes < dwTotal) {
+		iLen = SimHostIn(SRCSINK_IN_EP, abData, sizeof(abData));
+		if (iLen < 0) {
+			if (++iIdle > MAX_IDLE) {
+				fprintf(stderr, "source stopped after %u bytes\n", Stream.dwBytes);
+				return false;
+			}
+			continue;
+		}
+		iIdle = 0;
+		StreamCheck(&Stream, abData, iLen);
+	}
+	qwStart = SimTimeUs() - qwStart;
+	if (!GetStats(&Stats)) {
+		return false;
+	}
+	Report("source", ePattern, Stream.dwBytes, qwStart, Stream.dwErrors, Stats.dwInErrors);
+	return Stream.fSynced && (Stream.dwErrors == 0) && (Stats.dwInErrors == 0);
+}
+
+
+static bool TestSink(EPattern ePattern, uint32_t dwTotal)
+{
+	TPattern		Pattern;
+	TSrcSinkStats	Stats;
+	uint8_t			abData[MAX_PACKET_SIZE];
+	uint64_t		qwStart;
+	uint32_t		dwSent, dwInjected;
+	int				iLen, iPacket, iIdle;
+
+	if (!SetMode(SRCSINK_MODE_SOURCE_SINK, ePattern)) {
+		fprintf(stderr, "SET_MODE failed\n");
+		return false;
+	}
+	PatternInit(&Pattern, ePattern);
+	dwSent = 0;
+	dwInjected = 0;
+	iPacket = 0;
+	iIdle = 0;
+	iLen = 0;
+	qwStart = SimTimeUs();
+	while (dwSent < dwTotal) {
+		if (iLen == 0) {
+			iLen = NextOutPacket(&Pattern, abData, iPacketSize, iPacket++, &dwInjected);
+		}
+		if (SimHostOut(SRCSINK_OUT_EP, abData, iLen) < 0) {
+			if (++iIdle > MAX_IDLE) {
+				fprintf(stderr, "sink stopped after %u bytes\n", dwSent);
+				return false;
+			}
+			continue;
+		}
+		iIdle = 0;
+		dwSent += iLen;
+		iLen = 0;
+	}
+	qwStart = SimTimeUs() - qwStart;
+	if (!GetStats(&Stats)) {
+		return false;
+	}
+	Report("sink", ePattern, dwSent, qwStart, dwInjected, Stats.dwOutErrors);
+	if (Stats.dwOutBytes != dwSent) {
+		fprintf(stderr, "device received %u bytes instead of %u\n", Stats.dwOutBytes, dwSent);
+		return false;
+	}
+	return Stats.dwOutErrors == dwInjected;
+}
+
+
+static bool TestLoopback(EPattern ePattern, uint32_t dwTotal)
+{
+	TPattern		Pattern;
+	THostStream		Stream;
+	TSrcSinkStats	Stats;
+	uint8_t			abOut[MAX_PACKET_SIZE], abIn[MAX_PACKET_SIZE];
+	uint64_t		qwStart;
+	uint32_t		dwSent, dwInjected;
+	int				iLen, iIn, iPacket, iIdle;
+
+	if (!SetMode(SRCSINK_MODE_LOOPBACK, ePattern)) {
+		fprintf(stderr, "SET_MODE failed\n");
+		return false;
+	}
+	PatternInit(&Pattern, ePattern);
+	StreamInit(&Stream, ePattern);
+	dwSent = 0;
+	dwInjected = 0;
+	iPacket = 0;
+	iIdle = 0;
+	iLen = 0;
+	qwStart = SimTimeUs();
+	for (;;) {
+		if ((iLen == 0) && (dwSent < dwTotal)) {
+			iLen = NextOutPacket(&Pattern, abOut, iPacketSize, iPacket++, &dwInjected);
+		}
+		if ((iLen > 0) && (SimHostOut(SRCSINK_OUT_EP, abOut, iLen) >= 0)) {
+			dwSent += iLen;
+			iLen = 0;
+			iIdle = 0;
+		}
+		iIn = SimHostIn(SRCSINK_IN_EP, abIn, sizeof(abIn));
+		if (iIn >= 0) {
+			StreamCheck(&Stream, abIn, iIn);
+			iIdle = 0;
+		}
+		else if ((dwSent >= dwTotal) && GetStats(&Stats) && (Stats.dwInBytes >= dwSent)) {
+			// all data is back
+			break;
+		}
+		else if (++iIdle > MAX_IDLE) {
+			fprintf(stderr, "loopback stopped after %u bytes\n", dwSent);
+			return false;
+		}
+	}
+	qwStart = SimTimeUs() - qwStart;
+	Report("loopback", ePattern, dwSent, qwStart, Stream.dwErrors, Stats.dwOutErrors);
+	if ((Stats.dwOutBytes != dwSent) || (Stats.dwInBytes != dwSent)) {
+		fprintf(stderr, "device looped %u of %u bytes back, %u sent\n",
+				Stats.dwInBytes, Stats.dwOutBytes, dwSent);
+		return false;
+	}
+	// injected errors show on both sides, nothing may go wrong inside the device
+	return (Stats.dwOutErrors == dwInjected) && (Stream.dwErrors == dwInjected) &&
+			(Stats.dwInErrors == dwInjected);
+}
+
+
+// checks an echo and its frame stamps
+static bool CheckEcho(const char *pszPipe, const uint8_t *pbOut, const uint8_t *pbIn, int iLen, uint16_t wFrame)
+{
+	if ((pbIn[SRCSINK_ECHO_RX_FRAME] != (wFrame & 0xFF)) || (pbIn[SRCSINK_ECHO_RX_FRAME + 1] != (wFrame >> 8)) ||
+		(pbIn[SRCSINK_ECHO_TX_FRAME] != (wFrame & 0xFF)) || (pbIn[SRCSINK_ECHO_TX_FRAME + 1] != (wFrame >> 8)) ||
+		(memcmp(&pbIn[SRCSINK_ECHO_HDR_SIZE], &pbOut[SRCSINK_ECHO_HDR_SIZE], iLen - SRCSINK_ECHO_HDR_SIZE) != 0)) {
+		fprintf(stderr, "%s echo in frame %u is wrong\n", pszPipe, wFrame);
+		return false;
+	}
+	return true;
+}
+
+
+static bool TestEcho(int iCount)
+{
+	uint8_t		abOut[MAX_PACKET_SIZE], abIn[MAX_PACKET_SIZE];
+	uint16_t	wFrame;
+	int			i;
+
+	if (!SetMode(SRCSINK_MODE_ECHO, ePatternZeros)) {
+		fprintf(stderr, "SET_MODE failed\n");
+		return false;
+	}
+	// throw away what the source left behind
+	while (SimHostIn(SRCSINK_IN_EP, abIn, sizeof(abIn)) >= 0)
+		;
+	wFrame = 0;
+	for (i = 0; i < iCount; i++) {
+		// a new frame now and then, wrapping around
+		if ((i % 3) == 0) {
+			SimHostFrame();
+			wFrame = (wFrame + 1) & 0x7FF;
+		}
+		memset(abOut, i, sizeof(abOut));
+		if ((SimHostOut(SRCSINK_OUT_EP, abOut, iPacketSize) != iPacketSize) ||
+			(SimHostIn(SRCSINK_IN_EP, abIn, sizeof(abIn)) != iPacketSize) ||
+			!CheckEcho("bulk", abOut, abIn, iPacketSize, wFrame)) {
+			return false;
+		}
+		if ((SimHostOut(SRCSINK_INT_OUT_EP, abOut, iPacketSize) != iPacketSize) ||
+			(SimHostIn(SRCSINK_INT_IN_EP, abIn, sizeof(abIn)) != iPacketSize) ||
+			!CheckEcho("interrupt", abOut, abIn, iPacketSize, wFrame)) {
+			return false;
+		}
+		SimPutLE32(&abOut[SRCSINK_ECHO_HDR_SIZE], i);
+		if ((VendorRequest(true, SRCSINK_REQ_ECHO, i, i >> 16, abIn, 8) != 8) ||
+			!CheckEcho("control", abOut, abIn, 8, wFrame)) {
+			return false;
+		}
+	}
+	fprintf(stderr, "echo     %d round trips on each pipe\n", iCount);
+	return true;
+}
+
+
+// an isoc packet as the host sends it, see srcsink.h
+static void IsocPacket(uint8_t *pbData, int iLen, uint32_t dwSeq)
+{
+	int	i;
+
+	SimPutLE32(&pbData[SRCSINK_ISOC_SEQ], dwSeq);
+	pbData[SRCSINK_ISOC_FRAME] = 0;
+	pbData[SRCSINK_ISOC_FRAME + 1] = 0;
+	pbData[SRCSINK_ISOC_LEN] = iLen & 0xFF;
+	pbData[SRCSINK_ISOC_LEN + 1] = iLen >> 8;
+	for (i = SRCSINK_ISOC_HDR_SIZE; i < iLen; i++) {
+		pbData[i] = dwSeq + i;
+	}
+}
+
+
+static bool TestIsoc(int iFrames)
+{
+	static const int	aiSizes[] = {SRCSINK_ISOC_HDR_SIZE, 64, SRCSINK_ISOC_MAX_PACKET};
+	uint8_t		abOut[SRCSINK_ISOC_MAX_PACKET], abIn[SRCSINK_ISOC_MAX_PACKET], abData[sizeof(TSrcSinkIsocStats)];
+	uint32_t	dwOutSeq, dwInSeq, dwSeq, dwInDropped, dwInErrors;
+	uint32_t	dwLate, dwDropped, dwDuplicated;
+	uint16_t	wFrame, wLastFrame;
+	int			i, j, iLen, iSize;
+	bool		fOk;
+
+	// select alternate setting 1, like SET_INTERFACE does
+	USBHwEPConfig(SRCSINK_ISOC_IN_EP, SRCSINK_ISOC_MAX_PACKET);
+	USBHwEPConfig(SRCSINK_ISOC_OUT_EP, SRCSINK_ISOC_MAX_PACKET);
+	SrcSinkSetInterface(0, 1);
+
+	fOk = true;
+	for (j = 0; j < (int)(sizeof(aiSizes) / sizeof(aiSizes[0])); j++) {
+		iSize = aiSizes[j];
+		if (VendorRequest(false, SRCSINK_REQ_SET_ISOC, iSize, 0, NULL, 0) != 0) {
+			fprintf(stderr, "SET_ISOC failed\n");
+			return false;
+		}
+		dwOutSeq = dwInSeq = 0;
+		dwInDropped = dwInErrors = 0;
+		wLastFrame = 0;
+		dwLate = dwDropped = dwDuplicated = 0;
+		for (i = 1; i <= iFrames; i++) {
+			switch (i % 100) {
+			case 10:
+				// nothing this frame, the next packet is late
+				dwLate++;
+				break;
+			case 40:
+				// a packet lost on the way
+				dwOutSeq++;
+				dwDropped++;
+				break;
+			case 70:
+				// the previous packet once more
+				IsocPacket(abOut, iSize, dwOutSeq - 1);
+				SimHostOut(SRCSINK_ISOC_OUT_EP, abOut, iSize);
+				dwDuplicated++;
+				break;
+			default:
+				IsocPacket(abOut, iSize, dwOutSeq++);
+				SimHostOut(SRCSINK_ISOC_OUT_EP, abOut, iSize);
+				break;
+			}
+			SimHostFrame();
+			if ((i % 100) == 55) {
+				// the host missed this frame
+				continue;
+			}
+			iLen = SimHostIn(SRCSINK_ISOC_IN_EP, abIn, sizeof(abIn));
+			if (iLen != iSize) {
+				fprintf(stderr, "isoc IN of %d bytes in frame %d\n", iLen, i);
+				return false;
+			}
+			dwSeq = SimGetLE32(&abIn[SRCSINK_ISOC_SEQ]);
+			wFrame = abIn[SRCSINK_ISOC_FRAME] | (abIn[SRCSINK_ISOC_FRAME + 1] << 8);
+			dwInDropped += dwSeq - dwInSeq;
+			// one packet per frame, so the frame numbers advance like the sequence
+			if ((dwSeq > 0) && (((wFrame - wLastFrame) & 0x7FF) != ((dwSeq - dwInSeq + 1) & 0x7FF))) {
+				dwInErrors++;
+			}
+			dwInSeq = dwSeq + 1;
+			wLastFrame = wFrame;
+			IsocPacket(abOut, iSize, dwSeq);
+			if (memcmp(&abIn[SRCSINK_ISOC_HDR_SIZE], &abOut[SRCSINK_ISOC_HDR_SIZE], iSize - SRCSINK_ISOC_HDR_SIZE) != 0) {
+				dwInErrors++;
+			}
+		}
+		if (VendorRequest(true, SRCSINK_REQ_GET_ISOC_STATS, 0, 0, abData, sizeof(abData)) != sizeof(abData)) {
+			fprintf(stderr, "GET_ISOC_STATS failed\n");
+			return false;
+		}
+		fprintf(stderr, "isoc     %3d bytes: IN %u packets, %u dropped, %u errors\n"
+				"                    OUT %u packets, %u dropped, %u duplicated, %u late, %u errors\n",
+				iSize, SimGetLE32(&abData[0]), dwInDropped, dwInErrors, SimGetLE32(&abData[4]),
+				SimGetLE32(&abData[8]), SimGetLE32(&abData[12]), SimGetLE32(&abData[16]), SimGetLE32(&abData[20]));
+		// the time is bus time, one packet per 1 ms frame
+		printf("isoc,none,%d,%d,%d,%u,%u\n", iSize * iFrames, iFrames * 1000, iSize * 1000 / 1024,
+				dwInErrors, SimGetLE32(&abData[20]));
+		if ((SimGetLE32(&abData[0]) != (uint32_t)iFrames) || (dwInDropped != (uint32_t)iFrames / 100) ||
+			(dwInErrors != 0) || (SimGetLE32(&abData[8]) != dwDropped) ||
+			(SimGetLE32(&abData[12]) != dwDuplicated) || (SimGetLE32(&abData[16]) != dwLate) ||
+			(SimGetLE32(&abData[20]) != 0)) {
+			fprintf(stderr, "isoc counters are wrong, expected OUT %u dropped, %u duplicated, %u late\n",
+					dwDropped, dwDuplicated, dwLate);
+			fOk = false;
+		}
+	}
+	SrcSinkSetInterface(0, 0);
+	return fOk;
+}
+
+
+static bool TestControl(int iCount)
+{
+	static const int	aiSizes[] = {0, 8, 64};
+	uint8_t		abData[SRCSINK_REQ_DATA_SIZE];
+	uint64_t	qwStart;
+	int			i, j, iDir;
+	bool		fIn;
+
+	memset(abData, 0x55, sizeof(abData));
+	for (iDir = 0; iDir < 2; iDir++) {
+		fIn = (iDir == 0);
+		for (i = 0; i < (int)(sizeof(aiSizes) / sizeof(aiSizes[0])); i++) {
+			qwStart = SimTimeUs();
+			for (j = 0; j < iCount; j++) {
+				if (VendorRequest(fIn, fIn ? SRCSINK_REQ_ECHO : SRCSINK_REQ_SINK, j, 0,
+								abData, aiSizes[i]) != aiSizes[i]) {
+					fprintf(stderr, "control %s of %d bytes failed\n", fIn ? "IN" : "OUT", aiSizes[i]);
+					return false;
+				}
+			}
+			qwStart = SimTimeUs() - qwStart;
+			fprintf(stderr, "control  %-3s %2d bytes: %d transfers in %llu us, %llu transfers/s\n",
+					fIn ? "IN" : "OUT", aiSizes[i], iCount, (unsigned long long)qwStart,
+					(unsigned long long)((qwStart > 0) ? (uint64_t)iCount * 1000000 / qwStart : 0));
+			printf("control-%s,none,%d,%llu,%u,0,0\n", fIn ? "in" : "out", iCount * aiSizes[i],
+					(unsigned long long)qwStart,
+					(qwStart > 0) ? (uint32_t)((uint64_t)iCount * aiSizes[i] * 1000000 / 1024 / qwStart) : 0);
+		}
+	}
+	if (SimHostGetStaleControl() != 0) {
+		fprintf(stderr, "device queued %u control packets the host never asked for\n",
+				SimHostGetStaleControl());
+		return false;
+	}
+	return true;
+}
+
+
+static void Usage(const char *pszName)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -n <kB>    amount of data per test (default 1024)\n"
+		"  -p <bytes> bulk packet size, 8 to 64 (default 64)\n"
+		"  -e <n>     corrupt one byte in every n-th OUT packet (default 0 = none)\n",
+		pszName);
+}
+
+
+int main(int argc, char *argv[])
+{
+	uint32_t	dwTotal = 1024 * 1024;
+	int			c, i;
+	bool		fOk;
+
+	while ((c = getopt(argc, argv, "n:p:e:h")) != -1) {
+		switch (c) {
+		case 'n':	dwTotal = strtoul(optarg, NULL, 0) * 1024;	break;
+		case 'p':	iPacketSize = strtoul(optarg, NULL, 0);		break;
+		case 'e':	iErrorRate = strtoul(optarg, NULL, 0);		break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((iPacketSize < 8) || (iPacketSize > MAX_PACKET_SIZE) || ((iPacketSize & (iPacketSize - 1)) != 0)) {
+		fprintf(stderr, "invalid packet size %d\n", iPacketSize);
+		return 1;
+	}
+
+	// set up the device side, like main_srcsink.c and SET_CONFIGURATION do
+	USBInit();
+	USBRegisterRequestHandler(REQTYPE_TYPE_VENDOR, SrcSinkHandleRequest, abVendorReqData);
+	USBHwNakIntEnable(INACK_BI);
+	USBHwEPConfig(SRCSINK_IN_EP, iPacketSize);
+	USBHwEPConfig(SRCSINK_OUT_EP, iPacketSize);
+	USBHwRegisterEPIntHandler(SRCSINK_IN_EP, SrcSinkBulkIn);
+	USBHwRegisterEPIntHandler(SRCSINK_OUT_EP, SrcSinkBulkOut);
+	USBHwEPConfig(SRCSINK_INT_IN_EP, iPacketSize);
+	USBHwEPConfig(SRCSINK_INT_OUT_EP, iPacketSize);
+	USBHwRegisterEPIntHandler(SRCSINK_INT_IN_EP, SrcSinkIntEcho);
+	USBHwRegisterEPIntHandler(SRCSINK_INT_OUT_EP, SrcSinkIntEcho);
+	USBHwRegisterFrameHandler(SrcSinkFrame);
+	SrcSinkInit();
+
+	fOk = true;
+	for (i = ePatternZeros; i <= ePatternPRBS; i++) {
+		fOk = TestSource(i, dwTotal) && fOk;
+		fOk = TestSink(i, dwTotal) && fOk;
+		fOk = TestLoopback(i, dwTotal) && fOk;
+	}
+	// and back to source/sink with stale loopback data in the IN buffers
+	fOk = TestSource(ePatternCounter, dwTotal) && fOk;
+	fOk = TestEcho(5000) && fOk;
+	fOk = TestIsoc(10000) && fOk;
+	fOk = TestControl(10000) && fOk;
+
+	fprintf(stderr, "%s\n", fOk ? "PASS" : "FAIL");
+	return fOk ? 0 : 1;
+}
@@ -0,0 +1,477 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Event trace simulation.
+
+	Runs the source/sink test function on the PC, on top of the simulated
+	USB controller and a stack built with USB_TRACE, and reads the trace
+	back the way host/trace does, with the vendor request for it. The
+	dumps go through the decoder of host/trace.
+
+	The device clock counts the records, one microsecond each, from just
+	before its 32 bit wrap, so every record has its own timestamp and the
+	decoder has to undo the wrap.
+
+	First an enumeration with a stalled request and some bulk traffic is
+	traced, and the timeline has to show exactly the SETUP packets sent,
+	the stall, the packets moved and the bus reset, in order, with no
+	records lost. Then far more records than the ring holds are written
+	before it is read, and the oldest ones have to be reported lost: the
+	records read and the records lost have to add up to the records
+	written, with the newest ones kept. Finally the cost of a trace point
+	is measured.
+
+	With -v, the timeline of the enumeration is printed, with -o it is
+	written in the Chrome trace event format.
+
+	Human readable results go to stderr, a CSV line per test to stdout:
+	test,records written,records read,lost,dumps
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "usbapi.h"
+#include "usbhw_lpc.h"
+#include "usbtrace.h"
+
+#include "pattern.h"
+#include "srcsink.h"
+
+#include "tracedecode.h"
+#include "usbhw_sim.h"
+
+#define CLOCK_START		0xFFFFFFE0	/**< device time of the first record */
+#define DUMP_SIZE		(TRACE_HEADER_SIZE + TRACE_DUMP_RECORDS * TRACE_RECORD_SIZE)
+#define PACKET_SIZE		64
+#define OUT_PACKETS		8
+#define IN_PACKETS		4
+#define FLOOD_PACKETS	(3 * TRACE_SIZE)
+#define COST_RECORDS	10000000
+
+#define LE_WORD(x)		((x)&0xFF),((x)>>8)
+
+static const uint8_t abDescriptors[] = {
+
+// device descriptor
+	0x12,
+	DESC_DEVICE,
+	LE_WORD(0x0200),			// bcdUSB
+	0xFF,						// bDeviceClass
+	0x00,						// bDeviceSubClass
+	0x00,						// bDeviceProtocol
+	MAX_PACKET_SIZE0,			// bMaxPacketSize
+	LE_WORD(0xFFFF),			// idVendor
+	LE_WORD(0x0006),			// idProduct
+	LE_WORD(0x0100),			// bcdDevice
+	0x00,						// iManufacturer
+	0x00,						// iProduct
+	0x00,						// iSerialNumber
+	0x01,						// bNumConfigurations
+
+// configuration descriptor
+	0x09,
+	DESC_CONFIGURATION,
+	LE_WORD(18),				// wTotalLength
+	0x01,						// bNumInterfaces
+	0x01,						// bConfigurationValue
+	0x00,						// iConfiguration
+	0x80,						// bmAttributes
+	0x32,						// bMaxPower
+
+// interface
+	0x09,
+	DESC_INTERFACE,
+	0x00,						// bInterfaceNumber
+	0x00,						// bAlternateSetting
+	0x00,						// bNumEndPoints
+	0xFF,						// bInterfaceClass
+	0x00,						// bInterfaceSubClass
+	0x00,						// bInterfaceProtocol
+	0x00,						// iInterface
+
+// terminating zero
+	0
+};
+
+/** Requests of the enumeration, with the data length the host asks for */
+static const uint8_t abEnumeration[][8] = {
+	{0x80, REQ_GET_DESCRIPTOR,		LE_WORD(DESC_DEVICE << 8),			LE_WORD(0),			LE_WORD(8)},
+	{0x00, REQ_SET_ADDRESS,			LE_WORD(3),							LE_WORD(0),			LE_WORD(0)},
+	{0x80, REQ_GET_DESCRIPTOR,		LE_WORD(DESC_DEVICE << 8),			LE_WORD(0),			LE_WORD(18)},
+	{0x80, REQ_GET_DESCRIPTOR,		LE_WORD(DESC_CONFIGURATION << 8),	LE_WORD(0),			LE_WORD(64)},
+	{0x80, REQ_GET_DESCRIPTOR,		LE_WORD((DESC_STRING << 8) | 5),	LE_WORD(0x0409),	LE_WORD(64)},
+	{0x00, REQ_SET_CONFIGURATION,	LE_WORD(1),							LE_WORD(0),			LE_WORD(0)},
+	{0x40, SRCSINK_REQ_SET_MODE,	LE_WORD(SRCSINK_MODE_SOURCE_SINK),	LE_WORD(ePatternCounter),	LE_WORD(0)}
+};
+#define STALLED_REQUEST	4			/**< the string descriptor does not exist */
+
+static uint32_t	dwRecords;			/**< records written since USBTraceInit */
+static uint8_t	abVendorReqData[SRCSINK_REQ_DATA_SIZE];
+static bool		fVerbose = false;
+static const char *pszChrome = NULL;
+
+
+// the device clock, which counts the records
+static uint32_t TraceClock(void)
+{
+	return CLOCK_START + dwRecords++;
+}
+
+
+/*
+	Reads the trace like host/trace does, until a dump is not full: each
+	request for it adds a few records of its own. What is left after the
+	last request is read directly, so the trace holds every record.
+ */
+static bool ReadTrace(TTrace *pTrace, int *piDumps)
+{
+	uint8_t	abDump[DUMP_SIZE];
+	int		iLen, iCount;
+
+	*piDumps = 0;
+	do {
+		iLen = SimHostRequest(0xC0, SRCSINK_REQ_GET_TRACE, 0, 0, abDump, sizeof(abDump));
+		if (iLen < 0) {
+			fprintf(stderr, "GET_TRACE failed (%d)\n", iLen);
+			return false;
+		}
+		iCount = TraceAddDump(pTrace, abDump, iLen);
+		if (iCount < 0) {
+			fprintf(stderr, "invalid dump of %d bytes\n", iLen);
+			return false;
+		}
+		(*piDumps)++;
+	} while (iCount == TRACE_DUMP_RECORDS);
+
+	// the records of the last request
+	do {
+		iLen = USBTraceRead(abDump, sizeof(abDump));
+		iCount = TraceAddDump(pTrace, abDump, iLen);
+	} while (iCount > 0);
+	return iCount == 0;
+}
+
+
+// records read, without the TRACE_LOST markers
+static int CountRecords(const TTrace *pTrace, uint8_t bEvent, int iEP)
+{
+	int	i, iCount;
+
+	iCount = 0;
+	for (i = 0; i < pTrace->iCount; i++) {
+		if ((pTrace->pEvents[i].bEvent != TRACE_LOST) &&
+			((bEvent == 0) || (pTrace->pEvents[i].bEvent == bEvent)) &&
+			((iEP < 0) || (pTrace->pEvents[i].bEP == iEP))) {
+			iCount++;
+		}
+	}
+	return iCount;
+}
+
+
+// every record has to be one microsecond after the previous one
+static bool CheckTimes(const TTrace *pTrace)
+{
+	const TTraceEvent *pPrev;
+	int	i;
+
+	pPrev = NULL;
+	for (i = 0; i < pTrace->iCount; i++) {
+		if (pTrace->pEvents[i].bEvent == TRACE_LOST) {
+			pPrev = NULL;
+			continue;
+		}
+		if ((pPrev != NULL) && (pTrace->pEvents[i].qwTime != pPrev->qwTime + 1)) {
+			fprintf(stderr, "record %d at %llu us, previous at %llu us\n", i,
+					(unsigned long long)pTrace->pEvents[i].qwTime, (unsigned long long)pPrev->qwTime);
+			return false;
+		}
+		pPrev = &pTrace->pEvents[i];
+	}
+	return true;
+}
+
+
+static void Report(const char *pszTest, const TTrace *pTrace, int iDumps)
+{
+	fprintf(stderr, "%-12s %u records written, %d read, %u lost, %d dumps\n",
+			pszTest, dwRecords, CountRecords(pTrace, 0, -1), pTrace->dwLost, iDumps);
+	printf("%s,%u,%d,%u,%d\n", pszTest, dwRecords, CountRecords(pTrace, 0, -1), pTrace->dwLost, iDumps);
+}
+
+
+static bool WriteChrome(const TTrace *pTrace)
+{
+	FILE	*f;
+
+	f = fopen(pszChrome, "w");
+	if (f == NULL) {
+		perror(pszChrome);
+		return false;
+	}
+	TraceWriteChrome(pTrace, f);
+	fclose(f);
+	return true;
+}
+
+
+static bool TestEnumeration(void)
+{
+	TTrace		Trace;
+	TTraceEvent	*pEvent;
+	uint8_t		abData[PACKET_SIZE];
+	int			i, iSetup, iStall, iDumps, iLen;
+	bool		fOk;
+
+	USBTraceInit(TraceClock);
+	dwRecords = 0;
+	SimHostReset();
+
+	fOk = true;
+	for (i = 0; i < (int)(sizeof(abEnumeration) / sizeof(abEnumeration[0])); i++) {
+		iLen = SimHostControl(abEnumeration[i], abData, sizeof(abData));
+		if ((iLen == SIM_STALL) != (i == STALLED_REQUEST)) {
+			fprintf(stderr, "request %d returned %d\n", i, iLen);
+			fOk = false;
+		}
+	}
+	memset(abData, 0, sizeof(abData));
+	for (i = 0; i < OUT_PACKETS; i++) {
+		if (SimHostOut(SRCSINK_OUT_EP, abData, sizeof(abData)) != sizeof(abData)) {
+			fprintf(stderr, "OUT packet %d failed\n", i);
+			fOk = false;
+		}
+	}
+	for (i = 0; i < IN_PACKETS; i++) {
+		if (SimHostIn(SRCSINK_IN_EP, abData, sizeof(abData)) < 0) {
+			fprintf(stderr, "IN packet %d failed\n", i);
+			fOk = false;
+		}
+	}
+
+	TraceInit(&Trace);
+	fOk = ReadTrace(&Trace, &iDumps) && fOk;
+	Report("enumeration", &Trace, iDumps);
+	if (fVerbose) {
+		TracePrintTimeline(&Trace, stderr);
+	}
+	if (pszChrome != NULL) {
+		fOk = WriteChrome(&Trace) && fOk;
+	}
+
+	// the bus reset comes first, then the requests in order, then those for the trace
+	if ((Trace.iCount == 0) || (Trace.pEvents[0].bEvent != TRACE_DEV_STATUS) ||
+		(Trace.pEvents[0].wArg != DEV_STATUS_RESET)) {
+		fprintf(stderr, "no bus reset at the start\n");
+		fOk = false;
+	}
+	iSetup = 0;
+	iStall = -1;
+	for (i = 0; i < Trace.iCount; i++) {
+		pEvent = &Trace.pEvents[i];
+		if ((pEvent->bEvent == TRACE_STALL) && (pEvent->bEP == 0x80) && pEvent->wArg) {
+			if (iStall >= 0) {
+				fprintf(stderr, "control pipe stalled more than once\n");
+				fOk = false;
+			}
+			iStall = iSetup - 1;
+		}
+		if (pEvent->bEvent != TRACE_SETUP) {
+			continue;
+		}
+		if (iSetup < (int)(sizeof(abEnumeration) / sizeof(abEnumeration[0]))) {
+			if ((pEvent->dwArg1 != SimGetLE32(&abEnumeration[iSetup][0])) ||
+				(pEvent->dwArg2 != SimGetLE32(&abEnumeration[iSetup][4]))) {
+				fprintf(stderr, "SETUP %d is %08X %08X\n", iSetup, pEvent->dwArg1, pEvent->dwArg2);
+				fOk = false;
+			}
+		}
+		else if ((pEvent->dwArg1 & 0xFFFF) != (0xC0 | (SRCSINK_REQ_GET_TRACE << 8))) {
+			fprintf(stderr, "SETUP %d is %08X %08X\n", iSetup, pEvent->dwArg1, pEvent->dwArg2);
+			fOk = false;
+		}
+		iSetup++;
+	}
+	if (iSetup != (int)(sizeof(abEnumeration) / sizeof(abEnumeration[0])) + iDumps) {
+		fprintf(stderr, "%d SETUP packets traced\n", iSetup);
+		fOk = false;
+	}
+	if (iStall != STALLED_REQUEST) {
+		fprintf(stderr, "stall traced after request %d\n", iStall);
+		fOk = false;
+	}
+	if (CountRecords(&Trace, TRACE_EP_READ, SRCSINK_OUT_EP) != OUT_PACKETS) {
+		fprintf(stderr, "%d OUT packets traced\n", CountRecords(&Trace, TRACE_EP_READ, SRCSINK_OUT_EP));
+		fOk = false;
+	}
+	if (CountRecords(&Trace, TRACE_EP_WRITE, SRCSINK_IN_EP) < IN_PACKETS) {
+		fprintf(stderr, "%d IN packets traced\n", CountRecords(&Trace, TRACE_EP_WRITE, SRCSINK_IN_EP));
+		fOk = false;
+	}
+	if ((Trace.dwLost != 0) || (CountRecords(&Trace, 0, -1) != (int)dwRecords)) {
+		fprintf(stderr, "records lost\n");
+		fOk = false;
+	}
+	fOk = CheckTimes(&Trace) && fOk;
+	if (Trace.pEvents[Trace.iCount - 1].qwTime < (1ULL << 32)) {
+		fprintf(stderr, "the device time did not wrap\n");
+		fOk = false;
+	}
+	TraceFree(&Trace);
+	return fOk;
+}
+
+
+static bool TestOverflow(void)
+{
+	TTrace		Trace;
+	TTraceEvent	*pLast;
+	uint8_t		abData[PACKET_SIZE];
+	uint32_t	dwWritten;
+	int			i, iDumps;
+	bool		fOk;
+
+	USBTraceInit(TraceClock);
+	dwRecords = 0;
+	memset(abData, 0, sizeof(abData));
+	fOk = true;
+	for (i = 0; i < FLOOD_PACKETS; i++) {
+		if (SimHostOut(SRCSINK_OUT_EP, abData, sizeof(abData)) != sizeof(abData)) {
+			fprintf(stderr, "OUT packet %d failed\n", i);
+			fOk = false;
+		}
+	}
+	dwWritten = dwRecords;
+
+	TraceInit(&Trace);
+	fOk = ReadTrace(&Trace, &iDumps) && fOk;
+	Report("overflow", &Trace, iDumps);
+
+	// the ring is overwritten before the first dump, and holds the newest records
+	if ((Trace.iCount == 0) || (Trace.pEvents[0].bEvent != TRACE_LOST) ||
+		(Trace.pEvents[0].dwArg1 == 0) || (Trace.pEvents[0].dwArg1 != Trace.dwLost)) {
+		fprintf(stderr, "lost records not reported first\n");
+		fOk = false;
+	}
+	if (CountRecords(&Trace, 0, -1) + Trace.dwLost != dwRecords) {
+		fprintf(stderr, "%d records read and %u lost of %u\n",
+				CountRecords(&Trace, 0, -1), Trace.dwLost, dwRecords);
+		fOk = false;
+	}
+	pLast = NULL;
+	for (i = 0; i < Trace.iCount; i++) {
+		if ((Trace.pEvents[i].bEvent == TRACE_EP_READ) && (Trace.pEvents[i].bEP == SRCSINK_OUT_EP)) {
+			pLast = &Trace.pEvents[i];
+		}
+	}
+	if ((pLast == NULL) || ((uint32_t)(pLast->qwTime - CLOCK_START) != dwWritten - 1)) {
+		fprintf(stderr, "newest OUT packet not in the trace\n");
+		fOk = false;
+	}
+	fOk = CheckTimes(&Trace) && fOk;
+	TraceFree(&Trace);
+	return fOk;
+}
+
+
+// the time of a trace point, on the PC
+static bool TestCost(void)
+{
+	uint64_t	qwStart;
+	uint8_t		abDump[DUMP_SIZE];
+	int			i;
+
+	USBTraceInit(TraceClock);
+	dwRecords = 0;
+	qwStart = SimTimeNs();
+	for (i = 0; i < COST_RECORDS; i++) {
+		USBTrace(TRACE_USER, 0x82, i, i, 0);
+	}
+	qwStart = SimTimeNs() - qwStart;
+	fprintf(stderr, "cost         %d records in %llu us, %llu.%02llu ns per record\n", COST_RECORDS,
+			(unsigned long long)qwStart / 1000, (unsigned long long)qwStart / COST_RECORDS,
+			(unsigned long long)(qwStart * 100 / COST_RECORDS) % 100);
+	printf("cost,%u,0,0,0\n", dwRecords);
+
+	// the newest records are the last ones written
+	USBTraceRead(abDump, sizeof(abDump));
+	return (dwRecords == COST_RECORDS) && (SimGetLE32(&abDump[4]) == COST_RECORDS - TRACE_SIZE) &&
+			(SimGetLE32(&abDump[TRACE_HEADER_SIZE + 8]) == COST_RECORDS - TRACE_SIZE);
+}
+
+
+static void Usage(const char *pszName)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -v         print the timeline of the enumeration\n"
+		"  -o <name>  write it in the Chrome trace event format\n",
+		pszName);
+}
+
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	bool	fOk;
+
+	while ((c = getopt(argc, argv, "vo:h")) != -1) {
+		switch (c) {
+		case 'v':	fVerbose = true;	break;
+		case 'o':	pszChrome = optarg;	break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// set up the device side, like main_srcsink.c does
+	USBInit();
+	USBRegisterDescriptors(abDescriptors);
+	USBRegisterRequestHandler(REQTYPE_TYPE_VENDOR, SrcSinkHandleRequest, abVendorReqData);
+	USBHwNakIntEnable(INACK_BI);
+	USBHwEPConfig(SRCSINK_IN_EP, PACKET_SIZE);
+	USBHwEPConfig(SRCSINK_OUT_EP, PACKET_SIZE);
+	USBHwRegisterEPIntHandler(SRCSINK_IN_EP, SrcSinkBulkIn);
+	USBHwRegisterEPIntHandler(SRCSINK_OUT_EP, SrcSinkBulkOut);
+	USBHwRegisterFrameHandler(SrcSinkFrame);
+	SrcSinkInit();
+
+	fOk = TestEnumeration();
+	fOk = TestOverflow() && fOk;
+	fOk = TestCost() && fOk;
+
+	fprintf(stderr, "%s\n", fOk ? "PASS" : "FAIL");
+	return fOk ? 0 : 1;
+}
+
@@ -0,0 +1,444 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Simulated UARTs, see uart_sim.h.
+
+	Time only passes in UARTSimRun, which moves from one event to the
+	next: a character leaving the transmitter, a character from the peer
+	arriving in the receive FIFO, or a character timeout. The interrupt
+	handler is called from there whenever the real UART would raise an
+	interrupt, so it never runs while the code under test is in between
+	two accesses to the UART.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "uart.h"
+#include "uart_sim.h"
+
+#define SIM_PCLK		60000000	/**< peripheral clock, limits the baud rate */
+#define RX_TRIGGER		8			/**< receive FIFO trigger level */
+#define TIMEOUT_CHARS	4			/**< character timeout, in character times */
+
+#define RX_ERRORS		(UART_LSR_PE | UART_LSR_FE | UART_LSR_BI)
+
+/** Line format */
+typedef struct {
+	uint32_t	dwBaud;
+	int			iDataBits;
+	int			iParity;
+	int			iStopBits;
+} TFormat;
+
+/** State of one UART and its peer */
+typedef struct {
+	bool		fInit;
+	TFnUARTIntHandler	*pfnHandler;
+	TFormat		Format;					/**< set by the device */
+	TFormat		Peer;					/**< set by the test */
+	bool		fTxIntEnabled;
+	bool		fThreInt;				/**< transmit FIFO ran empty */
+	bool		fOverrun;
+
+	// receive FIFO, with the error bits of each character
+	uint8_t		abRxData[UART_HW_FIFO];
+	uint8_t		abRxStatus[UART_HW_FIFO];
+	int			iRxHead, iRxCount;
+	uint32_t	dwIdleNs;				/**< since the receive FIFO was last touched */
+
+	// transmit FIFO and shift register
+	uint8_t		abTxData[UART_HW_FIFO];
+	int			iTxHead, iTxCount;
+	uint8_t		bShift;
+	uint32_t	dwShiftNs;				/**< until the shift register is empty, 0 if idle */
+
+	// peer receiver, in capture mode
+	uint8_t		*pbCapture;
+	uint32_t	dwCaptureSize;
+
+	// peer transmitter
+	uint32_t	dwToSend;
+	uint32_t	dwPeerNs;				/**< until the character on the line arrives, 0 if idle */
+
+	TUARTSimStats	Stats;
+} TSimUart;
+
+static TSimUart aUarts[UARTSIM_NUM];
+
+
+/**
+	The data stream on a UART, the same for both directions. Every UART
+	has its own stream, without a period that lines up with any FIFO.
+
+	@param [in] iUart
+	@param [in] dwPos	position in the stream
+ */
+uint8_t UARTSimData(int iUart, uint32_t dwPos)
+{
+	return (dwPos ^ (dwPos >> 8) ^ (dwPos >> 16) ^ (iUart * 0x3C) ^ 0xA5) & 0xFF;
+}
+
+
+// the time a character takes on the line, in ns
+static uint32_t CharNs(const TFormat *pFormat)
+{
+	uint32_t dwHalfBits;
+
+	// start bit, data bits, parity bit, 1, 1.5 or 2 stop bits
+	dwHalfBits = 2 * (1 + pFormat->iDataBits + (pFormat->iParity ? 1 : 0)) + 2 + pFormat->iStopBits;
+	return (uint64_t)dwHalfBits * 500000000 / pFormat->dwBaud;
+}
+
+
+static bool SameFormat(const TFormat *pA, const TFormat *pB)
+{
+	return (pA->dwBaud == pB->dwBaud) && (pA->iDataBits == pB->iDataBits) &&
+			(pA->iParity == pB->iParity) && (pA->iStopBits == pB->iStopBits);
+}
+
+
+static void SetFormat(TFormat *pFormat, uint32_t dwBaud, int iDataBits, int iParity, int iStopBits)
+{
+	pFormat->dwBaud = dwBaud;
+	pFormat->iDataBits = iDataBits;
+	pFormat->iParity = iParity;
+	pFormat->iStopBits = iStopBits;
+}
+
+
+void UARTInit(int iUart, TFnUARTIntHandler *pfnHandler)
+{
+	TSimUart *pUart = &aUarts[iUart];
+
+	memset(pUart, 0, sizeof(*pUart));
+	pUart->fInit = true;
+	pUart->pfnHandler = pfnHandler;
+	SetFormat(&pUart->Format, 115200, 8, 0, 0);
+	SetFormat(&pUart->Peer, 115200, 8, 0, 0);
+}
+
+
+bool UARTSetFormat(int iUart, uint32_t dwBaud, int iDataBits, int iParity, int iStopBits)
+{
+	// the same checks as lpc2000_uart.c, the baud rate is exact here
+	if ((iUart >= UARTSIM_NUM) || (dwBaud == 0) || (dwBaud > SIM_PCLK / 16) ||
+		(iDataBits < 5) || (iDataBits > 8) || (iParity > 4) || (iStopBits > 2) ||
+		((iStopBits == 1) && (iDataBits != 5))) {
+		return false;
+	}
+	SetFormat(&aUarts[iUart].Format, dwBaud, iDataBits, iParity, iStopBits);
+	return true;
+}
+
+
+uint8_t UARTGetStatus(int iUart)
+{
+	TSimUart *pUart = &aUarts[iUart];
+	uint8_t bStatus;
+
+	bStatus = 0;
+	if (pUart->iRxCount > 0) {
+		bStatus |= UART_LSR_RDR | pUart->abRxStatus[pUart->iRxHead];
+	}
+	if (pUart->fOverrun) {
+		bStatus |= UART_LSR_OE;
+		pUart->fOverrun = false;
+	}
+	if (pUart->iTxCount == 0) {
+		bStatus |= UART_LSR_THRE;
+		if (pUart->dwShiftNs == 0) {
+			bStatus |= UART_LSR_TEMT;
+		}
+	}
+	return bStatus;
+}
+
+
+uint8_t UARTRead(int iUart)
+{
+	TSimUart *pUart = &aUarts[iUart];
+	uint8_t b;
+
+	if (pUart->iRxCount == 0) {
+		return 0;
+	}
+	b = pUart->abRxData[pUart->iRxHead];
+	pUart->iRxHead = (pUart->iRxHead + 1) % UART_HW_FIFO;
+	pUart->iRxCount--;
+	pUart->dwIdleNs = 0;
+	return b;
+}
+
+
+void UARTWrite(int iUart, uint8_t b)
+{
+	TSimUart *pUart = &aUarts[iUart];
+
+	if (pUart->iTxCount == UART_HW_FIFO) {
+		pUart->Stats.dwTxOverflows++;
+		return;
+	}
+	pUart->abTxData[(pUart->iTxHead + pUart->iTxCount) % UART_HW_FIFO] = b;
+	pUart->iTxCount++;
+	pUart->fThreInt = false;
+}
+
+
+void UARTTxIntEnable(int iUart, bool fEnable)
+{
+	TSimUart *pUart = &aUarts[iUart];
+
+	// like the real one, enabling it with an empty FIFO raises it at once
+	pUart->fTxIntEnabled = fEnable;
+	pUart->fThreInt = fEnable && (pUart->iTxCount == 0);
+}
+
+
+/**
+	Sets the line format of the peer
+
+	@param [in] iUart
+	@param [in] dwBaud
+	@param [in] iDataBits
+	@param [in] iParity		as in the CDC line coding
+	@param [in] iStopBits	as in the CDC line coding
+ */
+void UARTSimSetPeer(int iUart, uint32_t dwBaud, int iDataBits, int iParity, int iStopBits)
+{
+	SetFormat(&aUarts[iUart].Peer, dwBaud, iDataBits, iParity, iStopBits);
+}
+
+
+/**
+	Lets the peer send more characters, back to back
+
+	@param [in] iUart
+	@param [in] dwCount
+ */
+void UARTSimSend(int iUart, uint32_t dwCount)
+{
+	aUarts[iUart].dwToSend += dwCount;
+}
+
+
+/**
+	Returns the line format the device has set
+
+	@returns false if the UART was not initialised
+ */
+bool UARTSimGetFormat(int iUart, uint32_t *pdwBaud, int *piDataBits, int *piParity, int *piStopBits)
+{
+	TSimUart *pUart = &aUarts[iUart];
+
+	*pdwBaud = pUart->Format.dwBaud;
+	*piDataBits = pUart->Format.iDataBits;
+	*piParity = pUart->Format.iParity;
+	*piStopBits = pUart->Format.iStopBits;
+	return pUart->fInit;
+}
+
+
+/**
+	Makes the peer store what it receives instead of checking it, for
+	text output. Restarts the count of received characters.
+
+	@param [in] iUart
+	@param [in] pbBuf	received characters, those that do not fit are lost
+	@param [in] dwSize
+ */
+void UARTSimCapture(int iUart, uint8_t *pbBuf, uint32_t dwSize)
+{
+	aUarts[iUart].pbCapture = pbBuf;
+	aUarts[iUart].dwCaptureSize = dwSize;
+	aUarts[iUart].Stats.dwReceived = 0;
+}
+
+
+void UARTSimGetStats(int iUart, TUARTSimStats *pStats)
+{
+	*pStats = aUarts[iUart].Stats;
+}
+
+
+// a character from the transmitter reaches the peer
+static void PeerReceive(TSimUart *pUart, int iUart)
+{
+	if (pUart->pbCapture != NULL) {
+		if (pUart->Stats.dwReceived < pUart->dwCaptureSize) {
+			pUart->pbCapture[pUart->Stats.dwReceived] = pUart->bShift;
+		}
+	}
+	else if (!SameFormat(&pUart->Format, &pUart->Peer) ||
+		(pUart->bShift != UARTSimData(iUart, pUart->Stats.dwReceived))) {
+		pUart->Stats.dwErrors++;
+	}
+	pUart->Stats.dwReceived++;
+}
+
+
+// a character from the peer reaches the receive FIFO
+static void DeviceReceive(TSimUart *pUart, int iUart)
+{
+	uint8_t b;
+	int i;
+
+	b = UARTSimData(iUart, pUart->Stats.dwSent);
+	pUart->Stats.dwSent++;
+	pUart->dwIdleNs = 0;
+	if (pUart->iRxCount == UART_HW_FIFO) {
+		// the character in the shift register is lost
+		pUart->fOverrun = true;
+		pUart->Stats.dwOverruns++;
+		return;
+	}
+	i = (pUart->iRxHead + pUart->iRxCount) % UART_HW_FIFO;
+	if (SameFormat(&pUart->Format, &pUart->Peer)) {
+		pUart->abRxData[i] = b;
+		pUart->abRxStatus[i] = 0;
+	}
+	else {
+		pUart->abRxData[i] = ~b;
+		pUart->abRxStatus[i] = UART_LSR_FE;
+	}
+	pUart->iRxCount++;
+}
+
+
+// whether the UART has an interrupt pending
+static bool IntPending(TSimUart *pUart)
+{
+	int i;
+
+	if (pUart->iRxCount >= RX_TRIGGER) {
+		return true;
+	}
+	if ((pUart->iRxCount > 0) && (pUart->dwIdleNs >= TIMEOUT_CHARS * CharNs(&pUart->Format))) {
+		return true;
+	}
+	for (i = 0; i < pUart->iRxCount; i++) {
+		if (pUart->abRxStatus[(pUart->iRxHead + i) % UART_HW_FIFO] & RX_ERRORS) {
+			return true;
+		}
+	}
+	return pUart->fTxIntEnabled && pUart->fThreInt;
+}
+
+
+// time until the next event of a UART, limited to dwMax
+static uint32_t NextEvent(TSimUart *pUart, uint32_t dwMax)
+{
+	uint32_t dwTimeout;
+
+	if ((pUart->dwShiftNs != 0) && (pUart->dwShiftNs < dwMax)) {
+		dwMax = pUart->dwShiftNs;
+	}
+	if ((pUart->dwPeerNs != 0) && (pUart->dwPeerNs < dwMax)) {
+		dwMax = pUart->dwPeerNs;
+	}
+	if (pUart->iRxCount > 0) {
+		dwTimeout = TIMEOUT_CHARS * CharNs(&pUart->Format);
+		if ((pUart->dwIdleNs < dwTimeout) && (dwTimeout - pUart->dwIdleNs < dwMax)) {
+			dwMax = dwTimeout - pUart->dwIdleNs;
+		}
+	}
+	return dwMax;
+}
+
+
+// lets time pass for one UART, and handles what happened
+static void Advance(TSimUart *pUart, int iUart, uint32_t dwNs)
+{
+	if (!pUart->fInit) {
+		return;
+	}
+
+	if (pUart->dwShiftNs != 0) {
+		pUart->dwShiftNs -= dwNs;
+		if (pUart->dwShiftNs == 0) {
+			PeerReceive(pUart, iUart);
+		}
+	}
+	if (pUart->iRxCount > 0) {
+		pUart->dwIdleNs += dwNs;
+	}
+	if (pUart->dwPeerNs != 0) {
+		pUart->dwPeerNs -= dwNs;
+		if (pUart->dwPeerNs == 0) {
+			DeviceReceive(pUart, iUart);
+		}
+	}
+
+	// the shift register takes the next character straight away
+	if ((pUart->dwShiftNs == 0) && (pUart->iTxCount > 0)) {
+		pUart->bShift = pUart->abTxData[pUart->iTxHead];
+		pUart->iTxHead = (pUart->iTxHead + 1) % UART_HW_FIFO;
+		pUart->iTxCount--;
+		pUart->dwShiftNs = CharNs(&pUart->Format);
+		if (pUart->iTxCount == 0) {
+			pUart->fThreInt = true;
+		}
+	}
+	// and so does the peer
+	if ((pUart->dwPeerNs == 0) && (pUart->dwToSend > 0)) {
+		pUart->dwToSend--;
+		pUart->dwPeerNs = CharNs(&pUart->Peer);
+	}
+
+	if ((pUart->pfnHandler != NULL) && IntPending(pUart)) {
+		// reading the interrupt identification clears the THRE interrupt
+		pUart->fThreInt = false;
+		pUart->Stats.dwInterrupts++;
+		pUart->pfnHandler(iUart);
+	}
+}
+
+
+/**
+	Lets time pass on all UARTs
+
+	@param [in] dwNs	nanoseconds
+ */
+void UARTSimRun(uint32_t dwNs)
+{
+	uint32_t dwStep;
+	int i;
+
+	while (dwNs > 0) {
+		dwStep = dwNs;
+		for (i = 0; i < UARTSIM_NUM; i++) {
+			if (aUarts[i].fInit) {
+				dwStep = NextEvent(&aUarts[i], dwStep);
+			}
+		}
+		for (i = 0; i < UARTSIM_NUM; i++) {
+			Advance(&aUarts[i], i, dwStep);
+		}
+		dwNs -= dwStep;
+	}
+}
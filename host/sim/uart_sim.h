@@ -0,0 +1,68 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	Simulated UARTs.
+
+	This replaces lpc2000_uart.c in host builds. Each UART has the 16 byte
+	FIFOs and the interrupts of the real one, and characters take as long
+	as they would on the line in simulated time, see UARTSimRun. On the
+	other end of each line sits a peer that sends a data stream as fast as
+	the line allows and checks the stream it receives. Both use
+	UARTSimData, with their own position.
+
+	If the format the device set differs from that of the peer, every
+	character arrives with a framing error on either side.
+
+	The peer can also just store what it receives, see UARTSimCapture.
+	UARTs initialised without an interrupt handler are polled.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define UARTSIM_NUM		4		/**< number of UARTs */
+
+/** Counters of the peer and the line */
+typedef struct {
+	uint32_t	dwSent;				/**< characters the peer sent */
+	uint32_t	dwReceived;			/**< characters the peer received */
+	uint32_t	dwErrors;			/**< received characters that were wrong */
+	uint32_t	dwOverruns;			/**< characters lost in the receive FIFO of the device */
+	uint32_t	dwTxOverflows;		/**< characters written to a full transmit FIFO */
+	uint32_t	dwInterrupts;		/**< interrupts raised */
+} TUARTSimStats;
+
+uint8_t UARTSimData(int iUart, uint32_t dwPos);
+
+void UARTSimSetPeer(int iUart, uint32_t dwBaud, int iDataBits, int iParity, int iStopBits);
+void UARTSimSend(int iUart, uint32_t dwCount);
+void UARTSimCapture(int iUart, uint8_t *pbBuf, uint32_t dwSize);
+void UARTSimRun(uint32_t dwNs);
+bool UARTSimGetFormat(int iUart, uint32_t *pdwBaud, int *piDataBits, int *piParity, int *piStopBits);
+void UARTSimGetStats(int iUart, TUARTSimStats *pStats);
@@ -0,0 +1,649 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file
+	Simulated USB hardware layer
+
+	Models the endpoint buffers of the LPC USB controller closely enough to
+	run the stack and the example applications on a PC:
+	* control endpoints have a single buffer, all others are double buffered
+	* endpoint interrupts are raised when a buffer is emptied (IN) or
+	  filled (OUT) by the host, and on NAK if enabled with USBHwNakIntEnable
+	* a stalled endpoint refuses all transactions until unstalled
+	* isochronous endpoints (3, 6, 9, 12, 15) never NAK or interrupt, the
+	  device serves them from the frame handler. IN data not taken by the
+	  host before the next frame is lost, so is OUT data the frame handler
+	  did not read.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "usbhw_lpc.h"
+#include "usbapi.h"
+#include "usbtrace.h"
+
+#include "usbhw_sim.h"
+
+#define SIM_MAX_PACKET		1023	/**< largest (isochronous) packet */
+#define SIM_NUM_BUFS		2		/**< buffers of a double-buffered EP */
+#define SIM_CONTROL_TRIES	1000	/**< NAKs before a control transfer fails */
+
+/** convert from endpoint address to endpoint index */
+#define EP2IDX(bEP)	((((bEP)&0xF)<<1)|(((bEP)&0x80)>>7))
+/** convert from endpoint index to endpoint address */
+#define IDX2EP(idx)	((((idx)<<7)&0x80)|(((idx)>>1)&0xF))
+/** isochronous endpoints on the LPC are 3, 6, 9, 12 and 15 */
+#define IDX_ISOC(idx)	(((idx) >= 6) && ((((idx) >> 1) % 3) == 0))
+
+/** State of one simulated endpoint */
+typedef struct {
+	uint16_t	wMaxPacketSize;		/**< as configured by USBHwEPConfig */
+	bool		fStalled;			/**< stall bit */
+	bool		fSetup;				/**< last received packet was a SETUP */
+	bool		fNacked;			/**< a NAK was sent since the last interrupt */
+	int			iBufs;				/**< number of buffers (1 or 2) */
+	int			iFull;				/**< number of full buffers */
+	int			iHead;				/**< oldest full buffer */
+	int			aiLen[SIM_NUM_BUFS];
+	uint8_t		aabBuf[SIM_NUM_BUFS][SIM_MAX_PACKET];
+} TSimEP;
+
+static TSimEP			aEP[32];
+static uint8_t			bNakIntBits;
+static uint16_t			wFrameNr;
+static uint32_t			dwOverruns;
+static uint32_t			dwStaleControl;
+
+static TFnDevIntHandler	*_pfnDevIntHandler = NULL;
+static TFnEPIntHandler	*_apfnEPIntHandlers[16];
+static TFnFrameHandler	*_pfnFrameHandler = NULL;
+
+
+/**
+	Local function to compose the 'select endpoint' status byte
+ */
+static uint8_t SimEPStat(int idx)
+{
+	TSimEP	*pEP = &aEP[idx];
+	uint8_t	bStat;
+	bool	fIn = (idx & 1) != 0;
+
+	bStat = 0;
+	if (fIn ? (pEP->iFull == pEP->iBufs) : (pEP->iFull > 0)) {
+		bStat |= EPSTAT_FE;
+	}
+	if (pEP->fStalled) {
+		bStat |= EPSTAT_ST;
+	}
+	if (pEP->fSetup) {
+		bStat |= EPSTAT_STP;
+	}
+	if (pEP->fNacked) {
+		bStat |= EPSTAT_EPN;
+	}
+	if (pEP->iFull > 0) {
+		bStat |= EPSTAT_B1FULL;
+	}
+	if (pEP->iFull > 1) {
+		bStat |= EPSTAT_B2FULL;
+	}
+	return bStat;
+}
+
+
+/**
+	Local function to raise an endpoint interrupt, converting the status
+	exactly like USBHwISR does.
+ */
+static void SimEPInterrupt(int idx)
+{
+	uint8_t	bEPStat, bStat;
+
+	bEPStat = SimEPStat(idx);
+	aEP[idx].fNacked = false;
+	bStat = ((bEPStat & EPSTAT_FE) ? EP_STATUS_DATA : 0) |
+			((bEPStat & EPSTAT_ST) ? EP_STATUS_STALLED : 0) |
+			((bEPStat & EPSTAT_STP) ? EP_STATUS_SETUP : 0) |
+			((bEPStat & EPSTAT_EPN) ? EP_STATUS_NACKED : 0) |
+			((bEPStat & EPSTAT_PO) ? EP_STATUS_ERROR : 0);
+	if (_apfnEPIntHandlers[idx / 2] != NULL) {
+		_apfnEPIntHandlers[idx / 2](IDX2EP(idx), bStat);
+	}
+}
+
+
+/**
+	Local function to check if a NAK on this endpoint raises an interrupt.
+
+	The simulation does not know the endpoint types, so the bulk and
+	interrupt NAK bits are treated alike.
+ */
+static bool SimNakIntEnabled(int idx)
+{
+	bool fIn = (idx & 1) != 0;
+
+	if (idx < 2) {
+		return (bNakIntBits & (fIn ? INACK_CI : INACK_CO)) != 0;
+	}
+	return (bNakIntBits & (fIn ? (INACK_BI | INACK_II) : (INACK_BO | INACK_IO))) != 0;
+}
+
+
+/*************************************************************************
+	Device side, see usbhw_lpc.c for descriptions
+**************************************************************************/
+
+bool USBHwInit(void)
+{
+	int i;
+
+	memset(aEP, 0, sizeof(aEP));
+	for (i = 0; i < 32; i++) {
+		aEP[i].iBufs = (i < 2) ? 1 : SIM_NUM_BUFS;
+	}
+	bNakIntBits = 0;
+	wFrameNr = 0;
+	return true;
+}
+
+
+void USBHwEPConfig(uint8_t bEP, uint16_t wMaxPacketSize)
+{
+	TSimEP *pEP = &aEP[EP2IDX(bEP)];
+
+	pEP->wMaxPacketSize = wMaxPacketSize;
+	pEP->iBufs = ((bEP & 0xF) == 0) ? 1 : SIM_NUM_BUFS;
+	pEP->iFull = 0;
+	pEP->iHead = 0;
+}
+
+
+void USBHwRegisterEPIntHandler(uint8_t bEP, TFnEPIntHandler *pfnHandler)
+{
+	_apfnEPIntHandlers[EP2IDX(bEP) / 2] = pfnHandler;
+}
+
+
+void USBHwRegisterDevIntHandler(TFnDevIntHandler *pfnHandler)
+{
+	_pfnDevIntHandler = pfnHandler;
+}
+
+
+void USBHwRegisterFrameHandler(TFnFrameHandler *pfnHandler)
+{
+	_pfnFrameHandler = pfnHandler;
+}
+
+
+void USBHwSetAddress(uint8_t bAddr)
+{
+	(void)bAddr;
+}
+
+
+void USBHwConnect(bool fConnect)
+{
+	(void)fConnect;
+}
+
+
+void USBHwConfigDevice(bool fConfigured)
+{
+	(void)fConfigured;
+}
+
+
+void USBHwNakIntEnable(uint8_t bIntBits)
+{
+	bNakIntBits = bIntBits;
+}
+
+
+uint8_t USBHwEPGetStatus(uint8_t bEP)
+{
+	return SimEPStat(EP2IDX(bEP));
+}
+
+
+uint16_t USBHwEPGetMaxPacketSize(uint8_t bEP)
+{
+	return aEP[EP2IDX(bEP)].wMaxPacketSize;
+}
+
+
+void USBHwEPStall(uint8_t bEP, bool fStall)
+{
+	TRACE(TRACE_STALL, bEP, fStall, 0, 0);
+	aEP[EP2IDX(bEP)].fStalled = fStall;
+}
+
+
+int USBHwEPWrite(uint8_t bEP, uint8_t *pbBuf, int iLen)
+{
+	TSimEP	*pEP = &aEP[EP2IDX(bEP)];
+	int		iBuf;
+
+	if ((iLen > SIM_MAX_PACKET) ||
+		((pEP->wMaxPacketSize != 0) && (iLen > pEP->wMaxPacketSize))) {
+		fprintf(stderr, "sim: EP%02X write of %d bytes exceeds packet size\n", bEP, iLen);
+		iLen = pEP->wMaxPacketSize;
+	}
+	if (pEP->iFull == pEP->iBufs) {
+		// real hardware would silently overwrite a buffer here
+		fprintf(stderr, "sim: EP%02X write with all buffers full\n", bEP);
+		dwOverruns++;
+		return iLen;
+	}
+	TRACE(TRACE_EP_WRITE, bEP, iLen, 0, 0);
+	iBuf = (pEP->iHead + pEP->iFull) % pEP->iBufs;
+	if (iLen > 0) {
+		memcpy(pEP->aabBuf[iBuf], pbBuf, iLen);
+	}
+	pEP->aiLen[iBuf] = iLen;
+	pEP->iFull++;
+	return iLen;
+}
+
+
+int USBHwEPRead(uint8_t bEP, uint8_t *pbBuf, int iMaxLen)
+{
+	TSimEP	*pEP = &aEP[EP2IDX(bEP)];
+	int		iLen;
+
+	if (pEP->iFull == 0) {
+		TRACE(TRACE_EP_READ, bEP, 0xFFFF, 0, 0);
+		return -1;
+	}
+	iLen = pEP->aiLen[pEP->iHead];
+	TRACE(TRACE_EP_READ, bEP, iLen, 0, 0);
+	if (pbBuf != NULL) {
+		memcpy(pbBuf, pEP->aabBuf[pEP->iHead], (iLen < iMaxLen) ? iLen : iMaxLen);
+	}
+	pEP->iHead = (pEP->iHead + 1) % pEP->iBufs;
+	pEP->iFull--;
+	pEP->fSetup = false;
+	return iLen;
+}
+
+
+int USBHwISOCEPRead(const uint8_t bEP, uint8_t *pbBuf, const int iMaxLen)
+{
+	return USBHwEPRead(bEP, pbBuf, iMaxLen);
+}
+
+
+void USBHwISR(void)
+{
+	// all interrupts are delivered from the SimHost* functions
+}
+
+
+/*************************************************************************
+	Host side
+**************************************************************************/
+
+/**
+	Simulates a USB bus reset
+ */
+void SimHostReset(void)
+{
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		aEP[i].iFull = 0;
+		aEP[i].iHead = 0;
+		aEP[i].fStalled = false;
+	}
+	TRACE(TRACE_DEV_STATUS, 0, DEV_STATUS_RESET, 0, 0);
+	if (_pfnDevIntHandler != NULL) {
+		_pfnDevIntHandler(DEV_STATUS_RESET);
+	}
+}
+
+
+/**
+	Simulates a start-of-frame
+ */
+void SimHostFrame(void)
+{
+	int i;
+
+	// isoc IN data that missed its frame is gone
+	for (i = 6; i < 32; i += 6) {
+		aEP[i + 1].iFull = 0;
+	}
+	wFrameNr = (wFrameNr + 1) & 0x7FF;
+	if (_pfnFrameHandler != NULL) {
+		_pfnFrameHandler(wFrameNr);
+	}
+	// and so is isoc OUT data the device did not read in time
+	for (i = 6; i < 32; i += 6) {
+		aEP[i].iFull = 0;
+	}
+}
+
+
+/**
+	Sends one OUT data packet to the device
+
+	@param [in]	bEP		Endpoint address
+	@param [in]	pbBuf	Packet data
+	@param [in]	iLen	Packet length
+
+	@return iLen if the packet was ACKed, SIM_NAK or SIM_STALL otherwise
+ */
+int SimHostOut(uint8_t bEP, const uint8_t *pbBuf, int iLen)
+{
+	int		idx = EP2IDX(bEP);
+	TSimEP	*pEP = &aEP[idx];
+	int		iBuf;
+
+	if (pEP->fStalled) {
+		return SIM_STALL;
+	}
+	if (IDX_ISOC(idx) && (pEP->iFull == pEP->iBufs)) {
+		// no handshake on isoc, the packet is simply lost
+		return iLen;
+	}
+	if (pEP->iFull == pEP->iBufs) {
+		pEP->fNacked = true;
+		if (SimNakIntEnabled(idx)) {
+			SimEPInterrupt(idx);
+		}
+		return SIM_NAK;
+	}
+	iBuf = (pEP->iHead + pEP->iFull) % pEP->iBufs;
+	memcpy(pEP->aabBuf[iBuf], pbBuf, iLen);
+	pEP->aiLen[iBuf] = iLen;
+	pEP->iFull++;
+	if (!IDX_ISOC(idx)) {
+		SimEPInterrupt(idx);
+	}
+	return iLen;
+}
+
+
+/**
+	Requests one IN data packet from the device
+
+	@param [in]	bEP		Endpoint address
+	@param [out] pbBuf	Packet data
+	@param [in]	iMaxLen	Size of pbBuf
+
+	@return packet length if the packet was received, SIM_NAK or SIM_STALL
+	otherwise. An isoc endpoint with nothing to send returns 0.
+ */
+int SimHostIn(uint8_t bEP, uint8_t *pbBuf, int iMaxLen)
+{
+	int		idx = EP2IDX(bEP);
+	TSimEP	*pEP = &aEP[idx];
+	int		iLen;
+
+	if (pEP->fStalled) {
+		return SIM_STALL;
+	}
+	if (IDX_ISOC(idx) && (pEP->iFull == 0)) {
+		// nothing to send in this frame
+		return 0;
+	}
+	if (pEP->iFull == 0) {
+		pEP->fNacked = true;
+		if (SimNakIntEnabled(idx)) {
+			SimEPInterrupt(idx);
+		}
+		return SIM_NAK;
+	}
+	iLen = pEP->aiLen[pEP->iHead];
+	if (iLen > iMaxLen) {
+		fprintf(stderr, "sim: EP%02X babble (%d > %d)\n", bEP, iLen, iMaxLen);
+		iLen = iMaxLen;
+	}
+	memcpy(pbBuf, pEP->aabBuf[pEP->iHead], iLen);
+	pEP->iHead = (pEP->iHead + 1) % pEP->iBufs;
+	pEP->iFull--;
+	if (!IDX_ISOC(idx)) {
+		SimEPInterrupt(idx);
+	}
+	return iLen;
+}
+
+
+/**
+	Clears a halt condition, like a CLEAR_FEATURE(ENDPOINT_HALT) would
+ */
+void SimHostClearHalt(uint8_t bEP)
+{
+	USBHwEPStall(bEP, false);
+}
+
+
+/**
+	Returns the max packet size of an endpoint as configured by the device
+ */
+uint16_t SimHostGetMaxPacketSize(uint8_t bEP)
+{
+	return aEP[EP2IDX(bEP)].wMaxPacketSize;
+}
+
+
+/**
+	Returns the number of packets the device wrote into a full endpoint
+ */
+uint32_t SimHostGetOverruns(void)
+{
+	return dwOverruns;
+}
+
+
+/**
+	Sends a SETUP packet to the device. Like on the real bus, a SETUP is
+	always accepted and ends a stall and whatever transfer was going on
+	on the control pipe. IN data the device still had queued is dropped
+	and counted, see SimHostGetStaleControl.
+
+	@param [in]	pbSetup	The 8 byte setup packet
+ */
+void SimHostSetup(const uint8_t *pbSetup)
+{
+	TSimEP	*pOut = &aEP[0];
+	TSimEP	*pIn = &aEP[1];
+
+	dwStaleControl += pIn->iFull;
+	pIn->iFull = 0;
+	pIn->iHead = 0;
+	pIn->fStalled = false;
+	pOut->iFull = 1;
+	pOut->iHead = 0;
+	pOut->fStalled = false;
+	memcpy(pOut->aabBuf[0], pbSetup, 8);
+	pOut->aiLen[0] = 8;
+	pOut->fSetup = true;
+	SimEPInterrupt(0);
+}
+
+
+/**
+	Runs a complete control transfer: setup, data and status stage
+
+	@param [in]		pbSetup	The 8 byte setup packet
+	@param [in,out]	pbData	Data to send, or room for the data to receive
+	@param [in]		iMaxLen	Size of pbData
+
+	@return number of bytes in the data stage, SIM_NAK if the device did
+	not respond or SIM_STALL if it stalled the request
+ */
+int SimHostControl(const uint8_t *pbSetup, uint8_t *pbData, int iMaxLen)
+{
+	uint8_t	abPacket[SIM_MAX_PACKET];
+	int		iLength, iDone, iChunk, iTries;
+	bool	fIn;
+
+	fIn = (pbSetup[0] & 0x80) != 0;
+	iLength = pbSetup[6] | (pbSetup[7] << 8);
+	if (iLength > iMaxLen) {
+		iLength = iMaxLen;
+	}
+	SimHostSetup(pbSetup);
+
+	// data stage
+	iDone = 0;
+	iTries = 0;
+	while ((iDone < iLength) && (iTries < SIM_CONTROL_TRIES)) {
+		if (fIn) {
+			iChunk = SimHostIn(0x80, abPacket, sizeof(abPacket));
+			if (iChunk >= 0) {
+				if (iChunk > iLength - iDone) {
+					fprintf(stderr, "sim: EP80 babble in control transfer\n");
+					iChunk = iLength - iDone;
+				}
+				memcpy(pbData + iDone, abPacket, iChunk);
+				iDone += iChunk;
+				iTries = 0;
+				if (iChunk < aEP[1].wMaxPacketSize) {
+					break;
+				}
+				continue;
+			}
+		}
+		else {
+			iChunk = iLength - iDone;
+			if (iChunk > aEP[0].wMaxPacketSize) {
+				iChunk = aEP[0].wMaxPacketSize;
+			}
+			iChunk = SimHostOut(0x00, pbData + iDone, iChunk);
+			if (iChunk >= 0) {
+				iDone += iChunk;
+				iTries = 0;
+				continue;
+			}
+		}
+		if (iChunk == SIM_STALL) {
+			return SIM_STALL;
+		}
+		iTries++;
+	}
+	if (iTries == SIM_CONTROL_TRIES) {
+		return SIM_NAK;
+	}
+
+	// status stage, in the opposite direction, always IN without data stage
+	if (iLength == 0) {
+		fIn = false;
+	}
+	for (iTries = 0; iTries < SIM_CONTROL_TRIES; iTries++) {
+		iChunk = fIn ? SimHostOut(0x00, abPacket, 0) : SimHostIn(0x80, abPacket, sizeof(abPacket));
+		if (iChunk == SIM_STALL) {
+			return SIM_STALL;
+		}
+		if (iChunk >= 0) {
+			if (iChunk != 0) {
+				fprintf(stderr, "sim: %d bytes in control status stage\n", iChunk);
+			}
+			return iDone;
+		}
+	}
+	return SIM_NAK;
+}
+
+
+/**
+	Builds a setup packet and runs the control transfer
+
+	@param [in]		bmRequestType
+	@param [in]		bRequest
+	@param [in]		wValue
+	@param [in]		wIndex
+	@param [in,out]	pbData	Data to send, or room for the data to receive
+	@param [in]		iLen	wLength, and the size of pbData
+
+	@return as SimHostControl
+ */
+int SimHostRequest(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+				uint8_t *pbData, int iLen)
+{
+	uint8_t	abSetup[8];
+
+	abSetup[0] = bmRequestType;
+	abSetup[1] = bRequest;
+	abSetup[2] = wValue & 0xFF;
+	abSetup[3] = wValue >> 8;
+	abSetup[4] = wIndex & 0xFF;
+	abSetup[5] = wIndex >> 8;
+	abSetup[6] = iLen & 0xFF;
+	abSetup[7] = iLen >> 8;
+	return SimHostControl(abSetup, pbData, iLen);
+}
+
+
+/**
+	Returns the number of EP0 IN packets the device queued but the host
+	never asked for, dropped by the next SETUP
+ */
+uint32_t SimHostGetStaleControl(void)
+{
+	return dwStaleControl;
+}
+
+
+/** Monotonic time in microseconds, for timing the simulations */
+uint64_t SimTimeUs(void)
+{
+	return SimTimeNs() / 1000;
+}
+
+
+/** Monotonic time in nanoseconds */
+uint64_t SimTimeNs(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/** Reads a little endian 32-bit value, as used in USB descriptors and requests */
+uint32_t SimGetLE32(const uint8_t *pb)
+{
+	return pb[0] | (pb[1] << 8) | (pb[2] << 16) | ((uint32_t)pb[3] << 24);
+}
+
+
+/** Writes a little endian 32-bit value */
+void SimPutLE32(uint8_t *pb, uint32_t dw)
+{
+	pb[0] = dw;
+	pb[1] = dw >> 8;
+	pb[2] = dw >> 16;
+	pb[3] = dw >> 24;
+}
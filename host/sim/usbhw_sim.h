@@ -0,0 +1,65 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	Simulated USB device controller.
+
+	This replaces usbhw_lpc.c in host builds of the stack. The device side
+	sees the regular USBHw* API, the host side of the simulation uses the
+	SimHost* functions below to move packets in and out of the endpoint
+	buffers. Endpoint interrupts are delivered synchronously from within
+	the SimHost* calls, just like the real controller would raise them.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_NAK			(-1)	/**< endpoint NAKed the transaction */
+#define SIM_STALL		(-2)	/**< endpoint is stalled */
+
+void SimHostReset(void);
+void SimHostFrame(void);
+
+int  SimHostOut(uint8_t bEP, const uint8_t *pbBuf, int iLen);
+int  SimHostIn(uint8_t bEP, uint8_t *pbBuf, int iMaxLen);
+void SimHostClearHalt(uint8_t bEP);
+
+void SimHostSetup(const uint8_t *pbSetup);
+int  SimHostControl(const uint8_t *pbSetup, uint8_t *pbData, int iMaxLen);
+int  SimHostRequest(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+					uint8_t *pbData, int iLen);
+
+uint16_t SimHostGetMaxPacketSize(uint8_t bEP);
+uint32_t SimHostGetOverruns(void);
+uint32_t SimHostGetStaleControl(void);
+
+// helpers for the host side of the simulations
+uint64_t SimTimeUs(void);
+uint64_t SimTimeNs(void);
+uint32_t SimGetLE32(const uint8_t *pb);
+void     SimPutLE32(uint8_t *pb, uint32_t dw);
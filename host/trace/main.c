@@ -0,0 +1,207 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Event trace reader.
+
+	Reads the binary event trace out of the 'srcsink' test function on the
+	LPC through libusb-1.0, by repeating the vendor request for it until
+	a dump is not full, and prints the timeline. Each request adds a few
+	records of its own, which show up in the next read. The stack on
+	the device has to be built with USB_TRACE.
+
+	With -f, the dumps are read from a file instead, for instance as
+	written by USBTraceRead to a UART, one dump after the other. With -w,
+	the dumps read from the device are saved in that same form. With -o,
+	the timeline is also written in the Chrome trace event format, to be
+	opened with chrome://tracing or Perfetto.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <libusb.h>
+
+#include "tracedecode.h"
+
+// USB device specific definitions, see srcsink.h
+#define VENDOR_ID			0xFFFF
+#define PRODUCT_ID			0x0006
+
+#define	BM_REQUEST_TYPE		(2<<5)
+#define SRCSINK_REQ_GET_TRACE	0x17
+
+#define DUMP_SIZE			(TRACE_HEADER_SIZE + TRACE_DUMP_RECORDS * TRACE_RECORD_SIZE)
+#define TIMEOUT_MS			1000
+
+static TTrace	Trace;
+
+
+static bool ReadDevice(FILE *fRaw)
+{
+	libusb_device_handle *hdl;
+	uint8_t	abDump[DUMP_SIZE];
+	int		iLen, iCount;
+	bool	fOk;
+
+	hdl = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID);
+	if (hdl == NULL) {
+		fprintf(stderr, "device not found\n");
+		return false;
+	}
+	fOk = true;
+	do {
+		iLen = libusb_control_transfer(hdl, BM_REQUEST_TYPE | LIBUSB_ENDPOINT_IN, SRCSINK_REQ_GET_TRACE,
+									0, 0, abDump, sizeof(abDump), TIMEOUT_MS);
+		if (iLen < 0) {
+			fprintf(stderr, "GET_TRACE failed: %s\n", libusb_error_name(iLen));
+			fOk = false;
+			break;
+		}
+		iCount = TraceAddDump(&Trace, abDump, iLen);
+		if (iCount < 0) {
+			fprintf(stderr, "invalid dump of %d bytes\n", iLen);
+			fOk = false;
+			break;
+		}
+		if ((fRaw != NULL) && (fwrite(abDump, 1, iLen, fRaw) != (size_t)iLen)) {
+			perror("write");
+			fOk = false;
+			break;
+		}
+	} while (iCount == TRACE_DUMP_RECORDS);
+
+	libusb_close(hdl);
+	return fOk;
+}
+
+
+// reads dumps from a file, one after the other
+static bool ReadFile(const char *pszName)
+{
+	FILE	*f;
+	uint8_t	abDump[TRACE_HEADER_SIZE + 255 * TRACE_RECORD_SIZE];
+	int		iLen;
+	bool	fOk;
+
+	f = fopen(pszName, "rb");
+	if (f == NULL) {
+		perror(pszName);
+		return false;
+	}
+	fOk = true;
+	while (fread(abDump, 1, TRACE_HEADER_SIZE, f) == TRACE_HEADER_SIZE) {
+		iLen = TRACE_HEADER_SIZE + abDump[3] * TRACE_RECORD_SIZE;
+		if ((fread(abDump + TRACE_HEADER_SIZE, 1, iLen - TRACE_HEADER_SIZE, f) != (size_t)(iLen - TRACE_HEADER_SIZE)) ||
+			(TraceAddDump(&Trace, abDump, iLen) < 0)) {
+			fprintf(stderr, "%s: invalid dump\n", pszName);
+			fOk = false;
+			break;
+		}
+	}
+	fclose(f);
+	return fOk;
+}
+
+
+static void Usage(const char *pszName)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -f <name>  read the dumps from a file instead of the device\n"
+		"  -w <name>  save the dumps read from the device\n"
+		"  -o <name>  write the timeline in the Chrome trace event format\n"
+		"  -q         do not print the timeline\n",
+		pszName);
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char	*pszIn = NULL, *pszRaw = NULL, *pszChrome = NULL;
+	FILE		*f;
+	bool		fQuiet = false, fOk;
+	int			c, i;
+
+	while ((c = getopt(argc, argv, "f:w:o:qh")) != -1) {
+		switch (c) {
+		case 'f':	pszIn = optarg;		break;
+		case 'w':	pszRaw = optarg;	break;
+		case 'o':	pszChrome = optarg;	break;
+		case 'q':	fQuiet = true;		break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	TraceInit(&Trace);
+	if (pszIn != NULL) {
+		fOk = ReadFile(pszIn);
+	}
+	else {
+		f = NULL;
+		if ((pszRaw != NULL) && ((f = fopen(pszRaw, "wb")) == NULL)) {
+			perror(pszRaw);
+			return 1;
+		}
+		i = libusb_init(NULL);
+		if (i < 0) {
+			fprintf(stderr, "libusb_init failed: %s\n", libusb_error_name(i));
+			return 1;
+		}
+		fOk = ReadDevice(f);
+		libusb_exit(NULL);
+		if (f != NULL) {
+			fclose(f);
+		}
+	}
+
+	if (!fQuiet) {
+		TracePrintTimeline(&Trace, stdout);
+	}
+	if (fOk && (pszChrome != NULL)) {
+		f = fopen(pszChrome, "w");
+		if (f == NULL) {
+			perror(pszChrome);
+			fOk = false;
+		}
+		else {
+			TraceWriteChrome(&Trace, f);
+			fclose(f);
+		}
+	}
+	fprintf(stderr, "%d records, %u lost\n", Trace.iCount, Trace.dwLost);
+	TraceFree(&Trace);
+
+	return fOk ? 0 : 1;
+}
+
@@ -0,0 +1,375 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Decoder of the binary event trace of target/usbtrace.c.
+
+	Dumps are added one after the other as they come from the device,
+	each with the records that were taken out of its ring since the last
+	one. Records that the device overwrote before they were dumped show up
+	as a TRACE_LOST event in the timeline. The 32 bit device time wraps
+	after 71 minutes, which is undone on the way in.
+
+	The timeline is printed as text, one record per line, or written in
+	the Chrome trace event format (JSON), which chrome://tracing and
+	Perfetto show with a row per endpoint. Control transfers appear there
+	as a span from their SETUP to the last control endpoint event before
+	the next SETUP.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracedecode.h"
+
+#define DEV_STATUS_CONNECT	(1<<0)
+#define DEV_STATUS_SUSPEND	(1<<2)
+#define DEV_STATUS_RESET	(1<<4)
+
+#define TID_DEVICE			256		/**< Chrome row of events without endpoint */
+
+static const char *apszStdReq[] = {
+	"GET_STATUS", "CLEAR_FEATURE", NULL, "SET_FEATURE", NULL, "SET_ADDRESS",
+	"GET_DESCRIPTOR", "SET_DESCRIPTOR", "GET_CONFIGURATION", "SET_CONFIGURATION",
+	"GET_INTERFACE", "SET_INTERFACE", "SYNCH_FRAME"
+};
+
+
+static uint16_t GetLE16(const uint8_t *pb)
+{
+	return pb[0] | (pb[1] << 8);
+}
+
+
+static uint32_t GetLE32(const uint8_t *pb)
+{
+	return pb[0] | (pb[1] << 8) | (pb[2] << 16) | ((uint32_t)pb[3] << 24);
+}
+
+
+/**
+	Starts an empty timeline
+
+	@param [out] pTrace
+ */
+void TraceInit(TTrace *pTrace)
+{
+	memset(pTrace, 0, sizeof(*pTrace));
+}
+
+
+/**
+	Frees the events of a timeline
+
+	@param [in,out] pTrace
+ */
+void TraceFree(TTrace *pTrace)
+{
+	free(pTrace->pEvents);
+	TraceInit(pTrace);
+}
+
+
+static bool AddEvent(TTrace *pTrace, const TTraceEvent *pEvent)
+{
+	TTraceEvent	*pNew;
+	int			iSize;
+
+	if (pTrace->iCount == pTrace->iSize) {
+		iSize = (pTrace->iSize == 0) ? 256 : 2 * pTrace->iSize;
+		pNew = realloc(pTrace->pEvents, iSize * sizeof(TTraceEvent));
+		if (pNew == NULL) {
+			return false;
+		}
+		pTrace->pEvents = pNew;
+		pTrace->iSize = iSize;
+	}
+	pTrace->pEvents[pTrace->iCount++] = *pEvent;
+	return true;
+}
+
+
+/**
+	Adds the records of a dump to the timeline
+
+	@param [in,out] pTrace
+	@param [in] pbDump		header and records, as sent by the device
+	@param [in] iLen		length of pbDump
+
+	@return the number of records in the dump, or -1 if it is no valid dump
+ */
+int TraceAddDump(TTrace *pTrace, const uint8_t *pbDump, int iLen)
+{
+	TTraceEvent	Event;
+	const uint8_t *pb;
+	uint32_t	dwLost, dwTime;
+	int			iCount, i;
+
+	if ((iLen < TRACE_HEADER_SIZE) || (GetLE16(pbDump) != TRACE_MAGIC) ||
+		(pbDump[2] != TRACE_RECORD_SIZE)) {
+		return -1;
+	}
+	iCount = pbDump[3];
+	if (iLen < TRACE_HEADER_SIZE + iCount * TRACE_RECORD_SIZE) {
+		return -1;
+	}
+
+	// the device counts lost records since it started
+	dwLost = GetLE32(pbDump + 4);
+	if (dwLost != pTrace->dwLost) {
+		memset(&Event, 0, sizeof(Event));
+		Event.qwTime = pTrace->qwWraps + pTrace->dwLastTime;
+		Event.bEvent = TRACE_LOST;
+		Event.dwArg1 = dwLost - pTrace->dwLost;
+		if (!AddEvent(pTrace, &Event)) {
+			return -1;
+		}
+		pTrace->dwLost = dwLost;
+	}
+
+	for (i = 0; i < iCount; i++) {
+		pb = pbDump + TRACE_HEADER_SIZE + i * TRACE_RECORD_SIZE;
+		dwTime = GetLE32(pb);
+		if (dwTime < pTrace->dwLastTime) {
+			pTrace->qwWraps += 1ULL << 32;
+		}
+		pTrace->dwLastTime = dwTime;
+		Event.qwTime = pTrace->qwWraps + dwTime;
+		Event.bEvent = pb[4];
+		Event.bEP = pb[5];
+		Event.wArg = GetLE16(pb + 6);
+		Event.dwArg1 = GetLE32(pb + 8);
+		Event.dwArg2 = GetLE32(pb + 12);
+		if (!AddEvent(pTrace, &Event)) {
+			return -1;
+		}
+	}
+	return iCount;
+}
+
+
+// name of the request of a SETUP record
+static const char *RequestName(const TTraceEvent *pEvent, char *pszBuf, int iSize)
+{
+	uint8_t	bmRequestType, bRequest;
+
+	bmRequestType = pEvent->dwArg1 & 0xFF;
+	bRequest = (pEvent->dwArg1 >> 8) & 0xFF;
+	switch ((bmRequestType >> 5) & 3) {
+	case 0:
+		if ((bRequest < sizeof(apszStdReq) / sizeof(apszStdReq[0])) && (apszStdReq[bRequest] != NULL)) {
+			return apszStdReq[bRequest];
+		}
+		snprintf(pszBuf, iSize, "standard 0x%02X", bRequest);
+		break;
+	case 1:
+		snprintf(pszBuf, iSize, "class 0x%02X", bRequest);
+		break;
+	case 2:
+		snprintf(pszBuf, iSize, "vendor 0x%02X", bRequest);
+		break;
+	default:
+		snprintf(pszBuf, iSize, "reserved 0x%02X", bRequest);
+		break;
+	}
+	return pszBuf;
+}
+
+
+static void DevStatusText(uint16_t wStatus, char *pszBuf, int iSize)
+{
+	snprintf(pszBuf, iSize, "%s %s%s",
+			(wStatus & DEV_STATUS_CONNECT) ? "connected" : "disconnected",
+			(wStatus & DEV_STATUS_SUSPEND) ? "suspended" : "active",
+			(wStatus & DEV_STATUS_RESET) ? ", reset" : "");
+}
+
+
+// event name and its details, for the timeline
+static const char *EventText(const TTraceEvent *pEvent, char *pszBuf, int iSize)
+{
+	char	szName[32];
+
+	switch (pEvent->bEvent) {
+	case TRACE_LOST:
+		snprintf(pszBuf, iSize, "-- %u records lost --", pEvent->dwArg1);
+		return "LOST";
+	case TRACE_SETUP:
+		snprintf(pszBuf, iSize, "%02X %02X %04X %04X %04X  %s",
+				pEvent->dwArg1 & 0xFF, (pEvent->dwArg1 >> 8) & 0xFF, pEvent->dwArg1 >> 16,
+				pEvent->dwArg2 & 0xFFFF, pEvent->dwArg2 >> 16,
+				RequestName(pEvent, szName, sizeof(szName)));
+		return "SETUP";
+	case TRACE_STALL:
+		snprintf(pszBuf, iSize, "EP 0x%02X", pEvent->bEP);
+		return pEvent->wArg ? "STALL" : "UNSTALL";
+	case TRACE_EP_READ:
+		if (pEvent->wArg == 0xFFFF) {
+			snprintf(pszBuf, iSize, "EP 0x%02X  no packet", pEvent->bEP);
+		}
+		else {
+			snprintf(pszBuf, iSize, "EP 0x%02X  %u bytes", pEvent->bEP, pEvent->wArg);
+		}
+		return "READ";
+	case TRACE_EP_WRITE:
+		snprintf(pszBuf, iSize, "EP 0x%02X  %u bytes", pEvent->bEP, pEvent->wArg);
+		return "WRITE";
+	case TRACE_DEV_STATUS:
+		DevStatusText(pEvent->wArg, pszBuf, iSize);
+		return "STATUS";
+	default:
+		snprintf(pszBuf, iSize, "EP 0x%02X  %u 0x%08X 0x%08X",
+				pEvent->bEP, pEvent->wArg, pEvent->dwArg1, pEvent->dwArg2);
+		return (pEvent->bEvent >= TRACE_USER) ? "USER" : "UNKNOWN";
+	}
+}
+
+
+/**
+	Prints the timeline, one record per line, with the time since the
+	first record and since the previous one
+
+	@param [in] pTrace
+	@param [in] f
+ */
+void TracePrintTimeline(const TTrace *pTrace, FILE *f)
+{
+	const TTraceEvent *pEvent;
+	const char	*pszEvent;
+	char		szText[80];
+	uint64_t	qwStart, qwPrev;
+	int			i;
+
+	qwStart = (pTrace->iCount > 0) ? pTrace->pEvents[0].qwTime : 0;
+	qwPrev = qwStart;
+	for (i = 0; i < pTrace->iCount; i++) {
+		pEvent = &pTrace->pEvents[i];
+		pszEvent = EventText(pEvent, szText, sizeof(szText));
+		if (pEvent->bEvent >= TRACE_USER) {
+			fprintf(f, "%12.3f ms %+8lld us  %-7s 0x%02X %s\n",
+					(pEvent->qwTime - qwStart) / 1000.0, (long long)(pEvent->qwTime - qwPrev),
+					pszEvent, pEvent->bEvent, szText);
+		}
+		else {
+			fprintf(f, "%12.3f ms %+8lld us  %-7s %s\n",
+					(pEvent->qwTime - qwStart) / 1000.0, (long long)(pEvent->qwTime - qwPrev),
+					pszEvent, szText);
+		}
+		qwPrev = pEvent->qwTime;
+	}
+}
+
+
+// Chrome row of an event
+static int EventTid(const TTraceEvent *pEvent)
+{
+	switch (pEvent->bEvent) {
+	case TRACE_LOST:
+	case TRACE_DEV_STATUS:
+		return TID_DEVICE;
+	case TRACE_SETUP:
+		return 0;
+	default:
+		return pEvent->bEP;
+	}
+}
+
+
+// end of the control transfer started by the SETUP record at iSetup
+static uint64_t ControlEnd(const TTrace *pTrace, int iSetup)
+{
+	const TTraceEvent *pEvent;
+	uint64_t	qwEnd;
+	int			i;
+
+	qwEnd = pTrace->pEvents[iSetup].qwTime;
+	for (i = iSetup + 1; i < pTrace->iCount; i++) {
+		pEvent = &pTrace->pEvents[i];
+		if ((pEvent->bEvent == TRACE_SETUP) || (pEvent->bEvent == TRACE_LOST)) {
+			break;
+		}
+		if ((pEvent->bEvent != TRACE_DEV_STATUS) && ((pEvent->bEP & 0x7F) == 0)) {
+			qwEnd = pEvent->qwTime;
+		}
+	}
+	return qwEnd;
+}
+
+
+/**
+	Writes the timeline in the Chrome trace event format, with a row per
+	endpoint and one for the device status
+
+	@param [in] pTrace
+	@param [in] f
+ */
+void TraceWriteChrome(const TTrace *pTrace, FILE *f)
+{
+	const TTraceEvent *pEvent;
+	const char	*pszEvent;
+	char		szText[80], szName[32];
+	bool		afRow[TID_DEVICE + 1];
+	int			i, iTid;
+
+	memset(afRow, 0, sizeof(afRow));
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (i = 0; i < pTrace->iCount; i++) {
+		pEvent = &pTrace->pEvents[i];
+		pszEvent = EventText(pEvent, szText, sizeof(szText));
+		iTid = EventTid(pEvent);
+		afRow[iTid] = true;
+		if (pEvent->bEvent == TRACE_SETUP) {
+			fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%d,"
+					"\"args\":{\"setup\":\"%s\"}},\n",
+					RequestName(pEvent, szName, sizeof(szName)), (unsigned long long)pEvent->qwTime,
+					(unsigned long long)(ControlEnd(pTrace, i) - pEvent->qwTime), iTid, szText);
+		}
+		else {
+			fprintf(f, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"%s\",\"ts\":%llu,\"pid\":1,\"tid\":%d,"
+					"\"args\":{\"event\":%u,\"detail\":\"%s\"}},\n",
+					pszEvent, (pEvent->bEvent == TRACE_LOST) ? "g" : "t",
+					(unsigned long long)pEvent->qwTime, iTid, pEvent->bEvent, szText);
+		}
+	}
+
+	// names of the rows
+	for (iTid = 0; iTid <= TID_DEVICE; iTid++) {
+		if (afRow[iTid]) {
+			if (iTid == TID_DEVICE) {
+				snprintf(szName, sizeof(szName), "device");
+			}
+			else {
+				snprintf(szName, sizeof(szName), "EP 0x%02X", iTid);
+			}
+			fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+					"\"args\":{\"name\":\"%s\"}},\n", iTid, szName);
+		}
+	}
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"LPCUSB\"}}\n");
+	fprintf(f, "]}\n");
+}
+
@@ -0,0 +1,77 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	Decoder of the binary event trace of target/usbtrace.c.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// the dump format, see target/usbtrace.h
+#define TRACE_MAGIC			0x5254
+#define TRACE_HEADER_SIZE	8
+#define TRACE_RECORD_SIZE	16
+#define TRACE_DUMP_RECORDS	16		/**< records the device sends per request */
+
+#define TRACE_SETUP			0x01
+#define TRACE_STALL			0x02
+#define TRACE_EP_READ		0x03
+#define TRACE_EP_WRITE		0x04
+#define TRACE_DEV_STATUS	0x05
+#define TRACE_USER			0x80
+
+#define TRACE_LOST			0x00	/**< not a record: dwArg1 records were lost here */
+
+/** One decoded record */
+typedef struct {
+	uint64_t	qwTime;			/**< us, without the wraps of the 32 bit device time */
+	uint8_t		bEvent;
+	uint8_t		bEP;
+	uint16_t	wArg;
+	uint32_t	dwArg1;
+	uint32_t	dwArg2;
+} TTraceEvent;
+
+/** A timeline, built from one dump after the other */
+typedef struct {
+	TTraceEvent	*pEvents;
+	int			iCount;
+	int			iSize;
+	uint32_t	dwLost;			/**< lost count of the last dump */
+	uint32_t	dwLastTime;		/**< device time of the last record */
+	uint64_t	qwWraps;		/**< time added for wraps of the device time */
+} TTrace;
+
+void TraceInit(TTrace *pTrace);
+void TraceFree(TTrace *pTrace);
+int  TraceAddDump(TTrace *pTrace, const uint8_t *pbDump, int iLen);
+void TracePrintTimeline(const TTrace *pTrace, FILE *f);
+void TraceWriteChrome(const TTrace *pTrace, FILE *f);
+
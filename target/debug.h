@@ -29,8 +29,9 @@
 int printf(const char *format, ...);
 
 #ifdef DEBUG
+void ConsoleFlush(void);
 #define DBG	printf
-#define ASSERT(x)	if(!(x)){DBG("\nAssertion '%s' failed in %s:%s#%d!\n",#x,__FILE__,__FUNCTION__,__LINE__);while(1);}
+#define ASSERT(x)	if(!(x)){DBG("\nAssertion '%s' failed in %s:%s#%d!\n",#x,__FILE__,__FUNCTION__,__LINE__);ConsoleFlush();while(1);}
 #else
 #define DBG(x ...)
 #define ASSERT(x)
@@ -25,6 +25,9 @@
 	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#ifndef _BLOCKDEV_H_
+#define _BLOCKDEV_H_
+
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -33,4 +36,31 @@ bool BlockDevInit(void);
 bool BlockDevWrite(uint32_t dwBlock, uint8_t* pbBuf);
 bool BlockDevRead(uint32_t dwBlock, uint8_t* pbBuf);
 
-bool BlockDevGetSize(uint32_t *pdwDriveSize);
+bool BlockDevGetSize(uint32_t *pdwNumBlocks);
+
+bool BlockDevDiscard(uint32_t dwBlock, uint32_t dwCount);
+
+bool BlockDevStartWrite(uint32_t dwBlock, uint8_t *pbBuf);
+bool BlockDevPoll(void);
+
+/** Block device operations, one table per storage medium */
+typedef struct {
+	bool (*pfnInit)(void);
+	bool (*pfnWrite)(uint32_t dwBlock, uint8_t *pbBuf);
+	bool (*pfnRead)(uint32_t dwBlock, uint8_t *pbBuf);
+	bool (*pfnGetSize)(uint32_t *pdwNumBlocks);	/**< size in blocks of 512 bytes */
+	bool (*pfnDiscard)(uint32_t dwBlock, uint32_t dwCount);	/**< NULL if not supported */
+	/**
+		Asynchronous writes, NULL if not supported. pfnStartWrite takes the
+		data and returns while the medium is still busy with it, pfnPoll
+		returns true once it is done. A started discard also keeps the
+		medium busy. Other operations wait for the medium themselves.
+	 */
+	bool (*pfnStartWrite)(uint32_t dwBlock, uint8_t *pbBuf);
+	bool (*pfnPoll)(void);
+} TBlockDevOps;
+
+/** SD card operations, implemented by blockdev_sd.c */
+extern const TBlockDevOps BlockDevSD;
+
+#endif /* _BLOCKDEV_H_ */
@@ -67,7 +67,37 @@ bool BlockDevRead(uint32_t dwBlock, uint8_t* pbBuf)
 }
 
 
-bool BlockDevGetSize(uint32_t *pdwDriveSize)
+/**
+	Tells the card that a range of blocks is no longer in use, so it can
+	erase them in the background instead of during a later write.
+	Returns once the erase is started, see BlockDevPoll.
+ */
+bool BlockDevDiscard(uint32_t dwBlock, uint32_t dwCount)
+{
+	if (dwCount == 0) {
+		return true;
+	}
+	return SDStartErase(dwBlock, dwBlock + dwCount - 1);
+}
+
+
+bool BlockDevStartWrite(uint32_t dwBlock, uint8_t *pbBuf)
+{
+	return SDStartWrite(pbBuf, dwBlock);
+}
+
+
+bool BlockDevPoll(void)
+{
+	return SDPoll();
+}
+
+
+/**
+	Reads the card size from the CSD, in blocks of 512 bytes. A count of
+	blocks, unlike a byte count, still fits 32 bits for SDHC cards.
+ */
+bool BlockDevGetSize(uint32_t *pdwNumBlocks)
 {
 	uint8_t	abBuf[16];
 	uint32_t	c_size, num_blocks, block_size;
@@ -90,8 +120,9 @@ bool BlockDevGetSize(uint32_t *pdwDriveSize)
 		break;
 
 	case 1:
+		// capacity is (c_size + 1) * 512 kB
 		c_size =		getsdbits(abBuf, 69, 22);
-		num_blocks = (c_size + 1) * 512 * 1024;
+		num_blocks = (c_size + 1) * 1024;
 		block_size = 512;
 		break;
 		
@@ -100,7 +131,20 @@ bool BlockDevGetSize(uint32_t *pdwDriveSize)
 		return false;
 	}
 
-	*pdwDriveSize = num_blocks * block_size;
+	// CSD version 1 cards can have blocks of 1 or 2 kB
+	*pdwNumBlocks = num_blocks * (block_size / 512);
 	return true;
 }
 
+
+/** SD card as a block device, for use as a SCSI logical unit */
+const TBlockDevOps BlockDevSD = {
+	BlockDevInit,
+	BlockDevWrite,
+	BlockDevRead,
+	BlockDevGetSize,
+	BlockDevDiscard,
+	BlockDevStartWrite,
+	BlockDevPoll
+};
+
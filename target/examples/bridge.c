@@ -0,0 +1,233 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	USB to UART bridge.
+
+	Every port of the CDC function is connected to a UART. The UART
+	interrupt moves received characters from the hardware FIFO into a
+	receive ring, and refills the transmit FIFO from a transmit ring once
+	it runs empty. BridgePoll, from the main loop, moves data between these
+	rings and the CDC FIFOs, no more than fits on the other side, so a full
+	UART transmitter makes the host wait instead of losing data.
+
+	A line coding set by the host goes straight to the UART. If it cannot
+	be made, the request is stalled.
+*/
+
+#include "debug.h"
+#include <string.h>
+
+#include "armVIC.h"
+
+#include "serial_fifo.h"
+#include "uart.h"
+#include "bridge.h"
+
+/** State of one port */
+typedef struct {
+	int				iUart;
+	fifo_t			RxRing;			/**< from the UART interrupt */
+	fifo_t			TxRing;			/**< to the UART interrupt */
+	volatile bool	fTxActive;		/**< transmit interrupt is enabled */
+	TBridgeStats	Stats;
+	uint8_t			abRxData[VCOM_FIFO_SIZE];
+	uint8_t			abTxData[VCOM_FIFO_SIZE];
+} TBridgePort;
+
+// UART of each port, UART0 is the console so it comes last
+#ifdef LPC214x
+static const int aiUarts[] = {1, 0};
+#else
+static const int aiUarts[] = {1, 2, 3, 0};
+#endif
+
+#if defined(LPC214x) && (CDC_NUM_PORTS > 2)
+#error "LPC214x has only UART0 and UART1, build with CDC_NUM_PORTS of 2 or less"
+#endif
+#if defined(DEBUG) && defined(BRIDGE_USES_CONSOLE_UART)
+#error "The last port takes UART0 from the DBG console, build without DEBUG"
+#endif
+
+static TBridgePort aPorts[CDC_NUM_PORTS];
+
+
+/**
+	Local function to refill the transmit FIFO of the UART, which has to
+	be empty. Switches the transmit interrupt off when there is nothing
+	left to send.
+
+	@param [in] pPort
+ */
+static void TxFill(TBridgePort *pPort)
+{
+	uint8_t b;
+	int i;
+
+	for (i = 0; i < UART_HW_FIFO; i++) {
+		if (!fifo_get(&pPort->TxRing, &b)) {
+			break;
+		}
+		UARTWrite(pPort->iUart, b);
+	}
+	pPort->Stats.dwTxBytes += i;
+	if ((i > 0) != pPort->fTxActive) {
+		pPort->fTxActive = (i > 0);
+		UARTTxIntEnable(pPort->iUart, pPort->fTxActive);
+	}
+}
+
+
+/**
+	UART interrupt handler, empties the receive FIFO and refills the
+	transmit FIFO
+
+	@param [in] iUart
+ */
+static void BridgeIsr(int iUart)
+{
+	TBridgePort *pPort;
+	uint8_t bStatus;
+	int i;
+
+	for (i = 0; aPorts[i].iUart != iUart; i++)
+		;
+	pPort = &aPorts[i];
+
+	while ((bStatus = UARTGetStatus(iUart)) & UART_LSR_RDR) {
+		if (bStatus & (UART_LSR_OE | UART_LSR_PE | UART_LSR_FE | UART_LSR_BI)) {
+			if (bStatus & UART_LSR_OE) {
+				pPort->Stats.dwOverruns++;
+			}
+			if (bStatus & UART_LSR_PE) {
+				pPort->Stats.dwParityErrors++;
+			}
+			if (bStatus & UART_LSR_FE) {
+				pPort->Stats.dwFramingErrors++;
+			}
+			if (bStatus & UART_LSR_BI) {
+				pPort->Stats.dwBreaks++;
+			}
+		}
+		if (!fifo_put(&pPort->RxRing, UARTRead(iUart))) {
+			pPort->Stats.dwRxDropped++;
+		}
+		pPort->Stats.dwRxBytes++;
+	}
+
+	if (pPort->fTxActive && (bStatus & UART_LSR_THRE)) {
+		TxFill(pPort);
+	}
+}
+
+
+/**
+	Applies a line coding to the UART of a port, for
+	CdcRegisterLineCodingHandler.
+
+	@param [in] iPort
+	@param [in] pLineCoding
+	@returns false if the UART cannot do it
+ */
+bool BridgeSetLineCoding(int iPort, const TLineCoding *pLineCoding)
+{
+	return UARTSetFormat(aPorts[iPort].iUart, pLineCoding->dwDTERate,
+				pLineCoding->bDataBits, pLineCoding->bParityType, pLineCoding->bCharFormat);
+}
+
+
+/**
+	Moves data between the CDC FIFOs and the UART rings of all ports, in
+	both directions. Call this from the main loop.
+ */
+void BridgePoll(void)
+{
+	TBridgePort *pPort;
+	uint8_t *pbData;
+	unsigned cpsr;
+	int iPort, iLen;
+
+	for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+		pPort = &aPorts[iPort];
+
+		// host to UART, straight into the transmit ring
+		iLen = fifo_reserve(&pPort->TxRing, &pbData);
+		if (iLen > 0) {
+			iLen = CdcRead(iPort, pbData, iLen);
+			fifo_commit(&pPort->TxRing, iLen);
+		}
+		if (!pPort->fTxActive && (fifo_avail(&pPort->TxRing) != 0)) {
+			cpsr = disableIRQ();
+			// the interrupt may have been first
+			if (!pPort->fTxActive) {
+				TxFill(pPort);
+			}
+			restoreIRQ(cpsr);
+		}
+
+		// UART to host, straight from the receive ring
+		iLen = fifo_peek(&pPort->RxRing, &pbData);
+		if (iLen > 0) {
+			fifo_consume(&pPort->RxRing, CdcWrite(iPort, pbData, iLen));
+		}
+	}
+}
+
+
+/**
+	Returns the counters of a port
+
+	@param [in] iPort
+	@param [out] pStats
+ */
+void BridgeGetStats(int iPort, TBridgeStats *pStats)
+{
+	*pStats = aPorts[iPort].Stats;
+}
+
+
+/**
+	Initialises the UARTs of all ports, at 115200 8N1 until the host sets
+	a line coding.
+	Call this after CdcInit, and register BridgeSetLineCoding with
+	CdcRegisterLineCodingHandler.
+ */
+void BridgeInit(void)
+{
+	TBridgePort *pPort;
+	int i;
+
+	for (i = 0; i < CDC_NUM_PORTS; i++) {
+		pPort = &aPorts[i];
+		memset(&pPort->Stats, 0, sizeof(pPort->Stats));
+		pPort->iUart = aiUarts[i];
+		fifo_init(&pPort->RxRing, pPort->abRxData);
+		fifo_init(&pPort->TxRing, pPort->abTxData);
+		pPort->fTxActive = false;
+		UARTInit(pPort->iUart, BridgeIsr);
+	}
+}
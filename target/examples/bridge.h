@@ -0,0 +1,56 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	USB to UART bridge for the ports of the CDC function, see bridge.c.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cdc_acm.h"
+
+#if (defined(LPC214x) && (CDC_NUM_PORTS > 1)) || (CDC_NUM_PORTS > 3)
+#define BRIDGE_USES_CONSOLE_UART	/**< the last port is on UART0, there is no console */
+#endif
+
+/** Counters of one bridge port */
+typedef struct {
+	uint32_t	dwRxBytes;			/**< characters received from the UART */
+	uint32_t	dwTxBytes;			/**< characters written to the UART */
+	uint32_t	dwRxDropped;		/**< received characters that found the ring full */
+	uint32_t	dwOverruns;			/**< overruns of the UART receive FIFO */
+	uint32_t	dwParityErrors;
+	uint32_t	dwFramingErrors;
+	uint32_t	dwBreaks;
+} TBridgeStats;
+
+void BridgeInit(void);
+void BridgePoll(void);
+bool BridgeSetLineCoding(int iPort, const TLineCoding *pLineCoding);
+void BridgeGetStats(int iPort, TBridgeStats *pStats);
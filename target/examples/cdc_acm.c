@@ -0,0 +1,561 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	CDC ACM function with CDC_NUM_PORTS virtual COM ports.
+
+	Each port has its own pair of interfaces, a notification endpoint and
+	a pair of bulk endpoints, see cdc_acm.h, and its own transmit and
+	receive FIFO. Class requests go to the port of the interface in wIndex.
+
+	Data from the host is read from the bulk OUT endpoint straight into
+	the receive FIFO. When the FIFO has no room for another packet, the
+	packet stays in the endpoint and the host gets NAKs on that port only,
+	until the application reads from the FIFO again.
+
+	Data for the host is sent as a chain of bulk IN packets, terminated by
+	a short or zero-length packet. A chain starts as soon as the flush
+	threshold is reached, or from the frame interrupt after the data has
+	waited long enough. The frame interrupt visits the ports in turn,
+	starting with a different port every frame, so that a busy port
+	cannot keep the others waiting.
+
+	The USB stack runs from the USB interrupt and the Cdc* port functions
+	from the application, the IRQ is disabled where they meet.
+*/
+
+#include <string.h>			// memcpy
+
+#include "debug.h"
+#include "armVIC.h"
+#include "usbapi.h"
+
+#include "serial_fifo.h"
+#include "cdc_acm.h"
+
+/** State of one port */
+typedef struct {
+	fifo_t			TxFifo;
+	fifo_t			RxFifo;
+	TLineCoding		LineCoding;
+	uint16_t		wLineState;		/**< bit0 = DTR, bit1 = RTS */
+	volatile bool	fBulkInBusy;
+	volatile bool	fChainDone;
+	volatile bool	fRxDeferred;	/**< OUT data waits in the endpoint for FIFO space */
+	int				iFlushThreshold;
+	int				iFlushFrames;
+	int				iWaitFrames;	/**< frames the oldest unsent byte has waited */
+	uint8_t			abTxData[VCOM_FIFO_SIZE];
+	uint8_t			abRxData[VCOM_FIFO_SIZE + VCOM_FIFO_SLACK];	/**< packets are read in place */
+} TCdcPort;
+
+static TCdcPort aPorts[CDC_NUM_PORTS];
+static int iFirstPort;				/**< port the frame handler starts with */
+static uint8_t abClassReqData[8];
+static TFnLineCodingHandler *_pfnLineCodingHandler = NULL;
+
+
+/**
+	Local function to find the port of an endpoint
+
+	@param [in] bEP
+	@returns port
+ */
+static TCdcPort *EPToPort(uint8_t bEP)
+{
+	if ((bEP & 0x80) != 0) {
+		return &aPorts[(bEP - CDC_BULK_IN_EP(0)) / 3];
+	}
+	return &aPorts[(bEP - CDC_BULK_OUT_EP(0)) / 3];
+}
+
+
+/**
+	Local function to handle incoming bulk data
+
+	Reads all packets waiting in the endpoint, for as long as they fit in
+	the FIFO. When one does not fit, it is left in the endpoint, so the
+	host gets NAKs, and fRxDeferred is set. Since no new interrupt comes
+	for a packet that is already there, whoever takes data out of the FIFO
+	calls this again once there is room, see RxResume.
+
+	@param [in] bEP
+	@param [in] bEPStatus
+ */
+static void BulkOut(uint8_t bEP, uint8_t bEPStatus)
+{
+	TCdcPort *pPort = EPToPort(bEP);
+	uint8_t *pbData;
+	int iLen;
+
+	while ((USBHwEPGetStatus(bEP) & EP_STATUS_DATA) != 0) {
+		if (fifo_free(&pPort->RxFifo) < CDC_MAX_PACKET) {
+			// may not fit into fifo, wait for the application
+			pPort->fRxDeferred = true;
+			return;
+		}
+
+		// get data from USB straight into the FIFO, a packet that does not fit
+		// before the end of the buffer runs into the slack behind it
+		fifo_reserve(&pPort->RxFifo, &pbData);
+		iLen = USBHwEPRead(bEP, pbData, CDC_MAX_PACKET);
+		if (iLen > 0) {
+			fifo_commit(&pPort->RxFifo, iLen);
+		}
+	}
+	pPort->fRxDeferred = false;
+}
+
+
+/**
+	Local function to pick up deferred OUT data once the FIFO has room again.
+	Called from the application, so the USB interrupt is kept out while
+	the endpoint is read.
+
+	@param [in] iPort
+ */
+static void RxResume(int iPort)
+{
+	TCdcPort *pPort = &aPorts[iPort];
+	unsigned cpsr;
+
+	if (pPort->fRxDeferred && (fifo_free(&pPort->RxFifo) >= CDC_MAX_PACKET)) {
+		cpsr = disableIRQ();
+		// the interrupt handler may have been first
+		if (pPort->fRxDeferred) {
+			BulkOut(CDC_BULK_OUT_EP(iPort), 0);
+		}
+		restoreIRQ(cpsr);
+	}
+}
+
+
+/**
+	Sends the next packet in chain of packets to the host
+
+	@param [in] bEP
+	@param [in] fFirstPacket
+ */
+static void SendNextBulkIn(uint8_t bEP, bool fFirstPacket)
+{
+	TCdcPort *pPort = EPToPort(bEP);
+	uint8_t *pbData;
+	int iLen;
+
+	// this transfer is done
+	pPort->fBulkInBusy = false;
+
+	// first packet?
+	if (fFirstPacket) {
+		pPort->fChainDone = false;
+		pPort->iWaitFrames = 0;
+	}
+
+	// last packet?
+	if (pPort->fChainDone) {
+		return;
+	}
+
+	// send up to CDC_MAX_PACKET bytes straight from the transmit FIFO
+	iLen = fifo_peek(&pPort->TxFifo, &pbData);
+	if (iLen > CDC_MAX_PACKET) {
+		iLen = CDC_MAX_PACKET;
+	}
+	USBHwEPWrite(bEP, pbData, iLen);
+	fifo_consume(&pPort->TxFifo, iLen);
+	pPort->fBulkInBusy = true;
+
+	// was this a short packet? if it was only cut short by the end of the
+	// buffer, the rest follows in the next packet
+	if ((iLen < CDC_MAX_PACKET) && (fifo_avail(&pPort->TxFifo) == 0)) {
+		pPort->fChainDone = true;
+	}
+}
+
+
+/**
+	Local function to handle the bulk endpoints.
+
+	The stack has a single handler for both directions of a logical
+	endpoint, and the bulk IN endpoint of one port shares its number with
+	the bulk OUT endpoint of the previous one.
+
+	@param [in] bEP
+	@param [in] bEPStatus
+ */
+static void BulkEP(uint8_t bEP, uint8_t bEPStatus)
+{
+	if ((bEP & 0x80) != 0) {
+		SendNextBulkIn(bEP, false);
+	}
+	else {
+		BulkOut(bEP, bEPStatus);
+	}
+}
+
+
+/**
+	Local function to start a chain of IN packets from the application,
+	unless one is already on its way. A running chain picks up new data
+	by itself.
+
+	@param [in] iPort
+ */
+static void TxKick(int iPort)
+{
+	TCdcPort *pPort = &aPorts[iPort];
+	unsigned cpsr;
+
+	cpsr = disableIRQ();
+	if (!pPort->fBulkInBusy && (fifo_avail(&pPort->TxFifo) != 0)) {
+		SendNextBulkIn(CDC_BULK_IN_EP(iPort), true);
+	}
+	restoreIRQ(cpsr);
+}
+
+
+/**
+	USB frame interrupt handler
+
+	Called every millisecond by the hardware driver.
+
+	Sends the first of a chain of packets to the host, on every port where
+	the waiting data reaches the flush threshold or has waited long enough.
+	A chain is always terminated by a short packet, either a packet shorter
+	than the maximum packet size or a zero-length packet (as required by
+	the windows usbser.sys driver).
+
+	@param [in] wFrame
+ */
+static void CdcFrame(uint16_t wFrame)
+{
+	TCdcPort *pPort;
+	int i, iPort;
+
+	iPort = iFirstPort;
+	for (i = 0; i < CDC_NUM_PORTS; i++) {
+		pPort = &aPorts[iPort];
+		if (pPort->fBulkInBusy || (fifo_avail(&pPort->TxFifo) == 0)) {
+			pPort->iWaitFrames = 0;
+		}
+		else if ((++pPort->iWaitFrames >= pPort->iFlushFrames) ||
+				 (fifo_avail(&pPort->TxFifo) >= pPort->iFlushThreshold)) {
+			// send first packet
+			SendNextBulkIn(CDC_BULK_IN_EP(iPort), true);
+		}
+		iPort = (iPort + 1) % CDC_NUM_PORTS;
+	}
+	iFirstPort = (iFirstPort + 1) % CDC_NUM_PORTS;
+}
+
+
+/**
+	USB device status handler
+
+	Resets the ports when a USB reset is received.
+
+	@param [in] bDevStatus
+ */
+static void CdcDevStatus(uint8_t bDevStatus)
+{
+	int i;
+
+	if ((bDevStatus & DEV_STATUS_RESET) != 0) {
+		for (i = 0; i < CDC_NUM_PORTS; i++) {
+			aPorts[i].fBulkInBusy = false;
+			aPorts[i].fRxDeferred = false;
+			aPorts[i].iWaitFrames = 0;
+		}
+	}
+}
+
+
+/**
+	Handles the USB-CDC class requests, for the port of the interface
+	in wIndex.
+
+	@param [in] pSetup
+	@param [out] piLen
+	@param [out] ppbData
+	@returns true if the request was handled
+ */
+bool CdcHandleClassRequest(TSetupPacket *pSetup, int *piLen, uint8_t **ppbData)
+{
+	TLineCoding LineCoding;
+	TCdcPort *pPort;
+	int iPort;
+
+	if (REQTYPE_GET_RECIP(pSetup->bmRequestType) != REQTYPE_RECIP_INTERFACE) {
+		return false;
+	}
+	iPort = (pSetup->wIndex & 0xFF) / 2;
+	if (iPort >= CDC_NUM_PORTS) {
+		DBG("Invalid CDC interface %d\n", pSetup->wIndex);
+		return false;
+	}
+	pPort = &aPorts[iPort];
+
+	switch (pSetup->bRequest) {
+
+	// set line coding
+	case SET_LINE_CODING:
+		if (*piLen < 7) {
+			return false;
+		}
+		memcpy((uint8_t *)&LineCoding, *ppbData, 7);
+DBG("SET_LINE_CODING %d: dwDTERate=%u, bCharFormat=%u, bParityType=%u, bDataBits=%u\n",
+	iPort,
+	LineCoding.dwDTERate,
+	LineCoding.bCharFormat,
+	LineCoding.bParityType,
+	LineCoding.bDataBits);
+		// keep the old one if it cannot be applied
+		if ((_pfnLineCodingHandler != NULL) && !_pfnLineCodingHandler(iPort, &LineCoding)) {
+			return false;
+		}
+		pPort->LineCoding = LineCoding;
+		*piLen = 7;
+		break;
+
+	// get line coding
+	case GET_LINE_CODING:
+		*ppbData = (uint8_t *)&pPort->LineCoding;
+		*piLen = 7;
+		break;
+
+	// set control line state
+	case SET_CONTROL_LINE_STATE:
+		// bit0 = DTR, bit1 = RTS
+		pPort->wLineState = pSetup->wValue;
+		break;
+
+	default:
+		return false;
+	}
+	return true;
+}
+
+
+/**
+	Registers a callback for SET_LINE_CODING, to apply the line coding to
+	a real serial port. The request is stalled if the callback returns
+	false, and the port keeps its old line coding.
+
+	@param [in] pfnHandler called with the port and its new line coding
+ */
+void CdcRegisterLineCodingHandler(TFnLineCodingHandler *pfnHandler)
+{
+	_pfnLineCodingHandler = pfnHandler;
+}
+
+
+/**
+	Initialises all ports.
+	Call this function before using any of the other Cdc* functions.
+ */
+void CdcInit(void)
+{
+	TCdcPort *pPort;
+	int i;
+
+	for (i = 0; i < CDC_NUM_PORTS; i++) {
+		pPort = &aPorts[i];
+		fifo_init(&pPort->TxFifo, pPort->abTxData);
+		fifo_init(&pPort->RxFifo, pPort->abRxData);
+		pPort->LineCoding.dwDTERate = 115200;
+		pPort->LineCoding.bCharFormat = 0;
+		pPort->LineCoding.bParityType = 0;
+		pPort->LineCoding.bDataBits = 8;
+		pPort->wLineState = 0;
+		pPort->fBulkInBusy = false;
+		pPort->fChainDone = true;
+		pPort->fRxDeferred = false;
+		pPort->iFlushThreshold = CDC_FLUSH_THRESHOLD;
+		pPort->iFlushFrames = CDC_FLUSH_FRAMES;
+		pPort->iWaitFrames = 0;
+	}
+	iFirstPort = 0;
+}
+
+
+/**
+	Registers the class request, endpoint, frame and device status
+	handlers of all ports with the USB stack.
+ */
+void CdcRegisterHandlers(void)
+{
+	int i;
+
+	USBRegisterRequestHandler(REQTYPE_TYPE_CLASS, CdcHandleClassRequest, abClassReqData);
+	for (i = 0; i < CDC_NUM_PORTS; i++) {
+		USBHwRegisterEPIntHandler(CDC_INT_IN_EP(i), NULL);
+		USBHwRegisterEPIntHandler(CDC_BULK_IN_EP(i), BulkEP);
+		USBHwRegisterEPIntHandler(CDC_BULK_OUT_EP(i), BulkEP);
+	}
+	USBHwRegisterFrameHandler(CdcFrame);
+	USBHwRegisterDevIntHandler(CdcDevStatus);
+}
+
+
+/**
+	Sets the policy for sending data written to a port.
+
+	Data is sent as soon as iThreshold bytes are waiting, otherwise once
+	the oldest byte has waited iFrames frames (milliseconds). A threshold
+	of one packet with a short timeout coalesces chatty output into full
+	packets while single characters still go out within a frame or two.
+
+	@param [in] iPort
+	@param [in] iThreshold number of bytes that are sent immediately
+	@param [in] iFrames maximum number of frames data waits, at least 1
+ */
+void CdcSetFlush(int iPort, int iThreshold, int iFrames)
+{
+	aPorts[iPort].iFlushThreshold = (iThreshold > 0) ? iThreshold : 1;
+	aPorts[iPort].iFlushFrames = (iFrames > 0) ? iFrames : 1;
+}
+
+
+/**
+	Sends all data waiting in a port without waiting for the flush
+	threshold or timeout.
+
+	@param [in] iPort
+ */
+void CdcFlush(int iPort)
+{
+	TxKick(iPort);
+}
+
+
+/**
+	Writes one character to a port
+
+	@param [in] iPort
+	@param [in] c character to write
+	@returns character written, or EOF if character could not be written
+ */
+int CdcPutchar(int iPort, int c)
+{
+	TCdcPort *pPort = &aPorts[iPort];
+
+	if (!fifo_put(&pPort->TxFifo, c)) {
+		return EOF;
+	}
+	if (fifo_avail(&pPort->TxFifo) >= pPort->iFlushThreshold) {
+		TxKick(iPort);
+	}
+	return c;
+}
+
+
+/**
+	Writes up to iLen bytes to a port
+
+	@param [in] iPort
+	@param [in] pbBuf data to write
+	@param [in] iLen number of bytes in pbBuf
+	@returns number of bytes written
+ */
+int CdcWrite(int iPort, const uint8_t *pbBuf, int iLen)
+{
+	TCdcPort *pPort = &aPorts[iPort];
+
+	iLen = fifo_write(&pPort->TxFifo, pbBuf, iLen);
+	if (fifo_avail(&pPort->TxFifo) >= pPort->iFlushThreshold) {
+		TxKick(iPort);
+	}
+	return iLen;
+}
+
+
+/**
+	Reads one character from a port
+
+	@param [in] iPort
+	@returns character read, or EOF if character could not be read
+ */
+int CdcGetchar(int iPort)
+{
+	uint8_t c;
+
+	if (!fifo_get(&aPorts[iPort].RxFifo, &c)) {
+		return EOF;
+	}
+	RxResume(iPort);
+	return c;
+}
+
+
+/**
+	Reads up to iLen bytes from a port
+
+	@param [in] iPort
+	@param [out] pbBuf buffer for the data
+	@param [in] iLen size of pbBuf
+	@returns number of bytes read
+ */
+int CdcRead(int iPort, uint8_t *pbBuf, int iLen)
+{
+	iLen = fifo_read(&aPorts[iPort].RxFifo, pbBuf, iLen);
+	RxResume(iPort);
+	return iLen;
+}
+
+
+/**
+	Returns the number of bytes that can be written to a port
+
+	@param [in] iPort
+ */
+int CdcTxFree(int iPort)
+{
+	return fifo_free(&aPorts[iPort].TxFifo);
+}
+
+
+/**
+	Returns the line coding last set by the host
+
+	@param [in] iPort
+ */
+const TLineCoding *CdcGetLineCoding(int iPort)
+{
+	return &aPorts[iPort].LineCoding;
+}
+
+
+/**
+	Returns the control line state last set by the host
+
+	@param [in] iPort
+	@returns bit0 = DTR, bit1 = RTS
+ */
+uint16_t CdcGetLineState(int iPort)
+{
+	return aPorts[iPort].wLineState;
+}
@@ -0,0 +1,185 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	CDC ACM function with several virtual COM ports, see cdc_acm.c.
+*/
+
+#ifndef _CDC_ACM_H_
+#define _CDC_ACM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "usbstruct.h"
+
+#ifndef CDC_NUM_PORTS
+#define CDC_NUM_PORTS		1		/**< number of ports, 1 to 4 */
+#endif
+
+#define CDC_MAX_PACKET		64		/**< bulk packet size */
+#define CDC_NOTIFY_PACKET	8		/**< notification packet size */
+
+// endpoints of port n, each on its own interrupt and bulk endpoint pair
+#define CDC_INT_IN_EP(n)	(0x81 + 3 * (n))
+#define CDC_BULK_IN_EP(n)	(0x82 + 3 * (n))
+#define CDC_BULK_OUT_EP(n)	(0x05 + 3 * (n))
+
+// interfaces of port n
+#define CDC_COMM_IF(n)		(2 * (n))
+#define CDC_DATA_IF(n)		(2 * (n) + 1)
+
+// default flush policy, see CdcSetFlush
+#define CDC_FLUSH_THRESHOLD	CDC_MAX_PACKET
+#define CDC_FLUSH_FRAMES	1
+
+#define CS_INTERFACE		0x24
+#define CS_ENDPOINT			0x25
+
+// class requests
+#define SET_LINE_CODING			0x20
+#define GET_LINE_CODING			0x21
+#define SET_CONTROL_LINE_STATE	0x22
+
+/** Data of the GET_LINE_CODING / SET_LINE_CODING class requests */
+typedef struct {
+	uint32_t	dwDTERate;		/**< baud rate */
+	uint8_t		bCharFormat;	/**< stop bits, 0 = 1, 1 = 1.5, 2 = 2 */
+	uint8_t		bParityType;	/**< 0 = none, 1 = odd, 2 = even, 3 = mark, 4 = space */
+	uint8_t		bDataBits;		/**< 5, 6, 7, 8 or 16 */
+} TLineCoding;
+
+/**
+	Interface association descriptor, which groups the two interfaces of
+	a port for the host. Only needed with more than one port, where the
+	device descriptor has to use class 0xEF, subclass 2, protocol 1.
+ */
+#if CDC_NUM_PORTS > 1
+#define CDC_IAD_DESCRIPTOR(n)	\
+	0x08,						\
+	DESC_INTERFACE_ASSOCIATION,	\
+	CDC_COMM_IF(n),				/* bFirstInterface */	\
+	0x02,						/* bInterfaceCount */	\
+	0x02,						/* bFunctionClass */	\
+	0x02,						/* bFunctionSubClass */	\
+	0x01,						/* bFunctionProtocol */	\
+	0x00,						/* iFunction */
+#define CDC_IAD_SIZE		8
+#else
+#define CDC_IAD_DESCRIPTOR(n)
+#define CDC_IAD_SIZE		0
+#endif
+
+/** Descriptors of port n, for the configuration descriptor */
+#define CDC_PORT_DESCRIPTORS(n)	\
+	CDC_IAD_DESCRIPTOR(n)		\
+/* control class interface */	\
+	0x09,						\
+	DESC_INTERFACE,				\
+	CDC_COMM_IF(n),				/* bInterfaceNumber */		\
+	0x00,						/* bAlternateSetting */		\
+	0x01,						/* bNumEndPoints */			\
+	0x02,						/* bInterfaceClass */		\
+	0x02,						/* bInterfaceSubClass */	\
+	0x01,						/* bInterfaceProtocol, linux requires value of 1 for the cdc_acm module */	\
+	0x00,						/* iInterface */			\
+/* header functional descriptor */	\
+	0x05,						\
+	CS_INTERFACE,				\
+	0x00,						\
+	0x10, 0x01,					/* bcdCDC */				\
+/* call management functional descriptor */	\
+	0x05,						\
+	CS_INTERFACE,				\
+	0x01,						\
+	0x01,						/* bmCapabilities = device handles call management */	\
+	CDC_DATA_IF(n),				/* bDataInterface */		\
+/* ACM functional descriptor */	\
+	0x04,						\
+	CS_INTERFACE,				\
+	0x02,						\
+	0x02,						/* bmCapabilities */		\
+/* union functional descriptor */	\
+	0x05,						\
+	CS_INTERFACE,				\
+	0x06,						\
+	CDC_COMM_IF(n),				/* bMasterInterface */		\
+	CDC_DATA_IF(n),				/* bSlaveInterface0 */		\
+/* notification EP */			\
+	0x07,						\
+	DESC_ENDPOINT,				\
+	CDC_INT_IN_EP(n),			/* bEndpointAddress */		\
+	0x03,						/* bmAttributes = intr */	\
+	CDC_NOTIFY_PACKET, 0x00,	/* wMaxPacketSize */		\
+	0x0A,						/* bInterval */				\
+/* data class interface descriptor */	\
+	0x09,						\
+	DESC_INTERFACE,				\
+	CDC_DATA_IF(n),				/* bInterfaceNumber */		\
+	0x00,						/* bAlternateSetting */		\
+	0x02,						/* bNumEndPoints */			\
+	0x0A,						/* bInterfaceClass = data */	\
+	0x00,						/* bInterfaceSubClass */	\
+	0x00,						/* bInterfaceProtocol */	\
+	0x00,						/* iInterface */			\
+/* data EP OUT */				\
+	0x07,						\
+	DESC_ENDPOINT,				\
+	CDC_BULK_OUT_EP(n),			/* bEndpointAddress */		\
+	0x02,						/* bmAttributes = bulk */	\
+	CDC_MAX_PACKET, 0x00,		/* wMaxPacketSize */		\
+	0x00,						/* bInterval */				\
+/* data EP in */				\
+	0x07,						\
+	DESC_ENDPOINT,				\
+	CDC_BULK_IN_EP(n),			/* bEndpointAddress */		\
+	0x02,						/* bmAttributes = bulk */	\
+	CDC_MAX_PACKET, 0x00,		/* wMaxPacketSize */		\
+	0x00,						/* bInterval */
+
+#define CDC_PORT_DESC_SIZE	(CDC_IAD_SIZE + 58)	/**< bytes of CDC_PORT_DESCRIPTORS */
+
+/** Callback for a new line coding, returns false if it cannot be used */
+typedef bool (TFnLineCodingHandler)(int iPort, const TLineCoding *pLineCoding);
+
+void CdcInit(void);
+void CdcRegisterHandlers(void);
+bool CdcHandleClassRequest(TSetupPacket *pSetup, int *piLen, uint8_t **ppbData);
+void CdcRegisterLineCodingHandler(TFnLineCodingHandler *pfnHandler);
+
+int  CdcPutchar(int iPort, int c);
+int  CdcGetchar(int iPort);
+int  CdcWrite(int iPort, const uint8_t *pbBuf, int iLen);
+int  CdcRead(int iPort, uint8_t *pbBuf, int iLen);
+int  CdcTxFree(int iPort);
+void CdcFlush(int iPort);
+void CdcSetFlush(int iPort, int iThreshold, int iFrames);
+const TLineCoding *CdcGetLineCoding(int iPort);
+uint16_t CdcGetLineState(int iPort);
+
+#endif /* _CDC_ACM_H_ */
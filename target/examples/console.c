@@ -28,56 +28,116 @@
 /*
 	Simple console input/output, over serial port #0
 
+	Output goes into a buffer, and from there into the UART as fast as it
+	can take it, so printing never waits for the UART. That makes it safe
+	to print from interrupt handlers. When the buffer is full, output is
+	dropped and counted, see ConsoleGetDropped.
+
+	The buffer is emptied by every call that prints, and by ConsolePoll,
+	which the main loop has to call to get the rest of the output out.
+
 	Partially copied from Jim Lynch's tutorial
 */
 
+#include <stddef.h>
+
+#include "armVIC.h"
+#include "uart.h"
 #include "console.h"
-#ifdef LPC214x
-#include "lpc214x.h"
-#endif
-#ifdef LPC23xx
-#include "lpc23xx.h"
-#endif
-
-
-/* Initialize Serial Interface       */
-void ConsoleInit(int iDivider)  
-{               
-#ifdef LPC214x
-	PINSEL0 = (PINSEL0 & ~0x0000000F) | 0x00000005;	/* Enable RxD0 and TxD0              */
-#else
-    PINSEL0 = (PINSEL0 & ~0x000000F0) | 0x00000050;	/* Enable RxD0 and TxD0              */
-#endif
-
-	U0LCR = 0x83;                          			/* 8 bits, no Parity, 1 Stop bit     */
-	U0DLL = iDivider & 0xFF;						/* set divider / baud rate */
-	U0DLM = iDivider >> 8;
-	U0LCR = 0x03;                          			/* DLAB = 0                          */
-	
-	// enable FIFO
-	U0FCR = 1;
+
+#define CONSOLE_UART	0
+
+static uint8_t abTxBuf[CONSOLE_BUF_SIZE];
+static volatile unsigned int iTxHead;	/**< bytes ever buffered */
+static volatile unsigned int iTxTail;	/**< bytes ever sent to the UART */
+static volatile uint32_t dwDropped;
+
+
+/**
+	Initialises the serial port, 8 bits, no parity, 1 stop bit
+
+	@param [in] dwBaud	baud rate
+ */
+void ConsoleInit(uint32_t dwBaud)
+{
+	UARTInit(CONSOLE_UART, NULL);
+	UARTSetFormat(CONSOLE_UART, dwBaud, 8, 0, 0);
+}
+
+
+/**
+	Moves buffered output into the UART, no more than it can take
+	without waiting
+ */
+void ConsolePoll(void)
+{
+	unsigned cpsr;
+	int i;
+
+	cpsr = disableIRQ();
+	if (UARTGetStatus(CONSOLE_UART) & UART_LSR_THRE) {
+		for (i = 0; (i < UART_HW_FIFO) && (iTxTail != iTxHead); i++) {
+			UARTWrite(CONSOLE_UART, abTxBuf[iTxTail % CONSOLE_BUF_SIZE]);
+			iTxTail++;
+		}
+	}
+	restoreIRQ(cpsr);
+}
+
+
+/**
+	Waits until all buffered output has left the UART, for when nothing
+	else is going to call ConsolePoll, like before a reset
+ */
+void ConsoleFlush(void)
+{
+	while ((iTxTail != iTxHead) || !(UARTGetStatus(CONSOLE_UART) & UART_LSR_TEMT)) {
+		ConsolePoll();
+	}
+}
+
+
+/**
+	Returns the number of characters dropped because the buffer was full
+ */
+uint32_t ConsoleGetDropped(void)
+{
+	return dwDropped;
 }
 
 
 /* Write character to Serial Port    */
 int putchar(int ch)  
-{             
-	if (ch == '\n') {
-		while (!(U0LSR & 0x20));
-		U0THR = '\r';
+{
+	unsigned cpsr;
+	unsigned int iNeeded;
+
+	iNeeded = (ch == '\n') ? 2 : 1;
+	cpsr = disableIRQ();
+	if ((CONSOLE_BUF_SIZE - (iTxHead - iTxTail)) < iNeeded) {
+		dwDropped++;
 	}
-	while (!(U0LSR & 0x20));
-	U0THR = ch;
-	
+	else {
+		if (ch == '\n') {
+			abTxBuf[iTxHead % CONSOLE_BUF_SIZE] = '\r';
+			iTxHead++;
+		}
+		abTxBuf[iTxHead % CONSOLE_BUF_SIZE] = ch;
+		iTxHead++;
+	}
+	restoreIRQ(cpsr);
+
+	ConsolePoll();
 	return ch;
 }
 
 
 int getchar (void)  {                    /* Read character from Serial Port   */
 
-  while (!(U0LSR & 0x01));
-
-  return (U0RBR);
+	while (!(UARTGetStatus(CONSOLE_UART) & UART_LSR_RDR)) {
+		ConsolePoll();
+	}
+	return UARTRead(CONSOLE_UART);
 }
 
 
@@ -90,4 +150,3 @@ int puts(const char *s)
 	return 1;
 }
 
-
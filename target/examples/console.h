@@ -25,9 +25,18 @@
 	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <stdint.h>
+
 #define EOF (-1)
 
-void ConsoleInit(int iDivider);
+#define CONSOLE_BUF_SIZE	1024	/**< bytes of output buffered, must be a power of two */
+
+void ConsoleInit(uint32_t dwBaud);
+void ConsolePoll(void);
+void ConsoleFlush(void);
+uint32_t ConsoleGetDropped(void);
+
 int putchar(int c);
+int getchar(void);
 int puts(const char *s);
 
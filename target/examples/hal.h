@@ -33,3 +33,6 @@ int		HalSysGetPCLK(void);
 
 void	HalPinSelect(uint8_t bPin, uint8_t bFunc);
 
+void		HalTimerInit(void);
+uint32_t	HalTimerGetUs(void);
+
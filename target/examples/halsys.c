@@ -221,3 +221,26 @@ void HalPinSelect(uint8_t bPin, uint8_t bFunc)
 	}
 }
 
+
+/**
+	Starts timer 1 as a free running microsecond counter
+ */
+void HalTimerInit(void)
+{
+#ifdef LPC23xx
+	PCLKSEL0 = (PCLKSEL0 & ~(3 << 4)) | (1 << 4);	// timer 1 clock to cclk
+#endif
+	T1TCR = 2;			// reset
+	T1PR = HalSysGetPCLK() / 1000000 - 1;
+	T1TCR = 1;			// run
+}
+
+
+/**
+	Returns the time since HalTimerInit in us, wrapping after 71 minutes
+ */
+uint32_t HalTimerGetUs(void)
+{
+	return T1TC;
+}
+
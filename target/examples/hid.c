@@ -0,0 +1,705 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	HID function with a queue of input reports.
+
+	Input reports are not written to the interrupt IN endpoint by the
+	application, but queued with HidSendReport. Only one report is in the
+	endpoint at a time. When the host has collected it, which happens at
+	most once every bInterval frames, the endpoint interrupt loads the
+	next report from the queue. So reports go out at the polling rate of
+	the host, in the order they were queued, and a report never waits for
+	more than the reports ahead of it in the queue.
+
+	Each report ID has its own policy for when reports come faster than
+	the host collects them: all are queued and sent, the oldest one waiting
+	is dropped to make room for the newest one, or reports are coalesced
+	so that only the latest state is sent. A report that waited longer
+	than the maximum age of its ID is dropped when its turn comes.
+
+	With an idle rate set by the host (SET_IDLE), the last report of an
+	ID is sent again when no new one was sent for that long.
+
+	Output reports come in on the interrupt OUT endpoint, unless it is
+	left out with HID_INT_OUT set to 0, or through SET_REPORT on the
+	control pipe. Either way they are read into one of two buffers and
+	passed to the handler of their report ID from HidPoll, in the
+	application. While the application handles one buffer, the next
+	report is received into the other. When both are full, a report on
+	the OUT endpoint stays there and the host gets NAKs until HidPoll
+	frees a buffer, so it is not lost. A SET_REPORT is stalled instead,
+	and the host has to send it again. Feature reports only go over
+	the control pipe, their handlers are called from the USB interrupt as
+	they are part of the request.
+
+	The USB stack runs from the USB interrupt and HidSendReport and HidPoll
+	from the application, the IRQ is disabled where they meet.
+*/
+
+#include <string.h>			// memcpy
+
+#include "debug.h"
+#include "armVIC.h"
+#include "usbapi.h"
+
+#include "hid.h"
+
+/** An input report in the queue */
+typedef struct {
+	uint8_t		abData[HID_MAX_PACKET];	/**< report, with its ID in front if it has one */
+	uint8_t		bReportID;
+	uint32_t	dwFrame;		/**< frame in which it was queued */
+} TReportSlot;
+
+/** State of the input report of one ID */
+typedef struct {
+	bool		fRegistered;
+	uint8_t		bLen;			/**< report length, with the ID */
+	EHidPolicy	ePolicy;
+	uint32_t	dwMaxAge;		/**< frames a report may wait, 0 = no limit */
+	int			iPending;		/**< reports of this ID in the queue */
+	uint8_t		bIdle;			/**< idle rate in units of 4 ms, 0 = only send new reports */
+	int			iIdleFrames;	/**< frames since a report of this ID was sent */
+	uint8_t		abLast[HID_MAX_PACKET];	/**< last report sent, for GET_REPORT and the idle rate */
+} TInputReport;
+
+/** An output or feature report ID */
+typedef struct {
+	uint8_t			bLen;		/**< report length, with the ID, 0 = not registered */
+	TFnHidSetReport	*pfnSet;
+	TFnHidGetReport	*pfnGet;
+} THostReport;
+
+/** Receive buffer of an output report */
+typedef struct {
+	uint8_t			abData[HID_MAX_PACKET];
+	int				iLen;
+	volatile bool	fFull;
+} TRxBuffer;
+
+static TInputReport	aInputReports[HID_NUM_REPORT_IDS + 1];
+static THostReport	aOutputReports[HID_NUM_REPORT_IDS + 1];
+static THostReport	aFeatureReports[HID_NUM_REPORT_IDS + 1];
+static TReportSlot	aSlots[HID_QUEUE_SIZE];
+static uint8_t		abOrder[HID_QUEUE_SIZE];	/**< slots in the queue, oldest first */
+static uint8_t		abFree[HID_QUEUE_SIZE];		/**< slots not in the queue */
+static int			iQueued;
+static int			iFree;
+static volatile bool fInBusy;		/**< a report is in the IN endpoint */
+static uint32_t		dwFrames;
+static THidStats	Stats;
+
+static TRxBuffer	aRxBufs[2];
+static int			iRxHead;		/**< buffer the next report goes into */
+static int			iRxTail;		/**< buffer HidPoll handles next */
+static volatile bool fRxDeferred;	/**< a report waits in the endpoint for a buffer */
+
+static const uint8_t *_pbReportDesc;
+static int			_iReportDescLen;
+static uint8_t		abClassReqData[HID_MAX_PACKET];
+static uint8_t		abFeature[HID_MAX_PACKET];	/**< GET_REPORT of a feature report */
+
+
+/**
+	Local function to take the report at position i out of the queue
+
+	@param [in] i
+ */
+static void RemoveAt(int i)
+{
+	TReportSlot *pSlot = &aSlots[abOrder[i]];
+
+	aInputReports[pSlot->bReportID].iPending--;
+	abFree[iFree++] = abOrder[i];
+	memmove(&abOrder[i], &abOrder[i + 1], iQueued - i - 1);
+	iQueued--;
+}
+
+
+/**
+	Local function to find the oldest report of an ID in the queue
+
+	@param [in] bReportID
+	@returns position in the queue, or -1 if there is none
+ */
+static int FindPending(uint8_t bReportID)
+{
+	int i;
+
+	for (i = 0; i < iQueued; i++) {
+		if (aSlots[abOrder[i]].bReportID == bReportID) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/**
+	Local function to put a report into the queue, according to the
+	policy of its ID. Call with the IRQ disabled.
+
+	@param [in] bReportID
+	@param [in] pbData	report, without the ID
+	@returns false if the queue had no room for it
+ */
+static bool Enqueue(uint8_t bReportID, const uint8_t *pbData)
+{
+	TInputReport *pReport = &aInputReports[bReportID];
+	TReportSlot *pSlot;
+	int i, iOffset;
+
+	iOffset = (bReportID != 0) ? 1 : 0;
+
+	// the newest state replaces the one waiting, in its place in the queue
+	if ((pReport->ePolicy == eHidCoalesce) && (pReport->iPending > 0)) {
+		pSlot = &aSlots[abOrder[FindPending(bReportID)]];
+		memcpy(pSlot->abData + iOffset, pbData, pReport->bLen - iOffset);
+		pSlot->dwFrame = dwFrames;
+		Stats.dwCoalesced++;
+		return true;
+	}
+
+	if (iQueued == HID_QUEUE_SIZE) {
+		i = (pReport->ePolicy == eHidDropOldest) ? FindPending(bReportID) : -1;
+		if (i < 0) {
+			Stats.dwRefused++;
+			return false;
+		}
+		RemoveAt(i);
+		Stats.dwDropped++;
+	}
+
+	pSlot = &aSlots[abFree[--iFree]];
+	pSlot->abData[0] = bReportID;
+	memcpy(pSlot->abData + iOffset, pbData, pReport->bLen - iOffset);
+	pSlot->bReportID = bReportID;
+	pSlot->dwFrame = dwFrames;
+	abOrder[iQueued++] = pSlot - aSlots;
+	pReport->iPending++;
+	Stats.dwQueued++;
+	return true;
+}
+
+
+/**
+	Local function to load the next report into the IN endpoint, dropping
+	the ones that waited too long. Call with the IRQ disabled.
+ */
+static void SendNext(void)
+{
+	TReportSlot *pSlot;
+	TInputReport *pReport;
+	uint32_t dwWait;
+
+	while (iQueued > 0) {
+		pSlot = &aSlots[abOrder[0]];
+		pReport = &aInputReports[pSlot->bReportID];
+		dwWait = dwFrames - pSlot->dwFrame;
+		if ((pReport->dwMaxAge != 0) && (dwWait > pReport->dwMaxAge)) {
+			RemoveAt(0);
+			Stats.dwStale++;
+			continue;
+		}
+		USBHwEPWrite(HID_INT_IN_EP, pSlot->abData, pReport->bLen);
+		memcpy(pReport->abLast, pSlot->abData, pReport->bLen);
+		pReport->iIdleFrames = 0;
+		if (dwWait > Stats.dwMaxWait) {
+			Stats.dwMaxWait = dwWait;
+		}
+		Stats.dwSent++;
+		RemoveAt(0);
+		fInBusy = true;
+		return;
+	}
+	fInBusy = false;
+}
+
+
+/**
+	Local function to handle the interrupt IN endpoint
+
+	Called when the host has collected the report in the endpoint.
+
+	@param [in] bEP
+	@param [in] bEPStatus
+ */
+static void IntIn(uint8_t bEP, uint8_t bEPStatus)
+{
+	if ((bEPStatus & EP_STATUS_DATA) == 0) {
+		SendNext();
+	}
+}
+
+
+/**
+	Local function to handle the interrupt OUT endpoint
+
+	Reads the reports waiting in the endpoint for as long as there is a
+	free buffer. When there is none, the report is left in the endpoint
+	and fRxDeferred is set, HidPoll calls this again once it has freed
+	a buffer.
+
+	@param [in] bEP
+	@param [in] bEPStatus
+ */
+static void IntOut(uint8_t bEP, uint8_t bEPStatus)
+{
+	TRxBuffer *pBuf;
+
+	while ((USBHwEPGetStatus(bEP) & EP_STATUS_DATA) != 0) {
+		pBuf = &aRxBufs[iRxHead];
+		if (pBuf->fFull) {
+			fRxDeferred = true;
+			return;
+		}
+		pBuf->iLen = USBHwEPRead(bEP, pBuf->abData, sizeof(pBuf->abData));
+		pBuf->fFull = true;
+		iRxHead ^= 1;
+	}
+}
+
+
+/**
+	USB frame interrupt handler
+
+	Called every millisecond by the hardware driver. Queues the last
+	report of an ID again once its idle time has passed, and loads the
+	endpoint if it is empty.
+
+	@param [in] wFrame
+ */
+static void HidFrame(uint16_t wFrame)
+{
+	TInputReport *pReport;
+	int i;
+
+	dwFrames++;
+	for (i = 0; i <= HID_NUM_REPORT_IDS; i++) {
+		pReport = &aInputReports[i];
+		if (!pReport->fRegistered || (pReport->bIdle == 0)) {
+			continue;
+		}
+		if ((++pReport->iIdleFrames >= 4 * pReport->bIdle) && (pReport->iPending == 0)) {
+			Enqueue(i, pReport->abLast + ((i != 0) ? 1 : 0));
+			pReport->iIdleFrames = 0;
+		}
+	}
+	if (!fInBusy) {
+		SendNext();
+	}
+}
+
+
+/**
+	Local function to empty the queue
+ */
+static void ClearQueue(void)
+{
+	int i;
+
+	iQueued = 0;
+	for (i = 0; i < HID_QUEUE_SIZE; i++) {
+		abFree[i] = i;
+	}
+	iFree = HID_QUEUE_SIZE;
+	for (i = 0; i <= HID_NUM_REPORT_IDS; i++) {
+		aInputReports[i].iPending = 0;
+	}
+	fInBusy = false;
+}
+
+
+/**
+	USB device status handler
+
+	Drops all queued reports when a USB reset is received.
+
+	@param [in] bDevStatus
+ */
+static void HidDevStatus(uint8_t bDevStatus)
+{
+	if ((bDevStatus & DEV_STATUS_RESET) != 0) {
+		ClearQueue();
+		fRxDeferred = false;
+	}
+}
+
+
+/**
+	Local function to handle a standard request for the HID interface,
+	which returns the report descriptor or the HID descriptor
+
+	@param [in] pSetup
+	@param [out] piLen
+	@param [out] ppbData
+	@returns true if the request was handled
+ */
+static bool HidHandleStdReq(TSetupPacket *pSetup, int *piLen, uint8_t **ppbData)
+{
+	if ((pSetup->bmRequestType != 0x81) ||			// standard IN request for interface
+		(pSetup->bRequest != REQ_GET_DESCRIPTOR)) {
+		return false;
+	}
+	if (GET_DESC_TYPE(pSetup->wValue) == DESC_HID_REPORT) {
+		*ppbData = (uint8_t *)_pbReportDesc;
+		*piLen = _iReportDescLen;
+		return true;
+	}
+	// search descriptor space
+	return USBGetDescriptor(pSetup->wValue, pSetup->wIndex, piLen, ppbData);
+}
+
+
+/**
+	Handles the HID class requests
+
+	@param [in] pSetup
+	@param [out] piLen
+	@param [out] ppbData
+	@returns true if the request was handled
+ */
+bool HidHandleClassRequest(TSetupPacket *pSetup, int *piLen, uint8_t **ppbData)
+{
+	TInputReport *pReport;
+	THostReport *pHostReport;
+	TRxBuffer *pBuf;
+	uint8_t bReportID;
+	int i, iOffset;
+
+	if ((REQTYPE_GET_RECIP(pSetup->bmRequestType) != REQTYPE_RECIP_INTERFACE) ||
+		((pSetup->wIndex & 0xFF) != HID_IF)) {
+		return false;
+	}
+	bReportID = pSetup->wValue & 0xFF;
+	if (bReportID > HID_NUM_REPORT_IDS) {
+		DBG("Invalid report ID %d\n", bReportID);
+		return false;
+	}
+	pReport = &aInputReports[bReportID];
+	iOffset = (bReportID != 0) ? 1 : 0;
+
+	switch (pSetup->bRequest) {
+
+	case HID_GET_REPORT:
+		switch (pSetup->wValue >> 8) {
+		case HID_REPORT_INPUT:
+			if (!pReport->fRegistered) {
+				return false;
+			}
+			*ppbData = pReport->abLast;
+			*piLen = pReport->bLen;
+			break;
+		case HID_REPORT_FEATURE:
+			pHostReport = &aFeatureReports[bReportID];
+			if ((pHostReport->pfnGet == NULL) ||
+				!pHostReport->pfnGet(bReportID, abFeature + iOffset, pHostReport->bLen - iOffset)) {
+				return false;
+			}
+			abFeature[0] = bReportID;
+			*ppbData = abFeature;
+			*piLen = pHostReport->bLen;
+			break;
+		default:
+			return false;
+		}
+		break;
+
+	// the data starts with the report ID, if the reports have one
+	case HID_SET_REPORT:
+		switch (pSetup->wValue >> 8) {
+		case HID_REPORT_OUTPUT:
+			// handled from HidPoll, like the reports on the OUT endpoint
+			pHostReport = &aOutputReports[bReportID];
+			pBuf = &aRxBufs[iRxHead];
+			if ((pHostReport->bLen == 0) || (*piLen != pHostReport->bLen) || pBuf->fFull) {
+				return false;
+			}
+			memcpy(pBuf->abData, *ppbData, *piLen);
+			pBuf->iLen = *piLen;
+			pBuf->fFull = true;
+			iRxHead ^= 1;
+			break;
+		case HID_REPORT_FEATURE:
+			pHostReport = &aFeatureReports[bReportID];
+			if ((pHostReport->pfnSet == NULL) || (*piLen != pHostReport->bLen)) {
+				return false;
+			}
+			pHostReport->pfnSet(bReportID, *ppbData + iOffset, *piLen - iOffset);
+			break;
+		default:
+			return false;
+		}
+		break;
+
+	case HID_GET_IDLE:
+		(*ppbData)[0] = pReport->bIdle;
+		*piLen = 1;
+		break;
+
+	// report ID 0 sets the idle rate of all reports
+	case HID_SET_IDLE:
+		DBG("SET IDLE, val=%X, idx=%X\n", pSetup->wValue, pSetup->wIndex);
+		for (i = 0; i <= HID_NUM_REPORT_IDS; i++) {
+			if ((i == bReportID) || (bReportID == 0)) {
+				aInputReports[i].bIdle = pSetup->wValue >> 8;
+				aInputReports[i].iIdleFrames = 0;
+			}
+		}
+		break;
+
+	default:
+		DBG("Unhandled class %X\n", pSetup->bRequest);
+		return false;
+	}
+	return true;
+}
+
+
+/**
+	Sets up an input report ID, which starts out as all zeros.
+
+	@param [in] bReportID	1 to HID_NUM_REPORT_IDS, or 0 if the report
+							descriptor does not use report IDs
+	@param [in] iLen		report length, without the ID
+	@param [in] ePolicy		what to do with reports that come faster than
+							the host collects them
+	@param [in] iMaxAge		frames a report may wait in the queue before
+							it is dropped, 0 for no limit
+ */
+void HidRegisterInputReport(uint8_t bReportID, int iLen, EHidPolicy ePolicy, int iMaxAge)
+{
+	TInputReport *pReport;
+
+	if (bReportID > HID_NUM_REPORT_IDS) {
+		DBG("Invalid report ID %d\n", bReportID);
+		return;
+	}
+	iLen += (bReportID != 0) ? 1 : 0;
+	if (iLen > HID_MAX_PACKET) {
+		DBG("Report %d too long\n", bReportID);
+		return;
+	}
+	pReport = &aInputReports[bReportID];
+	pReport->bLen = iLen;
+	pReport->ePolicy = ePolicy;
+	pReport->dwMaxAge = iMaxAge;
+	memset(pReport->abLast, 0, sizeof(pReport->abLast));
+	pReport->abLast[0] = bReportID;
+	pReport->fRegistered = true;
+}
+
+
+/**
+	Queues an input report for the host
+
+	@param [in] bReportID
+	@param [in] pbData		report, without the ID
+	@param [in] iLen		report length, as registered
+	@returns true if the report was queued, false if there was no room
+ */
+bool HidSendReport(uint8_t bReportID, const uint8_t *pbData, int iLen)
+{
+	TInputReport *pReport;
+	unsigned cpsr;
+	bool fOk;
+
+	if (bReportID > HID_NUM_REPORT_IDS) {
+		return false;
+	}
+	pReport = &aInputReports[bReportID];
+	if (!pReport->fRegistered || (iLen != pReport->bLen - ((bReportID != 0) ? 1 : 0))) {
+		return false;
+	}
+
+	cpsr = disableIRQ();
+	fOk = Enqueue(bReportID, pbData);
+	if (fOk && !fInBusy) {
+		SendNext();
+	}
+	restoreIRQ(cpsr);
+	return fOk;
+}
+
+
+/**
+	Local function to pass an output report to its handler
+
+	@param [in] pbData	report, with its ID in front if it has one
+	@param [in] iLen
+ */
+static void Dispatch(const uint8_t *pbData, int iLen)
+{
+	THostReport *pReport;
+	uint8_t bReportID;
+	int iOffset;
+
+	// without report IDs, the report is the whole packet
+	bReportID = 0;
+	iOffset = 0;
+	if ((aOutputReports[0].bLen == 0) && (iLen > 0)) {
+		bReportID = pbData[0];
+		iOffset = 1;
+	}
+	if ((bReportID > HID_NUM_REPORT_IDS) || (aOutputReports[bReportID].bLen == 0) ||
+		(iLen != aOutputReports[bReportID].bLen)) {
+		Stats.dwOutInvalid++;
+		return;
+	}
+	pReport = &aOutputReports[bReportID];
+	Stats.dwOutReports++;
+	pReport->pfnSet(bReportID, pbData + iOffset, iLen - iOffset);
+}
+
+
+/**
+	Passes the output reports received to their handlers.
+	Call this function from the main loop.
+ */
+void HidPoll(void)
+{
+	TRxBuffer *pBuf;
+	unsigned cpsr;
+
+	while (aRxBufs[iRxTail].fFull) {
+		pBuf = &aRxBufs[iRxTail];
+		Dispatch(pBuf->abData, pBuf->iLen);
+
+		cpsr = disableIRQ();
+		pBuf->fFull = false;
+		iRxTail ^= 1;
+		// a report waited for this buffer
+		if (fRxDeferred) {
+			fRxDeferred = false;
+			IntOut(HID_INT_OUT_EP, 0);
+		}
+		restoreIRQ(cpsr);
+	}
+}
+
+
+/**
+	Sets up an output report ID, which comes from the host on the
+	interrupt OUT endpoint or with SET_REPORT.
+
+	@param [in] bReportID	1 to HID_NUM_REPORT_IDS, or 0 if the report
+							descriptor does not use report IDs
+	@param [in] iLen		report length, without the ID
+	@param [in] pfnHandler	called from HidPoll with every report, not NULL
+ */
+void HidRegisterOutputReport(uint8_t bReportID, int iLen, TFnHidSetReport *pfnHandler)
+{
+	iLen += (bReportID != 0) ? 1 : 0;
+	if ((bReportID > HID_NUM_REPORT_IDS) || (iLen > HID_MAX_PACKET) || (pfnHandler == NULL)) {
+		DBG("Invalid report %d\n", bReportID);
+		return;
+	}
+	aOutputReports[bReportID].pfnSet = pfnHandler;
+	aOutputReports[bReportID].bLen = iLen;
+}
+
+
+/**
+	Sets up a feature report ID, which the host reads and writes with
+	GET_REPORT and SET_REPORT. The handlers are called from the USB
+	interrupt, a request is stalled if its handler is NULL.
+
+	@param [in] bReportID	1 to HID_NUM_REPORT_IDS, or 0 if the report
+							descriptor does not use report IDs
+	@param [in] iLen		report length, without the ID
+	@param [in] pfnSet		called with the report of a SET_REPORT
+	@param [in] pfnGet		fills in the report for a GET_REPORT
+ */
+void HidRegisterFeatureReport(uint8_t bReportID, int iLen, TFnHidSetReport *pfnSet, TFnHidGetReport *pfnGet)
+{
+	iLen += (bReportID != 0) ? 1 : 0;
+	if ((bReportID > HID_NUM_REPORT_IDS) || (iLen > HID_MAX_PACKET)) {
+		DBG("Invalid report %d\n", bReportID);
+		return;
+	}
+	aFeatureReports[bReportID].pfnSet = pfnSet;
+	aFeatureReports[bReportID].pfnGet = pfnGet;
+	aFeatureReports[bReportID].bLen = iLen;
+}
+
+
+/**
+	Returns the counters of the reports
+
+	@param [out] pStats
+ */
+void HidGetStats(THidStats *pStats)
+{
+	unsigned cpsr;
+
+	cpsr = disableIRQ();
+	*pStats = Stats;
+	restoreIRQ(cpsr);
+}
+
+
+/**
+	Initialises the HID function.
+	Call this function before using any of the other Hid* functions.
+
+	@param [in] pbReportDesc	report descriptor
+	@param [in] iReportDescLen	its length
+ */
+void HidInit(const uint8_t *pbReportDesc, int iReportDescLen)
+{
+	_pbReportDesc = pbReportDesc;
+	_iReportDescLen = iReportDescLen;
+	memset(aInputReports, 0, sizeof(aInputReports));
+	memset(aOutputReports, 0, sizeof(aOutputReports));
+	memset(aFeatureReports, 0, sizeof(aFeatureReports));
+	memset(aRxBufs, 0, sizeof(aRxBufs));
+	iRxHead = 0;
+	iRxTail = 0;
+	fRxDeferred = false;
+	memset(&Stats, 0, sizeof(Stats));
+	dwFrames = 0;
+	ClearQueue();
+}
+
+
+/**
+	Registers the descriptor, class request, endpoint, frame and device
+	status handlers with the USB stack.
+ */
+void HidRegisterHandlers(void)
+{
+	USBRegisterCustomReqHandler(HidHandleStdReq);
+	USBRegisterRequestHandler(REQTYPE_TYPE_CLASS, HidHandleClassRequest, abClassReqData);
+	USBHwRegisterEPIntHandler(HID_INT_IN_EP, IntIn);
+#if HID_INT_OUT
+	USBHwRegisterEPIntHandler(HID_INT_OUT_EP, IntOut);
+#endif
+	USBHwRegisterFrameHandler(HidFrame);
+	USBHwRegisterDevIntHandler(HidDevStatus);
+}
+
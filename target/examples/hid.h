@@ -0,0 +1,153 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	HID function with a queue of input reports and an interrupt OUT
+	endpoint for output reports, see hid.c.
+*/
+
+#ifndef _HID_H_
+#define _HID_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "usbstruct.h"
+
+#define HID_INT_IN_EP		0x81
+#define HID_INT_OUT_EP		0x04		/**< not 0x01, EP handlers are per logical endpoint */
+#define HID_MAX_PACKET		64		/**< interrupt packet size, and largest report with its ID */
+#define HID_IF				0		/**< interface number */
+
+#ifndef HID_IN_INTERVAL
+#define HID_IN_INTERVAL		1		/**< bInterval of the IN endpoint, in frames */
+#endif
+#ifndef HID_INT_OUT
+#define HID_INT_OUT			1		/**< 1 = output reports on an interrupt OUT endpoint too */
+#endif
+#ifndef HID_OUT_INTERVAL
+#define HID_OUT_INTERVAL	1		/**< bInterval of the OUT endpoint, in frames */
+#endif
+#ifndef HID_NUM_REPORT_IDS
+#define HID_NUM_REPORT_IDS	4		/**< report IDs 1 to n, or 0 for reports without ID */
+#endif
+#ifndef HID_QUEUE_SIZE
+#define HID_QUEUE_SIZE		16		/**< input reports waiting to be sent, of all IDs */
+#endif
+
+// report types, in the high byte of wValue of GET_REPORT / SET_REPORT
+#define HID_REPORT_INPUT	1
+#define HID_REPORT_OUTPUT	2
+#define HID_REPORT_FEATURE	3
+
+/** What happens to an input report when others of its ID are waiting */
+typedef enum {
+	eHidQueue,			/**< all reports are sent, a new one is refused when the queue is full */
+	eHidDropOldest,		/**< when the queue is full, the oldest report of the ID makes room */
+	eHidCoalesce		/**< only the newest report is sent, it replaces one still waiting */
+} EHidPolicy;
+
+/** Counters of the reports */
+typedef struct {
+	uint32_t	dwQueued;		/**< taken into the queue, idle repeats included */
+	uint32_t	dwSent;
+	uint32_t	dwRefused;		/**< queue full */
+	uint32_t	dwDropped;		/**< made room for a newer one, eHidDropOldest */
+	uint32_t	dwCoalesced;	/**< replaced by a newer one, eHidCoalesce */
+	uint32_t	dwStale;		/**< waited longer than their maximum age */
+	uint32_t	dwMaxWait;		/**< most frames a sent report waited in the queue */
+	uint32_t	dwOutReports;	/**< output reports passed to their handler */
+	uint32_t	dwOutInvalid;	/**< output reports with an unknown ID or length */
+} THidStats;
+
+/** Callback for an output or feature report from the host, without its ID */
+typedef void (TFnHidSetReport)(uint8_t bReportID, const uint8_t *pbData, int iLen);
+
+/** Callback that fills in a feature report for the host, returns false if it has none */
+typedef bool (TFnHidGetReport)(uint8_t bReportID, uint8_t *pbData, int iLen);
+
+/** Interrupt OUT endpoint descriptor, if there is one */
+#if HID_INT_OUT
+#define HID_OUT_EP_DESCRIPTOR	\
+	0x07,						\
+	DESC_ENDPOINT,				\
+	HID_INT_OUT_EP,				/* bEndpointAddress */		\
+	0x03,						/* bmAttributes = intr */	\
+	HID_MAX_PACKET, 0x00,		/* wMaxPacketSize */		\
+	HID_OUT_INTERVAL,			/* bInterval */
+#define HID_OUT_EP_SIZE		7
+#else
+#define HID_OUT_EP_DESCRIPTOR
+#define HID_OUT_EP_SIZE		0
+#endif
+
+/** Interface, HID and endpoint descriptors, for the configuration descriptor */
+#define HID_DESCRIPTORS(iReportDescLen)	\
+/* interface */					\
+	0x09,						\
+	DESC_INTERFACE,				\
+	HID_IF,						/* bInterfaceNumber */		\
+	0x00,						/* bAlternateSetting */		\
+	1 + HID_INT_OUT,			/* bNumEndPoints */			\
+	0x03,						/* bInterfaceClass = HID */	\
+	0x00,						/* bInterfaceSubClass */	\
+	0x00,						/* bInterfaceProtocol */	\
+	0x00,						/* iInterface */			\
+/* HID descriptor */			\
+	0x09,						\
+	DESC_HID_HID,				/* bDescriptorType = HID */	\
+	0x10, 0x01,					/* bcdHID */				\
+	0x00,						/* bCountryCode */			\
+	0x01,						/* bNumDescriptors = report */	\
+	DESC_HID_REPORT,			/* bDescriptorType */		\
+	(iReportDescLen) & 0xFF, (iReportDescLen) >> 8,	/* wDescriptorLength */	\
+/* interrupt IN EP */			\
+	0x07,						\
+	DESC_ENDPOINT,				\
+	HID_INT_IN_EP,				/* bEndpointAddress */		\
+	0x03,						/* bmAttributes = intr */	\
+	HID_MAX_PACKET, 0x00,		/* wMaxPacketSize */		\
+	HID_IN_INTERVAL,			/* bInterval */				\
+	HID_OUT_EP_DESCRIPTOR
+
+#define HID_DESC_SIZE		(25 + HID_OUT_EP_SIZE)	/**< bytes of HID_DESCRIPTORS */
+
+void HidInit(const uint8_t *pbReportDesc, int iReportDescLen);
+void HidRegisterHandlers(void);
+bool HidHandleClassRequest(TSetupPacket *pSetup, int *piLen, uint8_t **ppbData);
+
+void HidRegisterInputReport(uint8_t bReportID, int iLen, EHidPolicy ePolicy, int iMaxAge);
+bool HidSendReport(uint8_t bReportID, const uint8_t *pbData, int iLen);
+void HidGetStats(THidStats *pStats);
+
+void HidRegisterOutputReport(uint8_t bReportID, int iLen, TFnHidSetReport *pfnHandler);
+void HidRegisterFeatureReport(uint8_t bReportID, int iLen, TFnHidSetReport *pfnSet, TFnHidGetReport *pfnGet);
+void HidPoll(void);
+
+#endif /* _HID_H_ */
+
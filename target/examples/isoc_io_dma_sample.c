@@ -414,13 +414,8 @@ int main(void)
 	// PLL and MAM
 	HalSysInit();
 
-#ifdef LPC214x
-	// init DBG
-	ConsoleInit(60000000 / (16 * BAUD_RATE));
-#else
 	// init DBG
-	ConsoleInit(72000000 / (16 * BAUD_RATE));
-#endif
+	ConsoleInit(BAUD_RATE);
 
 	DBG("Initialising USB stack\n");
 
@@ -472,6 +467,7 @@ int main(void)
 	// echo any character received (do USB stuff in interrupt)
 	
 	for(;;) {
+		ConsolePoll();
 		x++;
 		
 		if (x == interval) {
@@ -0,0 +1,351 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Interrupt-driven UART hardware layer for LPC214x and LPC23xx.
+
+	Both FIFOs are enabled, received data interrupts once 8 characters
+	are waiting or when the line has been idle for a few character times,
+	and the transmitter interrupts when its FIFO runs empty, so a buffered
+	driver handles up to 16 characters per interrupt in either direction.
+
+	The baud rate is made with the fractional divider, which gets the
+	rates of usual USB-serial bridges, up to 921600 baud and beyond, within
+	a fraction of a percent from a 60 MHz PCLK.
+*/
+
+#include "debug.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef LPC214x
+#include "lpc214x.h"
+#endif
+#ifdef LPC23xx
+#include "lpc23xx.h"
+#endif
+
+#include "hal.h"
+#include "uart.h"
+
+// register offsets
+#define RBR		0x00
+#define THR		0x00
+#define DLL		0x00
+#define DLM		0x04
+#define IER		0x04
+#define IIR		0x08
+#define FCR		0x08
+#define LCR		0x0C
+#define LSR		0x14
+#define FDR		0x28
+
+#define UREG(dwBase, iOffset)	(*(volatile unsigned int *)((dwBase) + (iOffset)))
+
+// IER bits
+#define IER_RBR		(1<<0)
+#define IER_THRE	(1<<1)
+#define IER_RLS		(1<<2)
+
+// FCR bits
+#define FCR_ENABLE	(1<<0)
+#define FCR_RXRESET	(1<<1)
+#define FCR_TXRESET	(1<<2)
+#define FCR_RXTRIG8	(2<<6)
+
+// LCR bits
+#define LCR_STOP2	(1<<2)
+#define LCR_PARITY	(1<<3)
+#define LCR_DLAB	(1<<7)
+
+#define UART_VECT_NUM	1		/**< first VIC slot, after the USB interrupt */
+
+#define MAX_BAUD_ERROR	50		/**< 1 / max relative error of the baud rate */
+
+#ifdef LPC214x
+#define NUM_UARTS	2
+static const uint32_t adwBase[NUM_UARTS] = {UART0_BASE_ADDR, UART1_BASE_ADDR};
+static const uint8_t abTxPin[NUM_UARTS] = {0, 8};
+static const uint8_t abRxPin[NUM_UARTS] = {1, 9};
+static const uint8_t abPinFunc[NUM_UARTS] = {1, 1};
+static const uint8_t abPower[NUM_UARTS] = {3, 4};
+static const uint8_t abVICChannel[NUM_UARTS] = {6, 7};
+#else
+#define NUM_UARTS	4
+static const uint32_t adwBase[NUM_UARTS] = {UART0_BASE_ADDR, UART1_BASE_ADDR, UART2_BASE_ADDR, UART3_BASE_ADDR};
+static const uint8_t abTxPin[NUM_UARTS] = {2, 15, 10, 0};
+static const uint8_t abRxPin[NUM_UARTS] = {3, 16, 11, 1};
+static const uint8_t abPinFunc[NUM_UARTS] = {1, 1, 1, 2};
+static const uint8_t abPower[NUM_UARTS] = {3, 4, 24, 25};
+static const uint8_t abVICChannel[NUM_UARTS] = {6, 7, 28, 29};
+static const uint8_t abPclkSel[NUM_UARTS] = {6, 8, 16, 18};	/**< PCLKSEL0/1 bit, UART0-1 in PCLKSEL0 */
+#endif
+
+static TFnUARTIntHandler *_apfnIntHandlers[NUM_UARTS];
+
+static void UART0IntHandler(void) __attribute__ ((interrupt("IRQ")));
+static void UART1IntHandler(void) __attribute__ ((interrupt("IRQ")));
+#if NUM_UARTS > 2
+static void UART2IntHandler(void) __attribute__ ((interrupt("IRQ")));
+static void UART3IntHandler(void) __attribute__ ((interrupt("IRQ")));
+#endif
+
+
+/**
+	Local function to handle a UART interrupt.
+	Reading IIR acknowledges an empty transmitter, received data is
+	acknowledged by reading it.
+
+	@param [in] iUart
+ */
+static void HandleInt(int iUart)
+{
+	(void)UREG(adwBase[iUart], IIR);
+	if (_apfnIntHandlers[iUart] != NULL) {
+		_apfnIntHandlers[iUart](iUart);
+	}
+	VICVectAddr = 0x00;    // dummy write to VIC to signal end of ISR
+}
+
+static void UART0IntHandler(void)
+{
+	HandleInt(0);
+}
+
+static void UART1IntHandler(void)
+{
+	HandleInt(1);
+}
+
+#if NUM_UARTS > 2
+static void UART2IntHandler(void)
+{
+	HandleInt(2);
+}
+
+static void UART3IntHandler(void)
+{
+	HandleInt(3);
+}
+#endif
+
+
+/**
+	Sets the line format.
+
+	The parameters use the encoding of the CDC line coding, so they can be
+	passed on straight from a SET_LINE_CODING request.
+
+	@param [in] iUart
+	@param [in] dwBaud baud rate
+	@param [in] iDataBits 5 to 8
+	@param [in] iParity 0 = none, 1 = odd, 2 = even, 3 = mark, 4 = space
+	@param [in] iStopBits 0 = 1, 1 = 1.5, 2 = 2
+
+	@returns false if the format or baud rate cannot be made, the old
+	format is kept then
+ */
+bool UARTSetFormat(int iUart, uint32_t dwBaud, int iDataBits, int iParity, int iStopBits)
+{
+	uint32_t dwBase, dwClock, dwDiv, dwRate, dwError, dwBestError;
+	int iMul, iDivAdd, iDL, iBestMul, iBestDivAdd, iBestDL;
+	uint8_t bLCR;
+
+	if ((iUart >= NUM_UARTS) || (dwBaud == 0) ||
+		(iDataBits < 5) || (iDataBits > 8) || (iParity > 4) || (iStopBits > 2) ||
+		((iStopBits == 1) && (iDataBits != 5))) {
+		DBG("Unsupported UART format %u %d/%d/%d\n", dwBaud, iDataBits, iParity, iStopBits);
+		return false;
+	}
+
+	// find the divider and fractional divider closest to the baud rate,
+	// baud = PCLK / (16 * DL * (1 + DivAdd / Mul))
+	dwClock = HalSysGetPCLK();
+	if (dwBaud > dwClock / 16) {
+		DBG("Baud rate %u not possible\n", dwBaud);
+		return false;
+	}
+	dwBestError = 0xFFFFFFFF;
+	iBestMul = 1;
+	iBestDivAdd = 0;
+	iBestDL = 0;
+	for (iMul = 1; iMul <= 15; iMul++) {
+		for (iDivAdd = 0; iDivAdd < iMul; iDivAdd++) {
+			dwDiv = 16 * dwBaud * (iMul + iDivAdd);
+			iDL = (dwClock * iMul + dwDiv / 2) / dwDiv;
+			// the fractional divider needs DL >= 3
+			if ((iDL < ((iDivAdd == 0) ? 1 : 3)) || (iDL > 0xFFFF)) {
+				continue;
+			}
+			dwRate = (dwClock * iMul) / (16 * iDL * (iMul + iDivAdd));
+			dwError = (dwRate > dwBaud) ? (dwRate - dwBaud) : (dwBaud - dwRate);
+			if (dwError < dwBestError) {
+				dwBestError = dwError;
+				iBestMul = iMul;
+				iBestDivAdd = iDivAdd;
+				iBestDL = iDL;
+			}
+		}
+	}
+	if ((iBestDL == 0) || (dwBestError > dwBaud / MAX_BAUD_ERROR)) {
+		DBG("Baud rate %u not possible\n", dwBaud);
+		return false;
+	}
+
+	bLCR = iDataBits - 5;
+	if (iStopBits != 0) {
+		bLCR |= LCR_STOP2;
+	}
+	if (iParity != 0) {
+		// odd, even, forced 1, forced 0
+		bLCR |= LCR_PARITY | ((iParity - 1) << 4);
+	}
+
+	dwBase = adwBase[iUart];
+	UREG(dwBase, LCR) = bLCR | LCR_DLAB;
+	UREG(dwBase, DLL) = iBestDL & 0xFF;
+	UREG(dwBase, DLM) = iBestDL >> 8;
+	UREG(dwBase, FDR) = (iBestMul << 4) | iBestDivAdd;
+	UREG(dwBase, LCR) = bLCR;
+
+	DBG("UART%d at %u baud (DL=%d, %d/%d)\n", iUart, dwBaud - dwBestError, iBestDL, iBestDivAdd, iBestMul);
+	return true;
+}
+
+
+/**
+	Powers up a UART and connects its pins, sets it to 115200 8N1 and
+	installs an interrupt handler for it. Receive interrupts are enabled
+	right away, transmit interrupts with UARTTxIntEnable.
+	Without a handler the UART raises no interrupts and has to be polled.
+
+	@param [in] iUart
+	@param [in] pfnHandler called from the UART interrupt, or NULL
+ */
+void UARTInit(int iUart, TFnUARTIntHandler *pfnHandler)
+{
+	static void (* const apfnVectors[NUM_UARTS])(void) = {
+		UART0IntHandler, UART1IntHandler,
+#if NUM_UARTS > 2
+		UART2IntHandler, UART3IntHandler
+#endif
+	};
+	uint32_t dwBase;
+	int iChannel;
+#ifdef LPC23xx
+	volatile unsigned int *pdwPclkSel;
+#endif
+
+	ASSERT(iUart < NUM_UARTS);
+	dwBase = adwBase[iUart];
+	iChannel = abVICChannel[iUart];
+
+	PCONP |= (1 << abPower[iUart]);
+#ifdef LPC23xx
+	// UART clock to cclk, UARTSetFormat computes the divider for HalSysGetPCLK
+	pdwPclkSel = (iUart < 2) ? &PCLKSEL0 : &PCLKSEL1;
+	*pdwPclkSel = (*pdwPclkSel & ~(3 << abPclkSel[iUart])) | (1 << abPclkSel[iUart]);
+#endif
+	HalPinSelect(abTxPin[iUart], abPinFunc[iUart]);
+	HalPinSelect(abRxPin[iUart], abPinFunc[iUart]);
+
+	UREG(dwBase, IER) = 0;
+	UARTSetFormat(iUart, 115200, 8, 0, 0);
+	UREG(dwBase, FCR) = FCR_ENABLE | FCR_RXRESET | FCR_TXRESET | FCR_RXTRIG8;
+
+	_apfnIntHandlers[iUart] = pfnHandler;
+	if (pfnHandler == NULL) {
+		return;
+	}
+
+#ifdef LPC214x
+	(*(&VICVectCntl0 + UART_VECT_NUM + iUart)) = 0x20 | iChannel;
+	(*(&VICVectAddr0 + UART_VECT_NUM + iUart)) = (int)apfnVectors[iUart];
+#else
+	(*(&VICVectCntl0 + iChannel)) = 0x02;
+	(*(&VICVectAddr0 + iChannel)) = (int)apfnVectors[iUart];
+#endif
+	VICIntSelect &= ~(1 << iChannel);		// IRQ, not FIQ
+	VICIntEnable |= (1 << iChannel);
+
+	UREG(dwBase, IER) = IER_RBR | IER_RLS;
+}
+
+
+/**
+	Returns the line status, see UART_LSR_*. The error bits are cleared
+	by reading them.
+
+	@param [in] iUart
+ */
+uint8_t UARTGetStatus(int iUart)
+{
+	return UREG(adwBase[iUart], LSR);
+}
+
+
+/**
+	Reads one character from the receive FIFO, check UART_LSR_RDR first.
+
+	@param [in] iUart
+ */
+uint8_t UARTRead(int iUart)
+{
+	return UREG(adwBase[iUart], RBR);
+}
+
+
+/**
+	Writes one character into the transmit FIFO. Up to UART_HW_FIFO
+	characters fit once UART_LSR_THRE is set.
+
+	@param [in] iUart
+	@param [in] b
+ */
+void UARTWrite(int iUart, uint8_t b)
+{
+	UREG(adwBase[iUart], THR) = b;
+}
+
+
+/**
+	Enables or disables the interrupt for an empty transmit FIFO
+
+	@param [in] iUart
+	@param [in] fEnable
+ */
+void UARTTxIntEnable(int iUart, bool fEnable)
+{
+	uint32_t dwBase = adwBase[iUart];
+
+	if (fEnable) {
+		UREG(dwBase, IER) |= IER_THRE;
+	}
+	else {
+		UREG(dwBase, IER) &= ~IER_THRE;
+	}
+}
@@ -0,0 +1,229 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	USB to serial bridge, using the CDC class.
+	Everything the host sends goes out on UART1, everything received on
+	UART1 goes to the host, with the baud rate and format the host sets.
+
+	Build with -DCDC_NUM_PORTS=n for n ports (up to 2 on LPC214x, 4 on
+	LPC23xx). The last port of 2 on LPC214x, or of 4 on LPC23xx, takes
+	UART0 from the console, so that needs a build without DEBUG
+	(make DEBUG=).
+
+	Windows:
+	Extract the usbser.sys file from .cab file in C:\WINDOWS\Driver Cache\i386
+	and store it somewhere (C:\temp is a good place) along with the usbser.inf
+	file. Then plug in the LPC214x and direct windows to the usbser driver.
+	Windows then creates an extra COMx port that you can open in a terminal
+	program, like hyperterminal.
+
+	Linux:
+	The device should be recognised automatically by the cdc_acm driver,
+	which creates a /dev/ttyACMx device file that acts just like a regular
+	serial port.
+
+*/
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "debug.h"
+
+#ifdef LPC214x
+#include "lpc214x.h"
+#endif
+#ifdef LPC23xx
+#include "lpc23xx.h"
+#endif
+
+#include "armVIC.h"
+
+#include "hal.h"
+#include "console.h"
+#include "usbapi.h"
+
+#include "cdc_acm.h"
+#include "bridge.h"
+
+
+#define BAUD_RATE	115200
+
+#define MAX_PACKET_SIZE	64
+
+#define LE_WORD(x)		((x)&0xFF),((x)>>8)
+
+#define	INT_VECT_NUM	0
+
+#define IRQ_MASK 0x00000080
+
+#if CDC_NUM_PORTS > 1
+#define DEVICE_CLASS	0xEF, 0x02, 0x01	// miscellaneous, interface association
+#else
+#define DEVICE_CLASS	0x02, 0x00, 0x00	// communications
+#endif
+
+// forward declaration of interrupt handler
+static void USBIntHandler(void) __attribute__ ((interrupt("IRQ")));
+
+
+static const uint8_t abDescriptors[] = {
+
+// device descriptor
+	0x12,
+	DESC_DEVICE,
+	LE_WORD(0x0200),			// bcdUSB
+	DEVICE_CLASS,				// bDeviceClass, bDeviceSubClass, bDeviceProtocol
+	MAX_PACKET_SIZE0,			// bMaxPacketSize
+	LE_WORD(0xFFFF),			// idVendor
+	LE_WORD(0x0005),			// idProduct
+	LE_WORD(0x0100),			// bcdDevice
+	0x01,						// iManufacturer
+	0x02,						// iProduct
+	0x03,						// iSerialNumber
+	0x01,						// bNumConfigurations
+
+// configuration descriptor
+	0x09,
+	DESC_CONFIGURATION,
+	LE_WORD(9 + CDC_NUM_PORTS * CDC_PORT_DESC_SIZE),	// wTotalLength
+	2 * CDC_NUM_PORTS,			// bNumInterfaces
+	0x01,						// bConfigurationValue
+	0x00,						// iConfiguration
+	0xC0,						// bmAttributes
+	0x32,						// bMaxPower
+
+// control and data interfaces of each port
+	CDC_PORT_DESCRIPTORS(0)
+#if CDC_NUM_PORTS > 1
+	CDC_PORT_DESCRIPTORS(1)
+#endif
+#if CDC_NUM_PORTS > 2
+	CDC_PORT_DESCRIPTORS(2)
+#endif
+#if CDC_NUM_PORTS > 3
+	CDC_PORT_DESCRIPTORS(3)
+#endif
+
+	// string descriptors
+	0x04,
+	DESC_STRING,
+	LE_WORD(0x0409),
+
+	0x0E,
+	DESC_STRING,
+	'L', 0, 'P', 0, 'C', 0, 'U', 0, 'S', 0, 'B', 0,
+
+	0x14,
+	DESC_STRING,
+	'U', 0, 'S', 0, 'B', 0, 'S', 0, 'e', 0, 'r', 0, 'i', 0, 'a', 0, 'l', 0,
+
+	0x12,
+	DESC_STRING,
+	'D', 0, 'E', 0, 'A', 0, 'D', 0, 'C', 0, '0', 0, 'D', 0, 'E', 0,
+
+// terminating zero
+	0
+};
+
+
+/**
+	Interrupt handler
+
+	Simply calls the USB ISR, then signals end of interrupt to VIC
+ */
+static void USBIntHandler(void)
+{
+	USBHwISR();
+	VICVectAddr = 0x00;    // dummy write to VIC to signal end of ISR
+}
+
+
+/*************************************************************************
+	main
+	====
+**************************************************************************/
+int main(void)
+{
+	// PLL and MAM
+	HalSysInit();
+
+#ifndef BRIDGE_USES_CONSOLE_UART
+	// init DBG
+	ConsoleInit(BAUD_RATE);
+#endif
+
+	DBG("Initialising USB stack\n");
+
+	// initialise stack
+	USBInit();
+
+	// register descriptors
+	USBRegisterDescriptors(abDescriptors);
+
+	// register class request, endpoint, frame and device event handlers
+	CdcRegisterHandlers();
+
+	// initialise the ports
+	CdcInit();
+
+	// connect them to the UARTs, with the line coding from the host
+	CdcRegisterLineCodingHandler(BridgeSetLineCoding);
+	BridgeInit();
+
+	DBG("Starting USB communication\n");
+
+#ifdef LPC214x
+	(*(&VICVectCntl0+INT_VECT_NUM)) = 0x20 | 22; // choose highest priority ISR slot
+	(*(&VICVectAddr0+INT_VECT_NUM)) = (int)USBIntHandler;
+#else
+  VICVectCntl22 = 0x01;
+  VICVectAddr22 = (int)USBIntHandler;
+#endif
+
+	// set up USB interrupt
+	VICIntSelect &= ~(1<<22);               // select IRQ for USB
+	VICIntEnable |= (1<<22);
+
+	enableIRQ();
+
+	// connect to bus
+	USBHwConnect(true);
+
+	// move data between USB and UARTs (do USB and UART stuff in interrupt)
+	while (1) {
+		BridgePoll();
+#ifndef BRIDGE_USES_CONSOLE_UART
+		ConsolePoll();
+#endif
+	}
+
+	return 0;
+}
+
@@ -241,13 +241,8 @@ int main(void)
 	// PLL and MAM
 	HalSysInit();
 
-#ifdef LPC214x
 	// init DBG
-	ConsoleInit(60000000 / (16 * BAUD_RATE));
-#else
-	// init DBG
-	ConsoleInit(72000000 / (16 * BAUD_RATE));
-#endif
+	ConsoleInit(BAUD_RATE);
 
 	DBG("Initialising USB stack\n");
 	
@@ -269,9 +264,10 @@ int main(void)
 	// connect to bus
 	USBHwConnect(true);
 
-	// call USB interrupt handler continuously
+	// call USB interrupt handler continuously, and send console output
 	while (1) {
 		USBHwISR();
+		ConsolePoll();
 	}
 	
 	return 0;
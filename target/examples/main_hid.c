@@ -25,6 +25,20 @@
 	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+/*
+	HID example: a joystick, and a vendor defined report with a counter.
+
+	Both are input reports with their own report ID, queued by the HID
+	function in hid.c and sent at the polling rate of the host, once per
+	frame. The joystick position is updated far more often than the host
+	can collect it, so only its latest position is sent. The counter
+	reports are all sent, in order.
+
+	The host sets the counter with an output report, on the interrupt OUT
+	endpoint or with SET_REPORT, and reads and writes how often a counter
+	report is sent with a feature report.
+*/
+
 #include "debug.h"
 #include <stdint.h>
 #include <stdbool.h>
@@ -34,27 +48,28 @@
 #include "console.h"
 #include "usbapi.h"
 
-#define INTR_IN_EP		0x81
-
-#define MAX_PACKET_SIZE	64
+#include "hid.h"
 
 #define LE_WORD(x)		((x)&0xFF),((x)>>8)
 
-#define REPORT_SIZE			4
-
-static uint8_t	abClassReqData[4];
-static uint8_t	abReport[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07};
-static int	_iIdleRate = 0;
-static int	_iFrame = 0;
-
+#define REPORT_ID_JOYSTICK	1
+#define REPORT_ID_COUNTER	2
+#define REPORT_ID_SET_COUNTER	3
+#define REPORT_ID_PERIOD	4
+#define JOYSTICK_SIZE		4
+#define COUNTER_SIZE		4
+#define PERIOD_SIZE			1
 
+#define JOYSTICK_PERIOD_US	250		/**< the joystick is read four times per frame */
+#define COUNTER_PERIOD		8		/**< default joystick periods per counter report */
 
 // see the joystick example from the usb.org HID Descriptor Tool
-static uint8_t abReportDesc[] = {
+static const uint8_t abReportDesc[] = {
 	0x05, 0x01,
 	0x15, 0x00,
 	0x09, 0x04,
 	0xA1, 0x01,
+	0x85, REPORT_ID_JOYSTICK,
 	0x05, 0x02,
 	0x09, 0xBB,
 	0x15, 0x81,
@@ -89,6 +104,28 @@ static uint8_t abReportDesc[] = {
 	0x55, 0x00,
 	0x65, 0x00,
 	0x81, 0x02,
+	0xC0,
+
+	// vendor defined counter
+	0x06, 0x00, 0xFF,		// usage page (vendor defined)
+	0x09, 0x01,				// usage
+	0xA1, 0x01,				// collection (application)
+	0x85, REPORT_ID_COUNTER,
+	0x09, 0x02,				// usage
+	0x15, 0x00,				// logical minimum (0)
+	0x26, 0xFF, 0x00,		// logical maximum (255)
+	0x35, 0x00,				// physical minimum (0)
+	0x45, 0x00,				// physical maximum (0)
+	0x75, 0x08,				// report size (8)
+	0x95, COUNTER_SIZE,		// report count
+	0x81, 0x02,				// input (data, var, abs)
+	0x85, REPORT_ID_SET_COUNTER,
+	0x09, 0x03,				// usage
+	0x91, 0x02,				// output (data, var, abs)
+	0x85, REPORT_ID_PERIOD,
+	0x09, 0x04,				// usage
+	0x95, PERIOD_SIZE,		// report count
+	0xB1, 0x02,				// feature (data, var, abs)
 	0xC0
 };
 
@@ -114,40 +151,14 @@ static const uint8_t abDescriptors[] = {
 // configuration
 	0x09,
 	DESC_CONFIGURATION,
-	LE_WORD(0x22),  		// wTotalLength
+	LE_WORD(9 + HID_DESC_SIZE),	// wTotalLength
 	0x01,  					// bNumInterfaces
 	0x01,  					// bConfigurationValue
 	0x00,  					// iConfiguration
 	0x80,  					// bmAttributes
 	0x32,  					// bMaxPower
 
-// interface
-	0x09,   				
-	DESC_INTERFACE, 
-	0x00,  		 			// bInterfaceNumber
-	0x00,   				// bAlternateSetting
-	0x01,   				// bNumEndPoints
-	0x03,   				// bInterfaceClass = HID
-	0x00,   				// bInterfaceSubClass
-	0x00,   				// bInterfaceProtocol
-	0x00,   				// iInterface
-
-// HID descriptor
-	0x09, 
-	DESC_HID_HID, 			// bDescriptorType = HID
-	LE_WORD(0x0110),		// bcdHID
-	0x00,   				// bCountryCode
-	0x01,   				// bNumDescriptors = report
-	DESC_HID_REPORT,   		// bDescriptorType
-	LE_WORD(sizeof(abReportDesc)),
-
-// EP descriptor
-	0x07,   		
-	DESC_ENDPOINT,   		
-	INTR_IN_EP,				// bEndpointAddress
-	0x03,   				// bmAttributes = INT
-	LE_WORD(MAX_PACKET_SIZE),// wMaxPacketSize
-	10,						// bInterval   		
+	HID_DESCRIPTORS(sizeof(abReportDesc))
 
 // string descriptors
 	0x04,
@@ -174,93 +185,36 @@ static const uint8_t abDescriptors[] = {
 };
 
 
-/*************************************************************************
-	HandleClassRequest
-	==================
-		HID class request handler
-		
-**************************************************************************/
-static bool HandleClassRequest(TSetupPacket *pSetup, int *piLen, uint8_t **ppbData)
-{
-	uint8_t	*pbData = *ppbData;
+#define BAUD_RATE	115200
 
-	switch (pSetup->bRequest) {
-	
-   	// get_idle
-	case HID_GET_IDLE:
-		DBG("GET IDLE, val=%X, idx=%X\n", pSetup->wValue, pSetup->wIndex);
-		pbData[0] = (_iIdleRate / 4) & 0xFF;
-		*piLen = 1;
-		break;
-
-	// set_idle:
-	case HID_SET_IDLE:
-		DBG("SET IDLE, val=%X, idx=%X\n", pSetup->wValue, pSetup->wIndex);
-		_iIdleRate = ((pSetup->wValue >> 8) & 0xFF) * 4;
-		break;
-
-	default:
-		DBG("Unhandled class %X\n", pSetup->bRequest);
-		return false;
-	}
-	return true;
-}
+static volatile uint32_t	_dwCount = 0;
+static volatile int		_iCounterPeriod = COUNTER_PERIOD;
 
 
-#define BAUD_RATE	115200
+/**
+	Output report handler, sets the counter
+ */
+static void SetCounter(uint8_t bReportID, const uint8_t *pbData, int iLen)
+{
+	_dwCount = ((uint32_t)pbData[0] << 24) | ((uint32_t)pbData[1] << 16) | ((uint32_t)pbData[2] << 8) | pbData[3];
+}
 
 
-/*************************************************************************
-	HIDHandleStdReq
-	===============
-		Standard request handler for HID devices.
-		
-	This function tries to service any HID specific requests.
-		
-**************************************************************************/
-static bool HIDHandleStdReq(TSetupPacket *pSetup, int *piLen, uint8_t **ppbData)
+/**
+	Feature report handlers, for the joystick periods per counter report
+ */
+static void SetPeriod(uint8_t bReportID, const uint8_t *pbData, int iLen)
 {
-	uint8_t	bType, bIndex;
-
-	if ((pSetup->bmRequestType == 0x81) &&			// standard IN request for interface
-		(pSetup->bRequest == REQ_GET_DESCRIPTOR)) {	// get descriptor
-		
-		bType = GET_DESC_TYPE(pSetup->wValue);
-		bIndex = GET_DESC_INDEX(pSetup->wValue);
-		switch (bType) {
-
-		case DESC_HID_REPORT:
-			// report
-			*ppbData = abReportDesc;
-			*piLen = sizeof(abReportDesc);
-			break;
-
-		case DESC_HID_HID:
-		case DESC_HID_PHYSICAL:
-		default:
-		    // search descriptor space
-		    return USBGetDescriptor(pSetup->wValue, pSetup->wIndex, piLen, ppbData);
-		}
-		
-		return true;
+	if (pbData[0] != 0) {
+		_iCounterPeriod = pbData[0];
 	}
-	return false;
 }
 
 
-static void HandleFrame(uint16_t wFrame)
+static bool GetPeriod(uint8_t bReportID, uint8_t *pbData, int iLen)
 {
-	static int iCount;
-
-	_iFrame++;
-	if ((_iFrame > 1000)) {
-		// send report (dummy data)
-		abReport[0] = (iCount >> 8) & 0xFF;
-		abReport[1] = (iCount) & 0xFF;
-		iCount++;
-		USBHwEPWrite(INTR_IN_EP, abReport, REPORT_SIZE);
-		_iFrame = 0;
-	}
+	pbData[0] = _iCounterPeriod;
+	return true;
 }
 
 
@@ -270,16 +224,18 @@ static void HandleFrame(uint16_t wFrame)
 **************************************************************************/
 int main(void)
 {
+	uint8_t		abJoystick[JOYSTICK_SIZE], abCounter[COUNTER_SIZE];
+	uint32_t	dwNext;
+	int			iPeriod;
+
 	// PLL and MAM
 	HalSysInit();
 
-#ifdef LPC214x
-	// init DBG
-	ConsoleInit(60000000 / (16 * BAUD_RATE));
-#else
 	// init DBG
-	ConsoleInit(72000000 / (16 * BAUD_RATE));
-#endif
+	ConsoleInit(BAUD_RATE);
+
+	// time base of the reports
+	HalTimerInit();
 
 	DBG("Initialising USB stack\n");
 
@@ -289,26 +245,48 @@ int main(void)
 	// register device descriptors
 	USBRegisterDescriptors(abDescriptors);
 
-	// register HID standard request handler
-	USBRegisterCustomReqHandler(HIDHandleStdReq);
-
-	// register class request handler
-	USBRegisterRequestHandler(REQTYPE_TYPE_CLASS, HandleClassRequest, abClassReqData);
+	// register descriptor, class request, endpoint, frame and device event handlers
+	HidRegisterHandlers();
 
-	// register endpoint
-	USBHwRegisterEPIntHandler(INTR_IN_EP, NULL);
-
-	// register frame handler
-	USBHwRegisterFrameHandler(HandleFrame);
+	// initialise the HID function, with a report queue per report ID
+	HidInit(abReportDesc, sizeof(abReportDesc));
+	HidRegisterInputReport(REPORT_ID_JOYSTICK, JOYSTICK_SIZE, eHidCoalesce, 0);
+	HidRegisterInputReport(REPORT_ID_COUNTER, COUNTER_SIZE, eHidQueue, 0);
+	HidRegisterOutputReport(REPORT_ID_SET_COUNTER, COUNTER_SIZE, SetCounter);
+	HidRegisterFeatureReport(REPORT_ID_PERIOD, PERIOD_SIZE, SetPeriod, GetPeriod);
 
 	DBG("Starting USB communication\n");
 
 	// connect to bus
 	USBHwConnect(true);
 
-	// call USB interrupt handler continuously
+	// call USB interrupt handler continuously, send console output, handle
+	// output reports and queue input reports (dummy data)
+	dwNext = HalTimerGetUs();
+	iPeriod = 0;
 	while (1) {
 		USBHwISR();
+		ConsolePoll();
+		HidPoll();
+
+		if ((int32_t)(HalTimerGetUs() - dwNext) < 0) {
+			continue;
+		}
+		dwNext += JOYSTICK_PERIOD_US;
+		abJoystick[0] = iPeriod;
+		abJoystick[1] = iPeriod >> 2;
+		abJoystick[2] = iPeriod >> 4;
+		abJoystick[3] = 0;
+		HidSendReport(REPORT_ID_JOYSTICK, abJoystick, sizeof(abJoystick));
+		if ((++iPeriod % _iCounterPeriod) == 0) {
+			abCounter[0] = _dwCount >> 24;
+			abCounter[1] = _dwCount >> 16;
+			abCounter[2] = _dwCount >> 8;
+			abCounter[3] = _dwCount;
+			if (HidSendReport(REPORT_ID_COUNTER, abCounter, sizeof(abCounter))) {
+				_dwCount++;
+			}
+		}
 	}
 	
 	return 0;
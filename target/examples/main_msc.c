@@ -34,12 +34,16 @@
 #include "usbapi.h"
 
 #include "msc_bot.h"
+#include "msc_uas.h"
+#include "msc_scsi.h"
 #include "blockdev.h"
 
 #define BAUD_RATE	115200
 
 #define MAX_PACKET_SIZE	64
 
+#define DESC_PIPE_USAGE	0x24	/**< UAS pipe usage descriptor */
+
 #define LE_WORD(x)		((x)&0xFF),((x)>>8)
 
 
@@ -66,14 +70,14 @@ static const uint8_t abDescriptors[] = {
 // configuration descriptor
 	0x09,
 	DESC_CONFIGURATION,
-	LE_WORD(32),			// wTotalLength
+	LE_WORD(85),			// wTotalLength
 	0x01,					// bNumInterfaces
 	0x01,					// bConfigurationValue
 	0x00,					// iConfiguration
 	0xC0,					// bmAttributes
 	0x32,					// bMaxPower
 
-// interface
+// interface, alternate setting 0: bulk-only transport
 	0x09,
 	DESC_INTERFACE,
 	0x00,					// bInterfaceNumber
@@ -98,6 +102,61 @@ static const uint8_t abDescriptors[] = {
 	LE_WORD(MAX_PACKET_SIZE),// wMaxPacketSize
 	0x00,					// bInterval
 
+// interface, alternate setting 1: USB attached SCSI
+	0x09,
+	DESC_INTERFACE,
+	0x00,					// bInterfaceNumber
+	0x01,					// bAlternateSetting
+	0x04,					// bNumEndPoints
+	0x08,					// bInterfaceClass = mass storage
+	0x06,					// bInterfaceSubClass = transparent SCSI
+	0x62,					// bInterfaceProtocol = UAS
+	0x00,					// iInterface
+// EP
+	0x07,
+	DESC_ENDPOINT,
+	MSC_UAS_CMD_EP,			// bEndpointAddress
+	0x02,					// bmAttributes = bulk
+	LE_WORD(MAX_PACKET_SIZE),// wMaxPacketSize
+	0x00,					// bInterval
+	0x04,
+	DESC_PIPE_USAGE,
+	0x01,					// bPipeID = command
+	0x00,
+// EP
+	0x07,
+	DESC_ENDPOINT,
+	MSC_UAS_STATUS_EP,		// bEndpointAddress
+	0x02,					// bmAttributes = bulk
+	LE_WORD(MAX_PACKET_SIZE),// wMaxPacketSize
+	0x00,					// bInterval
+	0x04,
+	DESC_PIPE_USAGE,
+	0x02,					// bPipeID = status
+	0x00,
+// EP
+	0x07,
+	DESC_ENDPOINT,
+	MSC_UAS_DATA_IN_EP,		// bEndpointAddress
+	0x02,					// bmAttributes = bulk
+	LE_WORD(MAX_PACKET_SIZE),// wMaxPacketSize
+	0x00,					// bInterval
+	0x04,
+	DESC_PIPE_USAGE,
+	0x03,					// bPipeID = data-in
+	0x00,
+// EP
+	0x07,
+	DESC_ENDPOINT,
+	MSC_UAS_DATA_OUT_EP,	// bEndpointAddress
+	0x02,					// bmAttributes = bulk
+	LE_WORD(MAX_PACKET_SIZE),// wMaxPacketSize
+	0x00,					// bInterval
+	0x04,
+	DESC_PIPE_USAGE,
+	0x04,					// bPipeID = data-out
+	0x00,
+
 // string descriptors
 	0x04,
 	DESC_STRING,
@@ -141,7 +200,7 @@ static bool HandleClassRequest(TSetupPacket *pSetup, int *piLen, uint8_t **ppbDa
 
 	// get max LUN
 	case 0xFE:
-		*ppbData[0] = 0;		// No LUNs
+		*ppbData[0] = SCSIGetNumLUNs() - 1;
 		*piLen = 1;
 		break;
 
@@ -161,6 +220,31 @@ static bool HandleClassRequest(TSetupPacket *pSetup, int *piLen, uint8_t **ppbDa
 }
 
 
+/*************************************************************************
+	HandleSetInterface
+	==================
+		Switches between the bulk-only and UAS transports
+
+**************************************************************************/
+static void HandleSetInterface(uint8_t bInterface, uint8_t bAltSetting)
+{
+	if (bAltSetting == 1) {
+		DBG("Switching to UAS\n");
+		USBHwRegisterEPIntHandler(MSC_UAS_CMD_EP, MSCUasCommandOut);
+		USBHwRegisterEPIntHandler(MSC_UAS_STATUS_EP, MSCUasStatusIn);
+		USBHwRegisterEPIntHandler(MSC_UAS_DATA_IN_EP, MSCUasDataIn);
+		USBHwRegisterEPIntHandler(MSC_UAS_DATA_OUT_EP, MSCUasDataOut);
+		MSCUasReset();
+	}
+	else {
+		DBG("Switching to BOT\n");
+		USBHwRegisterEPIntHandler(MSC_BULK_IN_EP, MSCBotBulkIn);
+		USBHwRegisterEPIntHandler(MSC_BULK_OUT_EP, MSCBotBulkOut);
+		MSCBotReset();
+	}
+}
+
+
 /*************************************************************************
 	main
 	====
@@ -171,25 +255,29 @@ int main(void)
 	HalSysInit();
 
 	// init DBG
-	ConsoleInit(60000000 / (16 * BAUD_RATE));
+	ConsoleInit(BAUD_RATE);
 
-	// initialise the SD card
-	BlockDevInit();
+	// initialise the SD card and serve it as LUN 0
+	SCSIAddLUN(&BlockDevSD);
 
 	DBG("Initialising USB stack\n");
 
 	// initialise stack
 	USBInit();
 	
-	// enable bulk-in interrupts on NAKs
-	// these are required to get the BOT protocol going again after a STALL
-	USBHwNakIntEnable(INACK_BI);
+	// enable bulk interrupts on NAKs
+	// these are required to get the BOT protocol going again after a STALL,
+	// and to resume after the SD card has finished writing
+	USBHwNakIntEnable(INACK_BI | INACK_BO);
 
 	// register descriptors
 	USBRegisterDescriptors(abDescriptors);
 
 	// register class request handler
 	USBRegisterRequestHandler(REQTYPE_TYPE_CLASS, HandleClassRequest, abClassReqData);
+
+	// alternate setting 1 selects UAS
+	USBRegisterSetInterfaceHandler(HandleSetInterface);
 	
 	// register endpoint handlers
 	USBHwRegisterEPIntHandler(MSC_BULK_IN_EP, MSCBotBulkIn);
@@ -200,9 +288,10 @@ int main(void)
 	// connect to bus
 	USBHwConnect(true);
 
-	// call USB interrupt handler continuously
+	// call USB interrupt handler continuously, and send console output
 	while (1) {
 		USBHwISR();
+		ConsolePoll();
 	}
 	
 	return 0;
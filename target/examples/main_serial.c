@@ -30,6 +30,9 @@
 	This example application simply echoes everything it receives right back
 	to the host.
 
+	Build with -DCDC_NUM_PORTS=n for n ports (up to 4), each port echoes
+	its own data. The ports are served in turn, a packet at a time.
+
 	Windows:
 	Extract the usbser.sys file from .cab file in C:\WINDOWS\Driver Cache\i386
 	and store it somewhere (C:\temp is a good place) along with the usbser.inf
@@ -45,7 +48,6 @@
 */
 
 
-#include <string.h>			// memcpy
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -65,50 +67,24 @@
 #include "console.h"
 #include "usbapi.h"
 
-#include "serial_fifo.h"
+#include "cdc_acm.h"
 
 
 #define BAUD_RATE	115200
 
-#define INT_IN_EP		0x81
-#define BULK_OUT_EP		0x05
-#define BULK_IN_EP		0x82
-
 #define MAX_PACKET_SIZE	64
 
 #define LE_WORD(x)		((x)&0xFF),((x)>>8)
 
-// CDC definitions
-#define CS_INTERFACE			0x24
-#define CS_ENDPOINT				0x25
-
-#define	SET_LINE_CODING			0x20
-#define	GET_LINE_CODING			0x21
-#define	SET_CONTROL_LINE_STATE	0x22
-
 #define	INT_VECT_NUM	0
 
 #define IRQ_MASK 0x00000080
 
-// data structure for GET_LINE_CODING / SET_LINE_CODING class requests
-typedef struct {
-	uint32_t		dwDTERate;
-	uint8_t		bCharFormat;
-	uint8_t		bParityType;
-	uint8_t		bDataBits;
-} TLineCoding;
-
-static TLineCoding LineCoding = {115200, 0, 0, 8};
-static uint8_t abBulkBuf[64];
-static uint8_t abClassReqData[8];
-static volatile bool fBulkInBusy;
-static volatile bool fChainDone;
-
-static uint8_t txdata[VCOM_FIFO_SIZE];
-static uint8_t rxdata[VCOM_FIFO_SIZE];
-
-static fifo_t txfifo;
-static fifo_t rxfifo;
+#if CDC_NUM_PORTS > 1
+#define DEVICE_CLASS	0xEF, 0x02, 0x01	// miscellaneous, interface association
+#else
+#define DEVICE_CLASS	0x02, 0x00, 0x00	// communications
+#endif
 
 // forward declaration of interrupt handler
 static void USBIntHandler(void) __attribute__ ((interrupt("IRQ")));
@@ -119,10 +95,8 @@ static const uint8_t abDescriptors[] = {
 // device descriptor
 	0x12,
 	DESC_DEVICE,
-	LE_WORD(0x0101),			// bcdUSB
-	0x02,						// bDeviceClass
-	0x00,						// bDeviceSubClass
-	0x00,						// bDeviceProtocol
+	LE_WORD(0x0200),			// bcdUSB
+	DEVICE_CLASS,				// bDeviceClass, bDeviceSubClass, bDeviceProtocol
 	MAX_PACKET_SIZE0,			// bMaxPacketSize
 	LE_WORD(0xFFFF),			// idVendor
 	LE_WORD(0x0005),			// idProduct
@@ -135,75 +109,24 @@ static const uint8_t abDescriptors[] = {
 // configuration descriptor
 	0x09,
 	DESC_CONFIGURATION,
-	LE_WORD(67),				// wTotalLength
-	0x02,						// bNumInterfaces
+	LE_WORD(9 + CDC_NUM_PORTS * CDC_PORT_DESC_SIZE),	// wTotalLength
+	2 * CDC_NUM_PORTS,			// bNumInterfaces
 	0x01,						// bConfigurationValue
 	0x00,						// iConfiguration
 	0xC0,						// bmAttributes
 	0x32,						// bMaxPower
-// control class interface
-	0x09,
-	DESC_INTERFACE,
-	0x00,						// bInterfaceNumber
-	0x00,						// bAlternateSetting
-	0x01,						// bNumEndPoints
-	0x02,						// bInterfaceClass
-	0x02,						// bInterfaceSubClass
-	0x01,						// bInterfaceProtocol, linux requires value of 1 for the cdc_acm module
-	0x00,						// iInterface
-// header functional descriptor
-	0x05,
-	CS_INTERFACE,
-	0x00,
-	LE_WORD(0x0110),
-// call management functional descriptor
-	0x05,
-	CS_INTERFACE,
-	0x01,
-	0x01,						// bmCapabilities = device handles call management
-	0x01,						// bDataInterface
-// ACM functional descriptor
-	0x04,
-	CS_INTERFACE,
-	0x02,
-	0x02,						// bmCapabilities
-// union functional descriptor
-	0x05,
-	CS_INTERFACE,
-	0x06,
-	0x00,						// bMasterInterface
-	0x01,						// bSlaveInterface0
-// notification EP
-	0x07,
-	DESC_ENDPOINT,
-	INT_IN_EP,					// bEndpointAddress
-	0x03,						// bmAttributes = intr
-	LE_WORD(8),					// wMaxPacketSize
-	0x0A,						// bInterval
-// data class interface descriptor
-	0x09,
-	DESC_INTERFACE,
-	0x01,						// bInterfaceNumber
-	0x00,						// bAlternateSetting
-	0x02,						// bNumEndPoints
-	0x0A,						// bInterfaceClass = data
-	0x00,						// bInterfaceSubClass
-	0x00,						// bInterfaceProtocol
-	0x00,						// iInterface
-// data EP OUT
-	0x07,
-	DESC_ENDPOINT,
-	BULK_OUT_EP,				// bEndpointAddress
-	0x02,						// bmAttributes = bulk
-	LE_WORD(MAX_PACKET_SIZE),	// wMaxPacketSize
-	0x00,						// bInterval
-// data EP in
-	0x07,
-	DESC_ENDPOINT,
-	BULK_IN_EP,					// bEndpointAddress
-	0x02,						// bmAttributes = bulk
-	LE_WORD(MAX_PACKET_SIZE),	// wMaxPacketSize
-	0x00,						// bInterval
+
+// control and data interfaces of each port
+	CDC_PORT_DESCRIPTORS(0)
+#if CDC_NUM_PORTS > 1
+	CDC_PORT_DESCRIPTORS(1)
+#endif
+#if CDC_NUM_PORTS > 2
+	CDC_PORT_DESCRIPTORS(2)
+#endif
+#if CDC_NUM_PORTS > 3
+	CDC_PORT_DESCRIPTORS(3)
+#endif
 
 	// string descriptors
 	0x04,
@@ -227,168 +150,6 @@ static const uint8_t abDescriptors[] = {
 };
 
 
-/**
-	Local function to handle incoming bulk data
-
-	@param [in] bEP
-	@param [in] bEPStatus
- */
-static void BulkOut(uint8_t bEP, uint8_t bEPStatus)
-{
-	int i, iLen;
-
-	if (fifo_free(&rxfifo) < MAX_PACKET_SIZE) {
-		// may not fit into fifo
-		return;
-	}
-
-	// get data from USB into intermediate buffer
-	iLen = USBHwEPRead(bEP, abBulkBuf, sizeof(abBulkBuf));
-	for (i = 0; i < iLen; i++) {
-		// put into FIFO
-		if (!fifo_put(&rxfifo, abBulkBuf[i])) {
-			// overflow... :(
-			ASSERT(false);
-			break;
-		}
-	}
-}
-
-
-/**
-	Sends the next packet in chain of packets to the host
-
-	@param [in] bEP
-	@param [in] bEPStatus
- */
-static void SendNextBulkIn(uint8_t bEP, bool fFirstPacket)
-{
-	int iLen;
-
-	// this transfer is done
-	fBulkInBusy = false;
-
-	// first packet?
-	if (fFirstPacket) {
-		fChainDone = false;
-	}
-
-	// last packet?
-	if (fChainDone) {
-		return;
-	}
-
-	// get up to MAX_PACKET_SIZE bytes from transmit FIFO into intermediate buffer
-	for (iLen = 0; iLen < MAX_PACKET_SIZE; iLen++) {
-		if (!fifo_get(&txfifo, &abBulkBuf[iLen])) {
-			break;
-		}
-	}
-
-	// send over USB
-	USBHwEPWrite(bEP, abBulkBuf, iLen);
-	fBulkInBusy = true;
-
-	// was this a short packet?
-	if (iLen < MAX_PACKET_SIZE) {
-		fChainDone = true;
-	}
-}
-
-
-/**
-	Local function to handle outgoing bulk data
-
-	@param [in] bEP
-	@param [in] bEPStatus
- */
-static void BulkIn(uint8_t bEP, uint8_t bEPStatus)
-{
-	SendNextBulkIn(bEP, false);
-}
-
-
-/**
-	Local function to handle the USB-CDC class requests
-
-	@param [in] pSetup
-	@param [out] piLen
-	@param [out] ppbData
- */
-static bool HandleClassRequest(TSetupPacket *pSetup, int *piLen, uint8_t **ppbData)
-{
-	switch (pSetup->bRequest) {
-
-	// set line coding
-	case SET_LINE_CODING:
-DBG("SET_LINE_CODING\n");
-		memcpy((uint8_t *)&LineCoding, *ppbData, 7);
-		*piLen = 7;
-DBG("dwDTERate=%u, bCharFormat=%u, bParityType=%u, bDataBits=%u\n",
-	LineCoding.dwDTERate,
-	LineCoding.bCharFormat,
-	LineCoding.bParityType,
-	LineCoding.bDataBits);
-		break;
-
-	// get line coding
-	case GET_LINE_CODING:
-DBG("GET_LINE_CODING\n");
-		*ppbData = (uint8_t *)&LineCoding;
-		*piLen = 7;
-		break;
-
-	// set control line state
-	case SET_CONTROL_LINE_STATE:
-		// bit0 = DTR, bit = RTS
-DBG("SET_CONTROL_LINE_STATE %X\n", pSetup->wValue);
-		break;
-
-	default:
-		return false;
-	}
-	return true;
-}
-
-
-/**
-	Initialises the VCOM port.
-	Call this function before using VCOM_putchar or VCOM_getchar
- */
-void VCOM_init(void)
-{
-	fifo_init(&txfifo, txdata);
-	fifo_init(&rxfifo, rxdata);
-	fBulkInBusy = false;
-	fChainDone = true;
-}
-
-
-/**
-	Writes one character to VCOM port
-
-	@param [in] c character to write
-	@returns character written, or EOF if character could not be written
- */
-int VCOM_putchar(int c)
-{
-	return fifo_put(&txfifo, c) ? c : EOF;
-}
-
-
-/**
-	Reads one character from VCOM port
-
-	@returns character read, or EOF if character could not be read
- */
-int VCOM_getchar(void)
-{
-	uint8_t c;
-
-	return fifo_get(&rxfifo, &c) ? c : EOF;
-}
-
-
 /**
 	Interrupt handler
 
@@ -400,38 +161,6 @@ static void USBIntHandler(void)
 	VICVectAddr = 0x00;    // dummy write to VIC to signal end of ISR
 }
 
-/**
-	USB frame interrupt handler
-
-	Called every milisecond by the hardware driver.
-
-	This function is responsible for sending the first of a chain of packets
-	to the host. A chain is always terminated by a short packet, either a
-	packet shorter than the maximum packet size or a zero-length packet
-	(as required by the windows usbser.sys driver).
-
- */
-static void USBFrameHandler(uint16_t wFrame)
-{
-	if (!fBulkInBusy && (fifo_avail(&txfifo) != 0)) {
-		// send first packet
-		SendNextBulkIn(BULK_IN_EP, true);
-	}
-}
-
-
-/**
-	USB device status handler
-
-	Resets state machine when a USB reset is received.
- */
-static void USBDevIntHandler(uint8_t bDevStatus)
-{
-	if ((bDevStatus & DEV_STATUS_RESET) != 0) {
-		fBulkInBusy = false;
-	}
-}
-
 
 /*************************************************************************
 	main
@@ -439,18 +168,15 @@ static void USBDevIntHandler(uint8_t bDevStatus)
 **************************************************************************/
 int main(void)
 {
-	int c;
+	uint8_t abBuf[MAX_PACKET_SIZE];
+	int i, iPort, iLen;
+	uint8_t c;
 
 	// PLL and MAM
 	HalSysInit();
 
-#ifdef LPC214x
 	// init DBG
-	ConsoleInit(60000000 / (16 * BAUD_RATE));
-#else
-	// init DBG
-	ConsoleInit(72000000 / (16 * BAUD_RATE));
-#endif
+	ConsoleInit(BAUD_RATE);
 
 	DBG("Initialising USB stack\n");
 
@@ -460,22 +186,11 @@ int main(void)
 	// register descriptors
 	USBRegisterDescriptors(abDescriptors);
 
-	// register class request handler
-	USBRegisterRequestHandler(REQTYPE_TYPE_CLASS, HandleClassRequest, abClassReqData);
-
-	// register endpoint handlers
-	USBHwRegisterEPIntHandler(INT_IN_EP, NULL);
-	USBHwRegisterEPIntHandler(BULK_IN_EP, BulkIn);
-	USBHwRegisterEPIntHandler(BULK_OUT_EP, BulkOut);
-
-	// register frame handler
-	USBHwRegisterFrameHandler(USBFrameHandler);
-
-	// register device event handler
-	USBHwRegisterDevIntHandler(USBDevIntHandler);
+	// register class request, endpoint, frame and device event handlers
+	CdcRegisterHandlers();
 
-	// initialise VCOM
-	VCOM_init();
+	// initialise the ports
+	CdcInit();
 
 	DBG("Starting USB communication\n");
 
@@ -496,19 +211,28 @@ int main(void)
 	// connect to bus
 	USBHwConnect(true);
 
-	// echo any character received (do USB stuff in interrupt)
+	// echo any character received (do USB stuff in interrupt), at most
+	// a packet per port in turn, and no more than fits in the echo
 	while (1) {
-		c = VCOM_getchar();
-		if (c != EOF) {
-			// show on console
-			if ((c == 9) || (c == 10) || (c == 13) || ((c >= 32) && (c <= 126))) {
-				DBG("%c", c);
+		for (iPort = 0; iPort < CDC_NUM_PORTS; iPort++) {
+			iLen = CdcTxFree(iPort);
+			if (iLen > MAX_PACKET_SIZE) {
+				iLen = MAX_PACKET_SIZE;
 			}
-			else {
-				DBG(".");
+			iLen = CdcRead(iPort, abBuf, iLen);
+			for (i = 0; i < iLen; i++) {
+				// show on console
+				c = abBuf[i];
+				if ((c == 9) || (c == 10) || (c == 13) || ((c >= 32) && (c <= 126))) {
+					DBG("%c", c);
+				}
+				else {
+					DBG(".");
+				}
 			}
-			VCOM_putchar(c);
+			CdcWrite(iPort, abBuf, iLen);
 		}
+		ConsolePoll();
 	}
 
 	return 0;
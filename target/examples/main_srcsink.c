@@ -0,0 +1,249 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	This is a test function like gadget zero on Linux, to measure bulk
+	throughput and to check data integrity of the USB hardware layer.
+
+	In source/sink mode, the device sends a pattern stream on BULK_IN_EP
+	and checks the data it receives on BULK_OUT_EP against the same
+	pattern. In loopback mode, data received on BULK_OUT_EP is checked
+	and sent back on BULK_IN_EP.
+
+	Vendor requests select the mode and pattern and read the byte and
+	error counters, see srcsink.h.
+
+	For latency measurements, the interrupt endpoints and echo mode on the
+	bulk endpoints send packets straight back, stamped with frame numbers.
+
+	Alternate setting 1 adds isoc IN and OUT endpoints that stream
+	sequence-stamped packets, one per frame.
+*/
+
+#include "debug.h"
+#include <stdbool.h>
+
+#include "hal.h"
+#include "console.h"
+#include "usbapi.h"
+#include "usbtrace.h"
+
+#include "srcsink.h"
+
+
+#define MAX_PACKET_SIZE	64
+
+#define LE_WORD(x)		((x)&0xFF),((x)>>8)
+
+
+static const uint8_t abDescriptors[] = {
+
+/* Device descriptor */
+	0x12,              		
+	DESC_DEVICE,       		
+	LE_WORD(0x0200),		// bcdUSB	
+	0xFF,              		// bDeviceClass
+	0x00,              		// bDeviceSubClass
+	0x00,              		// bDeviceProtocol
+	MAX_PACKET_SIZE0,  		// bMaxPacketSize
+	LE_WORD(0xFFFF),		// idVendor
+	LE_WORD(0x0006),		// idProduct
+	LE_WORD(0x0100),		// bcdDevice
+	0x01,              		// iManufacturer
+	0x02,              		// iProduct
+	0x03,              		// iSerialNumber
+	0x01,              		// bNumConfigurations
+
+// configuration
+	0x09,
+	DESC_CONFIGURATION,
+	LE_WORD(0x45),  		// wTotalLength
+	0x01,  					// bNumInterfaces
+	0x01,  					// bConfigurationValue
+	0x00,  					// iConfiguration
+	0x80,  					// bmAttributes
+	0x32,  					// bMaxPower
+
+// interface
+	0x09,   				
+	DESC_INTERFACE, 
+	0x00,  		 			// bInterfaceNumber
+	0x00,   				// bAlternateSetting
+	0x04,   				// bNumEndPoints
+	0xFF,   				// bInterfaceClass
+	0x00,   				// bInterfaceSubClass
+	0x00,   				// bInterfaceProtocol
+	0x00,   				// iInterface
+
+// bulk in
+	0x07,   		
+	DESC_ENDPOINT,   		
+	SRCSINK_IN_EP,			// bEndpointAddress
+	0x02,   				// bmAttributes = BULK
+	LE_WORD(MAX_PACKET_SIZE),// wMaxPacketSize
+	0,						// bInterval   		
+
+// bulk out
+	0x07,   		
+	DESC_ENDPOINT,   		
+	SRCSINK_OUT_EP,			// bEndpointAddress
+	0x02,   				// bmAttributes = BULK
+	LE_WORD(MAX_PACKET_SIZE),// wMaxPacketSize
+	0,						// bInterval   		
+
+// interrupt in
+	0x07,
+	DESC_ENDPOINT,
+	SRCSINK_INT_IN_EP,		// bEndpointAddress
+	0x03,   				// bmAttributes = INT
+	LE_WORD(MAX_PACKET_SIZE),// wMaxPacketSize
+	1,						// bInterval
+
+// interrupt out
+	0x07,
+	DESC_ENDPOINT,
+	SRCSINK_INT_OUT_EP,		// bEndpointAddress
+	0x03,   				// bmAttributes = INT
+	LE_WORD(MAX_PACKET_SIZE),// wMaxPacketSize
+	1,						// bInterval
+
+// interface, alternate setting 1
+	0x09,
+	DESC_INTERFACE,
+	0x00,  		 			// bInterfaceNumber
+	0x01,   				// bAlternateSetting
+	0x02,   				// bNumEndPoints
+	0xFF,   				// bInterfaceClass
+	0x00,   				// bInterfaceSubClass
+	0x00,   				// bInterfaceProtocol
+	0x00,   				// iInterface
+
+// isoc in
+	0x07,
+	DESC_ENDPOINT,
+	SRCSINK_ISOC_IN_EP,		// bEndpointAddress
+	0x0D,   				// bmAttributes = isoc, synchronous, data
+	LE_WORD(SRCSINK_ISOC_MAX_PACKET),// wMaxPacketSize
+	1,						// bInterval
+
+// isoc out
+	0x07,
+	DESC_ENDPOINT,
+	SRCSINK_ISOC_OUT_EP,	// bEndpointAddress
+	0x0D,   				// bmAttributes = isoc, synchronous, data
+	LE_WORD(SRCSINK_ISOC_MAX_PACKET),// wMaxPacketSize
+	1,						// bInterval
+
+// string descriptors
+	0x04,
+	DESC_STRING,
+	LE_WORD(0x0409),
+
+	// manufacturer string
+	0x0E,
+	DESC_STRING,
+	'L', 0, 'P', 0, 'C', 0, 'U', 0, 'S', 0, 'B', 0,
+
+	// product string
+	0x16,
+	DESC_STRING,
+	'S', 0, 'o', 0, 'u', 0, 'r', 0, 'c', 0, 'e', 0, 'S', 0, 'i', 0, 'n', 0, 'k', 0,
+
+	// serial number string
+	0x12,
+	DESC_STRING,
+	'D', 0, 'E', 0, 'A', 0, 'D', 0, 'C', 0, '0', 0, 'D', 0, 'E', 0,
+	
+	// terminator
+	0
+};
+
+
+static uint8_t	abVendorReqData[SRCSINK_REQ_DATA_SIZE];
+
+
+#define BAUD_RATE	115200
+
+
+/*************************************************************************
+	main
+	====
+**************************************************************************/
+int main(void)
+{
+	// PLL and MAM
+	HalSysInit();
+
+	// init DBG
+	ConsoleInit(BAUD_RATE);
+
+	DBG("Initialising USB stack\n");
+	
+	// time stamps for the trace, if the stack is built with USB_TRACE
+	HalTimerInit();
+	USBTraceInit(HalTimerGetUs);
+
+	// initialise stack
+	USBInit();
+	
+	// register device descriptors
+	USBRegisterDescriptors(abDescriptors);
+
+	// register vendor request handler
+	USBRegisterRequestHandler(REQTYPE_TYPE_VENDOR, SrcSinkHandleRequest, abVendorReqData);
+
+	// register endpoints
+	USBHwRegisterEPIntHandler(SRCSINK_IN_EP, SrcSinkBulkIn);
+	USBHwRegisterEPIntHandler(SRCSINK_OUT_EP, SrcSinkBulkOut);
+	USBHwRegisterEPIntHandler(SRCSINK_INT_IN_EP, SrcSinkIntEcho);
+	USBHwRegisterEPIntHandler(SRCSINK_INT_OUT_EP, SrcSinkIntEcho);
+
+	// alternate setting 1 starts the isoc streams
+	USBRegisterSetInterfaceHandler(SrcSinkSetInterface);
+
+	// frame numbers for the echo time stamps, isoc endpoints
+	USBHwRegisterFrameHandler(SrcSinkFrame);
+
+	// start the IN stream on the first poll of the host
+	USBHwNakIntEnable(INACK_BI);
+
+	SrcSinkInit();
+
+	DBG("Starting USB communication\n");
+
+	// connect to bus
+	USBHwConnect(true);
+
+	// call USB interrupt handler continuously, and send console output
+	while (1) {
+		USBHwISR();
+		ConsolePoll();
+	}
+	
+	return 0;
+}
+
@@ -31,6 +31,20 @@
 
 	This layers sits between the generic USB layers and the SCSI layer
 	and performs data transfer according to the BOT protocol.
+
+	Data for the host is written to the bulk IN endpoint as long as it has
+	a free buffer, so both buffers of the double-buffered endpoint stay
+	full for the whole data phase. Packets are as large as the endpoint was
+	configured for.
+
+	Data from the host is read straight into the SCSI buffer, which is
+	handed to the SCSI layer when it is full. Only that hand-off waits for
+	the medium, so the next buffer fills up while the medium is busy with
+	the previous one. When the buffer is full and the medium is still
+	busy, received data is left in the bulk OUT endpoint buffers and the
+	CSW is held back, so the host sees NAKs instead of the device spinning
+	in an endpoint handler. The NAK interrupts on both bulk endpoints are
+	used to check again.
 */
 
 #include <string.h>
@@ -44,6 +58,7 @@
 
 #include "msc_bot.h"
 #include "msc_scsi.h"
+#include "msc_data.h"
 
 
 /** Command block wrapper structure */
@@ -75,9 +90,6 @@ typedef enum {
 } EBotState;
 
 #define MAX(x,y)       ((x)>(y)?(x):(y))       /**< MAX */
-#ifndef MIN
-#define MIN(a,b)	((a)<(b)?(a):(b))
-#endif
 
 #define CBW_SIGNATURE	0x43425355		/**< magic word in CBW */
 #define CSW_SIGNATURE	0x53425355		/**< magic word in CSW */
@@ -86,16 +98,13 @@ typedef enum {
 #define STATUS_FAILED		0x01		/**< failed transfer */
 #define STATUS_PHASE_ERR	0x02		/**< conflict between host and device */
 
-static uint32_t			dwTransferSize;		/**< total size of data transfer */
-static uint32_t			dwOffset;			/**< offset in current data transfer */
+static TMscData		Data;
 
 static TCBW			CBW;
 static TCSW			CSW;
 
 static EBotState	eState;
 
-static uint8_t			*pbData;
-
 
 
 /**
@@ -120,7 +129,7 @@ static void SendCSW(uint8_t bStatus)
 {
 	int iResidue;
 
-	iResidue = CBW.dwCBWDataTransferLength - dwTransferSize;
+	iResidue = CBW.dwCBWDataTransferLength - Data.dwTransferSize;
 
 	// construct CSW
 	CSW.dwCSWSignature		= CSW_SIGNATURE;
@@ -156,7 +165,7 @@ static bool CheckCBW(TCBW *pCBW, int iLen)
 	}
 
 	// CBW meaningful?
-	if (pCBW->bCBWLun != 0) {
+	if (pCBW->bCBWLun >= SCSIGetNumLUNs()) {
 		DBG("Invalid LUN %d\n", pCBW->bCBWLun);
 		return false;
 	}
@@ -190,75 +199,48 @@ static void BOTStall(void)
 }
 
 
-/*************************************************************************
-	HandleDataIn
-	============
-		Handles data from device-to-host
+/**
+	Local function to end the data phase with a CSW
 
-**************************************************************************/
-static void HandleDataIn(void)
+	@param [in]	eStatus	How the data phase ended
+ */
+static void DataDone(EMscDataStatus eStatus)
 {
-	int iChunk;
+	switch (eStatus) {
 
-	// process data for host in SCSI layer
-	pbData = SCSIHandleData(CBW.CBWCB, CBW.bCBWCBLength, pbData, dwOffset);
-	if (pbData == NULL) {
-		BOTStall();
-		SendCSW(STATUS_FAILED);
-		return;
-	}
-
-	// send data to host?
-	if (dwOffset < dwTransferSize) {
-		iChunk = MIN(64, dwTransferSize - dwOffset);
-		USBHwEPWrite(MSC_BULK_IN_EP, pbData, iChunk);
-		dwOffset += iChunk;
-	}
-
-	// are we done now?
-	if (dwOffset == dwTransferSize) {
-		if (dwOffset != CBW.dwCBWDataTransferLength) {
+	case eMscDataPassed:
+		if (Data.dwOffset != CBW.dwCBWDataTransferLength) {
 			// stall pipe
-			DBG("stalling DIN");
+			DBG("stalling %s", (Data.bEP & 0x80) ? "DIN" : "DOUT");
 			BOTStall();
 		}
-		// done
 		SendCSW(STATUS_PASSED);
-	}
-}
-
-
-/*************************************************************************
-	HandleDataOut
-	=============
-		Handles data from host-to-device
+		break;
 
-**************************************************************************/
-static void HandleDataOut(void)
-{
-	int iChunk;
-
-	if (dwOffset < dwTransferSize) {
-		// get data from host
-		iChunk = USBHwEPRead(MSC_BULK_OUT_EP, pbData, dwTransferSize - dwOffset);
-		// process data in SCSI layer
-		pbData = SCSIHandleData(CBW.CBWCB, CBW.bCBWCBLength, pbData, dwOffset);
-		if (pbData == NULL) {
+	case eMscDataFailed:
+		if ((Data.bEP & 0x80) || (Data.dwOffset < CBW.dwCBWDataTransferLength)) {
+			// stop data-in, or refuse the rest of the data
 			BOTStall();
-			SendCSW(STATUS_FAILED);
-			return;
 		}
-		dwOffset += iChunk;
+		SendCSW(STATUS_FAILED);
+		break;
+
+	default:
+		SendCSW(STATUS_PHASE_ERR);
+		break;
 	}
+}
 
-	// are we done now?
-	if (dwOffset == dwTransferSize) {
-		if (dwOffset != CBW.dwCBWDataTransferLength) {
-			// stall pipe
-			DBG("stalling DOUT");
-			BOTStall();
-		}
-		SendCSW(STATUS_PASSED);
+
+/**
+	Local function to move received packets to the SCSI layer, for as long
+	as it can take them. Packets stay in the endpoint buffers while the
+	medium is busy and the SCSI buffer is full, making the host retry.
+ */
+static void ProcessDataOut(void)
+{
+	while ((eState == eDataOut) && MSCDataOutStep(&Data)) {
+		// next step
 	}
 }
 
@@ -274,6 +256,7 @@ void MSCBotBulkOut(uint8_t bEP, uint8_t bEPStatus)
 {
 	int 	iLen, iChunk;
 	bool	fHostIn, fDevIn;
+	uint8_t	*pbBuf;
 
 	// ignore events on stalled EP
 	if (bEPStatus & EP_STATUS_STALLED) {
@@ -297,13 +280,12 @@ void MSCBotBulkOut(uint8_t bEP, uint8_t bEPStatus)
 		DBG("CBW: len=%d, flags=%x, cmd=%x, cmdlen=%d\n",
 			CBW.dwCBWDataTransferLength, CBW.bmCBWFlags, CBW.CBWCB[0], CBW.bCBWCBLength);
 
-		dwOffset = 0;
-		dwTransferSize = 0;
+		MSCDataInit(&Data, CBW.bCBWLun, CBW.CBWCB, CBW.bCBWCBLength);
 		fHostIn = ((CBW.bmCBWFlags & 0x80) != 0);
 
 		// verify request
-		pbData = SCSIHandleCmd(CBW.CBWCB, CBW.bCBWCBLength, &iLen, &fDevIn);
-		if (pbData == NULL) {
+		pbBuf = SCSIHandleCmd(CBW.bCBWLun, CBW.CBWCB, CBW.bCBWCBLength, &iLen, &fDevIn);
+		if (pbBuf == NULL) {
 			// unknown command
 			BOTStall();
 			SendCSW(STATUS_FAILED);
@@ -328,20 +310,21 @@ void MSCBotBulkOut(uint8_t bEP, uint8_t bEPStatus)
 			break;
 		}
 
-		dwTransferSize = iLen;
-		if ((dwTransferSize == 0) || fDevIn) {
+		if ((iLen == 0) || fDevIn) {
 			// data from device-to-host
+			MSCDataStart(&Data, pbBuf, iLen, MSC_BULK_IN_EP, DataDone);
 			eState = eDataIn;
-			HandleDataIn();
+			MSCDataIn(&Data);
 		}
 		else {
 			// data from host-to-device
+			MSCDataStart(&Data, pbBuf, iLen, MSC_BULK_OUT_EP, DataDone);
 			eState = eDataOut;
 		}
 		break;
 
 	case eDataOut:
-		HandleDataOut();
+		ProcessDataOut();
 		break;
 
 	case eDataIn:
@@ -381,16 +364,23 @@ void MSCBotBulkIn(uint8_t bEP, uint8_t bEPStatus)
 	switch (eState) {
 
 	case eCBW:
-	case eDataOut:
 		// ignore possibly old ACKs
 		break;
 
+	case eDataOut:
+		// host is already polling for the CSW, pass on the data it left
+		ProcessDataOut();
+		break;
+
 	case eDataIn:
-		HandleDataIn();
+		MSCDataIn(&Data);
 		break;
 
 	case eCSW:
-		// wait for an IN token, then send the CSW
+		// wait for an IN token and the medium, then send the CSW
+		if (SCSIBusy(CBW.bCBWLun)) {
+			break;
+		}
 		USBHwEPWrite(MSC_BULK_IN_EP, (uint8_t *)&CSW, 13);
 		eState = eCBW;
 		break;
@@ -0,0 +1,186 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**	@file
+
+	Data phase of the mass storage transports.
+
+	Both msc_bot.c and msc_uas.c move data between a bulk endpoint and
+	the block buffer of the SCSI layer the same way, this file does it for
+	them. Packets never cross a block buffer boundary, and each buffer goes
+	to the SCSI layer once it is complete. Received packets stay in the
+	endpoint while the medium is busy, so the host gets NAKs instead of
+	the device spinning. The transport only passes the data endpoint and
+	a callback that reports the status in its own way.
+*/
+
+#include "debug.h"
+
+#include "usbapi.h"
+
+#include "msc_scsi.h"
+#include "msc_data.h"
+
+#ifndef MIN
+#define MIN(a,b)	((a)<(b)?(a):(b))
+#endif
+
+
+/**
+	Sets up the data phase of a new command, with no data yet
+
+	@param [out] pData
+	@param [in]	bLUN	Logical unit of the command
+	@param [in]	pbCDB	Command block
+	@param [in]	bCDBLen	Command block length
+ */
+void MSCDataInit(TMscData *pData, uint8_t bLUN, uint8_t *pbCDB, uint8_t bCDBLen)
+{
+	pData->bLUN = bLUN;
+	pData->pbCDB = pbCDB;
+	pData->bCDBLen = bCDBLen;
+	pData->dwTransferSize = 0;
+	pData->dwOffset = 0;
+	pData->dwBufStart = 0;
+}
+
+
+/**
+	Starts the data phase, once the transport has accepted the command
+
+	@param [in,out] pData
+	@param [in]	pbBuf	Block buffer returned by SCSIHandleCmd
+	@param [in]	dwLen	Number of bytes to move, 0 for commands without data
+	@param [in]	bEP		Data endpoint, an IN endpoint if dwLen is 0
+	@param [in]	pfnDone	Called when the data phase ends
+ */
+void MSCDataStart(TMscData *pData, uint8_t *pbBuf, uint32_t dwLen, uint8_t bEP, TFnMscDataDone *pfnDone)
+{
+	pData->pbData = pbBuf;
+	pData->dwTransferSize = dwLen;
+	pData->dwOffset = 0;
+	pData->dwBufStart = 0;
+	pData->bEP = bEP;
+	pData->iPacketSize = USBHwEPGetMaxPacketSize(bEP);
+	pData->pfnDone = pfnDone;
+}
+
+
+/**
+	Sends data to the host while there is room in the IN endpoint.
+	A command without data is executed right away.
+
+	@param [in,out] pData
+ */
+void MSCDataIn(TMscData *pData)
+{
+	int iChunk;
+
+	// process command without data in SCSI layer
+	if ((pData->dwTransferSize == 0) &&
+		(SCSIHandleData(pData->bLUN, pData->pbCDB, pData->bCDBLen, pData->pbData, 0) == NULL)) {
+		pData->pfnDone(eMscDataFailed);
+		return;
+	}
+
+	while ((pData->dwOffset < pData->dwTransferSize) &&
+			((USBHwEPGetStatus(pData->bEP) & EP_STATUS_DATA) == 0)) {
+		// process next buffer of data for host in SCSI layer
+		if ((pData->dwOffset % BLOCKSIZE) == 0) {
+			pData->pbData = SCSIHandleData(pData->bLUN, pData->pbCDB, pData->bCDBLen,
+										pData->pbData, pData->dwOffset);
+			if (pData->pbData == NULL) {
+				pData->pfnDone(eMscDataFailed);
+				return;
+			}
+		}
+		// packets do not cross a buffer boundary
+		iChunk = MIN((uint32_t)pData->iPacketSize, pData->dwTransferSize - pData->dwOffset);
+		iChunk = MIN((uint32_t)iChunk, BLOCKSIZE - (pData->dwOffset % BLOCKSIZE));
+		USBHwEPWrite(pData->bEP, pData->pbData, iChunk);
+		pData->pbData += iChunk;
+		pData->dwOffset += iChunk;
+	}
+
+	if (pData->dwOffset == pData->dwTransferSize) {
+		pData->pfnDone(eMscDataPassed);
+	}
+}
+
+
+/**
+	Takes one step of receiving data from the host: either hands a
+	complete buffer to the SCSI layer, or reads one packet into the buffer.
+
+	@param [in,out] pData
+	@return true if another step can be taken right away
+ */
+bool MSCDataOutStep(TMscData *pData)
+{
+	uint32_t	dwLen;
+	int			iRoom, iChunk;
+
+	dwLen = pData->dwOffset - pData->dwBufStart;
+	if ((dwLen == BLOCKSIZE) || ((dwLen > 0) && (pData->dwOffset == pData->dwTransferSize))) {
+		// buffer complete, process data in SCSI layer once the medium is ready
+		if (SCSIBusy(pData->bLUN)) {
+			return false;
+		}
+		pData->pbData = SCSIHandleData(pData->bLUN, pData->pbCDB, pData->bCDBLen,
+									pData->pbData, pData->dwBufStart);
+		if (pData->pbData == NULL) {
+			pData->pfnDone(eMscDataFailed);
+			return false;
+		}
+		pData->dwBufStart = pData->dwOffset;
+		if (pData->dwOffset == pData->dwTransferSize) {
+			pData->pfnDone(eMscDataPassed);
+			return false;
+		}
+		return true;
+	}
+
+	if ((USBHwEPGetStatus(pData->bEP) & EP_STATUS_DATA) == 0) {
+		return false;
+	}
+
+	// get data from host, straight into the buffer behind the data already there
+	iRoom = MIN(BLOCKSIZE - dwLen, pData->dwTransferSize - pData->dwOffset);
+	iChunk = USBHwEPRead(pData->bEP, pData->pbData + dwLen, iRoom);
+	if (iChunk < 0) {
+		return false;
+	}
+	if ((iChunk < pData->iPacketSize) && (iChunk < iRoom)) {
+		// short packet, the host ended the data phase early
+		DBG("Short packet (%d bytes) at offset %d\n", iChunk, pData->dwOffset);
+		pData->pfnDone(eMscDataShort);
+		return false;
+	}
+	// anything past the data the device expects is dropped (BOT: Ho > Do, see 6.7.3)
+	pData->dwOffset += MIN(iChunk, iRoom);
+	return true;
+}
@@ -0,0 +1,63 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	Data phase of the mass storage transports, see msc_data.c.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** How a data phase ended */
+typedef enum {
+	eMscDataPassed,		/**< all data moved */
+	eMscDataFailed,		/**< the SCSI layer failed the command */
+	eMscDataShort		/**< the host sent less data than the command asks for */
+} EMscDataStatus;
+
+/** Called once when the data phase ends, to report the status to the host */
+typedef void (TFnMscDataDone)(EMscDataStatus eStatus);
+
+/** Data phase of the active command */
+typedef struct {
+	uint8_t			bLUN;
+	uint8_t			*pbCDB;
+	uint8_t			bCDBLen;
+	uint8_t			bEP;			/**< data endpoint, IN or OUT */
+	int				iPacketSize;	/**< packet size of the data endpoint */
+	uint32_t		dwTransferSize;	/**< total size of data transfer */
+	uint32_t		dwOffset;		/**< offset in current data transfer */
+	uint32_t		dwBufStart;		/**< offset of the data in the SCSI buffer */
+	uint8_t			*pbData;
+	TFnMscDataDone	*pfnDone;
+} TMscData;
+
+void MSCDataInit(TMscData *pData, uint8_t bLUN, uint8_t *pbCDB, uint8_t bCDBLen);
+void MSCDataStart(TMscData *pData, uint8_t *pbBuf, uint32_t dwLen, uint8_t bEP, TFnMscDataDone *pfnDone);
+void MSCDataIn(TMscData *pData);
+bool MSCDataOutStep(TMscData *pData);
@@ -30,6 +30,21 @@
 
 	This is the SCSI layer of the USB mass storage application example.
 	This layer depends directly on the blockdev layer.
+
+	Each logical unit has its own block device operations, sense data and
+	block buffer, so several media can be served over one interface.
+	Logical units are numbered in the order they are added with SCSIAddLUN.
+	
+	Logical units whose block device can discard blocks advertise logical
+	block provisioning (READ CAPACITY(16) and the Block Limits and Logical
+	Block Provisioning VPD pages) and accept UNMAP, so a host can TRIM
+	deleted files and let an SD card erase them ahead of the next write.
+	Only the first range of an UNMAP is discarded right away, SCSIBusy
+	starts each next one when the medium is done with the previous one.
+	
+	Block devices that support asynchronous writes get each block started
+	and not waited for; SCSIBusy tells the transport when the medium is
+	done, so it can hold off the host instead of spinning here.
 	
 	Windows peculiarities:
 	* Size of REQUEST SENSE CDB is 12 bytes instead of expected 6
@@ -47,7 +62,9 @@
 #include "msc_scsi.h"
 
 
-#define BLOCKSIZE		512
+#ifndef MIN
+#define MIN(a,b)	((a)<(b)?(a):(b))
+#endif
 
 // SBC2 mandatory SCSI commands
 #define	SCSI_CMD_TEST_UNIT_READY	0x00
@@ -64,15 +81,44 @@
 #define SCSI_CMD_WRITE_6			0x0A	/* not implemented yet */
 #define SCSI_CMD_WRITE_10			0x2A
 #define SCSI_CMD_VERIFY_10			0x2F	/* required for windows format */
+#define SCSI_CMD_UNMAP				0x42
+#define SCSI_CMD_SERVICE_ACTION_IN_16	0x9E
+
+// service actions
+#define SAI_READ_CAPACITY_16		0x10
+
+// vital product data pages
+#define VPD_SUPPORTED_PAGES			0x00
+#define VPD_BLOCK_LIMITS			0xB0
+#define VPD_LB_PROVISIONING			0xB2
+
+// UNMAP limits, the parameter list has to fit in the block buffer
+#define MAX_UNMAP_DESCRIPTORS		((BLOCKSIZE - 8) / 16)
+#ifndef MAX_UNMAP_BLOCKS
+#define MAX_UNMAP_BLOCKS			65536
+#endif
 
 // sense codes
+#define NOT_READY				0x023A00	/* medium not present */
 #define WRITE_ERROR				0x030C00
 #define READ_ERROR				0x031100
 #define INVALID_CMD_OPCODE		0x052000
+#define LBA_OUT_OF_RANGE		0x052100
 #define INVALID_FIELD_IN_CDB	0x052400
+#define INVALID_FIELD_IN_PARAM	0x052600
+
+/** State of one logical unit */
+typedef struct {
+	const TBlockDevOps	*pOps;		/**< block device of this unit */
+	uint32_t	dwSense;			/**< hex: 00aabbcc, where aa=KEY, bb=ASC, cc=ASCQ */
+	uint32_t	dwNumBlocks;		/**< capacity, 0 if the medium is not ready */
+	int			iUnmapNext;			/**< next UNMAP descriptor in abBlockBuf to discard */
+	int			iUnmapEnd;			/**< number of UNMAP descriptors in abBlockBuf */
+	uint8_t		abBlockBuf[BLOCKSIZE];	/**< holds one block of disk data */
+} TLogicalUnit;
 
-//	Sense code, which is set on error conditions
-static uint32_t			dwSense;	// hex: 00aabbcc, where aa=KEY, bb=ASC, cc=ASCQ
+static TLogicalUnit		aLUN[SCSI_MAX_LUNS];
+static int				iNumLUNs = 0;
 
 static const uint8_t		abInquiry[] = {
 	0x00,		// PDT = direct-access device
@@ -94,9 +140,6 @@ static const uint8_t abSense[] = { 0x70, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x0
 							  0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00,
 							  0x00, 0x00 };
 
-//	Buffer for holding one block of disk data
-static uint8_t abBlockBuf[BLOCKSIZE];
-
 
 typedef struct {
 	uint8_t		bOperationCode;
@@ -106,6 +149,213 @@ typedef struct {
 } TCDB6;
 
 
+static void PutBE32(uint8_t *pb, uint32_t dw)
+{
+	pb[0] = (dw >> 24) & 0xFF;
+	pb[1] = (dw >> 16) & 0xFF;
+	pb[2] = (dw >> 8) & 0xFF;
+	pb[3] = (dw >> 0) & 0xFF;
+}
+
+
+static uint32_t GetBE32(const uint8_t *pb)
+{
+	return (pb[0] << 24) | (pb[1] << 16) | (pb[2] << 8) | pb[3];
+}
+
+
+/*************************************************************************
+	SCSIGetVPD
+	==========
+		Builds a vital product data page
+		
+	IN		pLUN		Logical unit
+			bPage		Page code
+	OUT		pbData		Page data, at most 64 bytes
+	
+	Returns the length of the page, or -1 if the page is not supported
+**************************************************************************/
+static int SCSIGetVPD(TLogicalUnit *pLUN, uint8_t bPage, uint8_t *pbData)
+{
+	int		iLen;
+
+	memset(pbData, 0, 64);
+	pbData[1] = bPage;
+	switch (bPage) {
+
+	case VPD_SUPPORTED_PAGES:
+		pbData[4] = VPD_SUPPORTED_PAGES;
+		pbData[5] = VPD_BLOCK_LIMITS;
+		pbData[6] = VPD_LB_PROVISIONING;
+		iLen = 7;
+		break;
+
+	case VPD_BLOCK_LIMITS:
+		// see SBC3r25, 6.5.3
+		if (pLUN->pOps->pfnDiscard != NULL) {
+			PutBE32(&pbData[20], MAX_UNMAP_BLOCKS);
+			PutBE32(&pbData[24], MAX_UNMAP_DESCRIPTORS);
+		}
+		iLen = 64;
+		break;
+
+	case VPD_LB_PROVISIONING:
+		// see SBC3r25, 6.5.13
+		if (pLUN->pOps->pfnDiscard != NULL) {
+			pbData[5] = 0x80;	// LBPU, UNMAP supported
+			pbData[6] = 0x02;	// thin provisioned
+		}
+		iLen = 8;
+		break;
+
+	default:
+		return -1;
+	}
+	pbData[3] = iLen - 4;
+	return iLen;
+}
+
+
+/*************************************************************************
+	SCSIUnmapNext
+	=============
+		Starts discarding the next non-empty range of an UNMAP parameter
+		list, which was checked by SCSIUnmap already.
+		
+	IN		pLUN		Logical unit, parameter list in its block buffer
+	
+	Returns false if the block device failed, the other ranges are then
+	dropped.
+**************************************************************************/
+static bool SCSIUnmapNext(TLogicalUnit *pLUN)
+{
+	uint8_t		*pbDesc;
+	uint32_t	dwLBA, dwLen;
+
+	while (pLUN->iUnmapNext < pLUN->iUnmapEnd) {
+		pbDesc = &pLUN->abBlockBuf[8 + pLUN->iUnmapNext * 16];
+		pLUN->iUnmapNext++;
+		dwLBA = GetBE32(&pbDesc[4]);
+		dwLen = GetBE32(&pbDesc[8]);
+		if (dwLen != 0) {
+			DBG("UNMAP LBA=%d, len=%d\n", dwLBA, dwLen);
+			if (!pLUN->pOps->pfnDiscard(dwLBA, dwLen)) {
+				DBG("BlockDevDiscard failed\n");
+				pLUN->iUnmapEnd = 0;
+				pLUN->iUnmapNext = 0;
+				return false;
+			}
+			return true;
+		}
+	}
+	return true;
+}
+
+
+/*************************************************************************
+	SCSIUnmap
+	=========
+		Checks an UNMAP parameter list and starts discarding the blocks
+		it lists. Nothing is discarded unless all descriptors are valid.
+		The other ranges follow from SCSIBusy, one at a time, so a long
+		list does not hold up the USB interrupt for several erase times.
+		
+	IN		pLUN		Logical unit, parameter list in its block buffer
+			dwParamLen	Length of the parameter list
+	
+	Returns true if successful, otherwise sets the sense code and returns
+	false.
+**************************************************************************/
+static bool SCSIUnmap(TLogicalUnit *pLUN, uint32_t dwParamLen)
+{
+	uint8_t		*pbDesc;
+	uint32_t	dwLBA, dwLen, dwTotal;
+	int			i, iNumDesc;
+
+	pLUN->iUnmapNext = 0;
+	pLUN->iUnmapEnd = 0;
+	if (dwParamLen < 8) {
+		// no descriptors
+		return true;
+	}
+	iNumDesc = ((pLUN->abBlockBuf[2] << 8) | pLUN->abBlockBuf[3]) / 16;
+	if ((iNumDesc > MAX_UNMAP_DESCRIPTORS) || (8 + iNumDesc * 16 > (int)dwParamLen)) {
+		pLUN->dwSense = INVALID_FIELD_IN_PARAM;
+		return false;
+	}
+
+	// check all ranges first
+	dwTotal = 0;
+	for (i = 0; i < iNumDesc; i++) {
+		pbDesc = &pLUN->abBlockBuf[8 + i * 16];
+		dwLBA = GetBE32(&pbDesc[4]);
+		dwLen = GetBE32(&pbDesc[8]);
+		if ((GetBE32(&pbDesc[0]) != 0) || (dwLBA > pLUN->dwNumBlocks) || (dwLen > pLUN->dwNumBlocks - dwLBA)) {
+			pLUN->dwSense = LBA_OUT_OF_RANGE;
+			return false;
+		}
+		dwTotal += dwLen;
+		if (dwTotal > MAX_UNMAP_BLOCKS) {
+			pLUN->dwSense = INVALID_FIELD_IN_PARAM;
+			return false;
+		}
+	}
+
+	// then start on the first one
+	pLUN->iUnmapEnd = iNumDesc;
+	if (!SCSIUnmapNext(pLUN)) {
+		pLUN->dwSense = WRITE_ERROR;
+		return false;
+	}
+	return true;
+}
+
+
+/*************************************************************************
+	SCSIAddLUN
+	==========
+		Adds a logical unit backed by a block device, and initialises
+		the block device.
+		
+	IN		pOps		Block device operations
+	
+	Returns true if the unit was added. A unit whose medium failed to
+	initialise is still added, but reports 'not ready'.
+**************************************************************************/
+bool SCSIAddLUN(const TBlockDevOps *pOps)
+{
+	TLogicalUnit	*pLUN;
+
+	if (iNumLUNs >= SCSI_MAX_LUNS) {
+		DBG("Too many LUNs\n");
+		return false;
+	}
+	pLUN = &aLUN[iNumLUNs];
+	pLUN->pOps = pOps;
+	pLUN->dwSense = 0;
+	pLUN->iUnmapNext = 0;
+	pLUN->iUnmapEnd = 0;
+	if (!pOps->pfnInit() || !pOps->pfnGetSize(&pLUN->dwNumBlocks)) {
+		pLUN->dwNumBlocks = 0;
+		DBG("LUN %d not ready\n", iNumLUNs);
+	}
+	iNumLUNs++;
+	return true;
+}
+
+
+/*************************************************************************
+	SCSIGetNumLUNs
+	==============
+		Returns the number of logical units
+		
+**************************************************************************/
+int SCSIGetNumLUNs(void)
+{
+	return iNumLUNs;
+}
+
+
 /*************************************************************************
 	SCSIReset
 	=========
@@ -114,7 +364,50 @@ typedef struct {
 **************************************************************************/
 void SCSIReset(void)
 {
-	dwSense = 0;
+	int i;
+
+	for (i = 0; i < iNumLUNs; i++) {
+		aLUN[i].dwSense = 0;
+		aLUN[i].iUnmapNext = 0;
+		aLUN[i].iUnmapEnd = 0;
+	}
+}
+
+
+/*************************************************************************
+	SCSIBusy
+	========
+		Checks if the medium of a logical unit is still busy with a write
+		or discard that was started earlier. The transport should not pass
+		new data or report status until it is done.
+		
+		When the medium is done and an UNMAP has ranges left, the next one
+		is started and the unit stays busy. A range that fails then can no
+		longer fail the command; the blocks just stay mapped, which is
+		allowed as the unit does not promise zeroes after UNMAP.
+		
+	IN		bLUN		Logical unit number
+	
+	Returns true while the medium is busy
+**************************************************************************/
+bool SCSIBusy(uint8_t bLUN)
+{
+	TLogicalUnit		*pLUN;
+	const TBlockDevOps	*pOps;
+
+	if (bLUN >= iNumLUNs) {
+		return false;
+	}
+	pLUN = &aLUN[bLUN];
+	pOps = pLUN->pOps;
+	if ((pOps->pfnPoll != NULL) && !pOps->pfnPoll()) {
+		return true;
+	}
+	if (pLUN->iUnmapNext < pLUN->iUnmapEnd) {
+		SCSIUnmapNext(pLUN);
+		return true;
+	}
+	return false;
 }
 
 
@@ -124,9 +417,10 @@ void SCSIReset(void)
 		Verifies a SCSI CDB and indicates the direction and amount of data
 		that the device wants to transfer.
 		
-	If this call fails, a sense code is set in dwSense.
+	If this call fails, a sense code is set in the sense data of the LUN.
 
-	IN		pbCDB		Command data block
+	IN		bLUN		Logical unit number
+			pbCDB		Command data block
 			iCDBLen		Command data block len
 	OUT		*piRspLen	Length of intended response data:
 			*pfDevIn	true if data is transferred from device-to-host
@@ -134,11 +428,12 @@ void SCSIReset(void)
 	Returns a pointer to the data exchange buffer if successful,
 	return NULL otherwise.
 **************************************************************************/
-uint8_t * SCSIHandleCmd(uint8_t *pbCDB, uint8_t iCDBLen, int *piRspLen, bool *pfDevIn)
+uint8_t * SCSIHandleCmd(uint8_t bLUN, uint8_t *pbCDB, uint8_t iCDBLen, int *piRspLen, bool *pfDevIn)
 {
 	static const uint8_t aiCDBLen[] = {6, 10, 10, 0, 16, 12, 0, 0};
 	int		i;
 	TCDB6	*pCDB;
+	TLogicalUnit	*pLUN;
 	uint32_t		dwLen, dwLBA;
 	uint8_t		bGroupCode;
 	
@@ -146,6 +441,13 @@ uint8_t * SCSIHandleCmd(uint8_t *pbCDB, uint8_t iCDBLen, int *piRspLen, bool *pf
 	
 	// default direction is from device to host
 	*pfDevIn = true;
+	*piRspLen = 0;
+
+	if (bLUN >= iNumLUNs) {
+		DBG("Invalid LUN %d\n", bLUN);
+		return NULL;
+	}
+	pLUN = &aLUN[bLUN];
 	
 	// check CDB length
 	bGroupCode = (pCDB->bOperationCode >> 5) & 0x7;
@@ -159,12 +461,16 @@ uint8_t * SCSIHandleCmd(uint8_t *pbCDB, uint8_t iCDBLen, int *piRspLen, bool *pf
 	// test unit ready (6)
 	case SCSI_CMD_TEST_UNIT_READY:
 		DBG("TEST UNIT READY\n");
+		if (pLUN->dwNumBlocks == 0) {
+			pLUN->dwSense = NOT_READY;
+			return NULL;
+		}
 		*piRspLen = 0;
 		break;
 	
 	// request sense (6)
 	case SCSI_CMD_REQUEST_SENSE:
-		DBG("REQUEST SENSE (%06X)\n", dwSense);
+		DBG("REQUEST SENSE (%06X)\n", pLUN->dwSense);
 		// check params
 		*piRspLen = MIN(18, pCDB->bLength);
 		break;
@@ -176,32 +482,70 @@ uint8_t * SCSIHandleCmd(uint8_t *pbCDB, uint8_t iCDBLen, int *piRspLen, bool *pf
 	
 	// inquiry (6)
 	case SCSI_CMD_INQUIRY:
-		DBG("INQUIRY\n");
-		// see SPC3r23, 4.3.4.6
-		*piRspLen = MIN(36, pCDB->bLength);
+		DBG("INQUIRY %02X %02X\n", pbCDB[1], pbCDB[2]);
+		dwLen = (pbCDB[3] << 8) | pbCDB[4];
+		if ((pbCDB[1] & 1) != 0) {
+			// EVPD
+			i = SCSIGetVPD(pLUN, pbCDB[2], pLUN->abBlockBuf);
+			if (i < 0) {
+				pLUN->dwSense = INVALID_FIELD_IN_CDB;
+				return NULL;
+			}
+			*piRspLen = MIN((uint32_t)i, dwLen);
+		}
+		else if (pbCDB[2] != 0) {
+			// page code without EVPD
+			pLUN->dwSense = INVALID_FIELD_IN_CDB;
+			return NULL;
+		}
+		else {
+			// see SPC3r23, 4.3.4.6
+			*piRspLen = MIN(36, dwLen);
+		}
 		break;
 		
 	// read capacity (10)
 	case SCSI_CMD_READ_CAPACITY_10:
 		DBG("READ CAPACITY\n");
+		if (pLUN->dwNumBlocks == 0) {
+			pLUN->dwSense = NOT_READY;
+			return NULL;
+		}
 		*piRspLen = 8;
 		break;
 		
+	// read capacity (16)
+	case SCSI_CMD_SERVICE_ACTION_IN_16:
+		if ((pbCDB[1] & 0x1F) != SAI_READ_CAPACITY_16) {
+			DBG("Unhandled service action %02X\n", pbCDB[1]);
+			pLUN->dwSense = INVALID_CMD_OPCODE;
+			return NULL;
+		}
+		DBG("READ CAPACITY16\n");
+		if (pLUN->dwNumBlocks == 0) {
+			pLUN->dwSense = NOT_READY;
+			return NULL;
+		}
+		*piRspLen = MIN(32, GetBE32(&pbCDB[10]));
+		break;
+		
 	// read (10)
 	case SCSI_CMD_READ_10:
-		dwLBA = (pbCDB[2] << 24) | (pbCDB[3] << 16) | (pbCDB[4] << 8) | (pbCDB[5]);
-		dwLen = (pbCDB[7] << 8) | pbCDB[8];
-		DBG("READ10, LBA=%d, len=%d\n", dwLBA, dwLen);
-		*piRspLen = dwLen * BLOCKSIZE;
-		break;
-
 	// write (10)
 	case SCSI_CMD_WRITE_10:
 		dwLBA = (pbCDB[2] << 24) | (pbCDB[3] << 16) | (pbCDB[4] << 8) | (pbCDB[5]);
 		dwLen = (pbCDB[7] << 8) | pbCDB[8];
-		DBG("WRITE10, LBA=%d, len=%d\n", dwLBA, dwLen);
+		DBG("%s, LBA=%d, len=%d\n", (pCDB->bOperationCode == SCSI_CMD_READ_10) ? "READ10" : "WRITE10", dwLBA, dwLen);
+		if (pLUN->dwNumBlocks == 0) {
+			pLUN->dwSense = NOT_READY;
+			return NULL;
+		}
+		if ((dwLBA >= pLUN->dwNumBlocks) || (dwLen > pLUN->dwNumBlocks - dwLBA)) {
+			pLUN->dwSense = LBA_OUT_OF_RANGE;
+			return NULL;
+		}
 		*piRspLen = dwLen * BLOCKSIZE;
-		*pfDevIn = false;
+		*pfDevIn = (pCDB->bOperationCode == SCSI_CMD_READ_10);
 		break;
 
 	case SCSI_CMD_VERIFY_10:
@@ -212,9 +556,30 @@ uint8_t * SCSIHandleCmd(uint8_t *pbCDB, uint8_t iCDBLen, int *piRspLen, bool *pf
 		if ((pbCDB[1] & (1 << 1)) != 0) {
 			// we don't support BYTCHK
 			DBG("BYTCHK not supported\n");
-			dwSense = INVALID_FIELD_IN_CDB;
+			pLUN->dwSense = INVALID_FIELD_IN_CDB;
+			return NULL;
+		}
+		break;
+	
+	// unmap (10)
+	case SCSI_CMD_UNMAP:
+		dwLen = (pbCDB[7] << 8) | pbCDB[8];
+		DBG("UNMAP, len=%d\n", dwLen);
+		if (pLUN->pOps->pfnDiscard == NULL) {
+			pLUN->dwSense = INVALID_CMD_OPCODE;
+			return NULL;
+		}
+		if (pLUN->dwNumBlocks == 0) {
+			pLUN->dwSense = NOT_READY;
+			return NULL;
+		}
+		if (((pbCDB[1] & 1) != 0) || (dwLen > BLOCKSIZE)) {
+			// no ANCHOR support, and the list has to fit the block buffer
+			pLUN->dwSense = INVALID_FIELD_IN_CDB;
 			return NULL;
 		}
+		*piRspLen = dwLen;
+		*pfDevIn = false;
 		break;
 	
 	default:
@@ -224,12 +589,12 @@ uint8_t * SCSIHandleCmd(uint8_t *pbCDB, uint8_t iCDBLen, int *piRspLen, bool *pf
 		}
 		DBG("\n");
 		// unsupported command
-		dwSense = INVALID_CMD_OPCODE;
+		pLUN->dwSense = INVALID_CMD_OPCODE;
 		*piRspLen = 0;
 		return NULL;
 	}
 	
-	return abBlockBuf;
+	return pLUN->abBlockBuf;
 }
 
 
@@ -238,28 +603,40 @@ uint8_t * SCSIHandleCmd(uint8_t *pbCDB, uint8_t iCDBLen, int *piRspLen, bool *pf
 	==============
 		Handles a block of SCSI data.
 		
-	IN		pbCDB		Command data block
+	IN		bLUN		Logical unit number
+			pbCDB		Command data block
 			iCDBLen		Command data block len
 	IN/OUT	pbData		Data buffer
 	IN		dwOffset	Offset in data
 	
+	Data is exchanged in buffers of up to BLOCKSIZE bytes. For data to the
+	host, this is called at the start of each buffer, to fill it. For data
+	from the host, it is called when a buffer is full or all data is in,
+	with the offset of the start of the buffer.
+
 	Returns a pointer to the next data to be exchanged if successful,
 	returns NULL otherwise.
 **************************************************************************/
-uint8_t * SCSIHandleData(uint8_t *pbCDB, uint8_t iCDBLen, uint8_t *pbData, uint32_t dwOffset)
+uint8_t * SCSIHandleData(uint8_t bLUN, uint8_t *pbCDB, uint8_t iCDBLen, uint8_t *pbData, uint32_t dwOffset)
 {
 	TCDB6	*pCDB;
+	TLogicalUnit	*pLUN;
 	uint32_t		dwLBA;
 	uint32_t		dwBufPos, dwBlockNr;
-	uint32_t		dwDevSize, dwMaxBlock;
+	uint32_t		dwMaxBlock, dwParamLen;
 	
 	pCDB = (TCDB6 *)pbCDB;
+
+	if (bLUN >= iNumLUNs) {
+		return NULL;
+	}
+	pLUN = &aLUN[bLUN];
 	
 	switch (pCDB->bOperationCode) {
 
 	// test unit ready
 	case SCSI_CMD_TEST_UNIT_READY:
-		if (dwSense != 0) {
+		if (pLUN->dwSense != 0) {
 			DBG("UNIT NOT READY!\n");
 			return NULL;
 		}
@@ -269,11 +646,11 @@ uint8_t * SCSIHandleData(uint8_t *pbCDB, uint8_t iCDBLen, uint8_t *pbData, uint3
 	case SCSI_CMD_REQUEST_SENSE:
 		memcpy(pbData, abSense, 18);
 		// fill in KEY/ASC/ASCQ
-		pbData[2] = (dwSense >> 16) & 0xFF;
-		pbData[12] = (dwSense >> 8) & 0xFF;
-		pbData[13] = (dwSense >> 0) & 0xFF;
+		pbData[2] = (pLUN->dwSense >> 16) & 0xFF;
+		pbData[12] = (pLUN->dwSense >> 8) & 0xFF;
+		pbData[13] = (pLUN->dwSense >> 0) & 0xFF;
 		// reset sense data
-		dwSense = 0;
+		pLUN->dwSense = 0;
 		break;
 	
 	case SCSI_CMD_FORMAT_UNIT:
@@ -282,15 +659,18 @@ uint8_t * SCSIHandleData(uint8_t *pbCDB, uint8_t iCDBLen, uint8_t *pbData, uint3
 	
 	// inquiry
 	case SCSI_CMD_INQUIRY:
-		memcpy(pbData, abInquiry, sizeof(abInquiry));
+		if ((pbCDB[1] & 1) != 0) {
+			SCSIGetVPD(pLUN, pbCDB[2], pbData);
+		}
+		else {
+			memcpy(pbData, abInquiry, sizeof(abInquiry));
+		}
 		break;
 		
 	// read capacity
 	case SCSI_CMD_READ_CAPACITY_10:
-		// get size of drive (bytes)
-		BlockDevGetSize(&dwDevSize);
-		// calculate highest LBA
-		dwMaxBlock = (dwDevSize - 1) / BLOCKSIZE;
+		// highest LBA
+		dwMaxBlock = pLUN->dwNumBlocks - 1;
 		
 		pbData[0] = (dwMaxBlock >> 24) & 0xFF;
 		pbData[1] = (dwMaxBlock >> 16) & 0xFF;
@@ -302,6 +682,16 @@ uint8_t * SCSIHandleData(uint8_t *pbCDB, uint8_t iCDBLen, uint8_t *pbData, uint3
 		pbData[7] = (BLOCKSIZE >> 0) & 0xFF;
 		break;
 		
+	// read capacity (16)
+	case SCSI_CMD_SERVICE_ACTION_IN_16:
+		memset(pbData, 0, 32);
+		PutBE32(&pbData[4], pLUN->dwNumBlocks - 1);
+		PutBE32(&pbData[8], BLOCKSIZE);
+		if (pLUN->pOps->pfnDiscard != NULL) {
+			pbData[14] = 0x80;	// LBPME
+		}
+		break;
+		
 	// read10
 	case SCSI_CMD_READ_10:
 		dwLBA = (pbCDB[2] << 24) | (pbCDB[3] << 16) | (pbCDB[4] << 8) | (pbCDB[5]);
@@ -312,46 +702,55 @@ uint8_t * SCSIHandleData(uint8_t *pbCDB, uint8_t iCDBLen, uint8_t *pbData, uint3
 			// read new block
 			dwBlockNr = dwLBA + (dwOffset / BLOCKSIZE);
 			DBG("R");
-			if (BlockDevRead(dwBlockNr, abBlockBuf) < 0) {
-				dwSense = READ_ERROR;
+			if (!pLUN->pOps->pfnRead(dwBlockNr, pLUN->abBlockBuf)) {
+				pLUN->dwSense = READ_ERROR;
 				DBG("BlockDevRead failed\n");
 				return NULL;
 			}
 		}
 		// return pointer to data
-		return abBlockBuf + dwBufPos;
+		return pLUN->abBlockBuf + dwBufPos;
 
 	// write10
 	case SCSI_CMD_WRITE_10:
 		dwLBA = (pbCDB[2] << 24) | (pbCDB[3] << 16) | (pbCDB[4] << 8) | (pbCDB[5]);
 		
-		// copy data to block buffer
-		dwBufPos = ((dwOffset + 64) & (BLOCKSIZE - 1));
-		if (dwBufPos == 0) {
-			// write new block
-			dwBlockNr = dwLBA + (dwOffset / BLOCKSIZE);
-			DBG("W");
-			if (BlockDevWrite(dwBlockNr, abBlockBuf) < 0) {
-				dwSense = WRITE_ERROR;
-				DBG("BlockDevWrite failed\n");
-				return NULL;
-			}
+		// write the full block buffer, without waiting for the medium if possible
+		dwBlockNr = dwLBA + (dwOffset / BLOCKSIZE);
+		DBG("W");
+		if (!((pLUN->pOps->pfnStartWrite != NULL) ?
+				pLUN->pOps->pfnStartWrite(dwBlockNr, pLUN->abBlockBuf) :
+				pLUN->pOps->pfnWrite(dwBlockNr, pLUN->abBlockBuf))) {
+			pLUN->dwSense = WRITE_ERROR;
+			DBG("BlockDevWrite failed\n");
+			return NULL;
 		}
-		// return pointer to next data
-		return abBlockBuf + dwBufPos;
+		// the block device is done with the buffer, receive the next block in it
+		return pLUN->abBlockBuf;
 		
 	case SCSI_CMD_VERIFY_10:
 		// dummy implementation
 		break;
 		
+	// unmap
+	case SCSI_CMD_UNMAP:
+		dwParamLen = (pbCDB[7] << 8) | pbCDB[8];
+		if (dwParamLen == 0) {
+			break;
+		}
+		// the parameter list is in the block buffer now
+		if (!SCSIUnmap(pLUN, dwParamLen)) {
+			return NULL;
+		}
+		break;
+		
 	default:
 		// unsupported command
-		dwSense = INVALID_CMD_OPCODE;
+		pLUN->dwSense = INVALID_CMD_OPCODE;
 		return NULL;
 	}
 	
 	// default: return pointer to start of block buffer
-	return abBlockBuf;
+	return pLUN->abBlockBuf;
 }
 
-
@@ -28,6 +28,18 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "blockdev.h"
+
+#define BLOCKSIZE		512		/**< size of the SCSI data buffers */
+
+#ifndef SCSI_MAX_LUNS
+#define SCSI_MAX_LUNS	2		/**< maximum number of logical units */
+#endif
+
+bool	SCSIAddLUN(const TBlockDevOps *pOps);
+int		SCSIGetNumLUNs(void);
+
 void	SCSIReset(void);
-uint8_t *	SCSIHandleCmd(uint8_t *pbCDB, uint8_t bCDBLen, int *piRspLen, bool *pfDevIn);
-uint8_t *	SCSIHandleData(uint8_t *pbCDB, uint8_t bCDBLen, uint8_t *pbData, uint32_t dwOffset);
+bool	SCSIBusy(uint8_t bLUN);
+uint8_t *	SCSIHandleCmd(uint8_t bLUN, uint8_t *pbCDB, uint8_t bCDBLen, int *piRspLen, bool *pfDevIn);
+uint8_t *	SCSIHandleData(uint8_t bLUN, uint8_t *pbCDB, uint8_t bCDBLen, uint8_t *pbData, uint32_t dwOffset);
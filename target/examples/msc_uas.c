@@ -0,0 +1,552 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**	@file
+
+	USB Attached SCSI (UAS) transport for mass storage.
+
+	This is the alternative to the bulk-only transport in msc_bot.c, for
+	the same SCSI layer. It uses four pipes:
+	* command: the host sends command and task management IUs, each with
+	  its own tag, without waiting for earlier commands to complete
+	* status: the device answers with READ READY or WRITE READY before
+	  the data of a command, and a SENSE IU after it
+	* data-in and data-out: the data of the command that was announced
+	  last on the status pipe
+
+	Up to UAS_QUEUE_DEPTH commands are queued. They are executed in order,
+	one at a time, since each logical unit has a single block buffer. The
+	gain over BOT is that the next command is already in when the status of
+	the previous one goes out, so its data phase starts right away instead
+	of after another round trip on the bus. When the queue is full, the
+	command pipe is left alone and the host sees NAKs.
+
+	This is UAS as used on high and full speed, without streams: IUs on the
+	status pipe tell the host which tag the data pipes are serving. Sense
+	data of failed commands is returned in the SENSE IU, so a host never
+	needs to send REQUEST SENSE.
+
+	As in msc_bot.c, the NAK interrupts of the bulk endpoints drive the
+	state machine while the medium is busy.
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "debug.h"
+
+#include "usbapi.h"
+
+#include "msc_uas.h"
+#include "msc_scsi.h"
+#include "msc_data.h"
+
+#ifndef UAS_QUEUE_DEPTH
+#define UAS_QUEUE_DEPTH		4		/**< number of commands that can be queued */
+#endif
+
+// information unit IDs
+#define IU_COMMAND			0x01
+#define IU_SENSE			0x03
+#define IU_RESPONSE			0x04
+#define IU_TASK_MGMT		0x05
+#define IU_READ_READY		0x06
+#define IU_WRITE_READY		0x07
+
+#define COMMAND_IU_LEN		32		/**< command IU with a 16 byte CDB */
+#define TASK_MGMT_IU_LEN	16
+#define SENSE_IU_LEN		16		/**< SENSE IU without sense data */
+#define SENSE_DATA_LEN		18		/**< fixed format sense data */
+#define RESPONSE_IU_LEN		8
+#define READY_IU_LEN		4
+
+// response codes
+#define RC_TMF_COMPLETE			0x00
+#define RC_INVALID_IU			0x02
+#define RC_TMF_NOT_SUPPORTED	0x04
+#define RC_TMF_FAILED			0x05
+#define RC_TMF_SUCCEEDED		0x08
+#define RC_INCORRECT_LUN		0x09
+#define RC_OVERLAPPED_TAG		0x0A
+
+// task management functions
+#define TMF_ABORT_TASK			0x01
+#define TMF_ABORT_TASK_SET		0x02
+#define TMF_CLEAR_TASK_SET		0x04
+#define TMF_LOGICAL_UNIT_RESET	0x08
+#define TMF_IT_NEXUS_RESET		0x10
+#define TMF_QUERY_TASK			0x80
+
+// SCSI status
+#define STATUS_GOOD				0x00
+#define STATUS_CHECK_CONDITION	0x02
+
+/** A queued command */
+typedef struct {
+	uint16_t	wTag;
+	uint8_t		bLUN;
+	uint8_t		abCDB[16];
+} TUasTask;
+
+/** States of the command at the head of the queue */
+typedef enum {
+	eIdle,			/**< no command active */
+	eReady,			/**< READY IU waits for the status pipe */
+	eDataIn,
+	eDataOut,
+	eSense			/**< SENSE IU waits for the status pipe and the medium */
+} EUasState;
+
+static TUasTask		aQueue[UAS_QUEUE_DEPTH];
+static int			iHead;				/**< active command, if not idle */
+static int			iCount;				/**< number of queued commands, including the active one */
+
+static EUasState	eState;
+
+static TMscData		Data;				/**< data phase of the active command */
+
+static uint8_t		abStatusIU[SENSE_IU_LEN + SENSE_DATA_LEN];	/**< READY or SENSE IU */
+static int			iStatusLen;
+static uint8_t		abResponseIU[RESPONSE_IU_LEN];
+static bool			fResponse;			/**< response IU waits for the status pipe */
+
+
+static void ProcessCommands(void);
+static void ProcessStatus(void);
+
+
+/**
+	Resets the UAS state machine, dropping all queued commands
+ */
+void MSCUasReset(void)
+{
+	DBG("UAS reset in state %d with %d commands\n", eState, iCount);
+	eState = eIdle;
+	iHead = 0;
+	iCount = 0;
+	fResponse = false;
+	SCSIReset();
+}
+
+
+static uint16_t GetBE16(const uint8_t *pb)
+{
+	return (pb[0] << 8) | pb[1];
+}
+
+
+static void PutBE16(uint8_t *pb, uint16_t w)
+{
+	pb[0] = w >> 8;
+	pb[1] = w;
+}
+
+
+/**
+	Local function to prepare a RESPONSE IU, for task management and for
+	command IUs that cannot be queued
+
+	@param [in]	wTag	Tag of the IU that is answered
+	@param [in]	bCode	Response code
+ */
+static void SendResponse(uint16_t wTag, uint8_t bCode)
+{
+	memset(abResponseIU, 0, sizeof(abResponseIU));
+	abResponseIU[0] = IU_RESPONSE;
+	PutBE16(&abResponseIU[2], wTag);
+	abResponseIU[7] = bCode;
+	fResponse = true;
+	DBG("UAS response %d for tag %d\n", bCode, wTag);
+}
+
+
+/**
+	Local function to prepare the SENSE IU that ends the active command.
+	For a failed command, the sense data is fetched from the SCSI layer
+	with a REQUEST SENSE of its own, which also clears it.
+
+	@param [in]	bStatus	SCSI status
+ */
+static void SendSense(uint8_t bStatus)
+{
+	uint8_t		abRequestSense[6] = {0x03, 0x00, 0x00, 0x00, SENSE_DATA_LEN, 0x00};
+	TUasTask	*pTask = &aQueue[iHead];
+
+	memset(abStatusIU, 0, SENSE_IU_LEN);
+	abStatusIU[0] = IU_SENSE;
+	PutBE16(&abStatusIU[2], pTask->wTag);
+	abStatusIU[6] = bStatus;
+	iStatusLen = SENSE_IU_LEN;
+	if ((bStatus != STATUS_GOOD) &&
+		(SCSIHandleData(pTask->bLUN, abRequestSense, sizeof(abRequestSense), &abStatusIU[SENSE_IU_LEN], 0) != NULL)) {
+		PutBE16(&abStatusIU[14], SENSE_DATA_LEN);
+		iStatusLen += SENSE_DATA_LEN;
+	}
+	DBG("UAS sense: tag=%d, status=%x\n", pTask->wTag, bStatus);
+	eState = eSense;
+}
+
+
+/**
+	Local function to end the data phase with a SENSE IU
+
+	@param [in]	eStatus	How the data phase ended
+ */
+static void DataDone(EMscDataStatus eStatus)
+{
+	SendSense((eStatus == eMscDataPassed) ? STATUS_GOOD : STATUS_CHECK_CONDITION);
+}
+
+
+/**
+	Local function to start the command at the head of the queue
+ */
+static void StartCommand(void)
+{
+	TUasTask	*pTask;
+	uint8_t		*pbBuf;
+	int			iLen;
+	bool		fDevIn;
+
+	if ((eState != eIdle) || (iCount == 0)) {
+		return;
+	}
+	pTask = &aQueue[iHead];
+
+	DBG("UAS cmd: tag=%d, lun=%d, cmd=%x\n", pTask->wTag, pTask->bLUN, pTask->abCDB[0]);
+
+	MSCDataInit(&Data, pTask->bLUN, pTask->abCDB, sizeof(pTask->abCDB));
+
+	pbBuf = SCSIHandleCmd(pTask->bLUN, pTask->abCDB, sizeof(pTask->abCDB), &iLen, &fDevIn);
+	if (pbBuf == NULL) {
+		SendSense(STATUS_CHECK_CONDITION);
+		return;
+	}
+
+	if (iLen == 0) {
+		// command without data, executed right away
+		MSCDataStart(&Data, pbBuf, 0, MSC_UAS_DATA_IN_EP, DataDone);
+		MSCDataIn(&Data);
+		return;
+	}
+
+	// announce the data phase of this tag
+	MSCDataStart(&Data, pbBuf, iLen, fDevIn ? MSC_UAS_DATA_IN_EP : MSC_UAS_DATA_OUT_EP, DataDone);
+	abStatusIU[0] = fDevIn ? IU_READ_READY : IU_WRITE_READY;
+	abStatusIU[1] = 0;
+	PutBE16(&abStatusIU[2], pTask->wTag);
+	iStatusLen = READY_IU_LEN;
+	eState = eReady;
+}
+
+
+/**
+	Local function to retire the active command and start the next one
+ */
+static void FinishCommand(void)
+{
+	iHead = (iHead + 1) % UAS_QUEUE_DEPTH;
+	iCount--;
+	eState = eIdle;
+	StartCommand();
+	// a queue slot came free
+	ProcessCommands();
+}
+
+
+/**
+	Local function to move received packets to the SCSI layer, for as long
+	as it can take them
+ */
+static void ProcessDataOut(void)
+{
+	while ((eState == eDataOut) && MSCDataOutStep(&Data)) {
+		// next step
+	}
+}
+
+
+/**
+	Local function to write pending IUs to the status pipe while it has
+	room. A RESPONSE IU goes first, then the IU of the active command.
+	The SENSE IU is held back until the medium is done, so the host only
+	sees good status for data that was written.
+ */
+static void ProcessStatus(void)
+{
+	while ((USBHwEPGetStatus(MSC_UAS_STATUS_EP) & EP_STATUS_DATA) == 0) {
+		if (fResponse) {
+			USBHwEPWrite(MSC_UAS_STATUS_EP, abResponseIU, RESPONSE_IU_LEN);
+			fResponse = false;
+			// the command pipe was held back for this response
+			ProcessCommands();
+		}
+		else if (eState == eReady) {
+			USBHwEPWrite(MSC_UAS_STATUS_EP, abStatusIU, iStatusLen);
+			if (abStatusIU[0] == IU_READ_READY) {
+				eState = eDataIn;
+				MSCDataIn(&Data);
+			}
+			else {
+				eState = eDataOut;
+				ProcessDataOut();
+			}
+		}
+		else if ((eState == eSense) && !SCSIBusy(aQueue[iHead].bLUN)) {
+			USBHwEPWrite(MSC_UAS_STATUS_EP, abStatusIU, iStatusLen);
+			FinishCommand();
+		}
+		else {
+			break;
+		}
+	}
+}
+
+
+/**
+	Local function to check if a tag is in use by a queued command
+
+	@param [in]	wTag	Tag
+	@return true if the tag is in use
+ */
+static bool TagInUse(uint16_t wTag)
+{
+	int i;
+
+	for (i = 0; i < iCount; i++) {
+		if (aQueue[(iHead + i) % UAS_QUEUE_DEPTH].wTag == wTag) {
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/**
+	Local function to remove queued commands that have not started yet.
+	The active command always runs to completion.
+
+	@param [in]	bLUN	Logical unit of the commands
+	@param [in]	wTag	Tag of the command to remove
+	@param [in]	fAll	true to remove all commands of the logical unit
+	@return number of commands removed
+ */
+static int RemoveCommands(uint8_t bLUN, uint16_t wTag, bool fAll)
+{
+	TUasTask	*pTask;
+	int			i, iKeep, iFirst;
+
+	iFirst = (eState == eIdle) ? 0 : 1;
+	iKeep = iFirst;
+	for (i = iFirst; i < iCount; i++) {
+		pTask = &aQueue[(iHead + i) % UAS_QUEUE_DEPTH];
+		if ((pTask->bLUN == bLUN) && (fAll || (pTask->wTag == wTag))) {
+			continue;
+		}
+		aQueue[(iHead + iKeep) % UAS_QUEUE_DEPTH] = *pTask;
+		iKeep++;
+	}
+	i = iCount - iKeep;
+	iCount = iKeep;
+	return i;
+}
+
+
+/**
+	Local function to handle a task management IU
+
+	@param [in]	pbIU	Task management IU
+ */
+static void HandleTaskMgmt(const uint8_t *pbIU)
+{
+	uint16_t	wTag, wTaskTag;
+	uint8_t		bLUN;
+
+	wTag = GetBE16(&pbIU[2]);
+	wTaskTag = GetBE16(&pbIU[6]);
+	bLUN = pbIU[9];
+	DBG("UAS task management %x, tag=%d\n", pbIU[4], wTaskTag);
+
+	switch (pbIU[4]) {
+
+	case TMF_ABORT_TASK:
+		if ((eState != eIdle) && (aQueue[iHead].wTag == wTaskTag)) {
+			// already moving data
+			SendResponse(wTag, RC_TMF_FAILED);
+			break;
+		}
+		RemoveCommands(bLUN, wTaskTag, false);
+		SendResponse(wTag, RC_TMF_COMPLETE);
+		break;
+
+	case TMF_ABORT_TASK_SET:
+	case TMF_CLEAR_TASK_SET:
+	case TMF_LOGICAL_UNIT_RESET:
+		RemoveCommands(bLUN, 0, true);
+		SendResponse(wTag, RC_TMF_COMPLETE);
+		break;
+
+	case TMF_QUERY_TASK:
+		SendResponse(wTag, TagInUse(wTaskTag) ? RC_TMF_SUCCEEDED : RC_TMF_COMPLETE);
+		break;
+
+	default:
+		SendResponse(wTag, RC_TMF_NOT_SUPPORTED);
+		break;
+	}
+}
+
+
+/**
+	Local function to take IUs from the command pipe while there is room
+	in the queue and no RESPONSE IU is pending
+ */
+static void ProcessCommands(void)
+{
+	uint8_t		abIU[COMMAND_IU_LEN];
+	TUasTask	*pTask;
+	uint16_t	wTag;
+	int			iLen;
+
+	while ((iCount < UAS_QUEUE_DEPTH) && !fResponse &&
+			((USBHwEPGetStatus(MSC_UAS_CMD_EP) & EP_STATUS_DATA) != 0)) {
+		iLen = USBHwEPRead(MSC_UAS_CMD_EP, abIU, sizeof(abIU));
+		if (iLen < 4) {
+			SendResponse(0, RC_INVALID_IU);
+			continue;
+		}
+		wTag = GetBE16(&abIU[2]);
+
+		switch (abIU[0]) {
+
+		case IU_COMMAND:
+			if ((iLen < COMMAND_IU_LEN) || ((abIU[6] >> 2) != 0)) {
+				// no additional CDB bytes
+				SendResponse(wTag, RC_INVALID_IU);
+				break;
+			}
+			if ((abIU[8] != 0) || (abIU[9] >= SCSIGetNumLUNs())) {
+				SendResponse(wTag, RC_INCORRECT_LUN);
+				break;
+			}
+			if (TagInUse(wTag)) {
+				SendResponse(wTag, RC_OVERLAPPED_TAG);
+				break;
+			}
+			pTask = &aQueue[(iHead + iCount) % UAS_QUEUE_DEPTH];
+			pTask->wTag = wTag;
+			pTask->bLUN = abIU[9];
+			memcpy(pTask->abCDB, &abIU[16], sizeof(pTask->abCDB));
+			iCount++;
+			StartCommand();
+			break;
+
+		case IU_TASK_MGMT:
+			if (iLen < TASK_MGMT_IU_LEN) {
+				SendResponse(wTag, RC_INVALID_IU);
+				break;
+			}
+			HandleTaskMgmt(abIU);
+			break;
+
+		default:
+			SendResponse(wTag, RC_INVALID_IU);
+			break;
+		}
+	}
+}
+
+
+/**
+	Handles the UAS command pipe
+
+	@param [in]	bEP			Endpoint number
+	@param [in]	bEPStatus	Endpoint status (indicates NAK, STALL, etc)
+ */
+void MSCUasCommandOut(uint8_t bEP, uint8_t bEPStatus)
+{
+	// ignore events on stalled EP
+	if (bEPStatus & EP_STATUS_STALLED) {
+		return;
+	}
+	ProcessCommands();
+	ProcessStatus();
+}
+
+
+/**
+	Handles the UAS status pipe
+
+	@param [in]	bEP			Endpoint number
+	@param [in]	bEPStatus	Endpoint status (indicates NAK, STALL, etc)
+ */
+void MSCUasStatusIn(uint8_t bEP, uint8_t bEPStatus)
+{
+	if (bEPStatus & EP_STATUS_STALLED) {
+		return;
+	}
+	// the host polls for status, pass on the data it left and check if
+	// the medium is done
+	ProcessDataOut();
+	ProcessStatus();
+}
+
+
+/**
+	Handles the UAS data-in pipe
+
+	@param [in]	bEP			Endpoint number
+	@param [in]	bEPStatus	Endpoint status (indicates NAK, STALL, etc)
+ */
+void MSCUasDataIn(uint8_t bEP, uint8_t bEPStatus)
+{
+	if (bEPStatus & EP_STATUS_STALLED) {
+		return;
+	}
+	if (eState == eDataIn) {
+		MSCDataIn(&Data);
+		ProcessStatus();
+	}
+}
+
+
+/**
+	Handles the UAS data-out pipe
+
+	@param [in]	bEP			Endpoint number
+	@param [in]	bEPStatus	Endpoint status (indicates NAK, STALL, etc)
+ */
+void MSCUasDataOut(uint8_t bEP, uint8_t bEPStatus)
+{
+	if (bEPStatus & EP_STATUS_STALLED) {
+		return;
+	}
+	ProcessDataOut();
+	ProcessStatus();
+}
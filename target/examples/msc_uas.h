@@ -0,0 +1,42 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	USB Attached SCSI (UAS) transport for mass storage, see msc_uas.c.
+*/
+
+#define MSC_UAS_CMD_EP		0x02	/**< command pipe, shared with BOT bulk OUT */
+#define MSC_UAS_DATA_IN_EP	0x85	/**< data-in pipe, shared with BOT bulk IN */
+#define MSC_UAS_STATUS_EP	0x88	/**< status pipe */
+#define MSC_UAS_DATA_OUT_EP	0x0B	/**< data-out pipe */
+
+void MSCUasReset(void);
+void MSCUasCommandOut(uint8_t bEP, uint8_t bEPStatus);
+void MSCUasStatusIn(uint8_t bEP, uint8_t bEPStatus);
+void MSCUasDataIn(uint8_t bEP, uint8_t bEPStatus);
+void MSCUasDataOut(uint8_t bEP, uint8_t bEPStatus);
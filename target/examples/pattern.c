@@ -0,0 +1,187 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file
+	Data patterns for USB test functions.
+
+	A pattern is an endless stream of 32-bit little endian words. The
+	stream does not depend on how it is cut into packets, so the sender and
+	the receiver each keep their own TPattern and stay in step as long as
+	no data is lost. The counter and PRBS patterns make lost, repeated and
+	reordered packets show up as errors; all zeros only measures speed.
+
+	Each word of the counter and PRBS patterns determines all words after
+	it, so a receiver that joins a stream halfway can pick it up from any
+	word with PatternSync.
+ */
+
+#include <stdint.h>
+
+#include "pattern.h"
+
+#define PRBS_SEED	0x2545F491		/**< any non-zero value */
+
+
+/**
+	Local function to generate the next word of a pattern
+ */
+static uint32_t PatternNextWord(TPattern *pPattern)
+{
+	uint32_t dw;
+
+	switch (pPattern->ePattern) {
+
+	case ePatternCounter:
+		return pPattern->dwState++;
+
+	case ePatternPRBS:
+		// xorshift32, period 2^32 - 1
+		dw = pPattern->dwState;
+		dw ^= dw << 13;
+		dw ^= dw >> 17;
+		dw ^= dw << 5;
+		pPattern->dwState = dw;
+		return dw;
+
+	default:
+		return 0;
+	}
+}
+
+
+/**
+	Starts a pattern stream from the beginning
+
+	@param [out]	pPattern	Pattern stream
+	@param [in]		ePattern	Pattern
+ */
+void PatternInit(TPattern *pPattern, EPattern ePattern)
+{
+	pPattern->ePattern = ePattern;
+	pPattern->dwState = (ePattern == ePatternPRBS) ? PRBS_SEED : 0;
+	pPattern->dwWord = 0;
+	pPattern->iByte = 4;
+}
+
+
+/**
+	Continues a pattern stream from a word that was received
+
+	@param [in,out]	pPattern	Pattern stream
+	@param [in]		pbWord		Four bytes of the stream, starting at a word
+ */
+void PatternSync(TPattern *pPattern, const uint8_t *pbWord)
+{
+	pPattern->dwWord = pbWord[0] | (pbWord[1] << 8) | (pbWord[2] << 16) | ((uint32_t)pbWord[3] << 24);
+	pPattern->iByte = 4;
+	switch (pPattern->ePattern) {
+	case ePatternCounter:	pPattern->dwState = pPattern->dwWord + 1;	break;
+	case ePatternPRBS:		pPattern->dwState = pPattern->dwWord;		break;
+	default:				pPattern->dwState = 0;						break;
+	}
+}
+
+
+/**
+	Fills a buffer with the next bytes of a pattern stream
+
+	@param [in,out]	pPattern	Pattern stream
+	@param [out]	pbData		Buffer
+	@param [in]		iLen		Number of bytes
+ */
+void PatternFill(TPattern *pPattern, uint8_t *pbData, int iLen)
+{
+	uint32_t	dw;
+
+	// rest of the current word
+	while ((iLen > 0) && (pPattern->iByte < 4)) {
+		*pbData++ = pPattern->dwWord >> (8 * pPattern->iByte++);
+		iLen--;
+	}
+	// whole words
+	while (iLen >= 4) {
+		dw = PatternNextWord(pPattern);
+		pbData[0] = dw;
+		pbData[1] = dw >> 8;
+		pbData[2] = dw >> 16;
+		pbData[3] = dw >> 24;
+		pbData += 4;
+		iLen -= 4;
+	}
+	// start of the next word
+	if (iLen > 0) {
+		pPattern->dwWord = PatternNextWord(pPattern);
+		pPattern->iByte = 0;
+		while (iLen > 0) {
+			*pbData++ = pPattern->dwWord >> (8 * pPattern->iByte++);
+			iLen--;
+		}
+	}
+}
+
+
+/**
+	Checks a buffer against the next bytes of a pattern stream
+
+	@param [in,out]	pPattern	Pattern stream
+	@param [in]		pbData		Buffer
+	@param [in]		iLen		Number of bytes
+
+	@return number of bytes that differ from the pattern
+ */
+int PatternCheck(TPattern *pPattern, const uint8_t *pbData, int iLen)
+{
+	uint32_t	dw;
+	int			iErrors;
+
+	iErrors = 0;
+	// rest of the current word
+	while ((iLen > 0) && (pPattern->iByte < 4)) {
+		iErrors += (*pbData++ != (uint8_t)(pPattern->dwWord >> (8 * pPattern->iByte++)));
+		iLen--;
+	}
+	// whole words
+	while (iLen >= 4) {
+		dw = PatternNextWord(pPattern);
+		if ((pbData[0] | (pbData[1] << 8) | (pbData[2] << 16) | ((uint32_t)pbData[3] << 24)) != dw) {
+			iErrors += (pbData[0] != (uint8_t)dw) + (pbData[1] != (uint8_t)(dw >> 8)) +
+						(pbData[2] != (uint8_t)(dw >> 16)) + (pbData[3] != (uint8_t)(dw >> 24));
+		}
+		pbData += 4;
+		iLen -= 4;
+	}
+	// start of the next word
+	if (iLen > 0) {
+		pPattern->dwWord = PatternNextWord(pPattern);
+		pPattern->iByte = 0;
+		while (iLen > 0) {
+			iErrors += (*pbData++ != (uint8_t)(pPattern->dwWord >> (8 * pPattern->iByte++)));
+			iLen--;
+		}
+	}
+	return iErrors;
+}
@@ -0,0 +1,48 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdint.h>
+
+/** Data patterns */
+typedef enum {
+	ePatternZeros = 0,		/**< all zeros */
+	ePatternCounter = 1,	/**< 32-bit little endian word counter */
+	ePatternPRBS = 2		/**< pseudo random words, xorshift32 */
+} EPattern;
+
+/** Position in a pattern stream */
+typedef struct {
+	EPattern	ePattern;
+	uint32_t	dwState;	/**< counter or generator state */
+	uint32_t	dwWord;		/**< word being sent or checked */
+	int			iByte;		/**< next byte of dwWord, 4 if used up */
+} TPattern;
+
+void	PatternInit(TPattern *pPattern, EPattern ePattern);
+void	PatternSync(TPattern *pPattern, const uint8_t *pbWord);
+void	PatternFill(TPattern *pPattern, uint8_t *pbData, int iLen);
+int		PatternCheck(TPattern *pPattern, const uint8_t *pbData, int iLen);
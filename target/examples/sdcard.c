@@ -29,10 +29,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>		// memcmp
 
 #include "spi.h"
 
 #include "sdcard.h"
+#include "sdcrc.h"
 
 #define R1_IDLE_STATE			(1<<0)
 #define R1_ERASE_RESET			(1<<1)
@@ -86,9 +88,32 @@
 
 #define OCR_HCS						(1<<30)
 
+// CMD6 arguments, function group 1 (access mode)
+#define SWITCH_CHECK				0x00FFFFF0
+#define SWITCH_SET					0x80FFFFF0
+#define SWITCH_HIGH_SPEED			1
+
+// SPI clock frequencies
+#define SD_CLOCK_INIT				400000		// identification mode
+#define SD_CLOCK_DEFAULT			25000000	// default speed mode
+
 
 #define SD_BLOCK_SIZE				512
 
+// data response tokens
+#define DATA_RESP_MASK				0x1F
+#define DATA_RESP_ACCEPTED			0x05
+
+// CRC checking on the bus (CMD59), can be changed with SDSetCRC
+#ifndef SD_CRC
+#define SD_CRC						1
+#endif
+
+// attempts for a block read or write, before giving up
+#ifndef SD_MAX_TRIES
+#define SD_MAX_TRIES				3
+#endif
+
 // timing
 #define	NCR			8
 #define NAC			1024		// actually much more complex, TODO
@@ -104,6 +129,18 @@ typedef enum {
 
 static ECardType eCardType;
 
+/** What the card is doing after the last command */
+typedef enum {
+	eIdle,			/**< ready for a new command */
+	eProgramming,	/**< busy writing data */
+	eErasing		/**< busy erasing */
+} ECardState;
+
+static ECardState eCardState = eIdle;
+
+static bool fUseCrc = SD_CRC;	/**< CRC checking wanted */
+static bool fCrcOn = false;		/**< CRC checking enabled on the card */
+
 
 // returns an R1 error code
 static uint8_t SDWaitResp(int iTimeout)
@@ -138,12 +175,29 @@ static uint32_t SDExtraResp(int iLen)
 	return ulResp;
 }
 
+// waits until the card releases the busy signal (DO held low)
+static void SDWaitReady(void)
+{
+	uint8_t	bResp;
+
+	do {
+		SPITransfer(1, NULL, &bResp);
+	} while (bResp != 0xFF);
+	eCardState = eIdle;
+}
+
+
 // returns an R1 error code
 static uint8_t SDCommand(uint8_t bCmd, uint32_t ulParam)
 {
 	uint8_t	abBuf[6];
 	uint8_t	bResp;
 	
+	// finish a write or erase that was started earlier
+	if (eCardState != eIdle) {
+		SDWaitReady();
+	}
+
 	// check if card is busy
 	SPITransfer(1, NULL, &bResp);
 	if (bResp != 0xFF) {
@@ -157,7 +211,7 @@ static uint8_t SDCommand(uint8_t bCmd, uint32_t ulParam)
 	abBuf[2] = ulParam >> 16;
 	abBuf[3] = ulParam >> 8;
 	abBuf[4] = ulParam >> 0;
-	abBuf[5] = (bCmd == CMD_SEND_IF_COND) ? 0x87 : 0x95;
+	abBuf[5] = SDCrc7(abBuf, 5);
 	SPITransfer(6, abBuf, NULL);
 	
 	// wait for response
@@ -183,9 +237,24 @@ static bool SDSendOpCond(uint32_t ulOpCond)
 }
 
 
+// clocks out the rest of an aborted response, until the bus stays idle
+static void SDFlush(void)
+{
+	uint8_t	bResp;
+	int	i, iIdle;
+
+	iIdle = 0;
+	for (i = 0; (i < NAC) && (iIdle < 16); i++) {
+		SPITransfer(1, NULL, &bResp);
+		iIdle = (bResp == 0xFF) ? (iIdle + 1) : 0;
+	}
+}
+
+
 static bool SDReadDataToken(uint8_t bType, uint8_t *pbData, int iLen)
 {
 	uint8_t	bResp;
+	uint8_t	abCrc[2];
 
 	// wait for data token
 	bResp = SDWaitResp(NAC);
@@ -194,12 +263,14 @@ static bool SDReadDataToken(uint8_t bType, uint8_t *pbData, int iLen)
 		return false;
 	}
 	
-	// read data
+	// read data and CRC
 	SPITransfer(iLen, NULL, pbData);
+	SPITransfer(2, NULL, abCrc);
 	
-	// skip CRC
-	SPITransfer(2, NULL, NULL);
-	
+	if (fCrcOn && (((abCrc[0] << 8) | abCrc[1]) != SDCrc16(pbData, iLen))) {
+		DBG("Data CRC error!\n");
+		return false;
+	}
 	return true;
 }
 
@@ -207,6 +278,8 @@ static bool SDReadDataToken(uint8_t bType, uint8_t *pbData, int iLen)
 static bool SDWriteDataToken(uint8_t bType, const uint8_t *pbData, int iLen)
 {
 	uint8_t	bResp;
+	uint8_t	abCrc[2];
+	uint16_t	wCrc;
 
 	// NWR
 	SPITransfer(1, NULL, NULL);
@@ -215,26 +288,140 @@ static bool SDWriteDataToken(uint8_t bType, const uint8_t *pbData, int iLen)
 	SPITransfer(1, &bType, NULL);
 	if (iLen != 0) {
 		// send data
-	SPITransfer(iLen, pbData, NULL);
-	// (fake) CRC
-	SPITransfer(2, NULL, NULL);
-	// get data response
-	SPITransfer(1, NULL, &bResp);
-	if ((bResp & 0x1F) != 5) {
-		DBG("Received data response error (0x%02X)!\n", bResp);
-		return false;
-	}
+		SPITransfer(iLen, (uint8_t *)pbData, NULL);
+		// CRC, ignored by the card unless CRC checking is on
+		wCrc = fCrcOn ? SDCrc16(pbData, iLen) : 0xFFFF;
+		abCrc[0] = wCrc >> 8;
+		abCrc[1] = wCrc;
+		SPITransfer(2, abCrc, NULL);
+		// get data response, the card goes busy even if it rejected the data
+		SPITransfer(1, NULL, &bResp);
+		eCardState = eProgramming;
+		if ((bResp & DATA_RESP_MASK) != DATA_RESP_ACCEPTED) {
+			DBG("Received data response error (0x%02X)!\n", bResp);
+			return false;
+		}
 	}
 	
-	// wait while busy
-	do {
-		SPITransfer(1, NULL, &bResp);
-	} while (bResp != 0xFF);
+	// card is busy now, see SDPoll
+	eCardState = eProgramming;
 	
 	return true;
 }
 
 
+// returns the maximum clock frequency from the TRAN_SPEED field of the CSD
+static int SDTranSpeed(const uint8_t *pbCSD)
+{
+	// time values, times 10
+	static const uint8_t abValue[16] = {0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80};
+	int	iUnit, i;
+
+	if ((pbCSD[3] & 7) > 3) {
+		// reserved rate unit
+		return SD_CLOCK_DEFAULT;
+	}
+	// rate unit in 10 kbit/s, to account for the times 10 above
+	iUnit = 10000;
+	for (i = 0; i < (pbCSD[3] & 7); i++) {
+		iUnit *= 10;
+	}
+	return iUnit * abValue[(pbCSD[3] >> 3) & 0x0F];
+}
+
+
+// sends CMD6 and reads the 512-bit switch status, returns the selected function of group 1
+static int SDSwitchFunc(uint32_t ulArg)
+{
+	uint8_t	abStatus[64];
+	uint8_t	bResp;
+
+	if ((bResp = SDCommand(CMD_SWITCH_FUNC, ulArg)) != 0) {
+		DBG("CMD_SWITCH_FUNC failed (0x%02X)!\n", bResp);
+		return -1;
+	}
+	if (!SDReadDataToken(TOKEN_START_BLOCK, abStatus, sizeof(abStatus))) {
+		return -1;
+	}
+	// bits 379:376, 0xF if the function cannot be selected
+	return abStatus[16] & 0x0F;
+}
+
+
+// sends CMD59
+static bool SDCrcOnOff(bool fOn)
+{
+	uint8_t	bResp;
+
+	if ((bResp = SDCommand(CMD_CRC_ON_OFF, fOn ? 1 : 0)) != 0) {
+		DBG("CMD_CRC_ON_OFF failed (0x%02X)!\n", bResp);
+		return false;
+	}
+	fCrcOn = fOn;
+	return true;
+}
+
+
+/**
+	Switches the card to high speed mode (50 MHz), if it supports CMD6 and
+	the high speed function. The card updates TRAN_SPEED in its CSD.
+ */
+static bool SDSwitchHighSpeed(const uint8_t *pbCSD)
+{
+	// CMD6 belongs to command class 10 (CCC bit 10, CSD bit 94)
+	if ((pbCSD[4] & (1 << 6)) == 0) {
+		return false;
+	}
+	// check first, this changes nothing on the card
+	if (SDSwitchFunc(SWITCH_CHECK | SWITCH_HIGH_SPEED) != SWITCH_HIGH_SPEED) {
+		DBG("No high speed support\n");
+		return false;
+	}
+	if (SDSwitchFunc(SWITCH_SET | SWITCH_HIGH_SPEED) != SWITCH_HIGH_SPEED) {
+		DBG("High speed switch failed\n");
+		return false;
+	}
+	return true;
+}
+
+
+/**
+	Selects the fastest SPI clock the card allows, switching the card to
+	high speed first if possible. Each clock is verified by reading the CSD
+	and comparing it with a copy read at low speed; if the bus is not
+	stable, the clock is halved until it is, down to the identification
+	clock that the card was initialised with.
+ */
+static bool SDSetClock(void)
+{
+	uint8_t	abCSD[16], abCheck[16];
+	int		iClock;
+
+	if (!SDReadCSD(abCSD)) {
+		return false;
+	}
+	if (SDSwitchHighSpeed(abCSD)) {
+		// new TRAN_SPEED
+		if (!SDReadCSD(abCSD)) {
+			return false;
+		}
+	}
+
+	for (iClock = SDTranSpeed(abCSD); iClock > SD_CLOCK_INIT; iClock /= 2) {
+		SPISetSpeed(iClock);
+		if (SDReadCSD(abCheck) && (memcmp(abCheck, abCSD, sizeof(abCSD)) == 0)) {
+			DBG("SD clock %d kHz\n", iClock / 1000);
+			return true;
+		}
+		DBG("SD clock %d kHz unstable\n", iClock / 1000);
+		SPISetSpeed(SD_CLOCK_INIT);
+		SDFlush();
+	}
+	SPISetSpeed(SD_CLOCK_INIT);
+	return true;
+}
+
+
 bool SDInit(void)
 {
 	int i;
@@ -243,12 +430,14 @@ bool SDInit(void)
 	uint32_t ulData;
 
 	eCardType = eCardUnknown;
+	eCardState = eIdle;
+	fCrcOn = false;
 
 	// init SPI subsystem
 	SPIInit();
 
 	// set low SPI speed
-	SPISetSpeed(400000);
+	SPISetSpeed(SD_CLOCK_INIT);
 
 	// send at least 74 clocks with no chip select
 	SPITick(10);
@@ -295,11 +484,34 @@ bool SDInit(void)
 	}
 		eCardType = eCardSDV1;
 	}
+
+	// CRC checking also helps to find a clock that is too fast
+	if (fUseCrc && !SDCrcOnOff(true)) {
+		return false;
+	}
 	
 	// set high SPI speed
-	SPISetSpeed(25000000);
+	return SDSetClock();
+}
 
-	return true;
+
+/**
+	Turns CRC checking on or off for commands and data on the bus. With
+	CRC checking on, the card rejects corrupted commands and data blocks,
+	and the driver drops data blocks that arrive corrupted; the block
+	functions then try again.
+
+	@param [in]	fEnable	CRC checking on
+	@return false if the card did not accept the setting
+ */
+bool SDSetCRC(bool fEnable)
+{
+	fUseCrc = fEnable;
+	if (eCardType == eCardUnknown) {
+		// SDInit takes care of it
+		return true;
+	}
+	return SDCrcOnOff(fEnable);
 }
 
 
@@ -309,7 +521,8 @@ static uint32_t SDBlock2Addr(uint32_t ulBlock)
 }
 
 
-bool SDReadBlock(uint8_t *pbData, uint32_t ulBlock)
+// reads a block, once
+static bool SDTryReadBlock(uint8_t *pbData, uint32_t ulBlock)
 {
 	uint32_t	ulAddr;
 	uint8_t	bResp;
@@ -333,8 +546,27 @@ bool SDReadBlock(uint8_t *pbData, uint32_t ulBlock)
 }
 
 
+/**
+	Reads a block. A block that fails, for example because of a CRC error,
+	is read again, up to SD_MAX_TRIES times.
+ */
+bool SDReadBlock(uint8_t *pbData, uint32_t ulBlock)
+{
+	int i;
 
-bool SDWriteBlock(const uint8_t *pbData, uint32_t ulBlock)
+	for (i = 0; i < SD_MAX_TRIES; i++) {
+		if (SDTryReadBlock(pbData, ulBlock)) {
+			return true;
+		}
+		// skip whatever is left of the response
+		SDFlush();
+	}
+	return false;
+}
+
+
+// starts writing a block, once
+static bool SDTryStartWrite(const uint8_t *pbData, uint32_t ulBlock)
 {
 	uint32_t	ulAddr;
 	uint8_t	bResp;
@@ -358,6 +590,101 @@ bool SDWriteBlock(const uint8_t *pbData, uint32_t ulBlock)
 }
 
 
+/**
+	Starts writing a block. The data is sent to the card right away, so the
+	buffer can be reused on return, but the card stays busy programming it
+	for some time. Use SDPoll to find out when it is done; the next command
+	waits for it anyway.
+	A block that the card rejects, for example because of a CRC error, is
+	sent again, up to SD_MAX_TRIES times.
+ */
+bool SDStartWrite(const uint8_t *pbData, uint32_t ulBlock)
+{
+	int i;
+
+	for (i = 0; i < SD_MAX_TRIES; i++) {
+		if (SDTryStartWrite(pbData, ulBlock)) {
+			return true;
+		}
+		if (eCardState == eIdle) {
+			SDFlush();
+		}
+	}
+	return false;
+}
+
+
+bool SDWriteBlock(const uint8_t *pbData, uint32_t ulBlock)
+{
+	if (!SDStartWrite(pbData, ulBlock)) {
+		return false;
+	}
+	SDWaitReady();
+	return true;
+}
+
+
+/**
+	Starts erasing a range of blocks, the card is busy until SDPoll says
+	otherwise.
+ */
+bool SDStartErase(uint32_t ulFirstBlock, uint32_t ulLastBlock)
+{
+	uint8_t	bResp;
+
+	// set first and last block of the range
+	if ((bResp = SDCommand(CMD_ERASE_WR_BLK_START_ADDR, SDBlock2Addr(ulFirstBlock))) != 0) {
+		DBG("CMD_ERASE_WR_BLK_START_ADDR failed (0x%02X)!\n", bResp);
+		return false;
+	}
+	if ((bResp = SDCommand(CMD_ERASE_WR_BLK_END_ADDR, SDBlock2Addr(ulLastBlock))) != 0) {
+		DBG("CMD_ERASE_WR_BLK_END_ADDR failed (0x%02X)!\n", bResp);
+		return false;
+	}
+
+	// erase, card signals busy until done
+	if ((bResp = SDCommand(CMD_ERASE, 0)) != 0) {
+		DBG("CMD_ERASE failed (0x%02X)!\n", bResp);
+		return false;
+	}
+	eCardState = eErasing;
+
+	return true;
+}
+
+
+bool SDErase(uint32_t ulFirstBlock, uint32_t ulLastBlock)
+{
+	if (!SDStartErase(ulFirstBlock, ulLastBlock)) {
+		return false;
+	}
+	SDWaitReady();
+	return true;
+}
+
+
+/**
+	Checks if the card has finished a write or erase, by sampling the busy
+	signal once. This takes one byte on the bus, so it can be called from
+	the main loop or a timer without holding up anything else.
+
+	@return true if the card is ready for a new command
+ */
+bool SDPoll(void)
+{
+	uint8_t	bResp;
+
+	if (eCardState != eIdle) {
+		SPITransfer(1, NULL, &bResp);
+		if (bResp != 0xFF) {
+			return false;
+		}
+		eCardState = eIdle;
+	}
+	return true;
+}
+
+
 bool SDReadCSD(uint8_t *pbCSD)
 {
 	uint8_t	bResp;
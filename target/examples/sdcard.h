@@ -32,7 +32,13 @@ bool SDInit(void);
 bool SDReadCSD(uint8_t *pbCSD);
 bool SDReadCID(uint8_t *pbCID);
 bool SDReadOCR(uint32_t *pulOCR);
+bool SDSetCRC(bool fEnable);
 
 bool SDReadBlock(uint8_t *pbData, uint32_t ulBlock);
 bool SDWriteBlock(const uint8_t *pbData, uint32_t ulBlock);
+bool SDErase(uint32_t ulFirstBlock, uint32_t ulLastBlock);
+
+bool SDStartWrite(const uint8_t *pbData, uint32_t ulBlock);
+bool SDStartErase(uint32_t ulFirstBlock, uint32_t ulLastBlock);
+bool SDPoll(void);
 
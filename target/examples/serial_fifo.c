@@ -25,8 +25,49 @@
 	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+/** @file
+	Single-producer, single-consumer byte FIFO.
+
+	One side, typically an interrupt handler, only writes and the other
+	side only reads, so no locking is needed: the producer is the only one
+	to change head and the consumer the only one to change tail. Both
+	count bytes since the start and wrap naturally, the buffer position
+	is found by masking with the power-of-two size, and all VCOM_FIFO_SIZE
+	bytes can be used.
+
+	The data must be in the buffer before the producer publishes the new
+	head, and out of it before the consumer publishes the new tail, hence
+	the barriers between data and index accesses.
+
+	Besides the byte functions, there are functions that give direct
+	access to the largest contiguous free or filled part of the buffer, so
+	a USB packet can be copied in or out with memcpy, or read straight
+	from the buffer. fifo_write and fifo_read copy in two parts when the
+	data wraps around the end of the buffer.
+
+	A USB packet can only be read from the endpoint in one go, so it does
+	not fit when the contiguous free part is shorter than the packet. For
+	that case the buffer can be allocated VCOM_FIFO_SLACK bytes larger:
+	a packet may then run past the end of the buffer as long as fifo_free
+	says it fits, and fifo_commit moves the part past the end to the start.
+ */
+
+#include <string.h>
+
 #include "serial_fifo.h"
-#include <stdbool.h>
+
+#define FIFO_MASK	(VCOM_FIFO_SIZE - 1)
+
+// a negative array size fails the build if the size is no power of two
+typedef char fifo_size_check[((VCOM_FIFO_SIZE & FIFO_MASK) == 0) ? 1 : -1];
+
+#if defined(__ARM_ARCH_4T__) || defined(__ARM_ARCH_4__)
+// the ARM7TDMI does not reorder memory accesses, only the compiler could
+#define FIFO_BARRIER()	asm volatile ("" ::: "memory")
+#else
+#define FIFO_BARRIER()	__sync_synchronize()
+#endif
+
 
 void fifo_init(fifo_t *fifo, uint8_t *buf)
 {
@@ -38,35 +79,34 @@ void fifo_init(fifo_t *fifo, uint8_t *buf)
 
 bool fifo_put(fifo_t *fifo, uint8_t c)
 {
-	int next;
-	
+	unsigned int head = fifo->head;
+
 	// check if FIFO has room
-	next = (fifo->head + 1) % VCOM_FIFO_SIZE;
-	if (next == fifo->tail) {
+	if ((head - fifo->tail) == VCOM_FIFO_SIZE) {
 		// full
 		return false;
 	}
-	
-	fifo->buf[fifo->head] = c;
-	fifo->head = next;
-	
+	FIFO_BARRIER();
+	fifo->buf[head & FIFO_MASK] = c;
+	FIFO_BARRIER();
+	fifo->head = head + 1;
+
 	return true;
 }
 
 
 bool fifo_get(fifo_t *fifo, uint8_t *pc)
 {
-	int next;
-	
+	unsigned int tail = fifo->tail;
+
 	// check if FIFO has data
-	if (fifo->head == fifo->tail) {
+	if (fifo->head == tail) {
 		return false;
 	}
-	
-	next = (fifo->tail + 1) % VCOM_FIFO_SIZE;
-	
-	*pc = fifo->buf[fifo->tail];
-	fifo->tail = next;
+	FIFO_BARRIER();
+	*pc = fifo->buf[tail & FIFO_MASK];
+	FIFO_BARRIER();
+	fifo->tail = tail + 1;
 
 	return true;
 }
@@ -74,12 +114,149 @@ bool fifo_get(fifo_t *fifo, uint8_t *pc)
 
 int fifo_avail(fifo_t *fifo)
 {
-	return (VCOM_FIFO_SIZE + fifo->head - fifo->tail) % VCOM_FIFO_SIZE;
+	return fifo->head - fifo->tail;
 }
 
 
 int fifo_free(fifo_t *fifo)
 {
-	return (VCOM_FIFO_SIZE - 1 - fifo_avail(fifo));
+	return VCOM_FIFO_SIZE - fifo_avail(fifo);
+}
+
+
+/**
+	Finds the contiguous free space at the head of the FIFO.
+	Only the producer may call this.
+
+	@param [in]		fifo	The FIFO
+	@param [out]	ppbData	Start of the free space
+
+	@return number of bytes that can be written at *ppbData, see fifo_commit
+ */
+int fifo_reserve(fifo_t *fifo, uint8_t **ppbData)
+{
+	unsigned int	head = fifo->head;
+	int				iFree, iEnd;
+
+	iFree = VCOM_FIFO_SIZE - (head - fifo->tail);
+	FIFO_BARRIER();
+	iEnd = VCOM_FIFO_SIZE - (head & FIFO_MASK);
+	*ppbData = &fifo->buf[head & FIFO_MASK];
+	return (iFree < iEnd) ? iFree : iEnd;
+}
+
+
+/**
+	Adds bytes written into the space from fifo_reserve to the FIFO
+
+	@param [in]	fifo	The FIFO
+	@param [in]	iLen	Number of bytes written, at most what fifo_reserve
+						returned, or up to VCOM_FIFO_SLACK more if the buffer
+						has that much slack and fifo_free allows
+ */
+void fifo_commit(fifo_t *fifo, int iLen)
+{
+	int iOver;
+
+	// wrap what went into the slack, that part of the buffer is free
+	iOver = (fifo->head & FIFO_MASK) + iLen - VCOM_FIFO_SIZE;
+	if (iOver > 0) {
+		memcpy(fifo->buf, fifo->buf + VCOM_FIFO_SIZE, iOver);
+	}
+	FIFO_BARRIER();
+	fifo->head += iLen;
+}
+
+
+/**
+	Finds the contiguous data at the tail of the FIFO.
+	Only the consumer may call this.
+
+	@param [in]		fifo	The FIFO
+	@param [out]	ppbData	Start of the data
+
+	@return number of bytes that can be read at *ppbData, see fifo_consume
+ */
+int fifo_peek(fifo_t *fifo, uint8_t **ppbData)
+{
+	unsigned int	tail = fifo->tail;
+	int				iAvail, iEnd;
+
+	iAvail = fifo->head - tail;
+	FIFO_BARRIER();
+	iEnd = VCOM_FIFO_SIZE - (tail & FIFO_MASK);
+	*ppbData = &fifo->buf[tail & FIFO_MASK];
+	return (iAvail < iEnd) ? iAvail : iEnd;
+}
+
+
+/**
+	Removes bytes from the FIFO that were read from the span from fifo_peek
+
+	@param [in]	fifo	The FIFO
+	@param [in]	iLen	Number of bytes read, at most what fifo_peek returned
+ */
+void fifo_consume(fifo_t *fifo, int iLen)
+{
+	FIFO_BARRIER();
+	fifo->tail += iLen;
+}
+
+
+/**
+	Copies as much data into the FIFO as fits
+
+	@param [in]	fifo	The FIFO
+	@param [in]	pbData	Data to write
+	@param [in]	iLen	Number of bytes to write
+
+	@return number of bytes written
+ */
+int fifo_write(fifo_t *fifo, const uint8_t *pbData, int iLen)
+{
+	uint8_t	*pbSpan;
+	int		iSpan, iDone;
+
+	for (iDone = 0; iDone < iLen; iDone += iSpan) {
+		iSpan = fifo_reserve(fifo, &pbSpan);
+		if (iSpan == 0) {
+			break;
+		}
+		if (iSpan > (iLen - iDone)) {
+			iSpan = iLen - iDone;
+		}
+		memcpy(pbSpan, pbData + iDone, iSpan);
+		fifo_commit(fifo, iSpan);
+	}
+	return iDone;
+}
+
+
+/**
+	Copies up to iLen bytes out of the FIFO
+
+	@param [in]		fifo	The FIFO
+	@param [out]	pbData	Buffer for the data
+	@param [in]		iLen	Size of pbData
+
+	@return number of bytes read
+ */
+int fifo_read(fifo_t *fifo, uint8_t *pbData, int iLen)
+{
+	uint8_t	*pbSpan;
+	int		iSpan, iDone;
+
+	for (iDone = 0; iDone < iLen; iDone += iSpan) {
+		iSpan = fifo_peek(fifo, &pbSpan);
+		if (iSpan == 0) {
+			break;
+		}
+		if (iSpan > (iLen - iDone)) {
+			iSpan = iLen - iDone;
+		}
+		memcpy(pbData + iDone, pbSpan, iSpan);
+		fifo_consume(fifo, iSpan);
+	}
+	return iDone;
 }
 
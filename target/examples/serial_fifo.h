@@ -25,14 +25,20 @@
 	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+/**
+	@file
+	Single-producer, single-consumer byte FIFO, see serial_fifo.c.
+*/
+
 #include <stdint.h>
 #include <stdbool.h>
 
-#define VCOM_FIFO_SIZE	128
+#define VCOM_FIFO_SIZE	128		/**< bytes, must be a power of two */
+#define VCOM_FIFO_SLACK	64		/**< optional bytes after the buffer, see fifo_commit */
 
 typedef struct {
-	int		head;
-	int 	tail;
+	volatile unsigned int	head;	/**< bytes ever written, only the producer changes it */
+	volatile unsigned int	tail;	/**< bytes ever read, only the consumer changes it */
 	uint8_t		*buf;
 } fifo_t;
 
@@ -41,3 +47,11 @@ bool fifo_put(fifo_t *fifo, uint8_t c);
 bool fifo_get(fifo_t *fifo, uint8_t *pc);
 int  fifo_avail(fifo_t *fifo);
 int	 fifo_free(fifo_t *fifo);
+
+// contiguous spans, for copying whole packets
+int  fifo_reserve(fifo_t *fifo, uint8_t **ppbData);
+void fifo_commit(fifo_t *fifo, int iLen);
+int  fifo_peek(fifo_t *fifo, uint8_t **ppbData);
+void fifo_consume(fifo_t *fifo, int iLen);
+int  fifo_write(fifo_t *fifo, const uint8_t *pbData, int iLen);
+int  fifo_read(fifo_t *fifo, uint8_t *pbData, int iLen);
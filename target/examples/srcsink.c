@@ -0,0 +1,523 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file
+	Source/sink and loopback test function, like gadget zero on Linux.
+
+	In source/sink mode, the bulk IN endpoint sends an endless pattern
+	stream (see pattern.c) and data from the bulk OUT endpoint is checked
+	against the same pattern, each direction with its own stream. In
+	loopback mode, packets from the OUT endpoint are checked, kept in a
+	small queue and sent back on the IN endpoint, where they are checked
+	once more to catch corruption inside the device.
+
+	The host selects the mode and the pattern with a vendor request, which
+	starts both streams from the beginning and clears the counters. The
+	counters can be read at any time, they wrap at 4 GB.
+
+	Packets that were already in the IN endpoint buffers when the mode
+	changed still belong to the old stream. The new stream always starts
+	at the start of a packet, so the host skips IN packets until one
+	starts with the first word of the pattern, and starts over if one of
+	the next few packets does too.
+
+	When the loopback queue is full, OUT packets stay in the endpoint and
+	the host sees NAKs, so no data is dropped.
+
+	For latency measurements, echo mode sends bulk OUT packets back like
+	loopback mode, without checking them. The interrupt endpoints always
+	echo, and a vendor request answers on the control pipe. Echoed data
+	carries the USB frame number at which the device received it and at
+	which it sent it back, see srcsink.h, so the host can tell how much of
+	a round trip is spent waiting for frames and how much in the device.
+
+	Alternate setting 1 adds a pair of isoc endpoints for streaming tests.
+	Isoc endpoints do not interrupt, so both are served from the frame
+	handler: every frame, the IN endpoint gets a packet with the next
+	sequence number and the current frame number, and the packet that the
+	host sent in the previous frame is checked. The host sends its OUT
+	packets numbered the same way. Dropped and duplicated sequence numbers
+	are counted, as are packets that arrive after a frame without one,
+	meaning the host did not keep up the stream.
+
+	One more vendor request reads out the event trace of the stack, see
+	usbtrace.c, which is empty unless the stack is built with USB_TRACE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "debug.h"
+
+#include "usbapi.h"
+#include "usbtrace.h"
+
+#include "pattern.h"
+#include "srcsink.h"
+
+#ifndef MIN
+#define MIN(a,b)	((a)<(b)?(a):(b))
+#endif
+
+#define MAX_PACKET		64		/**< largest bulk or interrupt packet */
+#define LOOP_PACKETS	8		/**< packets in the loopback queue */
+
+/** Loopback queue entry */
+typedef struct {
+	uint8_t		abData[MAX_PACKET];
+	int			iLen;
+} TLoopPacket;
+
+static int				iMode;
+static TPattern			InPattern;
+static TPattern			OutPattern;
+static TSrcSinkStats	Stats;
+
+static TLoopPacket		aLoop[LOOP_PACKETS];
+static int				iLoopHead;
+static int				iLoopCount;
+
+static uint16_t			wFrame;		/**< last frame number seen */
+
+static bool				fIsoc;			/**< alternate setting 1 is selected */
+static int				iIsocInSize;	/**< isoc IN packet size, 0 = off */
+static uint32_t			dwIsocInSeq;	/**< next isoc IN sequence number */
+static uint32_t			dwIsocOutSeq;	/**< expected isoc OUT sequence number */
+static bool				fIsocOutSync;	/**< dwIsocOutSeq is known */
+static bool				fIsocOutGap;	/**< a frame went by without OUT packet */
+static TSrcSinkIsocStats	IsocStats;
+static uint8_t			abIsoc[SRCSINK_ISOC_MAX_PACKET] __attribute__ ((aligned(4)));
+
+
+/**
+	Local function to stamp an echoed packet with the current frame number
+
+	@param [in]	pbData		Packet data
+	@param [in]	iLen		Packet length
+	@param [in]	iOffset		SRCSINK_ECHO_RX_FRAME or SRCSINK_ECHO_TX_FRAME
+ */
+static void StampFrame(uint8_t *pbData, int iLen, int iOffset)
+{
+	if (iLen >= SRCSINK_ECHO_HDR_SIZE) {
+		pbData[iOffset] = wFrame & 0xFF;
+		pbData[iOffset + 1] = wFrame >> 8;
+	}
+}
+
+
+/**
+	Local function to keep the IN endpoint full of pattern data
+ */
+static void SourceData(void)
+{
+	uint8_t	abData[MAX_PACKET];
+	int		iLen;
+
+	iLen = USBHwEPGetMaxPacketSize(SRCSINK_IN_EP);
+	if (iLen > MAX_PACKET) {
+		iLen = MAX_PACKET;
+	}
+	while ((USBHwEPGetStatus(SRCSINK_IN_EP) & EP_STATUS_DATA) == 0) {
+		PatternFill(&InPattern, abData, iLen);
+		USBHwEPWrite(SRCSINK_IN_EP, abData, iLen);
+		Stats.dwInBytes += iLen;
+	}
+}
+
+
+/**
+	Local function to check all data received on the OUT endpoint
+ */
+static void SinkData(void)
+{
+	uint8_t	abData[MAX_PACKET];
+	int		iLen;
+
+	while ((USBHwEPGetStatus(SRCSINK_OUT_EP) & EP_STATUS_DATA) != 0) {
+		iLen = USBHwEPRead(SRCSINK_OUT_EP, abData, sizeof(abData));
+		if (iLen < 0) {
+			break;
+		}
+		Stats.dwOutBytes += iLen;
+		Stats.dwOutErrors += PatternCheck(&OutPattern, abData, iLen);
+	}
+}
+
+
+/**
+	Local function to move packets from the OUT endpoint through the
+	loopback queue to the IN endpoint, for as long as there is room.
+	In echo mode, the data is stamped instead of checked.
+ */
+static void LoopData(void)
+{
+	TLoopPacket	*pPacket;
+	bool		fMoved;
+
+	do {
+		fMoved = false;
+		// send queued packets while the IN endpoint has room
+		if ((iLoopCount > 0) && ((USBHwEPGetStatus(SRCSINK_IN_EP) & EP_STATUS_DATA) == 0)) {
+			pPacket = &aLoop[iLoopHead];
+			if (iMode == SRCSINK_MODE_ECHO) {
+				StampFrame(pPacket->abData, pPacket->iLen, SRCSINK_ECHO_TX_FRAME);
+			}
+			else {
+				Stats.dwInErrors += PatternCheck(&InPattern, pPacket->abData, pPacket->iLen);
+			}
+			USBHwEPWrite(SRCSINK_IN_EP, pPacket->abData, pPacket->iLen);
+			Stats.dwInBytes += pPacket->iLen;
+			iLoopHead = (iLoopHead + 1) % LOOP_PACKETS;
+			iLoopCount--;
+			fMoved = true;
+		}
+		// receive packets while the queue has room
+		if ((iLoopCount < LOOP_PACKETS) && ((USBHwEPGetStatus(SRCSINK_OUT_EP) & EP_STATUS_DATA) != 0)) {
+			pPacket = &aLoop[(iLoopHead + iLoopCount) % LOOP_PACKETS];
+			pPacket->iLen = USBHwEPRead(SRCSINK_OUT_EP, pPacket->abData, sizeof(pPacket->abData));
+			if (pPacket->iLen >= 0) {
+				Stats.dwOutBytes += pPacket->iLen;
+				if (iMode == SRCSINK_MODE_ECHO) {
+					StampFrame(pPacket->abData, pPacket->iLen, SRCSINK_ECHO_RX_FRAME);
+				}
+				else {
+					Stats.dwOutErrors += PatternCheck(&OutPattern, pPacket->abData, pPacket->iLen);
+				}
+				iLoopCount++;
+				fMoved = true;
+			}
+		}
+	} while (fMoved);
+}
+
+
+/**
+	Local function to echo a packet from the interrupt OUT endpoint on
+	the interrupt IN endpoint. The packet stays in the OUT endpoint until
+	the IN endpoint is free, so there is no need for a queue.
+ */
+static void EchoInterrupt(void)
+{
+	uint8_t	abData[MAX_PACKET];
+	int		iLen;
+
+	if (((USBHwEPGetStatus(SRCSINK_INT_IN_EP) & EP_STATUS_DATA) != 0) ||
+		((USBHwEPGetStatus(SRCSINK_INT_OUT_EP) & EP_STATUS_DATA) == 0)) {
+		return;
+	}
+	iLen = USBHwEPRead(SRCSINK_INT_OUT_EP, abData, sizeof(abData));
+	if (iLen < 0) {
+		return;
+	}
+	StampFrame(abData, iLen, SRCSINK_ECHO_RX_FRAME);
+	StampFrame(abData, iLen, SRCSINK_ECHO_TX_FRAME);
+	USBHwEPWrite(SRCSINK_INT_IN_EP, abData, iLen);
+}
+
+
+/**
+	Local function to restart both isoc streams and clear their counters
+ */
+static void IsocReset(void)
+{
+	dwIsocInSeq = 0;
+	fIsocOutSync = false;
+	fIsocOutGap = false;
+	memset(&IsocStats, 0, sizeof(IsocStats));
+}
+
+
+/**
+	Local function to write the next sequence-stamped packet to the isoc
+	IN endpoint. It goes out in the next frame, if the host asks for it.
+ */
+static void IsocIn(void)
+{
+	int	i;
+
+	if (iIsocInSize == 0) {
+		return;
+	}
+	abIsoc[SRCSINK_ISOC_SEQ] = dwIsocInSeq & 0xFF;
+	abIsoc[SRCSINK_ISOC_SEQ + 1] = (dwIsocInSeq >> 8) & 0xFF;
+	abIsoc[SRCSINK_ISOC_SEQ + 2] = (dwIsocInSeq >> 16) & 0xFF;
+	abIsoc[SRCSINK_ISOC_SEQ + 3] = dwIsocInSeq >> 24;
+	abIsoc[SRCSINK_ISOC_FRAME] = wFrame & 0xFF;
+	abIsoc[SRCSINK_ISOC_FRAME + 1] = wFrame >> 8;
+	abIsoc[SRCSINK_ISOC_LEN] = iIsocInSize & 0xFF;
+	abIsoc[SRCSINK_ISOC_LEN + 1] = iIsocInSize >> 8;
+	for (i = SRCSINK_ISOC_HDR_SIZE; i < iIsocInSize; i++) {
+		abIsoc[i] = dwIsocInSeq + i;
+	}
+	USBHwEPWrite(SRCSINK_ISOC_IN_EP, abIsoc, iIsocInSize);
+	dwIsocInSeq++;
+	IsocStats.dwInPackets++;
+}
+
+
+/**
+	Local function to check the packet received on the isoc OUT endpoint
+	in the previous frame, if any
+ */
+static void IsocOut(void)
+{
+	uint32_t	dwSeq;
+	int			i, iLen;
+
+	iLen = USBHwISOCEPRead(SRCSINK_ISOC_OUT_EP, abIsoc, sizeof(abIsoc));
+	if (iLen < 0) {
+		fIsocOutGap = fIsocOutSync;
+		return;
+	}
+	IsocStats.dwOutPackets++;
+	if ((iLen < SRCSINK_ISOC_HDR_SIZE) ||
+		((abIsoc[SRCSINK_ISOC_LEN] | (abIsoc[SRCSINK_ISOC_LEN + 1] << 8)) != iLen)) {
+		IsocStats.dwOutErrors++;
+		return;
+	}
+	dwSeq = abIsoc[SRCSINK_ISOC_SEQ] | (abIsoc[SRCSINK_ISOC_SEQ + 1] << 8) |
+			(abIsoc[SRCSINK_ISOC_SEQ + 2] << 16) | ((uint32_t)abIsoc[SRCSINK_ISOC_SEQ + 3] << 24);
+	if (fIsocOutSync && ((int32_t)(dwSeq - dwIsocOutSeq) < 0)) {
+		IsocStats.dwOutDuplicated++;
+		return;
+	}
+	if (fIsocOutSync && (dwSeq != dwIsocOutSeq)) {
+		IsocStats.dwOutDropped += dwSeq - dwIsocOutSeq;
+	}
+	else if (fIsocOutGap) {
+		IsocStats.dwOutLate++;
+	}
+	dwIsocOutSeq = dwSeq + 1;
+	fIsocOutSync = true;
+	fIsocOutGap = false;
+	for (i = SRCSINK_ISOC_HDR_SIZE; i < iLen; i++) {
+		if (abIsoc[i] != (uint8_t)(dwSeq + i)) {
+			IsocStats.dwOutErrors++;
+			break;
+		}
+	}
+}
+
+
+/**
+	Local function to select a mode and pattern, starting both streams
+	from the beginning
+ */
+static bool SrcSinkSetMode(int iNewMode, EPattern ePattern)
+{
+	if ((iNewMode < SRCSINK_MODE_SOURCE_SINK) || (iNewMode > SRCSINK_MODE_ECHO) ||
+		(ePattern > ePatternPRBS)) {
+		return false;
+	}
+	DBG("Mode %d, pattern %d\n", iNewMode, ePattern);
+	iMode = iNewMode;
+	PatternInit(&InPattern, ePattern);
+	PatternInit(&OutPattern, ePattern);
+	memset(&Stats, 0, sizeof(Stats));
+	iLoopHead = 0;
+	iLoopCount = 0;
+	if (iMode == SRCSINK_MODE_SOURCE_SINK) {
+		SourceData();
+	}
+	return true;
+}
+
+
+/**
+	Initialises the test function in source/sink mode with the counter
+	pattern
+ */
+void SrcSinkInit(void)
+{
+	iMode = SRCSINK_MODE_SOURCE_SINK;
+	PatternInit(&InPattern, ePatternCounter);
+	PatternInit(&OutPattern, ePatternCounter);
+	memset(&Stats, 0, sizeof(Stats));
+	iLoopHead = 0;
+	iLoopCount = 0;
+	fIsoc = false;
+	iIsocInSize = SRCSINK_ISOC_MAX_PACKET;
+	IsocReset();
+}
+
+
+/**
+	Handles the vendor requests of the test function
+
+	@param [in]		pSetup		The setup packet
+	@param [in,out]	*piLen		Pointer to data length
+	@param [in,out]	ppbData		Data buffer, SRCSINK_REQ_DATA_SIZE bytes
+
+	@return true if the request was handled successfully
+ */
+bool SrcSinkHandleRequest(TSetupPacket *pSetup, int *piLen, uint8_t **ppbData)
+{
+	switch (pSetup->bRequest) {
+
+	case SRCSINK_REQ_SET_MODE:
+		*piLen = 0;
+		return SrcSinkSetMode(pSetup->wValue, pSetup->wIndex);
+
+	case SRCSINK_REQ_GET_STATS:
+		memcpy(*ppbData, &Stats, sizeof(Stats));
+		*piLen = sizeof(Stats);
+		break;
+
+	case SRCSINK_REQ_CLEAR_STATS:
+		memset(&Stats, 0, sizeof(Stats));
+		*piLen = 0;
+		break;
+
+	case SRCSINK_REQ_ECHO:
+		// answer with the frame number, twice, and wValue and wIndex
+		*piLen = MIN(pSetup->wLength, SRCSINK_REQ_DATA_SIZE);
+		memset(*ppbData, 0, *piLen);
+		StampFrame(*ppbData, *piLen, SRCSINK_ECHO_RX_FRAME);
+		StampFrame(*ppbData, *piLen, SRCSINK_ECHO_TX_FRAME);
+		if (*piLen >= (SRCSINK_ECHO_HDR_SIZE + 4)) {
+			(*ppbData)[4] = pSetup->wValue & 0xFF;
+			(*ppbData)[5] = pSetup->wValue >> 8;
+			(*ppbData)[6] = pSetup->wIndex & 0xFF;
+			(*ppbData)[7] = pSetup->wIndex >> 8;
+		}
+		break;
+
+	case SRCSINK_REQ_SINK:
+		// data is thrown away, for control transfer rate measurements
+		*piLen = 0;
+		break;
+
+	case SRCSINK_REQ_SET_ISOC:
+		if ((pSetup->wValue != 0) &&
+			((pSetup->wValue < SRCSINK_ISOC_HDR_SIZE) || (pSetup->wValue > SRCSINK_ISOC_MAX_PACKET))) {
+			return false;
+		}
+		iIsocInSize = pSetup->wValue;
+		IsocReset();
+		*piLen = 0;
+		break;
+
+	case SRCSINK_REQ_GET_ISOC_STATS:
+		memcpy(*ppbData, &IsocStats, sizeof(IsocStats));
+		*piLen = sizeof(IsocStats);
+		break;
+
+	case SRCSINK_REQ_GET_TRACE:
+		return USBTraceHandleRequest(pSetup, piLen, ppbData);
+
+	default:
+		DBG("Unhandled vendor req %X\n", pSetup->bRequest);
+		return false;
+	}
+	return true;
+}
+
+
+/**
+	Handles the bulk IN endpoint
+
+	@param [in]	bEP			Endpoint number
+	@param [in]	bEPStatus	Endpoint status (indicates NAK, STALL, etc)
+ */
+void SrcSinkBulkIn(uint8_t bEP, uint8_t bEPStatus)
+{
+	if (bEPStatus & EP_STATUS_STALLED) {
+		return;
+	}
+	if (iMode == SRCSINK_MODE_SOURCE_SINK) {
+		SourceData();
+	}
+	else {
+		LoopData();
+	}
+}
+
+
+/**
+	Handles the bulk OUT endpoint
+
+	@param [in]	bEP			Endpoint number
+	@param [in]	bEPStatus	Endpoint status (indicates NAK, STALL, etc)
+ */
+void SrcSinkBulkOut(uint8_t bEP, uint8_t bEPStatus)
+{
+	if (bEPStatus & EP_STATUS_STALLED) {
+		return;
+	}
+	if (iMode == SRCSINK_MODE_SOURCE_SINK) {
+		SinkData();
+	}
+	else {
+		LoopData();
+	}
+}
+
+
+/**
+	Handles the interrupt IN and OUT endpoints
+
+	@param [in]	bEP			Endpoint number
+	@param [in]	bEPStatus	Endpoint status (indicates NAK, STALL, etc)
+ */
+void SrcSinkIntEcho(uint8_t bEP, uint8_t bEPStatus)
+{
+	if (bEPStatus & EP_STATUS_STALLED) {
+		return;
+	}
+	EchoInterrupt();
+}
+
+
+/**
+	Keeps track of the frame number, for the echo time stamps, and serves
+	the isoc endpoints
+
+	@param [in]	wFrameNr	Frame number from the start of frame packet
+ */
+void SrcSinkFrame(uint16_t wFrameNr)
+{
+	wFrame = wFrameNr;
+	if (fIsoc) {
+		IsocOut();
+		IsocIn();
+	}
+}
+
+
+/**
+	Starts the isoc streams from the beginning when alternate setting 1 is
+	selected, and stops them when going back to setting 0
+
+	@param [in]	bInterface		Interface number
+	@param [in]	bAltSetting		Alternate setting number
+ */
+void SrcSinkSetInterface(uint8_t bInterface, uint8_t bAltSetting)
+{
+	fIsoc = (bAltSetting == 1);
+	IsocReset();
+}
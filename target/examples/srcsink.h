@@ -0,0 +1,99 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	Source/sink and loopback test function, see srcsink.c.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "usbstruct.h"
+
+#define SRCSINK_IN_EP		0x82
+#define SRCSINK_OUT_EP		0x05
+#define SRCSINK_INT_IN_EP	0x81
+#define SRCSINK_INT_OUT_EP	0x04
+#define SRCSINK_ISOC_IN_EP	0x83	/**< alternate setting 1 only */
+#define SRCSINK_ISOC_OUT_EP	0x06	/**< alternate setting 1 only */
+
+#define SRCSINK_ISOC_MAX_PACKET	256	/**< both isoc endpoints fit in LPC214x EP RAM */
+
+// vendor requests
+#define SRCSINK_REQ_SET_MODE	0x10	/**< wValue = mode, wIndex = pattern */
+#define SRCSINK_REQ_GET_STATS	0x11	/**< returns TSrcSinkStats */
+#define SRCSINK_REQ_CLEAR_STATS	0x12
+#define SRCSINK_REQ_ECHO		0x13	/**< returns an echo header, wValue and wIndex */
+#define SRCSINK_REQ_SINK		0x14	/**< takes up to SRCSINK_REQ_DATA_SIZE bytes */
+#define SRCSINK_REQ_SET_ISOC	0x15	/**< wValue = isoc IN packet size, 0 = off */
+#define SRCSINK_REQ_GET_ISOC_STATS	0x16	/**< returns TSrcSinkIsocStats */
+#define SRCSINK_REQ_GET_TRACE	0x17	/**< returns the oldest trace records, see usbtrace.h */
+
+#define SRCSINK_REQ_DATA_SIZE	64		/**< size of the vendor request data store */
+
+// modes
+#define SRCSINK_MODE_SOURCE_SINK	0	/**< IN sends the pattern, OUT checks it */
+#define SRCSINK_MODE_LOOPBACK		1	/**< OUT data is checked and sent back on IN */
+#define SRCSINK_MODE_ECHO			2	/**< OUT data is stamped and sent back on IN */
+
+// echo header, frame numbers at the start of echoed data (little endian)
+#define SRCSINK_ECHO_RX_FRAME	0		/**< frame in which the data was received */
+#define SRCSINK_ECHO_TX_FRAME	2		/**< frame in which it was sent back */
+#define SRCSINK_ECHO_HDR_SIZE	4
+
+// isoc packet header, followed by (sequence number + i) & 0xFF (little endian)
+#define SRCSINK_ISOC_SEQ		0		/**< 32-bit sequence number, one per packet */
+#define SRCSINK_ISOC_FRAME		4		/**< IN: frame in which the device wrote it */
+#define SRCSINK_ISOC_LEN		6		/**< length of the whole packet */
+#define SRCSINK_ISOC_HDR_SIZE	8
+
+/** Counters, as returned by SRCSINK_REQ_GET_STATS (little endian) */
+typedef struct {
+	uint32_t	dwOutBytes;		/**< bytes received */
+	uint32_t	dwOutErrors;	/**< bytes received that did not match the pattern */
+	uint32_t	dwInBytes;		/**< bytes sent */
+	uint32_t	dwInErrors;		/**< looped back bytes that no longer matched when sent */
+} TSrcSinkStats;
+
+/** Isoc counters, as returned by SRCSINK_REQ_GET_ISOC_STATS (little endian) */
+typedef struct {
+	uint32_t	dwInPackets;		/**< packets written to the IN endpoint */
+	uint32_t	dwOutPackets;		/**< packets received */
+	uint32_t	dwOutDropped;		/**< sequence numbers that never arrived */
+	uint32_t	dwOutDuplicated;	/**< packets with an old sequence number */
+	uint32_t	dwOutLate;			/**< packets that came after one or more empty frames */
+	uint32_t	dwOutErrors;		/**< packets with a bad header or payload */
+} TSrcSinkIsocStats;
+
+void SrcSinkInit(void);
+bool SrcSinkHandleRequest(TSetupPacket *pSetup, int *piLen, uint8_t **ppbData);
+void SrcSinkBulkIn(uint8_t bEP, uint8_t bEPStatus);
+void SrcSinkBulkOut(uint8_t bEP, uint8_t bEPStatus);
+void SrcSinkIntEcho(uint8_t bEP, uint8_t bEPStatus);
+void SrcSinkFrame(uint16_t wFrameNr);
+void SrcSinkSetInterface(uint8_t bInterface, uint8_t bAltSetting);
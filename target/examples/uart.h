@@ -0,0 +1,61 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	UART hardware interface, see lpc2000_uart.c.
+
+	This is the part of the UART that a buffered driver needs: line
+	format, status, one character in or out, and an interrupt for
+	received data and for an empty transmitter. Host builds replace it
+	with a simulated UART.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define UART_HW_FIFO	16		/**< depth of the transmit and receive FIFOs */
+
+// line status bits, as returned by UARTGetStatus
+#define UART_LSR_RDR	(1<<0)	/**< received data ready */
+#define UART_LSR_OE		(1<<1)	/**< overrun, characters were lost */
+#define UART_LSR_PE		(1<<2)	/**< parity error in the next character */
+#define UART_LSR_FE		(1<<3)	/**< framing error in the next character */
+#define UART_LSR_BI		(1<<4)	/**< break received */
+#define UART_LSR_THRE	(1<<5)	/**< transmit FIFO empty */
+#define UART_LSR_TEMT	(1<<6)	/**< transmitter completely idle */
+
+/** Interrupt callback, for received data or an empty transmit FIFO */
+typedef void (TFnUARTIntHandler)(int iUart);
+
+void	UARTInit(int iUart, TFnUARTIntHandler *pfnHandler);
+bool	UARTSetFormat(int iUart, uint32_t dwBaud, int iDataBits, int iParity, int iStopBits);
+
+uint8_t	UARTGetStatus(int iUart);
+uint8_t	UARTRead(int iUart);
+void	UARTWrite(int iUart, uint8_t b);
+void	UARTTxIntEnable(int iUart, bool fEnable);
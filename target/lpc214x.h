@@ -53,6 +53,10 @@
 #define U0LCR		*(volatile unsigned int *)0xE000C00C
 #define U0LSR		*(volatile unsigned int *)0xE000C014
 
+/* UART0 and UART1 have the same register layout, from these base addresses */
+#define UART0_BASE_ADDR	0xE000C000
+#define UART1_BASE_ADDR	0xE0010000
+
 /* SPI0 (Serial Peripheral Interface 0) */
 #define S0SPCR			*(volatile unsigned int *)0xE0020000
 #define S0SPSR			*(volatile unsigned int *)0xE0020004
@@ -81,6 +85,11 @@
 #define VICVectAddr0	*(volatile unsigned int *)0xFFFFF100
 #define VICVectCntl0	*(volatile unsigned int *)0xFFFFF200
 
+/* Timer 1 */
+#define T1TCR			*(volatile unsigned int *)0xE0008004
+#define T1TC			*(volatile unsigned int *)0xE0008008
+#define T1PR			*(volatile unsigned int *)0xE000800C
+
 /* Common LPC2148 definitions, related to USB */
 #define	PCONP			*(volatile unsigned int *)0xE01FC0C4
 #define	PLL1CON			*(volatile unsigned int *)0xE01FC0A0
@@ -76,6 +76,8 @@ void USBHwConnect		(bool fConnect);
 int  USBHwEPRead		(uint8_t bEP, uint8_t *pbBuf, int iMaxLen);
 int	 USBHwEPWrite		(uint8_t bEP, uint8_t *pbBuf, int iLen);
 void USBHwEPStall		(uint8_t bEP, bool fStall);
+uint8_t USBHwEPGetStatus	(uint8_t bEP);
+uint16_t USBHwEPGetMaxPacketSize	(uint8_t bEP);
 int  USBHwISOCEPRead    (const uint8_t bEP, uint8_t *pbBuf, const int iMaxLen);
 
 /** Endpoint interrupt handler callback */
@@ -103,6 +105,10 @@ typedef bool (TFnHandleRequest)(TSetupPacket *pSetup, int *piLen, uint8_t **ppbD
 void USBRegisterRequestHandler(int iType, TFnHandleRequest *pfnHandler, uint8_t *pbDataStore);
 void USBRegisterCustomReqHandler(TFnHandleRequest *pfnHandler);
 
+/** Alternate setting callback, called after SET_INTERFACE */
+typedef void (TFnSetInterface)(uint8_t bInterface, uint8_t bAltSetting);
+void USBRegisterSetInterfaceHandler(TFnSetInterface *pfnHandler);
+
 /** Descriptor handler callback */
 typedef bool (TFnGetDescriptor)(uint16_t wTypeIndex, uint16_t wLangID, int *piLen, uint8_t **ppbData);
 
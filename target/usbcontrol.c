@@ -56,6 +56,7 @@
 
 #include "usbstruct.h"
 #include "usbapi.h"
+#include "usbtrace.h"
 
 #ifndef MIN
 #define MIN(a,b)	((a)<(b)?(a):(b))
@@ -69,6 +70,7 @@ static TSetupPacket		Setup;	/**< setup packet */
 static uint8_t				*pbData;	/**< pointer to data buffer */
 static int				iResidue;	/**< remaining bytes in buffer */
 static int				iLen;		/**< total length of control transfer */
+static bool				fDataIn;	/**< IN data or status still to be sent */
 
 /** Array of installed request handler callbacks */
 static TFnHandleRequest *apfnReqHandlers[4] = {NULL, NULL, NULL, NULL};
@@ -128,16 +130,27 @@ static void StallControlPipe(uint8_t bEPStat)
 
 
 /**
-	Sends next chunk of data (possibly 0 bytes) to host
+	Sends next chunk of data (possibly 0 bytes) to host.
+
+	A short packet ends the IN stage, and so does a full packet that
+	completes the length the host asked for. After that, the interrupt
+	for the last packet has nothing left to send, so a request that fits
+	in one packet takes exactly one write.
  */
 static void DataIn(void)
 {
 	int iChunk;
 
+	if (!fDataIn) {
+		return;
+	}
 	iChunk = MIN(MAX_PACKET_SIZE0, iResidue);
 	USBHwEPWrite(0x80, pbData, iChunk);
 	pbData += iChunk;
 	iResidue -= iChunk;
+	if ((iChunk < MAX_PACKET_SIZE0) || ((iResidue == 0) && (iLen == Setup.wLength))) {
+		fDataIn = false;
+	}
 }
 
 
@@ -156,13 +169,16 @@ void USBHandleControlTransfer(uint8_t bEP, uint8_t bEPStat)
 		if (bEPStat & EP_STATUS_SETUP) {
 			// setup packet, reset request message state machine
 			USBHwEPRead(0x00, (uint8_t *)&Setup, sizeof(Setup));
-			DBG("S%x", Setup.bRequest);
+			TRACE(TRACE_SETUP, 0x00, 0,
+				Setup.bmRequestType | (Setup.bRequest << 8) | ((uint32_t)Setup.wValue << 16),
+				Setup.wIndex | ((uint32_t)Setup.wLength << 16));
 
 			// defaults for data pointer and residue
 			iType = REQTYPE_GET_TYPE(Setup.bmRequestType);
 			pbData = apbDataStore[iType];
 			iResidue = Setup.wLength;
 			iLen = Setup.wLength;
+			fDataIn = false;
 
 			if ((Setup.wLength == 0) ||
 				(REQTYPE_GET_DIR(Setup.bmRequestType) == REQTYPE_DIR_TO_HOST)) {
@@ -173,8 +189,10 @@ void USBHandleControlTransfer(uint8_t bEP, uint8_t bEPStat)
 					return;
 				}
 				// send smallest of requested and offered length
-				iResidue = MIN(iLen, Setup.wLength);
+				iLen = MIN(iLen, Setup.wLength);
+				iResidue = iLen;
 				// send first part (possibly a zero-length status message)
+				fDataIn = true;
 				DataIn();
 			}
 		}
@@ -198,6 +216,7 @@ void USBHandleControlTransfer(uint8_t bEP, uint8_t bEPStat)
 						return;
 					}
 					// send status to host
+					fDataIn = true;
 					DataIn();
 				}
 			}
@@ -44,6 +44,7 @@
 #endif
 #include "usbhw_lpc.h"
 #include "usbapi.h"
+#include "usbtrace.h"
 //#include "LPC17xx.h"
 
 
@@ -324,6 +325,20 @@ uint8_t  USBHwEPGetStatus(uint8_t bEP)
 }
 
 
+/**
+    Gets the maximum packet size of an endpoint, as configured by
+    USBHwEPConfig from the endpoint descriptor.
+
+    @param [in] bEP     Endpoint number
+    @return Maximum packet size
+ */
+uint16_t USBHwEPGetMaxPacketSize(uint8_t bEP)
+{
+    LPC_USB->EpInd = EP2IDX(bEP);
+    return LPC_USB->MaxPSize;
+}
+
+
 /**
     Sets the stalled property of an endpoint
 
@@ -334,6 +349,7 @@ void USBHwEPStall(uint8_t bEP, bool fStall)
 {
     int idx = EP2IDX(bEP);
 
+    TRACE(TRACE_STALL, bEP, fStall, 0, 0);
     USBHwCmdWrite(CMD_EP_SET_STATUS | idx, fStall ? EP_ST : 0);
 }
 
@@ -352,6 +368,7 @@ int USBHwEPWrite(uint8_t bEP, uint8_t *pbBuf, int iLen)
     int idx;
 
     idx = EP2IDX(bEP);
+    TRACE(TRACE_EP_WRITE, bEP, iLen, 0, 0);
 
     // set write enable for specific endpoint
     LPC_USB->Ctrl = WR_EN | ((bEP & 0xF) << 2);
@@ -402,11 +419,13 @@ int USBHwEPRead(uint8_t bEP, uint8_t *pbBuf, int iMaxLen)
 
     // packet valid?
     if ((dwLen & DV) == 0) {
+        TRACE(TRACE_EP_READ, bEP, 0xFFFF, 0, 0);
         return -1;
     }
 
     // get length
     dwLen &= PKT_LNGTH_MASK;
+    TRACE(TRACE_EP_READ, bEP, dwLen, 0, 0);
 
     // get data
     dwData = 0;
@@ -546,6 +565,7 @@ void USBHwISR(void)
             bStat = ((bDevStat & CON) ? DEV_STATUS_CONNECT : 0) |
                     ((bDevStat & SUS) ? DEV_STATUS_SUSPEND : 0) |
                     ((bDevStat & RST) ? DEV_STATUS_RESET : 0);
+            TRACE(TRACE_DEV_STATUS, 0, bStat, bDevStat, 0);
             // call handler
             if (_pfnDevIntHandler != NULL) {
                 _pfnDevIntHandler(bStat);
@@ -38,7 +38,7 @@
 	will not be part of this module.
 
 	@todo some requests have to return a request error if device not configured:
-	@todo GET_INTERFACE, GET_STATUS, SET_INTERFACE, SYNCH_FRAME
+	@todo GET_STATUS, SYNCH_FRAME
 	@todo this applies to the following if endpoint != 0:
 	@todo SET_FEATURE, GET_FEATURE 
 */
@@ -53,6 +53,7 @@
 #include "usbhw_lpc.h"
 
 #define MAX_DESC_HANDLERS	4		/**< device, interface, endpoint, other */
+#define MAX_INTERFACES		4		/**< interfaces with alternate settings */
 
 
 /* general descriptor field offsets */
@@ -65,6 +66,7 @@
 #define CONF_DESC_bmAttributes			7	/**< configuration characteristics */
 
 /* interface descriptor field offsets */
+#define INTF_DESC_bInterfaceNumber		2	/**< interface number offset */
 #define INTF_DESC_bAlternateSetting		3	/**< alternate setting offset */
 
 /* endpoint descriptor field offsets */
@@ -74,8 +76,12 @@
 
 /** Currently selected configuration */
 static uint8_t				bConfiguration = 0;
+/** Currently selected alternate setting of each interface */
+static uint8_t				abAltSetting[MAX_INTERFACES];
 /** Installed custom request handler */
 static TFnHandleRequest	*pfnHandleCustomReq = NULL;
+/** Installed alternate setting handler */
+static TFnSetInterface		*pfnSetInterface = NULL;
 /** Pointer to registered descriptors */
 static const uint8_t			*pabDescrip = NULL;
 
@@ -429,10 +435,72 @@ static bool USBSetConfiguration(uint8_t bConfigIndex, uint8_t bAltSetting)
 		USBHwConfigDevice(true);
 	}
 
+	// all interfaces start in their default setting
+	memset(abAltSetting, 0, sizeof(abAltSetting));
+
 	return true;
 }
 
 
+/**
+	Selects an alternate setting of an interface in the current
+	configuration, configuring the endpoints of that setting.
+
+	@param [in]		bInterface		Interface number
+	@param [in]		bAltSetting		Alternate setting number
+
+	@return true if the alternate setting exists, false otherwise
+ */
+static bool USBSetInterface(uint8_t bInterface, uint8_t bAltSetting)
+{
+	uint8_t	*pab;
+	uint8_t	bCurConfig;
+	uint8_t	bEP;
+	uint16_t	wMaxPktSize;
+	bool	fFound, fMatch;
+
+	ASSERT(pabDescrip != NULL);
+
+	pab = (uint8_t *)pabDescrip;
+	bCurConfig = 0xFF;
+	fFound = false;
+	fMatch = false;
+
+	while (pab[DESC_bLength] != 0) {
+
+		switch (pab[DESC_bDescriptorType]) {
+
+		case DESC_CONFIGURATION:
+			bCurConfig = pab[CONF_DESC_bConfigurationValue];
+			break;
+
+		case DESC_INTERFACE:
+			fMatch = (bCurConfig == bConfiguration) &&
+					(pab[INTF_DESC_bInterfaceNumber] == bInterface) &&
+					(pab[INTF_DESC_bAlternateSetting] == bAltSetting);
+			fFound = fFound || fMatch;
+			break;
+
+		case DESC_ENDPOINT:
+			if (fMatch) {
+				bEP = pab[ENDP_DESC_bEndpointAddress];
+				wMaxPktSize = 	(pab[ENDP_DESC_wMaxPacketSize]) |
+								(pab[ENDP_DESC_wMaxPacketSize + 1] << 8);
+				USBHwEPConfig(bEP, wMaxPktSize);
+			}
+			break;
+
+		default:
+			break;
+		}
+		// skip to next descriptor
+		pab += pab[DESC_bLength];
+	}
+
+	return fFound;
+}
+
+
 /**
 	Local function to handle a standard device request
 		
@@ -461,7 +529,6 @@ static bool HandleStdDeviceReq(TSetupPacket *pSetup, int *piLen, uint8_t **ppbDa
 		break;
 
 	case REQ_GET_DESCRIPTOR:
-		DBG("D%x", pSetup->wValue);
 		return USBGetDescriptor(pSetup->wValue, pSetup->wIndex, piLen, ppbData);
 
 	case REQ_GET_CONFIGURATION:
@@ -529,17 +596,27 @@ static bool HandleStdInterfaceReq(TSetupPacket	*pSetup, int *piLen, uint8_t **pp
 		// not defined for interface
 		return false;
 	
-	case REQ_GET_INTERFACE:	// TODO use bNumInterfaces
-        // there is only one interface, return n-1 (= 0)
-		pbData[0] = 0;
+	case REQ_GET_INTERFACE:
+		if ((bConfiguration == 0) || (pSetup->wIndex >= MAX_INTERFACES)) {
+			return false;
+		}
+		pbData[0] = abAltSetting[pSetup->wIndex];
 		*piLen = 1;
 		break;
 	
-	case REQ_SET_INTERFACE:	// TODO use bNumInterfaces
-		// there is only one interface (= 0)
-		if (pSetup->wValue != 0) {
+	case REQ_SET_INTERFACE:
+		if ((bConfiguration == 0) || (pSetup->wIndex >= MAX_INTERFACES)) {
 			return false;
 		}
+		if (!USBSetInterface(pSetup->wIndex, pSetup->wValue)) {
+			DBG("No alternate setting %d for interface %d\n", pSetup->wValue, pSetup->wIndex);
+			return false;
+		}
+		abAltSetting[pSetup->wIndex] = pSetup->wValue;
+		// let the function switch over to the new setting
+		if (pfnSetInterface != NULL) {
+			pfnSetInterface(pSetup->wIndex, pSetup->wValue);
+		}
 		*piLen = 0;
 		break;
 
@@ -649,3 +726,18 @@ void USBRegisterCustomReqHandler(TFnHandleRequest *pfnHandler)
 	pfnHandleCustomReq = pfnHandler;
 }
 
+
+/**
+	Registers a callback for changes of alternate setting
+
+	The callback is called after a SET_INTERFACE request selected a valid
+	alternate setting and its endpoints have been configured, so the
+	function can install the endpoint handlers for that setting.
+
+	@param [in]	pfnHandler	Callback function pointer
+ */
+void USBRegisterSetInterfaceHandler(TFnSetInterface *pfnHandler)
+{
+	pfnSetInterface = pfnHandler;
+}
+
@@ -226,6 +226,7 @@ typedef struct
 #define DESC_DEVICE_QUALIFIER	6
 #define DESC_OTHER_SPEED		7
 #define DESC_INTERFACE_POWER	8
+#define DESC_INTERFACE_ASSOCIATION	11
 
 
 #define DESC_HID_HID			0x21
@@ -0,0 +1,161 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file
+	Binary event trace.
+
+	Unlike DBG, which formats and prints while the code under test waits,
+	a trace point only stores a timestamp, an event number and a few
+	arguments in a ring, so tracing hardly changes the timing. The stack
+	traces SETUP packets, stalls, endpoint reads and writes and device
+	status changes when it is built with USB_TRACE; the application can
+	add its own events from TRACE_USER on.
+
+	When the ring is full, the oldest records are overwritten, so it
+	always holds what happened last. The ring is read out with
+	USBTraceRead, from the oldest record on, in the same format as
+	USBTraceHandleRequest sends it to the host for a vendor request.
+	host/trace turns this into a timeline.
+
+	Records are written from the USB interrupt. Trace from elsewhere, or
+	call USBTraceRead from outside the USB interrupt, only with that
+	interrupt disabled.
+*/
+
+#include <stddef.h>
+#include <string.h>
+
+#include "usbtrace.h"
+
+static TTraceRecord		aRing[TRACE_SIZE];
+static unsigned int		iHead;		/**< records ever written */
+static unsigned int		iTail;		/**< records ever read */
+static uint32_t			dwLost;
+static TFnTraceClock	*_pfnClock = NULL;
+
+// data of USBTraceHandleRequest, has to stay valid during the transfer
+static uint8_t			abDump[sizeof(TTraceHeader) + TRACE_DUMP_RECORDS * sizeof(TTraceRecord)];
+
+
+/**
+	Sets the clock for the timestamps, and empties the ring
+
+	@param [in] pfnClock	returns the time in us, or NULL for no timestamps
+ */
+void USBTraceInit(TFnTraceClock *pfnClock)
+{
+	_pfnClock = pfnClock;
+	iHead = 0;
+	iTail = 0;
+	dwLost = 0;
+}
+
+
+/**
+	Adds a record to the ring
+
+	@param [in] bEvent	TRACE_*
+	@param [in] bEP		endpoint, if any
+	@param [in] wArg
+	@param [in] dwArg1
+	@param [in] dwArg2
+ */
+void USBTrace(uint8_t bEvent, uint8_t bEP, uint16_t wArg, uint32_t dwArg1, uint32_t dwArg2)
+{
+	TTraceRecord *pRec;
+
+	pRec = &aRing[iHead % TRACE_SIZE];
+	pRec->dwTime = (_pfnClock != NULL) ? _pfnClock() : 0;
+	pRec->bEvent = bEvent;
+	pRec->bEP = bEP;
+	pRec->wArg = wArg;
+	pRec->dwArg1 = dwArg1;
+	pRec->dwArg2 = dwArg2;
+	iHead++;
+}
+
+
+/**
+	Takes the oldest records out of the ring, behind a TTraceHeader
+
+	@param [out] pbBuf
+	@param [in] iMaxLen		size of pbBuf, at least sizeof(TTraceHeader)
+
+	@return the number of bytes in pbBuf
+ */
+int USBTraceRead(uint8_t *pbBuf, int iMaxLen)
+{
+	TTraceHeader Header;
+	int iCount;
+
+	// records that were overwritten are lost
+	if ((iHead - iTail) > TRACE_SIZE) {
+		dwLost += (iHead - iTail) - TRACE_SIZE;
+		iTail = iHead - TRACE_SIZE;
+	}
+
+	iCount = 0;
+	while ((iTail != iHead) && (iCount < 255) &&
+			((int)(sizeof(Header) + (iCount + 1) * sizeof(TTraceRecord)) <= iMaxLen)) {
+		memcpy(pbBuf + sizeof(Header) + iCount * sizeof(TTraceRecord),
+				&aRing[iTail % TRACE_SIZE], sizeof(TTraceRecord));
+		iTail++;
+		iCount++;
+	}
+
+	Header.wMagic = TRACE_MAGIC;
+	Header.bRecordSize = sizeof(TTraceRecord);
+	Header.bCount = iCount;
+	Header.dwLost = dwLost;
+	memcpy(pbBuf, &Header, sizeof(Header));
+	return sizeof(Header) + iCount * sizeof(TTraceRecord);
+}
+
+
+/**
+	Answers a vendor request for the trace with the oldest records, up to
+	TRACE_DUMP_RECORDS at a time. The host repeats the request until a
+	dump is not full, as every request adds a few records of its own.
+	The application picks the request code, and calls this function from
+	its own vendor request handler.
+
+	@param [in]		pSetup		The setup packet
+	@param [in,out]	*piLen		Pointer to data length
+	@param [in,out]	ppbData		Data buffer
+
+	@return true if the request was handled successfully
+ */
+bool USBTraceHandleRequest(TSetupPacket *pSetup, int *piLen, uint8_t **ppbData)
+{
+	if (pSetup->wLength < sizeof(TTraceHeader)) {
+		return false;
+	}
+	*piLen = USBTraceRead(abDump, (pSetup->wLength < sizeof(abDump)) ? pSetup->wLength : sizeof(abDump));
+	*ppbData = abDump;
+	return true;
+}
+
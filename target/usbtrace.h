@@ -0,0 +1,84 @@
+/*
+	LPCUSB, an USB device driver for LPC microcontrollers	
+	Copyright (C) 2006 Bertrik Sikken (bertrik@sikken.nl)
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright
+	   notice, this list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright
+	   notice, this list of conditions and the following disclaimer in the
+	   documentation and/or other materials provided with the distribution.
+	3. The name of the author may not be used to endorse or promote products
+	   derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+	IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+	OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, 
+	INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+	THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+	@file
+	Binary event trace, see usbtrace.c.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "usbstruct.h"
+
+#ifndef TRACE_SIZE
+#define TRACE_SIZE		128		/**< records in the ring, must be a power of two */
+#endif
+#define TRACE_DUMP_RECORDS	16	/**< records per USBTraceHandleRequest */
+
+#define TRACE_MAGIC		0x5254	/**< "TR", start of a dump */
+
+// events of the stack, with their arguments
+#define TRACE_SETUP		0x01	/**< dwArg1, dwArg2 = bytes 0-3, 4-7 of the packet */
+#define TRACE_STALL		0x02	/**< bEP, wArg = 1 stalled, 0 unstalled */
+#define TRACE_EP_READ	0x03	/**< bEP, wArg = length, 0xFFFF if none */
+#define TRACE_EP_WRITE	0x04	/**< bEP, wArg = length */
+#define TRACE_DEV_STATUS 0x05	/**< wArg = DEV_STATUS_* */
+#define TRACE_USER		0x80	/**< first event free for the application */
+
+/** One event, as stored and dumped (little endian) */
+typedef struct {
+	uint32_t	dwTime;			/**< timestamp, in us */
+	uint8_t		bEvent;			/**< TRACE_* */
+	uint8_t		bEP;			/**< endpoint, if any */
+	uint16_t	wArg;
+	uint32_t	dwArg1;
+	uint32_t	dwArg2;
+} TTraceRecord;
+
+/** Start of a dump, followed by bCount records */
+typedef struct {
+	uint16_t	wMagic;			/**< TRACE_MAGIC */
+	uint8_t		bRecordSize;	/**< sizeof(TTraceRecord) */
+	uint8_t		bCount;			/**< records that follow */
+	uint32_t	dwLost;			/**< records overwritten before they were dumped */
+} TTraceHeader;
+
+/** Returns the time in us, for the timestamps */
+typedef uint32_t (TFnTraceClock)(void);
+
+// the stack only traces when built with USB_TRACE
+#ifdef USB_TRACE
+#define TRACE(ev,ep,w,d1,d2)	USBTrace(ev,ep,w,d1,d2)
+#else
+#define TRACE(ev,ep,w,d1,d2)
+#endif
+
+void USBTraceInit(TFnTraceClock *pfnClock);
+void USBTrace(uint8_t bEvent, uint8_t bEP, uint16_t wArg, uint32_t dwArg1, uint32_t dwArg2);
+int  USBTraceRead(uint8_t *pbBuf, int iMaxLen);
+bool USBTraceHandleRequest(TSetupPacket *pSetup, int *piLen, uint8_t **ppbData);